@@ -1,61 +1,67 @@
-// Copyright Epic Games, Inc. All Rights Reserved.
-
-using UnrealBuildTool;
-
-public class FreeAnimHelpersEditor : ModuleRules
-{
-	public FreeAnimHelpersEditor(ReadOnlyTargetRules Target) : base(Target)
-	{
-		PCHUsage = ModuleRules.PCHUsageMode.UseExplicitOrSharedPCHs;
-		
-		PublicIncludePaths.AddRange(
-			new string[] {
-				// ... add public include paths required here ...
-			}
-			);
-				
-		
-		PrivateIncludePaths.AddRange(
-			new string[] {
-				// ... add other private include paths required here ...
-			}
-			);
-			
-		
-		PublicDependencyModuleNames.AddRange(
-			new string[]
-			{
-				"Core",
-				// ... add other public dependencies that you statically link with here ...
-			}
-			);
-			
-		
-		PrivateDependencyModuleNames.AddRange(
-			new string[]
-			{
-				"InputCore",
-				"UnrealEd",
-				"CoreUObject",
-				"Engine",
-				"Slate",
-				"SlateCore",
-
-				"AnimationBlueprintLibrary",
-				"AnimationModifiers",
-				"AnimGraphRuntime",
-				"AnimGraph",
-				"BlueprintGraph",
-				"ContentBrowser"
-			}
-			);
-		
-		
-		DynamicallyLoadedModuleNames.AddRange(
-			new string[]
-			{
-				// ... add any modules that your module loads dynamically here ...
-			}
-			);
-	}
-}
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+using UnrealBuildTool;
+
+public class FreeAnimHelpersEditor : ModuleRules
+{
+	public FreeAnimHelpersEditor(ReadOnlyTargetRules Target) : base(Target)
+	{
+		PCHUsage = ModuleRules.PCHUsageMode.UseExplicitOrSharedPCHs;
+		
+		PublicIncludePaths.AddRange(
+			new string[] {
+				// ... add public include paths required here ...
+			}
+			);
+				
+		
+		PrivateIncludePaths.AddRange(
+			new string[] {
+				// ... add other private include paths required here ...
+			}
+			);
+			
+		
+		PublicDependencyModuleNames.AddRange(
+			new string[]
+			{
+				"Core",
+				// ... add other public dependencies that you statically link with here ...
+			}
+			);
+			
+		
+		PrivateDependencyModuleNames.AddRange(
+			new string[]
+			{
+				"InputCore",
+				"UnrealEd",
+				"CoreUObject",
+				"Engine",
+				"DeveloperSettings",
+				"Slate",
+				"SlateCore",
+
+				"AnimationBlueprintLibrary",
+				"AnimationModifiers",
+				"AnimGraphRuntime",
+				"AnimGraph",
+				"BlueprintGraph",
+				"ContentBrowser",
+				"PropertyEditor",
+				"AssetRegistry",
+				"Json",
+				"JsonUtilities",
+				"Projects"
+			}
+			);
+		
+		
+		DynamicallyLoadedModuleNames.AddRange(
+			new string[]
+			{
+				// ... add any modules that your module loads dynamically here ...
+			}
+			);
+	}
+}
@@ -0,0 +1,240 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "AnimPoseCache.h"
+#include "FreeAnimDiagnostics.h"
+#include "AnimSkeletonBinding.h"
+#include "AnimTrackBuffer.h"
+#include "FreeAnimHelpersLibrary.h"
+#include "FreeAnimProfiler.h"
+#include "FreeAnimHelpersSettings.h"
+#include "Animation/AnimData/AnimDataModel.h"
+#include "Animation/AnimSequence.h"
+#include "Engine/SkeletalMesh.h"
+
+bool FAnimPoseCache::Init(const UAnimSequence* AnimationSequence, const TArray<FName>& RequiredBones, const USkeletalMesh* PreviewMesh)
+{
+	Reset();
+
+	if (!AnimationSequence || !AnimationSequence->GetSkeleton())
+	{
+		UE_LOG(LogFreeAnimHelpers, Warning, TEXT("Invalid Animation Sequence supplied for FAnimPoseCache"));
+		return false;
+	}
+
+	if (!PreviewMesh)
+	{
+		PreviewMesh = AnimationSequence->GetPreviewMesh();
+	}
+	return Init(AnimationSequence, *FAnimSkeletonBinding::Get(AnimationSequence, PreviewMesh), RequiredBones);
+}
+
+bool FAnimPoseCache::Init(const UAnimSequence* AnimationSequence, const FAnimSkeletonBinding& Binding, const TArray<FName>& RequiredBones, const FAnimTrackBuffer* OverrideTracks)
+{
+	FREEANIM_SCOPE("PoseCache");
+	Reset();
+
+	if (!AnimationSequence)
+	{
+		return false;
+	}
+
+	const int32 RefBonesNum = Binding.GetNumBones();
+
+	// Collect required bones with all parents in parent-before-child order
+	TArray<int32> RequiredIndices;
+	if (RequiredBones.IsEmpty())
+	{
+		RequiredIndices.SetNumUninitialized(RefBonesNum);
+		for (int32 BoneIndex = 0; BoneIndex < RefBonesNum; BoneIndex++)
+		{
+			RequiredIndices[BoneIndex] = BoneIndex;
+		}
+	}
+	else
+	{
+		TArray<int32> RequestedIndices;
+		RequestedIndices.Reserve(RequiredBones.Num());
+		for (const FName& BoneName : RequiredBones)
+		{
+			const int32 RefBoneIndex = Binding.FindBoneIndex(BoneName);
+			if (RefBoneIndex != INDEX_NONE)
+			{
+				RequestedIndices.Add(RefBoneIndex);
+			}
+		}
+		Binding.GetBoneIndicesWithParents(RequestedIndices, RequiredIndices);
+	}
+
+	TArray<int32> RefToCache;
+	RefToCache.Init(INDEX_NONE, RefBonesNum);
+	for (const int32 RefBoneIndex : RequiredIndices)
+	{
+		const int32 CacheBoneIndex = BoneNames.Add(Binding.GetBoneName(RefBoneIndex));
+		const int32 RefParentIndex = Binding.GetParentIndex(RefBoneIndex);
+
+		RefToCache[RefBoneIndex] = CacheBoneIndex;
+		RefBoneIndices.Add(RefBoneIndex);
+		ParentIndices.Add(RefParentIndex == INDEX_NONE ? INDEX_NONE : RefToCache[RefParentIndex]);
+		BoneNameToIndex.Add(BoneNames[CacheBoneIndex], CacheBoneIndex);
+		UseRetargetRefPose.Add(Binding.IsTranslationRetargeted(RefBoneIndex));
+		RetargetRefPoses.Add(Binding.GetRefPose(RefBoneIndex));
+		HasTrack.Add(Binding.HasTrack(RefBoneIndex));
+		OverrideSlots.Add((OverrideTracks && OverrideTracks->IsValid()) ? OverrideTracks->FindSlot(BoneNames[CacheBoneIndex]) : INDEX_NONE);
+	}
+
+	for (const FName& BoneName : RequiredBones)
+	{
+		if (!BoneNameToIndex.Contains(BoneName))
+		{
+			UE_LOG(LogFreeAnimHelpers, Warning, TEXT("Invalid bone name %s for Animation Sequence %s supplied for FAnimPoseCache"), *BoneName.ToString(), *AnimationSequence->GetName());
+		}
+	}
+
+	const int32 BonesNum = BoneNames.Num();
+	NumFrames = AnimationSequence->GetDataModel()->GetNumberOfKeys();
+	if (BonesNum == 0 || NumFrames <= 0)
+	{
+		Reset();
+		return false;
+	}
+
+	SourceDataModel = AnimationSequence->GetDataModel();
+	SourceOverrideTracks = OverrideTracks;
+
+	// long animations of large skeletons are evaluated on request instead
+	const int32 MaxSizeMB = GetDefault<UFreeAnimHelpersSettings>()->MaxPoseCacheSizeMB;
+	const SIZE_T PosesSize = GetPosesSize(NumFrames, BonesNum);
+	if (MaxSizeMB > 0 && PosesSize > (SIZE_T)MaxSizeMB * 1024 * 1024)
+	{
+		UE_LOG(LogFreeAnimHelpers, Log, TEXT("Poses of %s (%d frames, %d bones, %.1f MB) exceed pose cache limit, they will be evaluated on request"),
+			*AnimationSequence->GetName(), NumFrames, BonesNum, (double)PosesSize / (1024.0 * 1024.0));
+		return true;
+	}
+
+	ComponentPoses.SetNumUninitialized(NumFrames * BonesNum);
+	FFreeAnimProfiler::AddCounter(EFreeAnimCounter::TrackEvaluations, NumFrames * BonesNum);
+
+	// Retargeted local poses: read all keys of each track at once. Keys are stored in single precision, so conversion is exact
+	TArray<FTransform> TrackKeys;
+	for (int32 BoneIndex = 0; BoneIndex < BonesNum; BoneIndex++)
+	{
+		TrackKeys.Reset();
+		if (OverrideSlots[BoneIndex] != INDEX_NONE)
+		{
+			const int32 LastKey = OverrideTracks->GetNumFrames() - 1;
+			for (int32 FrameIndex = 0; FrameIndex < NumFrames; FrameIndex++)
+			{
+				TrackKeys.Add(OverrideTracks->GetKey(OverrideSlots[BoneIndex], FMath::Min(FrameIndex, LastKey)));
+			}
+		}
+		else if (HasTrack[BoneIndex])
+		{
+			SourceDataModel->GetBoneTrackTransforms(BoneNames[BoneIndex], TrackKeys);
+		}
+
+		if (TrackKeys.IsEmpty())
+		{
+			TrackKeys.Add(RetargetRefPoses[BoneIndex]);
+		}
+
+		const int32 LastKey = TrackKeys.Num() - 1;
+		for (int32 FrameIndex = 0; FrameIndex < NumFrames; FrameIndex++)
+		{
+			FTransform Pose = TrackKeys[FMath::Min(FrameIndex, LastKey)];
+			if (UseRetargetRefPose[BoneIndex])
+			{
+				Pose.SetTranslationAndScale3D(RetargetRefPoses[BoneIndex].GetTranslation(), RetargetRefPoses[BoneIndex].GetScale3D());
+			}
+			ComponentPoses[FrameIndex * BonesNum + BoneIndex] = FTransform3f(Pose);
+		}
+	}
+
+	// Component space: forward kinematics in double precision, one frame at a time
+	TArray<FTransform> FramePoses;
+	FramePoses.SetNumUninitialized(BonesNum);
+	for (int32 FrameIndex = 0; FrameIndex < NumFrames; FrameIndex++)
+	{
+		FTransform3f* FrameData = ComponentPoses.GetData() + FrameIndex * BonesNum;
+		for (int32 BoneIndex = 0; BoneIndex < BonesNum; BoneIndex++)
+		{
+			FramePoses[BoneIndex] = FTransform(FrameData[BoneIndex]);
+		}
+		UFreeAnimHelpersLibrary::LocalToComponentSpace(FramePoses, ParentIndices, FramePoses);
+		for (int32 BoneIndex = 0; BoneIndex < BonesNum; BoneIndex++)
+		{
+			FrameData[BoneIndex] = FTransform3f(FramePoses[BoneIndex]);
+		}
+	}
+
+	return true;
+}
+
+void FAnimPoseCache::Reset()
+{
+	NumFrames = 0;
+	BoneNames.Reset();
+	RefBoneIndices.Reset();
+	ParentIndices.Reset();
+	BoneNameToIndex.Reset();
+	RetargetRefPoses.Reset();
+	UseRetargetRefPose.Reset();
+	HasTrack.Reset();
+	OverrideSlots.Reset();
+	SourceDataModel = nullptr;
+	SourceOverrideTracks = nullptr;
+	ComponentPoses.Reset();
+}
+
+int32 FAnimPoseCache::FindBone(const FName& BoneName) const
+{
+	const int32* CacheBoneIndex = BoneNameToIndex.Find(BoneName);
+	return CacheBoneIndex ? *CacheBoneIndex : INDEX_NONE;
+}
+
+FTransform FAnimPoseCache::GetLocalTransform(int32 FrameIndex, int32 CacheBoneIndex) const
+{
+	if (OverrideSlots[CacheBoneIndex] != INDEX_NONE)
+	{
+		return SourceOverrideTracks->GetKey(OverrideSlots[CacheBoneIndex], FMath::Min(FrameIndex, SourceOverrideTracks->GetNumFrames() - 1));
+	}
+	if (HasTrack[CacheBoneIndex])
+	{
+		return SourceDataModel->GetBoneTrackTransform(BoneNames[CacheBoneIndex], FFrameNumber(FrameIndex));
+	}
+	return RetargetRefPoses[CacheBoneIndex];
+}
+
+FTransform FAnimPoseCache::GetRetargetedLocalTransform(int32 FrameIndex, int32 CacheBoneIndex) const
+{
+	FTransform Pose = GetLocalTransform(FrameIndex, CacheBoneIndex);
+	if (UseRetargetRefPose[CacheBoneIndex])
+	{
+		Pose.SetTranslationAndScale3D(RetargetRefPoses[CacheBoneIndex].GetTranslation(), RetargetRefPoses[CacheBoneIndex].GetScale3D());
+	}
+	return Pose;
+}
+
+FTransform FAnimPoseCache::GetComponentTransform(int32 FrameIndex, int32 CacheBoneIndex) const
+{
+	if (IsPrecomputed())
+	{
+		return FTransform(ComponentPoses[FrameIndex * BoneNames.Num() + CacheBoneIndex]);
+	}
+
+	FTransform Pose = GetRetargetedLocalTransform(FrameIndex, CacheBoneIndex);
+	for (int32 ParentIndex = ParentIndices[CacheBoneIndex]; ParentIndex != INDEX_NONE; ParentIndex = ParentIndices[ParentIndex])
+	{
+		Pose *= GetRetargetedLocalTransform(FrameIndex, ParentIndex);
+	}
+	Pose.NormalizeRotation();
+	return Pose;
+}
+
+FTransform FAnimPoseCache::GetComponentTransform(int32 FrameIndex, const FName& BoneName) const
+{
+	const int32 CacheBoneIndex = FindBone(BoneName);
+	return CacheBoneIndex == INDEX_NONE
+		? FTransform::Identity
+		: GetComponentTransform(FrameIndex, CacheBoneIndex);
+}
@@ -0,0 +1,255 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "AnimSequenceDiff.h"
+#include "Animation/AnimData/IAnimationDataModel.h"
+#include "Animation/AnimCurveTypes.h"
+#include "Animation/AnimSequence.h"
+#include "HAL/FileManager.h"
+#include "Serialization/Archive.h"
+
+namespace AnimSequenceDiff
+{
+	// 'FAHG'
+	static constexpr uint32 SnapshotMagic = 0x46414847;
+	static constexpr int32 SnapshotVersion = 1;
+
+	/* Names are stored as strings: plain file archives don't serialize FName */
+	static void SerializeName(FArchive& Ar, FName& Name)
+	{
+		FString NameString = Name.ToString();
+		Ar << NameString;
+		if (Ar.IsLoading())
+		{
+			Name = *NameString;
+		}
+	}
+
+	template<typename TValue, typename TSerializeFunc>
+	static void SerializeMap(FArchive& Ar, TMap<FName, TValue>& Map, TSerializeFunc SerializeValue)
+	{
+		int32 Num = Map.Num();
+		Ar << Num;
+		if (Ar.IsLoading())
+		{
+			Map.Empty(Num);
+			for (int32 Index = 0; Index < Num && !Ar.IsError(); Index++)
+			{
+				FName Key;
+				SerializeName(Ar, Key);
+				SerializeValue(Ar, Map.Add(Key));
+			}
+		}
+		else
+		{
+			for (auto& Pair : Map)
+			{
+				SerializeName(Ar, Pair.Key);
+				SerializeValue(Ar, Pair.Value);
+			}
+		}
+	}
+
+	static void SerializeCurveKeys(FArchive& Ar, TArray<FRichCurveKey>& Keys)
+	{
+		int32 Num = Keys.Num();
+		Ar << Num;
+		if (Ar.IsLoading())
+		{
+			Keys.SetNum(FMath::Max(Num, 0));
+		}
+		for (FRichCurveKey& Key : Keys)
+		{
+			uint8 InterpMode = (uint8)Key.InterpMode;
+			uint8 TangentMode = (uint8)Key.TangentMode;
+			Ar << Key.Time << Key.Value << Key.ArriveTangent << Key.LeaveTangent << InterpMode << TangentMode;
+			Key.InterpMode = (ERichCurveInterpMode)InterpMode;
+			Key.TangentMode = (ERichCurveTangentMode)TangentMode;
+		}
+	}
+
+	template<typename TValue>
+	static void GetSortedKeys(const TMap<FName, TValue>& First, const TMap<FName, TValue>& Second, TArray<FName>& OutNames)
+	{
+		First.GetKeys(OutNames);
+		for (const auto& Pair : Second)
+		{
+			OutNames.AddUnique(Pair.Key);
+		}
+		OutNames.Sort(FNameLexicalLess());
+	}
+}
+
+FAnimSequenceSnapshot FAnimSequenceSnapshot::Capture(const UAnimSequence* AnimationSequence)
+{
+	FAnimSequenceSnapshot Snapshot;
+	if (!IsValid(AnimationSequence))
+	{
+		return Snapshot;
+	}
+
+	const IAnimationDataModel* DataModel = AnimationSequence->GetDataModel();
+	Snapshot.FrameRate = DataModel->GetFrameRate();
+	Snapshot.NumKeys = DataModel->GetNumberOfKeys();
+
+	TArray<FName> TrackNames;
+	DataModel->GetBoneTrackNames(TrackNames);
+
+	TArray<FTransform> TrackKeys;
+	for (const FName& TrackName : TrackNames)
+	{
+		TrackKeys.Reset();
+		DataModel->GetBoneTrackTransforms(TrackName, TrackKeys);
+
+		FBoneKeys& BoneKeys = Snapshot.BoneTracks.Add(TrackName);
+		BoneKeys.PosKeys.SetNumUninitialized(TrackKeys.Num());
+		BoneKeys.RotKeys.SetNumUninitialized(TrackKeys.Num());
+		BoneKeys.ScaleKeys.SetNumUninitialized(TrackKeys.Num());
+		for (int32 KeyIndex = 0; KeyIndex < TrackKeys.Num(); KeyIndex++)
+		{
+			BoneKeys.PosKeys[KeyIndex] = FVector3f(TrackKeys[KeyIndex].GetTranslation());
+			BoneKeys.RotKeys[KeyIndex] = FQuat4f(TrackKeys[KeyIndex].GetRotation());
+			BoneKeys.ScaleKeys[KeyIndex] = FVector3f(TrackKeys[KeyIndex].GetScale3D());
+		}
+	}
+
+	for (const FFloatCurve& Curve : DataModel->GetFloatCurves())
+	{
+		Snapshot.FloatCurves.Add(Curve.GetName(), Curve.FloatCurve.GetConstRefOfKeys());
+	}
+
+	return Snapshot;
+}
+
+bool FAnimSequenceSnapshot::SaveToFile(const FString& FileName)
+{
+	TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*FileName));
+	if (!Writer.IsValid())
+	{
+		return false;
+	}
+	*Writer << *this;
+	return Writer->Close() && !Writer->IsError();
+}
+
+bool FAnimSequenceSnapshot::LoadFromFile(const FString& FileName)
+{
+	TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*FileName));
+	if (!Reader.IsValid())
+	{
+		return false;
+	}
+	*Reader << *this;
+	return Reader->Close() && !Reader->IsError();
+}
+
+FArchive& operator<<(FArchive& Ar, FAnimSequenceSnapshot& Snapshot)
+{
+	using namespace AnimSequenceDiff;
+
+	uint32 Magic = SnapshotMagic;
+	int32 Version = SnapshotVersion;
+	Ar << Magic << Version;
+	if (Magic != SnapshotMagic || Version != SnapshotVersion)
+	{
+		Ar.SetError();
+		return Ar;
+	}
+
+	Ar << Snapshot.FrameRate.Numerator << Snapshot.FrameRate.Denominator << Snapshot.NumKeys;
+	SerializeMap(Ar, Snapshot.BoneTracks, [](FArchive& InAr, FAnimSequenceSnapshot::FBoneKeys& Keys)
+	{
+		InAr << Keys.PosKeys << Keys.RotKeys << Keys.ScaleKeys;
+	});
+	SerializeMap(Ar, Snapshot.FloatCurves, &SerializeCurveKeys);
+
+	return Ar;
+}
+
+FAnimSequenceDiff FAnimSequenceDiff::Compare(const FAnimSequenceSnapshot& Expected, const FAnimSequenceSnapshot& Actual, const FAnimSequenceDiffTolerance& Tolerance)
+{
+	using namespace AnimSequenceDiff;
+
+	FAnimSequenceDiff Diff;
+	Diff.bTimingMatches = Expected.FrameRate == Actual.FrameRate && Expected.NumKeys == Actual.NumKeys;
+
+	TArray<FName> Names;
+	GetSortedKeys(Expected.BoneTracks, Actual.BoneTracks, Names);
+	for (const FName& BoneName : Names)
+	{
+		FBoneError& Error = Diff.Bones.AddDefaulted_GetRef();
+		Error.BoneName = BoneName;
+
+		const FAnimSequenceSnapshot::FBoneKeys* ExpectedKeys = Expected.BoneTracks.Find(BoneName);
+		const FAnimSequenceSnapshot::FBoneKeys* ActualKeys = Actual.BoneTracks.Find(BoneName);
+		if (!ExpectedKeys || !ActualKeys || ExpectedKeys->PosKeys.Num() != ActualKeys->PosKeys.Num())
+		{
+			Error.bMissing = true;
+			Error.bPassed = false;
+			continue;
+		}
+
+		double WorstRatio = 0.0;
+		for (int32 KeyIndex = 0; KeyIndex < ExpectedKeys->PosKeys.Num(); KeyIndex++)
+		{
+			const double Translation = FVector3f::Distance(ExpectedKeys->PosKeys[KeyIndex], ActualKeys->PosKeys[KeyIndex]);
+			const double Rotation = FMath::RadiansToDegrees(ExpectedKeys->RotKeys[KeyIndex].GetNormalized().AngularDistance(ActualKeys->RotKeys[KeyIndex].GetNormalized()));
+			const double Scale = FVector3f::Distance(ExpectedKeys->ScaleKeys[KeyIndex], ActualKeys->ScaleKeys[KeyIndex]);
+
+			Error.Translation = FMath::Max(Error.Translation, Translation);
+			Error.RotationDegrees = FMath::Max(Error.RotationDegrees, Rotation);
+			Error.Scale = FMath::Max(Error.Scale, Scale);
+
+			// frame which is the farthest from tolerance
+			const double Ratio = FMath::Max3(Translation / Tolerance.Translation, Rotation / Tolerance.RotationDegrees, Scale / Tolerance.Scale);
+			if (Ratio > WorstRatio)
+			{
+				WorstRatio = Ratio;
+				Error.WorstFrame = KeyIndex;
+			}
+		}
+		Error.bPassed = Error.Translation <= Tolerance.Translation && Error.RotationDegrees <= Tolerance.RotationDegrees && Error.Scale <= Tolerance.Scale;
+	}
+
+	Names.Reset();
+	GetSortedKeys(Expected.FloatCurves, Actual.FloatCurves, Names);
+	for (const FName& CurveName : Names)
+	{
+		FCurveError& Error = Diff.Curves.AddDefaulted_GetRef();
+		Error.CurveName = CurveName;
+
+		const TArray<FRichCurveKey>* ExpectedKeys = Expected.FloatCurves.Find(CurveName);
+		const TArray<FRichCurveKey>* ActualKeys = Actual.FloatCurves.Find(CurveName);
+		if (!ExpectedKeys || !ActualKeys)
+		{
+			Error.bMissing = true;
+			Error.bPassed = false;
+			continue;
+		}
+
+		// curves are compared by values, so different keys describing the same curve are accepted
+		FRichCurve ExpectedCurve, ActualCurve;
+		ExpectedCurve.SetKeys(*ExpectedKeys);
+		ActualCurve.SetKeys(*ActualKeys);
+		for (int32 FrameIndex = 0; FrameIndex < Expected.NumKeys; FrameIndex++)
+		{
+			const float Time = (float)Expected.FrameRate.AsSeconds(FFrameTime(FrameIndex));
+			const double Value = FMath::Abs(ExpectedCurve.Eval(Time) - ActualCurve.Eval(Time));
+			if (Value > Error.Value)
+			{
+				Error.Value = Value;
+				Error.WorstFrame = FrameIndex;
+			}
+		}
+		Error.bPassed = Error.Value <= Tolerance.Curve;
+	}
+
+	return Diff;
+}
+
+bool FAnimSequenceDiff::IsPassed() const
+{
+	return bTimingMatches
+		&& !Bones.ContainsByPredicate([](const FBoneError& Error) { return !Error.bPassed; })
+		&& !Curves.ContainsByPredicate([](const FCurveError& Error) { return !Error.bPassed; });
+}
@@ -0,0 +1,261 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "AnimSkeletonBinding.h"
+#include "RefPoseCache.h"
+#include "FreeAnimDiagnostics.h"
+#include "Animation/AnimData/IAnimationDataModel.h"
+#include "Animation/AnimData/AnimDataNotifications.h"
+#include "Animation/AnimSequenceBase.h"
+#include "Animation/Skeleton.h"
+#include "Engine/SkeletalMesh.h"
+#include "ReferenceSkeleton.h"
+#include "Misc/ScopeLock.h"
+#include "Algo/Count.h"
+#include "UObject/UObjectGlobals.h"
+
+/** Global storage of skeleton bindings */
+class FAnimSkeletonBindingRegistry
+{
+public:
+	using FKey = TPair<TObjectKey<UAnimSequenceBase>, TObjectKey<USkeletalMesh>>;
+
+	struct FEntry
+	{
+		TSharedPtr<const FAnimSkeletonBinding> Binding;
+		TWeakObjectPtr<const UAnimSequenceBase> Sequence;
+		FDelegateHandle ModelModifiedHandle;
+	};
+
+	static FAnimSkeletonBindingRegistry& Get()
+	{
+		static FAnimSkeletonBindingRegistry Instance;
+		return Instance;
+	}
+
+	TSharedRef<const FAnimSkeletonBinding> FindOrAdd(const UAnimSequenceBase* AnimationSequence, const USkeletalMesh* PreviewMesh)
+	{
+		FScopeLock ScopeLock(&Lock);
+
+		if (!PostGarbageCollectHandle.IsValid())
+		{
+			PostGarbageCollectHandle = FCoreUObjectDelegates::GetPostGarbageCollect().AddRaw(this, &FAnimSkeletonBindingRegistry::RemoveStaleEntries);
+		}
+
+		const FKey Key(AnimationSequence, PreviewMesh);
+		if (FEntry* Entry = Entries.Find(Key))
+		{
+			// skeleton of the sequence could be replaced without notification
+			if (Entry->Binding->Skeleton == TObjectKey<USkeleton>(AnimationSequence->GetSkeleton()))
+			{
+				return Entry->Binding.ToSharedRef();
+			}
+			Unsubscribe(*Entry);
+			Entries.Remove(Key);
+		}
+
+		FAnimSkeletonBinding* NewBinding = new FAnimSkeletonBinding();
+		NewBinding->Build(AnimationSequence, PreviewMesh);
+
+		FEntry& Entry = Entries.Add(Key);
+		Entry.Binding = MakeShareable(NewBinding);
+		Entry.Sequence = AnimationSequence;
+
+		// hierarchy and reference pose changes invalidate bindings of the skeleton and the mesh
+		FRefPoseCache::Watch(AnimationSequence->GetSkeleton());
+		if (PreviewMesh)
+		{
+			FRefPoseCache::Watch(PreviewMesh);
+		}
+
+		// any change in data model can add or remove tracks
+		if (IAnimationDataModel* DataModel = const_cast<IAnimationDataModel*>(AnimationSequence->GetDataModel()))
+		{
+			Entry.ModelModifiedHandle = DataModel->GetModifiedEvent().AddLambda([this, Key](const EAnimDataModelNotifyType&, IAnimationDataModel*, const FAnimDataModelNotifPayload&)
+			{
+				RemoveIf([&Key](const FKey& EntryKey, const FEntry&) { return EntryKey == Key; });
+			});
+		}
+
+		return Entry.Binding.ToSharedRef();
+	}
+
+	void RemoveIf(TFunctionRef<bool(const FKey&, const FEntry&)> Predicate)
+	{
+		FScopeLock ScopeLock(&Lock);
+		for (auto It = Entries.CreateIterator(); It; ++It)
+		{
+			if (Predicate(It.Key(), It.Value()))
+			{
+				Unsubscribe(It.Value());
+				It.RemoveCurrent();
+			}
+		}
+	}
+
+	void Reset()
+	{
+		FScopeLock ScopeLock(&Lock);
+		for (auto& Entry : Entries)
+		{
+			Unsubscribe(Entry.Value);
+		}
+		Entries.Empty();
+
+		if (PostGarbageCollectHandle.IsValid())
+		{
+			FCoreUObjectDelegates::GetPostGarbageCollect().Remove(PostGarbageCollectHandle);
+			PostGarbageCollectHandle.Reset();
+		}
+	}
+
+private:
+	void Unsubscribe(FEntry& Entry)
+	{
+		const UAnimSequenceBase* AnimationSequence = Entry.Sequence.Get();
+		if (AnimationSequence && Entry.ModelModifiedHandle.IsValid())
+		{
+			if (IAnimationDataModel* DataModel = const_cast<IAnimationDataModel*>(AnimationSequence->GetDataModel()))
+			{
+				DataModel->GetModifiedEvent().Remove(Entry.ModelModifiedHandle);
+			}
+		}
+		Entry.ModelModifiedHandle.Reset();
+	}
+
+	/* Drop bindings of destroyed sequences, meshes and skeletons */
+	void RemoveStaleEntries()
+	{
+		const TObjectKey<USkeletalMesh> NoMesh;
+		RemoveIf([&NoMesh](const FKey& Key, const FEntry& Entry)
+		{
+			return !Entry.Sequence.IsValid()
+				|| (Key.Value != NoMesh && !Key.Value.ResolveObjectPtr())
+				|| !Entry.Binding->Skeleton.ResolveObjectPtr();
+		});
+	}
+
+	FCriticalSection Lock;
+	TMap<FKey, FEntry> Entries;
+	FDelegateHandle PostGarbageCollectHandle;
+};
+
+TSharedRef<const FAnimSkeletonBinding> FAnimSkeletonBinding::Get(const UAnimSequenceBase* AnimationSequence, const USkeletalMesh* PreviewMesh)
+{
+	if (!AnimationSequence || !AnimationSequence->GetSkeleton())
+	{
+		UE_LOG(LogFreeAnimHelpers, Warning, TEXT("Invalid Animation Sequence supplied for FAnimSkeletonBinding"));
+		return MakeShareable(new FAnimSkeletonBinding());
+	}
+	return FAnimSkeletonBindingRegistry::Get().FindOrAdd(AnimationSequence, PreviewMesh);
+}
+
+TSharedRef<const FAnimSkeletonBinding> FAnimSkeletonBinding::GetForBones(const UAnimSequenceBase* AnimationSequence, const USkeletalMesh* PreviewMesh, const TArray<FName>& BoneNames, TArray<int32>& OutBoneIndices)
+{
+	TSharedRef<const FAnimSkeletonBinding> Binding = Get(AnimationSequence, PreviewMesh);
+	if (Binding->FindBoneIndices(BoneNames, OutBoneIndices) || !PreviewMesh)
+	{
+		return Binding;
+	}
+
+	// preview mesh can miss bones of the skeleton
+	TArray<int32> SkeletonBoneIndices;
+	TSharedRef<const FAnimSkeletonBinding> SkeletonBinding = Get(AnimationSequence);
+	SkeletonBinding->FindBoneIndices(BoneNames, SkeletonBoneIndices);
+	if (Algo::Count(SkeletonBoneIndices, INDEX_NONE) < Algo::Count(OutBoneIndices, INDEX_NONE))
+	{
+		OutBoneIndices = MoveTemp(SkeletonBoneIndices);
+		return SkeletonBinding;
+	}
+	return Binding;
+}
+
+void FAnimSkeletonBinding::Invalidate(const UObject* Asset)
+{
+	using FKey = FAnimSkeletonBindingRegistry::FKey;
+	using FEntry = FAnimSkeletonBindingRegistry::FEntry;
+
+	if (!Asset)
+	{
+		FAnimSkeletonBindingRegistry::Get().RemoveIf([](const FKey&, const FEntry&) { return true; });
+		return;
+	}
+
+	if (const UAnimSequenceBase* AnimationSequence = Cast<const UAnimSequenceBase>(Asset))
+	{
+		const TObjectKey<UAnimSequenceBase> SequenceKey(AnimationSequence);
+		FAnimSkeletonBindingRegistry::Get().RemoveIf([&SequenceKey](const FKey& Key, const FEntry&) { return Key.Key == SequenceKey; });
+	}
+	else if (const USkeletalMesh* SkeletalMesh = Cast<const USkeletalMesh>(Asset))
+	{
+		const TObjectKey<USkeletalMesh> MeshKey(SkeletalMesh);
+		FAnimSkeletonBindingRegistry::Get().RemoveIf([&MeshKey](const FKey& Key, const FEntry&) { return Key.Value == MeshKey; });
+	}
+	else if (const USkeleton* ChangedSkeleton = Cast<const USkeleton>(Asset))
+	{
+		const TObjectKey<USkeleton> SkeletonKey(ChangedSkeleton);
+		FAnimSkeletonBindingRegistry::Get().RemoveIf([&SkeletonKey](const FKey&, const FEntry& Entry) { return Entry.Binding->Skeleton == SkeletonKey; });
+	}
+}
+
+void FAnimSkeletonBinding::ResetCache()
+{
+	FAnimSkeletonBindingRegistry::Get().Reset();
+}
+
+bool FAnimSkeletonBinding::IsTranslationRetargeted(int32 BoneIndex) const
+{
+	const int32 SkeletonBoneIndex = SkeletonBoneIndices[BoneIndex];
+	return SkeletonBoneIndex != INDEX_NONE
+		&& SkeletonAsset->GetBoneTranslationRetargetingMode(SkeletonBoneIndex) == EBoneTranslationRetargetingMode::Type::Skeleton;
+}
+
+int32 FAnimSkeletonBinding::FindBoneIndex(const FName& BoneName) const
+{
+	const int32* BoneIndex = NameToIndex.Find(BoneName);
+	return BoneIndex ? *BoneIndex : INDEX_NONE;
+}
+
+bool FAnimSkeletonBinding::FindBoneIndices(const TArray<FName>& InBoneNames, TArray<int32>& OutBoneIndices) const
+{
+	bool bAllFound = true;
+	OutBoneIndices.SetNumUninitialized(InBoneNames.Num());
+	for (int32 i = 0; i < InBoneNames.Num(); i++)
+	{
+		OutBoneIndices[i] = FindBoneIndex(InBoneNames[i]);
+		bAllFound &= OutBoneIndices[i] != INDEX_NONE;
+	}
+	return bAllFound;
+}
+
+void FAnimSkeletonBinding::Build(const UAnimSequenceBase* AnimationSequence, const USkeletalMesh* PreviewMesh)
+{
+	const USkeleton* SequenceSkeleton = AnimationSequence->GetSkeleton();
+	const FReferenceSkeleton& SkeletonRefSkeleton = SequenceSkeleton->GetReferenceSkeleton();
+	const FReferenceSkeleton& RefSkeleton = PreviewMesh ? PreviewMesh->GetRefSkeleton() : SkeletonRefSkeleton;
+	const IAnimationDataModel* DataModel = AnimationSequence->GetDataModel();
+	const int32 BonesNum = RefSkeleton.GetNum();
+
+	Skeleton = SequenceSkeleton;
+	SkeletonAsset = SequenceSkeleton;
+
+	BoneNames.SetNum(BonesNum);
+	ParentIndices.SetNum(BonesNum);
+	RefPose = RefSkeleton.GetRefBonePose();
+	NameToIndex.Reserve(BonesNum);
+	HasTrackMask.Init(false, BonesNum);
+	SkeletonBoneIndices.SetNum(BonesNum);
+
+	for (int32 BoneIndex = 0; BoneIndex < BonesNum; BoneIndex++)
+	{
+		const FName BoneName = RefSkeleton.GetBoneName(BoneIndex);
+		BoneNames[BoneIndex] = BoneName;
+		ParentIndices[BoneIndex] = RefSkeleton.GetParentIndex(BoneIndex);
+		NameToIndex.Add(BoneName, BoneIndex);
+
+		HasTrackMask[BoneIndex] = DataModel && DataModel->IsValidBoneTrackName(BoneName);
+
+		// retargeting mode is stored in skeleton, bone indices of preview mesh can be different
+		SkeletonBoneIndices[BoneIndex] = PreviewMesh ? SkeletonRefSkeleton.FindBoneIndex(BoneName) : BoneIndex;
+	}
+}
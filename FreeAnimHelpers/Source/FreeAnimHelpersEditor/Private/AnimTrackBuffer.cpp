@@ -0,0 +1,92 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "AnimTrackBuffer.h"
+
+void FAnimTrackBuffer::Init(const TArray<FName>& InBoneNames, int32 InNumFrames)
+{
+	for (const FName& BoneName : InBoneNames)
+	{
+		AddBone(BoneName);
+	}
+	Init(InNumFrames);
+}
+
+void FAnimTrackBuffer::Init(int32 InNumFrames)
+{
+	NumFrames = FMath::Max(InNumFrames, 0);
+
+	const int32 KeysNum = BoneNames.Num() * NumFrames;
+	PosKeys.SetNumUninitialized(KeysNum);
+	RotKeys.SetNumUninitialized(KeysNum);
+	ScaleKeys.SetNumUninitialized(KeysNum);
+}
+
+int32 FAnimTrackBuffer::AddBone(const FName& BoneName)
+{
+	check(PosKeys.IsEmpty());
+
+	const int32 Slot = FindSlot(BoneName);
+	return Slot == INDEX_NONE ? SlotsByName.Add(BoneName, BoneNames.Add(BoneName)) : Slot;
+}
+
+void FAnimTrackBuffer::Reset()
+{
+	NumFrames = 0;
+	BoneNames.Empty();
+	SlotsByName.Empty();
+	PosKeys.Empty();
+	RotKeys.Empty();
+	ScaleKeys.Empty();
+}
+
+FTransform FAnimTrackBuffer::GetKey(int32 Slot, int32 FrameIndex) const
+{
+	const int32 KeyIndex = Slot * NumFrames + FrameIndex;
+	return FTransform(FQuat(RotKeys[KeyIndex]), FVector(PosKeys[KeyIndex]), FVector(ScaleKeys[KeyIndex]));
+}
+
+void FAnimTrackBuffer::Merge(const FAnimTrackBuffer& Other)
+{
+	if (!Other.IsValid())
+	{
+		return;
+	}
+	if (!IsValid())
+	{
+		*this = Other;
+		return;
+	}
+	check(Other.NumFrames == NumFrames);
+
+	for (int32 OtherSlot = 0; OtherSlot < Other.GetNumBones(); OtherSlot++)
+	{
+		// keys are bone-major, so new bone is appended to the end of each plane
+		int32 Slot = FindSlot(Other.BoneNames[OtherSlot]);
+		if (Slot == INDEX_NONE)
+		{
+			Slot = BoneNames.Add(Other.BoneNames[OtherSlot]);
+			SlotsByName.Add(Other.BoneNames[OtherSlot], Slot);
+			PosKeys.AddUninitialized(NumFrames);
+			RotKeys.AddUninitialized(NumFrames);
+			ScaleKeys.AddUninitialized(NumFrames);
+		}
+
+		FMemory::Memcpy(PosKeys.GetData() + Slot * NumFrames, Other.PosKeys.GetData() + OtherSlot * NumFrames, NumFrames * sizeof(FVector3f));
+		FMemory::Memcpy(RotKeys.GetData() + Slot * NumFrames, Other.RotKeys.GetData() + OtherSlot * NumFrames, NumFrames * sizeof(FQuat4f));
+		FMemory::Memcpy(ScaleKeys.GetData() + Slot * NumFrames, Other.ScaleKeys.GetData() + OtherSlot * NumFrames, NumFrames * sizeof(FVector3f));
+	}
+}
+
+void FAnimTrackBuffer::ToRawTrack(int32 Slot, FRawAnimSequenceTrack& OutTrack) const
+{
+	const int32 FirstKey = Slot * NumFrames;
+
+	// Reset keeps allocated memory
+	OutTrack.PosKeys.Reset(NumFrames);
+	OutTrack.PosKeys.Append(PosKeys.GetData() + FirstKey, NumFrames);
+	OutTrack.RotKeys.Reset(NumFrames);
+	OutTrack.RotKeys.Append(RotKeys.GetData() + FirstKey, NumFrames);
+	OutTrack.ScaleKeys.Reset(NumFrames);
+	OutTrack.ScaleKeys.Append(ScaleKeys.GetData() + FirstKey, NumFrames);
+}
@@ -1,147 +1,192 @@
-// (c) Yuri N. K. 2022. All rights reserved.
-// ykasczc@gmail.com
-
-#include "AnimateIKBones.h"
-#include "Runtime/Launch/Resources/Version.h"
-#include "Animation/AnimData/AnimDataModel.h"
-#include "Animation/AnimData/IAnimationDataController.h"
-#include "FreeAnimHelpersLibrary.h"
-#include "Animation/AnimSequence.h"
-#include "Animation/AnimTypes.h"
-#include "ReferenceSkeleton.h"
-#include "Engine/SkeletalMesh.h"
-#include "Engine/SkeletalMeshSocket.h"
-
-UAnimateIKBones::UAnimateIKBones()
-{
-	if (IKtoFK.Num() == 0)
-	{
-		IKtoFK.Add(TEXT("ik_foot_root"), TEXT("root"));
-		IKtoFK.Add(TEXT("ik_foot_r"), TEXT("foot_r"));
-		IKtoFK.Add(TEXT("ik_foot_l"), TEXT("foot_l"));
-		IKtoFK.Add(TEXT("ik_hand_root"), TEXT("root"));
-		IKtoFK.Add(TEXT("ik_hand_gun"), TEXT("hand_r"));
-		IKtoFK.Add(TEXT("ik_hand_r"), TEXT("hand_r"));
-		IKtoFK.Add(TEXT("ik_hand_l"), TEXT("hand_l"));
-	}
-}
-
-void UAnimateIKBones::OnApply_Implementation(UAnimSequence* AnimationSequence)
-{
-	USkeleton* Skeleton = AnimationSequence->GetSkeleton();
-	const FReferenceSkeleton& RefSkeleton = Skeleton->GetReferenceSkeleton();
-	const int32 KeysNum = AnimationSequence->GetDataModel()->GetNumberOfKeys();
-
-	// Names of source bones
-	TMap<FName, FTransform> HumanoidBones;
-	// Bone name to parent bone name
-	TMap<FName, FName> Parents;
-	// Frame values
-	TMap<FName, FTransform> FramePos;
-	// Tracks to save data
-	TMap<FName, FRawAnimSequenceTrack> OutTracks;
-
-	// Initialize containers
-	for (const auto& BonePair : IKtoFK)
-	{
-		if (RefSkeleton.FindBoneIndex(BonePair.Key) == INDEX_NONE)
-		{
-			UE_LOG(LogTemp, Warning, TEXT("Can't find bone: %s"), *BonePair.Key.ToString());
-			return;
-		}
-		if (RefSkeleton.FindBoneIndex(BonePair.Value) == INDEX_NONE)
-		{
-			UE_LOG(LogTemp, Warning, TEXT("Can't find bone: %s"), *BonePair.Value.ToString());
-			return;
-		}
-
-		FRawAnimSequenceTrack& Track = OutTracks.Add(BonePair.Key);
-		Track.PosKeys.SetNumUninitialized(KeysNum);
-		Track.RotKeys.SetNumUninitialized(KeysNum);
-		Track.ScaleKeys.SetNumUninitialized(KeysNum);
-
-		if (!Parents.Contains(BonePair.Key))
-		{
-			const int32 ParentIndex = RefSkeleton.GetParentIndex(RefSkeleton.FindBoneIndex(BonePair.Key));
-			Parents.Add(BonePair.Key, (ParentIndex == INDEX_NONE) ? BonePair.Key : RefSkeleton.GetBoneName(ParentIndex));
-		}
-		if (!Parents.Contains(BonePair.Value))
-		{
-			const int32 ParentIndex = RefSkeleton.GetParentIndex(RefSkeleton.FindBoneIndex(BonePair.Value));
-			Parents.Add(BonePair.Value, (ParentIndex == INDEX_NONE) ? BonePair.Value : RefSkeleton.GetBoneName(ParentIndex));
-		}
-
-		if (IKtoFK.Contains(BonePair.Value))
-		{
-			// Use runtime transforms of IK bones
-			FramePos.Add(BonePair.Value);
-		}
-		else
-		{
-			// Doesn't add IK bones
-			HumanoidBones.Add(BonePair.Value);
-		}
-	}
-
-	for (const auto& ChildToParent : Parents)
-	{
-		if (!HumanoidBones.Contains(ChildToParent.Value) && !FramePos.Contains(ChildToParent.Value))
-		{
-			FramePos.Add(ChildToParent.Value);
-		}
-	}
-
-	for (int32 FrameIndex = 0; FrameIndex < KeysNum; FrameIndex++)
-	{
-		float Time;
-		UAnimationBlueprintLibrary::GetTimeAtFrame(AnimationSequence, FrameIndex, Time);
-
-		for (auto& BonePair : HumanoidBones)
-		{
-			BonePair.Value = UFreeAnimHelpersLibrary::GetBonePositionAtTimeInCS(AnimationSequence, BonePair.Key, Time);
-		}
-
-		for (const auto& BonePair : IKtoFK)
-		{
-			const FName& IKBone = BonePair.Key;
-			const FName& FKBone = BonePair.Value;
-
-			const FTransform SourcePos = FramePos.Contains(FKBone)
-				? FramePos[FKBone]
-				: HumanoidBones[FKBone];
-			const FName ParentBoneName = Parents[IKBone];
-			FTransform ParentPos = FTransform::Identity;
-			if (ParentBoneName != IKBone)
-			{
-				ParentPos = FramePos.Contains(ParentBoneName)
-					? FramePos[ParentBoneName]
-					: HumanoidBones[ParentBoneName];
-			}
-
-			FTransform RelativeTr = SourcePos.GetRelativeTransform(ParentPos);
-			// Save to track
-			OutTracks[IKBone].PosKeys[FrameIndex] = (FVector3f)RelativeTr.GetTranslation();
-			OutTracks[IKBone].RotKeys[FrameIndex] = (FQuat4f)RelativeTr.GetRotation();
-			OutTracks[IKBone].ScaleKeys[FrameIndex] = (FVector3f)RelativeTr.GetScale3D();
-
-			if (FTransform* PositionToSave = FramePos.Find(IKBone))
-			{
-				*PositionToSave = SourcePos;
-			}
-		}
-	}
-
-	// Save new keys in DataModel
-	IAnimationDataController& Controller = AnimationSequence->GetController();
-	for (const auto& Track : OutTracks)
-	{
-		const FName& BoneName = Track.Key;
-		Controller.RemoveBoneTrack(BoneName);
-#if ENGINE_MINOR_VERSION < 2
-		Controller.AddBoneTrack(BoneName);
-#else
-		Controller.AddBoneCurve(BoneName);
-#endif
-		Controller.SetBoneTrackKeys(BoneName, Track.Value.PosKeys, Track.Value.RotKeys, Track.Value.ScaleKeys);
-	}
-}
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "AnimateIKBones.h"
+#include "FreeAnimDiagnostics.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include "Animation/AnimData/AnimDataModel.h"
+#include "Animation/AnimData/IAnimationDataController.h"
+#include "FreeAnimHelpersLibrary.h"
+#include "AnimTrackBuffer.h"
+#include "AnimPoseCache.h"
+#include "AnimSkeletonBinding.h"
+#include "Animation/AnimSequence.h"
+#include "Animation/AnimTypes.h"
+#include "ReferenceSkeleton.h"
+#include "Engine/SkeletalMesh.h"
+#include "Engine/SkeletalMeshSocket.h"
+#include "Misc/MemStack.h"
+
+UAnimateIKBones::UAnimateIKBones()
+{
+	if (IKtoFK.Num() == 0)
+	{
+		IKtoFK.Add(TEXT("ik_foot_root"), TEXT("root"));
+		IKtoFK.Add(TEXT("ik_foot_r"), TEXT("foot_r"));
+		IKtoFK.Add(TEXT("ik_foot_l"), TEXT("foot_l"));
+		IKtoFK.Add(TEXT("ik_hand_root"), TEXT("root"));
+		IKtoFK.Add(TEXT("ik_hand_gun"), TEXT("hand_r"));
+		IKtoFK.Add(TEXT("ik_hand_r"), TEXT("hand_r"));
+		IKtoFK.Add(TEXT("ik_hand_l"), TEXT("hand_l"));
+	}
+}
+
+FFreeAnimModifierEvaluation UAnimateIKBones::PrepareEvaluation(UAnimSequence* AnimationSequence) const
+{
+	USkeleton* Skeleton = AnimationSequence->GetSkeleton();
+	const FReferenceSkeleton& RefSkeleton = Skeleton->GetReferenceSkeleton();
+	const int32 KeysNum = AnimationSequence->GetDataModel()->GetNumberOfKeys();
+
+	// Names of source bones
+	TMap<FName, FTransform> HumanoidBones;
+	// Bone name to parent bone name
+	TMap<FName, FName> Parents;
+	// Frame values
+	TMap<FName, FTransform> FramePos;
+
+	// Initialize containers
+	for (const auto& BonePair : IKtoFK)
+	{
+		if (RefSkeleton.FindBoneIndex(BonePair.Key) == INDEX_NONE)
+		{
+			UE_LOG(LogFreeAnimHelpers, Warning, TEXT("Can't find bone: %s"), *BonePair.Key.ToString());
+			return FFreeAnimModifierEvaluation();
+		}
+		if (RefSkeleton.FindBoneIndex(BonePair.Value) == INDEX_NONE)
+		{
+			UE_LOG(LogFreeAnimHelpers, Warning, TEXT("Can't find bone: %s"), *BonePair.Value.ToString());
+			return FFreeAnimModifierEvaluation();
+		}
+
+		if (!Parents.Contains(BonePair.Key))
+		{
+			const int32 ParentIndex = RefSkeleton.GetParentIndex(RefSkeleton.FindBoneIndex(BonePair.Key));
+			Parents.Add(BonePair.Key, (ParentIndex == INDEX_NONE) ? BonePair.Key : RefSkeleton.GetBoneName(ParentIndex));
+		}
+		if (!Parents.Contains(BonePair.Value))
+		{
+			const int32 ParentIndex = RefSkeleton.GetParentIndex(RefSkeleton.FindBoneIndex(BonePair.Value));
+			Parents.Add(BonePair.Value, (ParentIndex == INDEX_NONE) ? BonePair.Value : RefSkeleton.GetBoneName(ParentIndex));
+		}
+
+		if (IKtoFK.Contains(BonePair.Value))
+		{
+			// Use runtime transforms of IK bones
+			FramePos.Add(BonePair.Value);
+		}
+		else
+		{
+			// Doesn't add IK bones
+			HumanoidBones.Add(BonePair.Value);
+		}
+	}
+
+	for (const auto& ChildToParent : Parents)
+	{
+		if (!HumanoidBones.Contains(ChildToParent.Value) && !FramePos.Contains(ChildToParent.Value))
+		{
+			FramePos.Add(ChildToParent.Value);
+		}
+	}
+
+	// bindings are resolved on game thread, poses are evaluated by the returned function
+	const TSharedRef<const FAnimSkeletonBinding> Binding = FAnimSkeletonBinding::Get(AnimationSequence, AnimationSequence->GetPreviewMesh());
+
+	return [AnimationSequence, Binding, KeysNum, IKtoFK = IKtoFK, HumanoidBones = MoveTemp(HumanoidBones), Parents = MoveTemp(Parents), FramePos = MoveTemp(FramePos)](const FFreeAnimModifierInput& Input, FFreeAnimModifierOutput& Output)
+	{
+		// Component-space poses of source bones
+		TArray<FName> HumanoidBoneNames;
+		HumanoidBones.GenerateKeyArray(HumanoidBoneNames);
+		FAnimPoseCache PoseCache;
+		if (!PoseCache.Init(AnimationSequence, *Binding, HumanoidBoneNames, Input.Tracks))
+		{
+			return false;
+		}
+
+		// Frame state is a flat array: component-space poses of source bones, then runtime transforms of IK bones.
+		// Bone names are resolved to indices of this array here, so frames don't copy or search maps
+		TArray<FName> IKPosNames;
+		TArray<FTransform> InitialIKPos;
+		FramePos.GenerateKeyArray(IKPosNames);
+		FramePos.GenerateValueArray(InitialIKPos);
+		const int32 HumanoidNum = HumanoidBoneNames.Num();
+		const int32 StateNum = HumanoidNum + IKPosNames.Num();
+
+		TArray<int32> HumanoidCacheIndices;
+		for (const FName& BoneName : HumanoidBoneNames)
+		{
+			HumanoidCacheIndices.Add(PoseCache.FindBone(BoneName));
+		}
+
+		// runtime transform of IK bone is preferred to pose of the same bone in animation
+		auto FindStateIndex = [&IKPosNames, &HumanoidBoneNames, HumanoidNum](const FName& BoneName)
+		{
+			const int32 IKPosIndex = IKPosNames.Find(BoneName);
+			return IKPosIndex == INDEX_NONE ? HumanoidBoneNames.Find(BoneName) : HumanoidNum + IKPosIndex;
+		};
+
+		/** One IK bone in order of IKtoFK */
+		struct FIKBoneStep
+		{
+			int32 Slot;
+			int32 SourceIndex;
+			/* INDEX_NONE for root bone */
+			int32 ParentIndex;
+			/* INDEX_NONE if other IK bones don't depend on this one */
+			int32 SaveIndex;
+		};
+
+		// Tracks to save data
+		FAnimTrackBuffer& OutTracks = Output.Tracks;
+		TArray<FIKBoneStep> Steps;
+		for (const auto& BonePair : IKtoFK)
+		{
+			const FName& IKBone = BonePair.Key;
+			const FName& ParentBoneName = Parents[IKBone];
+			const int32 IKPosIndex = IKPosNames.Find(IKBone);
+
+			FIKBoneStep& Step = Steps.AddDefaulted_GetRef();
+			Step.Slot = OutTracks.AddBone(IKBone);
+			Step.SourceIndex = FindStateIndex(BonePair.Value);
+			Step.ParentIndex = ParentBoneName == IKBone ? INDEX_NONE : FindStateIndex(ParentBoneName);
+			Step.SaveIndex = IKPosIndex == INDEX_NONE ? INDEX_NONE : HumanoidNum + IKPosIndex;
+			check(Step.SourceIndex != INDEX_NONE);
+		}
+		OutTracks.Init(KeysNum);
+
+		// Frames don't depend on each other: each frame starts from the same initial state
+		UFreeAnimHelpersLibrary::ParallelForFrames(KeysNum, [&](int32 FrameIndex)
+		{
+			FMemMark Mark(FMemStack::Get());
+			TArray<FTransform, TMemStackAllocator<>> FrameState;
+			FrameState.SetNumUninitialized(StateNum);
+			for (int32 Index = 0; Index < HumanoidNum; Index++)
+			{
+				FrameState[Index] = HumanoidCacheIndices[Index] == INDEX_NONE
+					? FTransform::Identity
+					: PoseCache.GetComponentTransform(FrameIndex, HumanoidCacheIndices[Index]);
+			}
+			for (int32 Index = HumanoidNum; Index < StateNum; Index++)
+			{
+				FrameState[Index] = InitialIKPos[Index - HumanoidNum];
+			}
+
+			for (const FIKBoneStep& Step : Steps)
+			{
+				const FTransform SourcePos = FrameState[Step.SourceIndex];
+				const FTransform& ParentPos = Step.ParentIndex == INDEX_NONE ? FTransform::Identity : FrameState[Step.ParentIndex];
+
+				FTransform RelativeTr = SourcePos.GetRelativeTransform(ParentPos);
+				// Save to track
+				OutTracks.SetKey(Step.Slot, FrameIndex, RelativeTr);
+
+				if (Step.SaveIndex != INDEX_NONE)
+				{
+					FrameState[Step.SaveIndex] = SourcePos;
+				}
+			}
+		});
+
+		return true;
+	};
+}
@@ -1,143 +1,174 @@
-// (c) Yuri N. K. 2025. All rights reserved.
-// ykasczc@gmail.com
-
-#include "CopyBoneLocalSpace.h"
-#include "Animation/AnimData/AnimDataModel.h"
-#include "Runtime/Launch/Resources/Version.h"
-#include "Animation/AnimData/IAnimationDataController.h"
-#include "FreeAnimHelpersLibrary.h"
-#include "Animation/AnimSequence.h"
-#include "Animation/AnimTypes.h"
-#include "ReferenceSkeleton.h"
-#include "Engine/SkeletalMesh.h"
-#include "Kismet/KismetMathLibrary.h"
-
-UCopyBoneLocalSpace::UCopyBoneLocalSpace()
-{
-	if (Bones.IsEmpty())
-	{
-		Bones.Add(FBoneCopyWrapper(TEXT("thumb_03_r"), 3));
-		Bones.Add(FBoneCopyWrapper(TEXT("index_03_r"), 3));
-		Bones.Add(FBoneCopyWrapper(TEXT("middle_03_r"), 3));
-		Bones.Add(FBoneCopyWrapper(TEXT("ring_03_r"), 3));
-		Bones.Add(FBoneCopyWrapper(TEXT("pinky_03_r"), 3));
-		Bones.Add(FBoneCopyWrapper(TEXT("weapon_r"), 1));
-
-		Bones.Add(FBoneCopyWrapper(TEXT("thumb_03_l"), 3));
-		Bones.Add(FBoneCopyWrapper(TEXT("index_03_l"), 3));
-		Bones.Add(FBoneCopyWrapper(TEXT("middle_03_l"), 3));
-		Bones.Add(FBoneCopyWrapper(TEXT("ring_03_l"), 3));
-		Bones.Add(FBoneCopyWrapper(TEXT("pinky_03_l"), 3));
-		Bones.Add(FBoneCopyWrapper(TEXT("weapon_l"), 1));
-	}
-}
-
-void UCopyBoneLocalSpace::OnApply_Implementation(UAnimSequence* AnimationSequence)
-{
-	USkeleton* Skeleton = AnimationSequence->GetSkeleton();
-	const FReferenceSkeleton& RefSkeleton = Skeleton->GetReferenceSkeleton();
-	const int32 KeysNum = AnimationSequence->GetDataModel()->GetNumberOfKeys();
-
-	TArray<FName> BoneNames;
-	TArray<FTransform> BoneTransformsSrc, BoneTransformsDst;
-	TMap<FName, int32> BoneIndices;
-	TMap<FName, FBoneCopyRuntimeData> BonesData;
-
-	if (!IsValid(SourceSequence))
-	{
-		return;
-	}
-
-	for (const auto& NewChain : Bones)
-	{
-		int32 BoneIndex = RefSkeleton.FindBoneIndex(NewChain.ChainEndBoneName);
-		if (BoneIndex != INDEX_NONE)
-		{
-			BoneIndices.Add(NewChain.ChainEndBoneName, BoneIndex);
-			BonesData.Add(NewChain.ChainEndBoneName, FBoneCopyRuntimeData(NewChain));
-
-			for (int32 i = 1; i < NewChain.ChainLength; i++)
-			{
-				BoneIndex = RefSkeleton.GetParentIndex(BoneIndex);
-				if (BoneIndex <= 0) continue;
-
-				const FName BName = RefSkeleton.GetBoneName(BoneIndex);
-
-				BoneIndices.Add(BName, BoneIndex);
-				BonesData.Add(BName, FBoneCopyRuntimeData(NewChain));
-			}
-		}
-	}
-
-	BoneIndices.GenerateKeyArray(BoneNames);
-	BoneTransformsSrc.SetNum(BoneNames.Num());
-	BoneTransformsDst.SetNum(BoneNames.Num());
-
-	// Tracks to save data
-	TMap<FName, FRawAnimSequenceTrack> OutTracks;
-
-	// Initialize containers
-	for (const auto& BoneName : BoneNames)
-	{
-		FRawAnimSequenceTrack& Track = OutTracks.Add(BoneName);
-		Track.PosKeys.SetNumUninitialized(KeysNum);
-		Track.RotKeys.SetNumUninitialized(KeysNum);
-		Track.ScaleKeys.SetNumUninitialized(KeysNum);
-	}
-
-	for (int32 FrameIndex = 0; FrameIndex < KeysNum; FrameIndex++)
-	{
-		float Time;
-		UAnimationBlueprintLibrary::GetTimeAtFrame(AnimationSequence, FrameIndex, Time);
-		float SrcTime = Time;
-		float SrcPlayLength = SourceSequence->GetPlayLength();
-
-		if (Time > SrcPlayLength)
-		{
-			if (bLoopSourceData)
-			{
-				while (SrcTime > SrcPlayLength) SrcTime -= SrcPlayLength;
-			}
-			else
-			{
-				SrcTime = SrcPlayLength;
-			}
-		}
-
-		// get current transforms in source sequence
-		UFreeAnimHelpersLibrary::GetBonePosesForTime(SourceSequence, BoneNames, SrcTime, false, BoneTransformsSrc, AnimationSequence->GetPreviewMesh());
-		// get current transforms in target sequence
-		UFreeAnimHelpersLibrary::GetBonePosesForTime(AnimationSequence, BoneNames, Time, false, BoneTransformsDst, AnimationSequence->GetPreviewMesh());
-
-		for (int32 i = 0; i < BoneNames.Num(); i++)
-		{
-			const FName& BoneName = BoneNames[i];
-			FTransform& LocalTransformSrc = BoneTransformsSrc[i];
-			const FTransform& LocalTransformDst = BoneTransformsDst[i];
-
-			if (UAnimationBlueprintLibrary::DoesCurveExist(SourceSequence, BoneName, ERawCurveTrackTypes::RCT_Transform))
-			{
-				const FTransformCurve& c = SourceSequence->GetDataModel()->GetTransformCurve(FAnimationCurveIdentifier(BoneName, ERawCurveTrackTypes::RCT_Transform));
-				LocalTransformSrc = c.Evaluate(SrcTime, 1.f) * LocalTransformSrc;
-			}
-
-			OutTracks[BoneName].PosKeys[FrameIndex] = BonesData[BoneName].bCopyTranslation ? (FVector3f)LocalTransformSrc.GetTranslation() : (FVector3f)LocalTransformDst.GetTranslation();
-			OutTracks[BoneName].RotKeys[FrameIndex] = BonesData[BoneName].bCopyRotation ? (FQuat4f)LocalTransformSrc.GetRotation() : (FQuat4f)LocalTransformDst.GetRotation();
-			OutTracks[BoneName].ScaleKeys[FrameIndex] = (FVector3f)LocalTransformDst.GetScale3D();
-		}
-	}
-
-	// Save new keys in DataModel
-	IAnimationDataController& Controller = AnimationSequence->GetController();
-	for (const auto& Track : OutTracks)
-	{
-		const FName& BoneName = Track.Key;
-		Controller.RemoveBoneTrack(BoneName);
-#if ENGINE_MINOR_VERSION < 2
-		Controller.AddBoneTrack(BoneName);
-#else
-		Controller.AddBoneCurve(BoneName);
-#endif
-		Controller.SetBoneTrackKeys(BoneName, Track.Value.PosKeys, Track.Value.RotKeys, Track.Value.ScaleKeys);
-	}
-}
\ No newline at end of file
+// (c) Yuri N. K. 2025. All rights reserved.
+// ykasczc@gmail.com
+
+#include "CopyBoneLocalSpace.h"
+#include "FreeAnimDiagnostics.h"
+#include "Animation/AnimData/AnimDataModel.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include "Animation/AnimData/IAnimationDataController.h"
+#include "FreeAnimHelpersLibrary.h"
+#include "Misc/MemStack.h"
+#include "AnimTrackBuffer.h"
+#include "AnimSkeletonBinding.h"
+#include "Animation/AnimSequence.h"
+#include "Animation/AnimTypes.h"
+#include "ReferenceSkeleton.h"
+#include "Engine/SkeletalMesh.h"
+#include "Kismet/KismetMathLibrary.h"
+
+UCopyBoneLocalSpace::UCopyBoneLocalSpace()
+{
+	if (Bones.IsEmpty())
+	{
+		Bones.Add(FBoneCopyWrapper(TEXT("thumb_03_r"), 3));
+		Bones.Add(FBoneCopyWrapper(TEXT("index_03_r"), 3));
+		Bones.Add(FBoneCopyWrapper(TEXT("middle_03_r"), 3));
+		Bones.Add(FBoneCopyWrapper(TEXT("ring_03_r"), 3));
+		Bones.Add(FBoneCopyWrapper(TEXT("pinky_03_r"), 3));
+		Bones.Add(FBoneCopyWrapper(TEXT("weapon_r"), 1));
+
+		Bones.Add(FBoneCopyWrapper(TEXT("thumb_03_l"), 3));
+		Bones.Add(FBoneCopyWrapper(TEXT("index_03_l"), 3));
+		Bones.Add(FBoneCopyWrapper(TEXT("middle_03_l"), 3));
+		Bones.Add(FBoneCopyWrapper(TEXT("ring_03_l"), 3));
+		Bones.Add(FBoneCopyWrapper(TEXT("pinky_03_l"), 3));
+		Bones.Add(FBoneCopyWrapper(TEXT("weapon_l"), 1));
+	}
+}
+
+FFreeAnimModifierEvaluation UCopyBoneLocalSpace::PrepareEvaluation(UAnimSequence* AnimationSequence) const
+{
+	USkeleton* Skeleton = AnimationSequence->GetSkeleton();
+	const FReferenceSkeleton& RefSkeleton = Skeleton->GetReferenceSkeleton();
+	const int32 KeysNum = AnimationSequence->GetDataModel()->GetNumberOfKeys();
+
+	TArray<FName> BoneNames;
+	TMap<FName, int32> BoneIndices;
+	TMap<FName, FBoneCopyRuntimeData> BonesData;
+
+	if (!IsValid(SourceSequence))
+	{
+		return FFreeAnimModifierEvaluation();
+	}
+
+	for (const auto& NewChain : Bones)
+	{
+		int32 BoneIndex = RefSkeleton.FindBoneIndex(NewChain.ChainEndBoneName);
+		if (BoneIndex != INDEX_NONE)
+		{
+			BoneIndices.Add(NewChain.ChainEndBoneName, BoneIndex);
+			BonesData.Add(NewChain.ChainEndBoneName, FBoneCopyRuntimeData(NewChain));
+
+			for (int32 i = 1; i < NewChain.ChainLength; i++)
+			{
+				BoneIndex = RefSkeleton.GetParentIndex(BoneIndex);
+				if (BoneIndex <= 0) continue;
+
+				const FName BName = RefSkeleton.GetBoneName(BoneIndex);
+
+				BoneIndices.Add(BName, BoneIndex);
+				BonesData.Add(BName, FBoneCopyRuntimeData(NewChain));
+			}
+		}
+	}
+
+	BoneIndices.GenerateKeyArray(BoneNames);
+
+	// resolve bones and curves once, frames are evaluated in parallel
+	TArray<int32> SrcBoneIndices, DstBoneIndices;
+	const TSharedRef<const FAnimSkeletonBinding> SrcBinding = FAnimSkeletonBinding::GetForBones(SourceSequence, AnimationSequence->GetPreviewMesh(), BoneNames, SrcBoneIndices);
+	const TSharedRef<const FAnimSkeletonBinding> DstBinding = FAnimSkeletonBinding::GetForBones(AnimationSequence, AnimationSequence->GetPreviewMesh(), BoneNames, DstBoneIndices);
+
+	// bones missing in source or target are skipped
+	for (int32 i = BoneNames.Num() - 1; i >= 0; i--)
+	{
+		if (SrcBoneIndices[i] == INDEX_NONE || DstBoneIndices[i] == INDEX_NONE)
+		{
+			UE_LOG(LogFreeAnimHelpers, Warning, TEXT("CopyBoneLocalSpace: bone %s is missing in %s"), *BoneNames[i].ToString(),
+				SrcBoneIndices[i] == INDEX_NONE ? *SourceSequence->GetName() : *AnimationSequence->GetName());
+			BoneNames.RemoveAt(i);
+			SrcBoneIndices.RemoveAt(i);
+			DstBoneIndices.RemoveAt(i);
+		}
+	}
+	if (BoneNames.IsEmpty())
+	{
+		return FFreeAnimModifierEvaluation();
+	}
+
+	TArray<const FTransformCurve*> SrcCurves;
+	TArray<FBoneCopyRuntimeData> SrcBonesData;
+	for (const FName& BoneName : BoneNames)
+	{
+		SrcCurves.Add(UAnimationBlueprintLibrary::DoesCurveExist(SourceSequence, BoneName, ERawCurveTrackTypes::RCT_Transform)
+			? &SourceSequence->GetDataModel()->GetTransformCurve(FAnimationCurveIdentifier(BoneName, ERawCurveTrackTypes::RCT_Transform))
+			: nullptr);
+		SrcBonesData.Add(BonesData[BoneName]);
+	}
+
+	const UAnimSequence* Source = SourceSequence;
+	const bool bLoop = bLoopSourceData;
+
+	return [AnimationSequence, Source, bLoop, SrcBinding, DstBinding, KeysNum, BoneNames = MoveTemp(BoneNames), SrcBoneIndices = MoveTemp(SrcBoneIndices), DstBoneIndices = MoveTemp(DstBoneIndices), SrcCurves = MoveTemp(SrcCurves), SrcBonesData = MoveTemp(SrcBonesData)](const FFreeAnimModifierInput& Input, FFreeAnimModifierOutput& Output)
+	{
+		// Tracks to save data, slot of bone is its index in BoneNames
+		FAnimTrackBuffer& OutTracks = Output.Tracks;
+		OutTracks.Init(BoneNames, KeysNum);
+		// bones written by previous stages of modifier stack
+		const TArray<int32> SlotMap = Input.MakeSlotMap(*DstBinding);
+
+		const float SrcPlayLength = Source->GetPlayLength();
+
+		UFreeAnimHelpersLibrary::ParallelForFrames(KeysNum, [&](int32 FrameIndex)
+		{
+			const float Time = AnimationSequence->GetTimeAtFrame(FrameIndex);
+			float SrcTime = Time;
+
+			if (Time > SrcPlayLength)
+			{
+				if (bLoop)
+				{
+					while (SrcTime > SrcPlayLength) SrcTime -= SrcPlayLength;
+				}
+				else
+				{
+					SrcTime = SrcPlayLength;
+				}
+			}
+
+			// get current transforms in source sequence (frame rates can differ, so source frame can be fractional)
+			FMemMark Mark(FMemStack::Get());
+			TArray<FTransform, TMemStackAllocator<>> BoneTransformsSrc, BoneTransformsDst;
+			BoneTransformsSrc.SetNumUninitialized(SrcBoneIndices.Num());
+			BoneTransformsDst.SetNumUninitialized(DstBoneIndices.Num());
+			UFreeAnimHelpersLibrary::GetBonePosesForFrameByIndex(Source, *SrcBinding, SrcBoneIndices, UFreeAnimHelpersLibrary::GetFrameTimeAtTime(Source, SrcTime), BoneTransformsSrc);
+			// get current transforms in target sequence
+			Input.GetBonePosesForFrame(AnimationSequence, *DstBinding, DstBoneIndices, SlotMap, FrameIndex, BoneTransformsDst);
+
+			for (int32 i = 0; i < BoneNames.Num(); i++)
+			{
+				FTransform& LocalTransformSrc = BoneTransformsSrc[i];
+				const FTransform& LocalTransformDst = BoneTransformsDst[i];
+
+				if (SrcCurves[i])
+				{
+					LocalTransformSrc = SrcCurves[i]->Evaluate(SrcTime, 1.f) * LocalTransformSrc;
+				}
+
+				OutTracks.SetPosKey(i, FrameIndex, SrcBonesData[i].bCopyTranslation ? LocalTransformSrc.GetTranslation() : LocalTransformDst.GetTranslation());
+				OutTracks.SetRotKey(i, FrameIndex, SrcBonesData[i].bCopyRotation ? LocalTransformSrc.GetRotation() : LocalTransformDst.GetRotation());
+				OutTracks.SetScaleKey(i, FrameIndex, LocalTransformDst.GetScale3D());
+			}
+		});
+
+		return true;
+	};
+}
+
+void UCopyBoneLocalSpace::GetReferencedSequences(TArray<const UAnimSequence*>& OutSequences) const
+{
+	if (SourceSequence)
+	{
+		OutSequences.AddUnique(SourceSequence);
+	}
+}
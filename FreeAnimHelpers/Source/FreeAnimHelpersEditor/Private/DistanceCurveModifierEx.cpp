@@ -1,581 +1,728 @@
-// Copyright Epic Games, Inc. All Rights Reserved.
-
-#include "DistanceCurveModifierEx.h"
-#include "Animation/AnimData/IAnimationDataController.h"
-#include "Runtime/Launch/Resources/Version.h"
-#include "FreeAnimHelpersLibrary.h"
-#include "AnimationBlueprintLibrary.h"
-#include "Animation/AnimSequence.h"
-#include "Animation/AnimationPoseData.h"
-#include "Kismet/KismetMathLibrary.h"
-#include "Curves/CurveFloat.h"
-#include "Curves/CurveVector.h"
-
-// TODO: This logic works decently for simple clips but it should be reworked to be more robust:
-//  * It could detect pivot points by change in direction.
-//  * It should also account for clips that have multiple stop/pivot points.
-//  * It should handle distance traveled for the ends of looping animations.
-void UDistanceCurveModifierEx::OnApply_Implementation(UAnimSequence* Animation)
-{
-	if (Animation == nullptr)
-	{
-		UE_LOG(LogAnimation, Error, TEXT("DistanceCurveModifierEx failed. Reason: Invalid Animation"));
-		return;
-	}
-
-	// build faked root motion curves
-	GenerateRootMotion(Animation);
-
-	const float AnimLength = Animation->GetPlayLength();
-	float SampleInterval;
-	int32 NumSteps;
-	float TimeOfMinSpeed;
-
-	// Find time mark of minimum speed
-	if (ReferencePoint == EFAHDMotionRefPoint::StopAtEnd)
-	{ 
-		TimeOfMinSpeed = AnimLength;
-	}
-	else if (ReferencePoint == EFAHDMotionRefPoint::BeginAtStart)
-	{
-		TimeOfMinSpeed = 0.f;
-	}
-	else
-	{
-		// Perform a high resolution search to find the sample point with minimum speed.
-		
-		TimeOfMinSpeed = 0.f;
-		float MinSpeedSq = FMath::Square(StopSpeedThreshold);
-
-		SampleInterval = 1.f / 120.f;
-		NumSteps = AnimLength / SampleInterval;
-		for (int32 Step = 0; Step < NumSteps; ++Step)
-		{
-			const float Time = Step * SampleInterval;
-
-			const bool bAllowLooping = false;
-			const FVector RootMotionTranslation = FindRootMotion(Time, SampleInterval);
-				//Animation->ExtractRootMotion(Time, SampleInterval, bAllowLooping).GetTranslation();
-			const float RootMotionSpeedSq = CalculateMagnitudeSq(RootMotionTranslation, Axis) / SampleInterval;
-
-			if (RootMotionSpeedSq < MinSpeedSq)
-			{
-				MinSpeedSq = RootMotionSpeedSq;
-				TimeOfMinSpeed = Time;
-			}
-		}
-	}
-
-	FName RootCurveX = FName(RootCurveName.ToString() + TEXT("_X"));
-	FName RootCurveY = FName(RootCurveName.ToString() + TEXT("_Y"));
-	FName RootCurveZ = FName(RootCurveName.ToString() + TEXT("_Z"));
-
-	//
-	// 1. Save raw root motion data
-	// 
-
-	if (bRootMotionToCurves)
-	{
-		UE_LOG(LogTemp, Log, TEXT("bRootMotionToCurves"));
-		if (UAnimationBlueprintLibrary::DoesCurveExist(Animation, RootCurveX, ERawCurveTrackTypes::RCT_Float))
-		{
-			UAnimationBlueprintLibrary::RemoveCurve(Animation, RootCurveX);
-		}
-		if (UAnimationBlueprintLibrary::DoesCurveExist(Animation, RootCurveY, ERawCurveTrackTypes::RCT_Float))
-		{
-			UAnimationBlueprintLibrary::RemoveCurve(Animation, RootCurveY);
-		}
-		if (UAnimationBlueprintLibrary::DoesCurveExist(Animation, RootCurveZ, ERawCurveTrackTypes::RCT_Float))
-		{
-			UAnimationBlueprintLibrary::RemoveCurve(Animation, RootCurveZ);
-		}
-		UAnimationBlueprintLibrary::AddCurve(Animation, RootCurveX, ERawCurveTrackTypes::RCT_Float, false);
-		UAnimationBlueprintLibrary::AddCurve(Animation, RootCurveY, ERawCurveTrackTypes::RCT_Float, false);
-		UAnimationBlueprintLibrary::AddCurve(Animation, RootCurveZ, ERawCurveTrackTypes::RCT_Float, false);
-
-		SampleInterval = 1.f / SampleRate;
-		NumSteps = FMath::CeilToInt(AnimLength / SampleInterval);
-		float Time = 0.0f;
-		for (int32 Step = 0; Step <= NumSteps && Time < AnimLength; ++Step)
-		{
-			Time = FMath::Min(Step * SampleInterval, AnimLength);
-			FVector rm = RootOffset.GetValue(Time);
-
-			UAnimationBlueprintLibrary::AddFloatCurveKey(Animation, RootCurveX, Time, rm.X);
-			UAnimationBlueprintLibrary::AddFloatCurveKey(Animation, RootCurveY, Time, rm.Y);
-			UAnimationBlueprintLibrary::AddFloatCurveKey(Animation, RootCurveZ, Time, rm.Z);
-		}
-
-		Animation->bEnableRootMotion = true;
-		Animation->RootMotionRootLock = ERootMotionRootLock::AnimFirstFrame;
-	}
-
-	if (bRootMotionToRootBone)
-	{
-		const int32 KeysNum = Animation->GetDataModel()->GetNumberOfKeys();
-		const FReferenceSkeleton& RefSkeleton = Animation->GetSkeleton()->GetReferenceSkeleton();
-		FName RootBoneName = RefSkeleton.GetBoneName(0);
-		TArray<FName> AttachBoneNames;
-		TArray<FTransform> AttachBonePositions;
-
-		bool bAnimateRootBoneFromCurves = bRootMotionFromCurves && !bRootMotionToCurves;
-		UE_LOG(LogTemp, Log, TEXT("Animation keys number = %d"), KeysNum);
-
-		if (bAnimateRootBoneFromCurves)
-		{
-			FAnimationCurveIdentifier IdCurveX, IdCurveY, IdCurveZ;
-			const FFloatCurve* CurveX = UFreeAnimHelpersLibrary::GetFloatCurve(Animation, RootCurveX, IdCurveX);
-			const FFloatCurve* CurveY = UFreeAnimHelpersLibrary::GetFloatCurve(Animation, RootCurveY, IdCurveY);
-			const FFloatCurve* CurveZ = UFreeAnimHelpersLibrary::GetFloatCurve(Animation, RootCurveZ, IdCurveZ);
-			if (!CurveX || !CurveY)
-			{
-				UE_LOG(LogTemp, Log, TEXT("Invalid root motion curves. X: %d, Y: %d, Z: %d"), CurveX ? 1 : 0, CurveY ? 1 : 0, CurveZ ? 1 : 0);
-				return;
-			}
-
-			for (auto& Curve : RootOffset.VectorCurves)
-				Curve.Reset();
-
-			for (int32 FrameIndex = 0; FrameIndex < KeysNum; FrameIndex++)
-			{
-				const float Time = Animation->GetTimeAtFrame(FrameIndex);
-				const FVector NewPoint = FVector(
-					CurveX->Evaluate(Time),
-					CurveY->Evaluate(Time),
-					CurveZ ? CurveZ->Evaluate(Time) : 0.f
-				);
-				AddVectorCurveKey(RootOffset, Time, NewPoint);
-			}
-
-			const int32 NumBones = RefSkeleton.GetNum();
-			for (int32 ChildIndex = 1; ChildIndex < NumBones; ChildIndex++)
-			{
-				if (RefSkeleton.GetParentIndex(ChildIndex) == 0)
-				{
-					AttachBoneNames.Add(RefSkeleton.GetBoneName(ChildIndex));
-				}
-			}
-			AttachBonePositions.SetNum(AttachBoneNames.Num());
-		}
-
-		FRawAnimSequenceTrack RootTrack;
-		RootTrack.PosKeys.SetNumUninitialized(KeysNum);
-		RootTrack.RotKeys.SetNumUninitialized(KeysNum);
-		RootTrack.ScaleKeys.SetNumUninitialized(KeysNum);
-
-		TArray<FRawAnimSequenceTrack> ChildTrachs;
-		ChildTrachs.SetNum(AttachBoneNames.Num());
-		for (auto& ChildTrack : ChildTrachs)
-		{
-			ChildTrack.PosKeys.SetNumUninitialized(KeysNum);
-			ChildTrack.RotKeys.SetNumUninitialized(KeysNum);
-			ChildTrack.ScaleKeys.SetNumUninitialized(KeysNum);
-		}
-
-		// Update animation
-		for (int32 FrameIndex = 0; FrameIndex < KeysNum; FrameIndex++)
-		{
-			float Time = Animation->GetTimeAtFrame(FrameIndex);
-
-			FTransform RootFramePose;
-			UFreeAnimHelpersLibrary::GetBonePoseForTime(Animation, RootBoneName, Time, false, RootFramePose);
-
-			const FVector NewRootLocation = RootOffset.GetValue(Time);
-
-			if (bAnimateRootBoneFromCurves)
-			{
-				UFreeAnimHelpersLibrary::GetBonePosesForTime(Animation, AttachBoneNames, Time, false, AttachBonePositions, Animation->GetPreviewMesh());
-
-				FTransform NewRootFramePose = RootFramePose;
-				NewRootFramePose.SetTranslation(NewRootLocation);
-
-				for (int32 i = 0; i < AttachBoneNames.Num(); i++)
-				{
-					FTransform BoneNewTr = (AttachBonePositions[i] * RootFramePose).GetRelativeTransform(NewRootFramePose);
-					ChildTrachs[i].PosKeys[FrameIndex] = (FVector3f)BoneNewTr.GetTranslation();
-					ChildTrachs[i].RotKeys[FrameIndex] = (FQuat4f)BoneNewTr.GetRotation();
-					ChildTrachs[i].ScaleKeys[FrameIndex] = (FVector3f)BoneNewTr.GetScale3D();
-				}
-			}
-
-			RootTrack.PosKeys[FrameIndex] = (FVector3f)NewRootLocation;
-			RootTrack.RotKeys[FrameIndex] = (FQuat4f)RootFramePose.GetRotation();
-			RootTrack.ScaleKeys[FrameIndex] = (FVector3f)RootFramePose.GetScale3D();
-		}
-
-		IAnimationDataController& Controller = Animation->GetController();
-		Controller.RemoveBoneTrack(RootBoneName);
-		Controller.AddBoneCurve(RootBoneName);
-		Controller.SetBoneTrackKeys(RootBoneName, RootTrack.PosKeys, RootTrack.RotKeys, RootTrack.ScaleKeys);
-
-		for (int32 i = 0; i < AttachBoneNames.Num(); i++)
-		{
-			Controller.RemoveBoneTrack(AttachBoneNames[i]);
-			Controller.AddBoneCurve(AttachBoneNames[i]);
-			Controller.SetBoneTrackKeys(AttachBoneNames[i], ChildTrachs[i].PosKeys, ChildTrachs[i].RotKeys, ChildTrachs[i].ScaleKeys);
-		}
-
-		Animation->RefreshCacheData();
-	}
-
-	//
-	// 2. Save distance data
-	//
-
-	if (UAnimationBlueprintLibrary::DoesCurveExist(Animation, CurveName, ERawCurveTrackTypes::RCT_Float))
-	{
-		UAnimationBlueprintLibrary::RemoveCurve(Animation, CurveName);
-	}
-	UAnimationBlueprintLibrary::AddCurve(Animation, CurveName, ERawCurveTrackTypes::RCT_Float, false);
-
-	SampleInterval = 1.f / SampleRate;
-	NumSteps = FMath::CeilToInt(AnimLength / SampleInterval);
-	float Time = 0.0f;
-	float DistanceRangeA = 999999.f, DistanceRangeB = -999999.f;
-	for (int32 Step = 0; Step <= NumSteps && Time < AnimLength; ++Step)
-	{
-		Time = FMath::Min(Step * SampleInterval, AnimLength);
-
-		// Assume that during any time before the stop/pivot point, the animation is approaching that point.
-		const float ValueSign = (Time < TimeOfMinSpeed) ? -1.0f : 1.0f;
-
-		const FVector RootMotionTranslation = FindRootMotionInRange(TimeOfMinSpeed, Time);
-			//Animation->ExtractRootMotionFromRange(TimeOfMinSpeed, Time).GetTranslation();
-		float Magnitude = ValueSign * CalculateMagnitude(RootMotionTranslation, Axis);
-		UAnimationBlueprintLibrary::AddFloatCurveKey(Animation, CurveName, Time, Magnitude);
-
-		DistanceRangeA = FMath::Min(DistanceRangeA, Magnitude);
-		DistanceRangeB = FMath::Max(DistanceRangeB, Magnitude);
-	}
-
-	if (bOptimizedDistanceCurveFormat)
-	{
-		FName OptimizedCurveName = FName(CurveName.ToString() + TEXT("_Optimized"));
-		if (UAnimationBlueprintLibrary::DoesCurveExist(Animation, OptimizedCurveName, ERawCurveTrackTypes::RCT_Float))
-		{
-			UAnimationBlueprintLibrary::RemoveCurve(Animation, OptimizedCurveName);
-		}
-		UAnimationBlueprintLibrary::AddCurve(Animation, OptimizedCurveName, ERawCurveTrackTypes::RCT_Float, false);
-
-		// Save magnitude
-		UAnimationBlueprintLibrary::AddFloatCurveKey(Animation, OptimizedCurveName, -1.f, DistanceRangeA);
-		UAnimationBlueprintLibrary::AddFloatCurveKey(Animation, OptimizedCurveName, -0.5f, DistanceRangeB);
-
-		int32 RootKeysNum = RootOffset.VectorCurves[0].GetNumKeys();
-		for (int32 KeyIndex = 0; KeyIndex < RootKeysNum; KeyIndex++)
-		{
-			Time = RootOffset.VectorCurves[0].Keys[KeyIndex].Time;
-			const FVector RootMotionTranslation = FindRootMotionInRange(TimeOfMinSpeed, Time);
-
-			// Assume that during any time before the stop/pivot point, the animation is approaching that point.
-			const float ValueSign = (Time < TimeOfMinSpeed) ? -1.0f : 1.0f;
-			float Magnitude = ValueSign * CalculateMagnitude(RootMotionTranslation, Axis);
-
-			float MappedMagnitude = FMath::GetMappedRangeValueClamped(FVector2D(DistanceRangeA, DistanceRangeB), FVector2D(0.f, AnimLength), Magnitude);
-
-			UAnimationBlueprintLibrary::AddFloatCurveKey(Animation, OptimizedCurveName, MappedMagnitude, Time);
-		}
-	}
-}
-
-void UDistanceCurveModifierEx::OnRevert_Implementation(UAnimSequence* Animation)
-{
-	const bool bRemoveNameFromSkeleton = false;
-	if (UAnimationBlueprintLibrary::DoesCurveExist(Animation, CurveName, ERawCurveTrackTypes::RCT_Float))
-	{
-		UAnimationBlueprintLibrary::RemoveCurve(Animation, CurveName, bRemoveNameFromSkeleton);
-	}
-
-	if (bRootMotionToCurves)
-	{	
-		/*
-		UE_LOG(LogTemp, Log, TEXT("Delete root motion curves :("));
-		UAnimationBlueprintLibrary::RemoveCurve(Animation, FName(RootCurveName.ToString() + TEXT("_X")), bRemoveNameFromSkeleton);
-		UAnimationBlueprintLibrary::RemoveCurve(Animation, FName(RootCurveName.ToString() + TEXT("_Y")), bRemoveNameFromSkeleton);
-		UAnimationBlueprintLibrary::RemoveCurve(Animation, FName(RootCurveName.ToString() + TEXT("_Z")), bRemoveNameFromSkeleton);
-		*/
-	}
-}
-
-float UDistanceCurveModifierEx::CalculateMagnitude(const FVector& Vector, EFAHDistanceCurve_Axis Axis)
-{
-	switch (Axis)
-	{
-		case EFAHDistanceCurve_Axis::X:		return FMath::Abs(Vector.X); break;
-		case EFAHDistanceCurve_Axis::Y:		return FMath::Abs(Vector.Y); break;
-		case EFAHDistanceCurve_Axis::Z:		return FMath::Abs(Vector.Z); break;
-		default: return FMath::Sqrt(CalculateMagnitudeSq(Vector, Axis)); break;
-	}
-}
-
-float UDistanceCurveModifierEx::CalculateMagnitudeSq(const FVector& Vector, EFAHDistanceCurve_Axis Axis)
-{
-	switch (Axis)
-	{
-		case EFAHDistanceCurve_Axis::X:		return FMath::Square(FMath::Abs(Vector.X)); break;
-		case EFAHDistanceCurve_Axis::Y:		return FMath::Square(FMath::Abs(Vector.Y)); break;
-		case EFAHDistanceCurve_Axis::Z:		return FMath::Square(FMath::Abs(Vector.Z)); break;
-		case EFAHDistanceCurve_Axis::XY:	return Vector.X * Vector.X + Vector.Y * Vector.Y; break;
-		case EFAHDistanceCurve_Axis::XZ:	return Vector.X * Vector.X + Vector.Z * Vector.Z; break;
-		case EFAHDistanceCurve_Axis::YZ:	return Vector.Y * Vector.Y + Vector.Z * Vector.Z; break;
-		case EFAHDistanceCurve_Axis::XYZ:	return Vector.X * Vector.X + Vector.Y * Vector.Y + Vector.Z * Vector.Z; break;
-		default: check(false); break;
-	}
-
-	return 0.f;
-}
-
-FVector UDistanceCurveModifierEx::DirectionAsVector(EMATMovementDirection Direction)
-{
-	switch (Direction)
-	{
-		case EMATMovementDirection::MD_X:		return FVector(1.f, 0.f, 0.f); break;
-		case EMATMovementDirection::MD_XY:		return FVector(1.f, 1.f, 0.f); break;
-		case EMATMovementDirection::MD_Y:		return FVector(0.f, 1.f, 0.f); break;
-		case EMATMovementDirection::MD_XnY:		return FVector(-1.f, 1.f, 0.f); break;
-		case EMATMovementDirection::MD_Xn:		return FVector(-1.f, 0.f, 0.f); break;
-		case EMATMovementDirection::MD_XnYn:	return FVector(-1.f, -1.f, 0.f); break;
-		case EMATMovementDirection::MD_Yn:		return FVector(0.f, -1.f, 0.f); break;
-		case EMATMovementDirection::MD_XYn:		return FVector(1.f, -1.f, 0.f); break;
-		case EMATMovementDirection::MD_Z:		return FVector(0.f, 0.f, 1.f); break;
-	}
-
-	return FVector::RightVector;
-}
-
-void UDistanceCurveModifierEx::AddVectorCurveKey(FRuntimeVectorCurve& Curve, float Time, const FVector& Value)
-{
-	FKeyHandle h1 = Curve.VectorCurves[0].AddKey(Time, Value.X);
-	FKeyHandle h2 = Curve.VectorCurves[1].AddKey(Time, Value.Y);
-	FKeyHandle h3 = Curve.VectorCurves[2].AddKey(Time, Value.Z);
-	Curve.VectorCurves[0].SetKeyInterpMode(h1, ERichCurveInterpMode::RCIM_Linear);
-	Curve.VectorCurves[1].SetKeyInterpMode(h2, ERichCurveInterpMode::RCIM_Linear);
-	Curve.VectorCurves[2].SetKeyInterpMode(h3, ERichCurveInterpMode::RCIM_Linear);
-}
-
-FVector UDistanceCurveModifierEx::GetVectorCurveValue(const FRuntimeVectorCurve& Curve, int32 KeyIndex)
-{
-	return FVector(Curve.VectorCurves[0].Keys[KeyIndex].Value, Curve.VectorCurves[1].Keys[KeyIndex].Value, Curve.VectorCurves[2].Keys[KeyIndex].Value);
-}
-
-void UDistanceCurveModifierEx::GenerateRootMotion(UAnimSequence* AnimationSequence)
-{
-	int32 KeysNum = AnimationSequence->GetDataModel()->GetNumberOfKeys();
-	UE_LOG(LogTemp, Log, TEXT("GenerateRootMotion for %d animation keys"), KeysNum);
-
-	FVector LastPelvis, LastFootRight, LastFootLeft;
-	float LastDistanceR = 0.f, LastDistanceL = 0.f;
-	bool bUseRightFoot = true;
-
-	RootOffset.ExternalCurve = nullptr;
-	AddVectorCurveKey(RootOffset, 0.f, FVector::ZeroVector);
-
-	// find initial base foot
-	FVector MovementDirection = DirectionAsVector(InitialDirection);
-	if (InitialDirection != EMATMovementDirection::MD_Z)
-	{
-		for (int32 KeyIndex = 0; KeyIndex < KeysNum; KeyIndex++)
-		{
-			float Time = AnimationSequence->GetTimeAtFrame(KeyIndex);
-
-			const FVector FootRight = UFreeAnimHelpersLibrary::GetBonePositionAtTimeInCS(AnimationSequence, FootRightBone, Time).GetTranslation();
-			const FVector FootLeft = UFreeAnimHelpersLibrary::GetBonePositionAtTimeInCS(AnimationSequence, FootLeftBone, Time).GetTranslation();
-
-			if (KeyIndex > 0)
-			{
-				bool bRightDP = FVector::DotProduct((FootRight - LastFootRight).GetSafeNormal2D(), MovementDirection) < 0.f;
-				bool bLeftDP = FVector::DotProduct((FootLeft - LastFootLeft).GetSafeNormal2D(), MovementDirection) < 0.f;
-
-				if (bRightDP && !bLeftDP)
-				{
-					bUseRightFoot = true; break;
-				}
-				else if (!bRightDP && bLeftDP)
-				{
-					bUseRightFoot = false; break;
-				}
-			}
-			LastFootRight = FootRight; LastFootLeft = FootLeft;
-		}
-	}
-
-	UE_LOG(LogTemp, Log, TEXT("GenerateRootMotion starts with leg (1 = right, 0 = left): %d"), (int)bUseRightFoot);
-
-	FVector LastFrameRoot = FVector::ZeroVector;
-	for (int32 KeyIndex = 0; KeyIndex < KeysNum; KeyIndex++)
-	{
-		float Time = AnimationSequence->GetTimeAtFrame(KeyIndex);
-
-		const FVector Pelvis = UFreeAnimHelpersLibrary::GetBonePositionAtTimeInCS(AnimationSequence, PelvisBone, Time).GetTranslation();
-		const FVector FootRight = UFreeAnimHelpersLibrary::GetBonePositionAtTimeInCS(AnimationSequence, FootRightBone, Time).GetTranslation();
-		const FVector FootLeft = UFreeAnimHelpersLibrary::GetBonePositionAtTimeInCS(AnimationSequence, FootLeftBone, Time).GetTranslation();
-
-		float DistanceR = FVector::Dist2D(Pelvis, FootRight),
-			DistanceL = FVector::Dist2D(Pelvis, FootLeft);
-
-		if (KeyIndex > 0)
-		{
-			if (InitialDirection == EMATMovementDirection::MD_Z)
-			{
-				LastFrameRoot = FVector(0.f, 0.f, FMath::Max(0.f, FMath::Min(FootRight.Z, FootLeft.Z)));
-			}
-			else
-			{
-				// update bearing foot
-				if (bUseRightFoot)
-				{
-					if (DistanceR < LastDistanceR && FVector::DotProduct(MovementDirection.GetSafeNormal2D(), Pelvis - FootRight) > 0.f)
-					{
-						bUseRightFoot = false;
-					}
-				}
-				else
-				{
-					if (DistanceL < LastDistanceL && FVector::DotProduct(MovementDirection.GetSafeNormal2D(), Pelvis - FootLeft) > 0.f)
-					{
-						bUseRightFoot = true;
-					}
-				}
-
-				FVector MovementDirectionR = (Pelvis - FootRight) - (LastPelvis - LastFootRight);
-				MovementDirectionR.Z = 0.f;
-				FVector MovementDirectionL = (Pelvis - FootLeft) - (LastPelvis - LastFootLeft);
-				MovementDirectionL.Z = 0.f;
-
-				if (FVector::DotProduct(MovementDirection, MovementDirectionR) > FVector::DotProduct(MovementDirection, MovementDirectionL))
-					MovementDirection = MovementDirectionR;
-				else
-					MovementDirection = MovementDirectionL;
-
-				LastFrameRoot += MovementDirection;
-			}
-
-			// save key
-			UE_LOG(LogTemp, Log, TEXT("[%d] Root location at time %f = %s"), (int)bUseRightFoot, Time, *LastFrameRoot.ToString());
-
-			AddVectorCurveKey(RootOffset, Time, LastFrameRoot);
-		}
-
-		LastPelvis = Pelvis; LastFootRight = FootRight; LastFootLeft = FootLeft;
-		LastDistanceR = DistanceR; LastDistanceL = DistanceL;
-	}
-
-	// update extremums
-	int32 RootKeysNum = RootOffset.VectorCurves[0].Keys.Num();
-	TArray< TArray<int32>> Extremums;
-	Extremums.SetNum(3);
-	Extremums[0].Add(0); Extremums[0].Add(1); Extremums[2].Add(0);
-
-	const int32 CheckArea = 2;
-	for (int32 i = CheckArea; i < RootKeysNum - CheckArea; i++)
-	{
-		FVector CurrentValue = GetVectorCurveValue(RootOffset, i);
-
-		bool bExtremumX = true, bExtremumY = true, bExtremumZ = true;
-		int32 AllSameSizeX = 0, AllSameSizeY = 0, AllSameSizeZ = 0;
-
-		for (int32 AreaIndex = i - CheckArea; AreaIndex <= i + CheckArea; AreaIndex++)
-		{
-			if (AreaIndex == i) continue;
-			FVector Delta = CurrentValue - GetVectorCurveValue(RootOffset, AreaIndex);
-
-			if (AllSameSizeX == 0)
-			{
-				AllSameSizeX = (int32)FMath::Sign(Delta.X);
-			}
-			else if (AllSameSizeX != FMath::Sign(Delta.X) && Delta.X != 0.f)
-			{
-				bExtremumX = false;
-			}
-			if (AllSameSizeY == 0)
-			{
-				AllSameSizeY = (int32)FMath::Sign(Delta.Y);
-			}
-			else if (AllSameSizeY != FMath::Sign(Delta.Y) && Delta.Y != 0.f)
-			{
-				bExtremumY = false;
-			}
-			if (AllSameSizeZ == 0)
-			{
-				AllSameSizeZ = (int32)FMath::Sign(Delta.Z);
-			}
-			else if (AllSameSizeZ != FMath::Sign(Delta.Z) && Delta.Z != 0.f)
-			{
-				bExtremumZ = false;
-			}
-		}
-
-		if (bExtremumX) Extremums[0].Add(i);
-		if (bExtremumY) Extremums[1].Add(i);
-		if (bExtremumZ) Extremums[2].Add(i);
-		UE_LOG(LogTemp, Log, TEXT("[%f] Extremums %d %d %d"), RootOffset.VectorCurves[0].Keys[i].Time, (int)bExtremumX, (int)bExtremumY, (int)bExtremumZ);
-	}
-	Extremums[0].Add(RootKeysNum - 1); Extremums[0].Add(RootKeysNum - 1); Extremums[2].Add(RootKeysNum - 1);
-
-	// cleanup intermediate extremums
-	for (int32 Axis3d = 0; Axis3d < 3; Axis3d++)
-	{
-		TSet<int32> IndToRemove;
-		for (int32 ExtrIndex = 1; ExtrIndex < Extremums[Axis3d].Num() - 1; ExtrIndex++)
-		{
-			FRichCurveKey Prev = RootOffset.VectorCurves[Axis3d].Keys[Extremums[Axis3d][ExtrIndex - 1]];
-			FRichCurveKey Curr = RootOffset.VectorCurves[Axis3d].Keys[Extremums[Axis3d][ExtrIndex]];
-			FRichCurveKey Next = RootOffset.VectorCurves[Axis3d].Keys[Extremums[Axis3d][ExtrIndex + 1]];
-
-			if (Curr.Time - Prev.Time < SmoothenAccuracy && Next.Time - Curr.Time > SmoothenAccuracy)
-			{
-				if (ExtrIndex == 1)
-				{
-					IndToRemove.Add(Extremums[Axis3d][ExtrIndex]);
-				}
-				else
-				{
-					Prev = RootOffset.VectorCurves[Axis3d].Keys[Extremums[Axis3d][ExtrIndex - 2]];
-					if (FMath::Sign(Prev.Value - Curr.Value) != FMath::Sign(Next.Value - Curr.Value))
-					{
-						IndToRemove.Add(Extremums[Axis3d][ExtrIndex]);
-					}
-				}
-			}
-			else if (Next.Time - Curr.Time < SmoothenAccuracy && Curr.Time - Prev.Time > SmoothenAccuracy)
-			{
-				if (ExtrIndex == Extremums[Axis3d].Num() - 2)
-				{
-					IndToRemove.Add(Extremums[Axis3d][ExtrIndex]);
-				}
-				else
-				{
-					Next = RootOffset.VectorCurves[Axis3d].Keys[Extremums[Axis3d][ExtrIndex + 2]];
-					if (FMath::Sign(Prev.Value - Curr.Value) != FMath::Sign(Next.Value - Curr.Value))
-					{
-						IndToRemove.Add(Extremums[Axis3d][ExtrIndex]);
-					}
-				}
-			}
-		}
-	}
-
-	// smoothen root offsets with respect to extremums
-	int32 Iterations = 8;
-	for (int32 Iter = 0; Iter < Iterations; Iter++)
-	{
-		// smoothen
-		for (int32 i = 1; i < RootKeysNum - 1; i++)
-		{
-			FVector Value = (GetVectorCurveValue(RootOffset, i) + GetVectorCurveValue(RootOffset, i - 1) + GetVectorCurveValue(RootOffset, i + 1)) / 3.f;
-			if (!Extremums[0].Contains(i)) RootOffset.VectorCurves[0].Keys[i].Value = Value.X;
-			if (!Extremums[1].Contains(i)) RootOffset.VectorCurves[1].Keys[i].Value = Value.Y;
-			if (!Extremums[2].Contains(i)) RootOffset.VectorCurves[2].Keys[i].Value = Value.Z;
-		}
-	}
-}
-
-FVector UDistanceCurveModifierEx::FindRootMotion(float StartTime, float DeltaTime) const
-{
-	return RootOffset.GetValue(StartTime + DeltaTime) - RootOffset.GetValue(StartTime);
-}
-
-FVector UDistanceCurveModifierEx::FindRootMotionInRange(float StartTime, float EndTime) const
-{
-	return RootOffset.GetValue(EndTime) - RootOffset.GetValue(StartTime);
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "DistanceCurveModifierEx.h"
+#include "FreeAnimDiagnostics.h"
+#include "Animation/AnimData/IAnimationDataController.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include "FreeAnimHelpersLibrary.h"
+#include "TrackCommitWriter.h"
+#include "FreeAnimProfiler.h"
+#include "AnimTrackBuffer.h"
+#include "AnimPoseCache.h"
+#include "AnimationBlueprintLibrary.h"
+#include "Animation/AnimSequence.h"
+#include "Animation/AnimationPoseData.h"
+#include "Kismet/KismetMathLibrary.h"
+#include "Curves/CurveFloat.h"
+#include "Curves/CurveVector.h"
+
+/** Stop or pivot point of root motion */
+struct FDistanceCurveMarker
+{
+	int32 Frame;
+	bool bPivot;
+};
+
+// TODO: It should handle distance traveled for the ends of looping animations.
+void UDistanceCurveModifierEx::OnApply_Implementation(UAnimSequence* Animation)
+{
+	if (Animation == nullptr)
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("DistanceCurveModifierEx failed. Reason: Invalid Animation"));
+		return;
+	}
+	FFreeAnimProfiler Profiler(this, Animation);
+
+	// build faked root motion curves
+	if (!GenerateRootMotion(Animation))
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("DistanceCurveModifierEx failed. Reason: can't generate root motion for %s"), *Animation->GetName());
+		return;
+	}
+
+	const float AnimLength = Animation->GetPlayLength();
+	float SampleInterval;
+	int32 NumSteps;
+
+	// Find stop and pivot points, distance is measured from the nearest one
+	TArray<FDistanceCurveMarker> Markers;
+	if (ReferencePoint == EFAHDMotionRefPoint::StopAtEnd)
+	{
+		Markers.Add({ RootOffset.Num() - 1, false });
+	}
+	else if (ReferencePoint == EFAHDMotionRefPoint::BeginAtStart)
+	{
+		Markers.Add({ 0, false });
+	}
+	else
+	{
+		FindMotionMarkers(Markers);
+		if (bAddMarkers)
+		{
+			AddMotionMarkers(Animation, Markers);
+		}
+		if (Markers.IsEmpty())
+		{
+			// no stops, distance from start
+			Markers.Add({ 0, false });
+		}
+	}
+
+	// Signed distance to the nearest marker. Time is increasing in sampling loop, so nearest marker is only moved forward
+	int32 MarkerIndex = 0;
+	auto GetSignedDistance = [this, &Markers, &MarkerIndex](float InTime)
+	{
+		while (MarkerIndex < Markers.Num() - 1
+			&& InTime - GetRootOffsetTime(Markers[MarkerIndex].Frame) > GetRootOffsetTime(Markers[MarkerIndex + 1].Frame) - InTime)
+		{
+			MarkerIndex++;
+		}
+		const float MarkerTime = GetRootOffsetTime(Markers[MarkerIndex].Frame);
+
+		// Assume that during any time before the stop/pivot point, the animation is approaching that point.
+		const float ValueSign = (InTime < MarkerTime) ? -1.0f : 1.0f;
+		return ValueSign * CalculateMagnitude(FindRootMotionInRange(MarkerTime, InTime), Axis);
+	};
+
+	FName RootCurveX = FName(RootCurveName.ToString() + TEXT("_X"));
+	FName RootCurveY = FName(RootCurveName.ToString() + TEXT("_Y"));
+	FName RootCurveZ = FName(RootCurveName.ToString() + TEXT("_Z"));
+
+	//
+	// 1. Save raw root motion data
+	// 
+
+	if (bRootMotionToCurves)
+	{
+		FREEANIM_SCOPE("RootMotionCurves");
+		SampleInterval = 1.f / SampleRate;
+		NumSteps = FMath::CeilToInt(AnimLength / SampleInterval);
+
+		// keys are collected in order of time and replace existing keys of the curves in a single commit
+		TArray<FRichCurveKey> KeysX, KeysY, KeysZ;
+		KeysX.Reserve(NumSteps + 1);
+		KeysY.Reserve(NumSteps + 1);
+		KeysZ.Reserve(NumSteps + 1);
+
+		float Time = 0.0f;
+		for (int32 Step = 0; Step <= NumSteps && Time < AnimLength; ++Step)
+		{
+			Time = FMath::Min(Step * SampleInterval, AnimLength);
+			const FVector rm = GetRootOffset(Time);
+
+			KeysX.Emplace(Time, rm.X);
+			KeysY.Emplace(Time, rm.Y);
+			KeysZ.Emplace(Time, rm.Z);
+		}
+
+		FTrackCommitWriter Writer(Animation);
+		Writer.AddFloatCurve(RootCurveX, MoveTemp(KeysX));
+		Writer.AddFloatCurve(RootCurveY, MoveTemp(KeysY));
+		Writer.AddFloatCurve(RootCurveZ, MoveTemp(KeysZ));
+		Writer.Commit();
+
+		Animation->bEnableRootMotion = true;
+		Animation->RootMotionRootLock = ERootMotionRootLock::AnimFirstFrame;
+	}
+
+	if (bRootMotionToRootBone)
+	{
+		FREEANIM_SCOPE("RootBoneTrack");
+		const int32 KeysNum = Animation->GetDataModel()->GetNumberOfKeys();
+		const FReferenceSkeleton& RefSkeleton = Animation->GetSkeleton()->GetReferenceSkeleton();
+		FName RootBoneName = RefSkeleton.GetBoneName(0);
+		TArray<FName> AttachBoneNames;
+		TArray<FTransform> AttachBonePositions;
+
+		bool bAnimateRootBoneFromCurves = bRootMotionFromCurves && !bRootMotionToCurves;
+		UE_LOG(LogFreeAnimHelpers, Verbose, TEXT("Animation keys number = %d"), KeysNum);
+
+		if (bAnimateRootBoneFromCurves)
+		{
+			FAnimationCurveIdentifier IdCurveX, IdCurveY, IdCurveZ;
+			const FFloatCurve* CurveX = UFreeAnimHelpersLibrary::GetFloatCurve(Animation, RootCurveX, IdCurveX);
+			const FFloatCurve* CurveY = UFreeAnimHelpersLibrary::GetFloatCurve(Animation, RootCurveY, IdCurveY);
+			const FFloatCurve* CurveZ = UFreeAnimHelpersLibrary::GetFloatCurve(Animation, RootCurveZ, IdCurveZ);
+			if (!CurveX || !CurveY)
+			{
+				UE_LOG(LogFreeAnimHelpers, Warning, TEXT("Invalid root motion curves. X: %d, Y: %d, Z: %d"), CurveX ? 1 : 0, CurveY ? 1 : 0, CurveZ ? 1 : 0);
+				FFreeAnimDiagnostics::Dump(TEXT("DistanceCurveModifierEx failed"));
+				return;
+			}
+
+			RootOffset.SetNumUninitialized(KeysNum);
+			RootOffsetFrameRate = Animation->GetSamplingFrameRate().AsDecimal();
+			for (int32 FrameIndex = 0; FrameIndex < KeysNum; FrameIndex++)
+			{
+				const float Time = Animation->GetTimeAtFrame(FrameIndex);
+				RootOffset[FrameIndex] = FVector3f(
+					CurveX->Evaluate(Time),
+					CurveY->Evaluate(Time),
+					CurveZ ? CurveZ->Evaluate(Time) : 0.f
+				);
+			}
+
+			const int32 NumBones = RefSkeleton.GetNum();
+			for (int32 ChildIndex = 1; ChildIndex < NumBones; ChildIndex++)
+			{
+				if (RefSkeleton.GetParentIndex(ChildIndex) == 0)
+				{
+					AttachBoneNames.Add(RefSkeleton.GetBoneName(ChildIndex));
+				}
+			}
+			AttachBonePositions.SetNum(AttachBoneNames.Num());
+		}
+
+		// root bone has slot 0, attached bones follow it
+		FAnimTrackBuffer OutTracks;
+		const int32 RootSlot = OutTracks.AddBone(RootBoneName);
+		OutTracks.Init(AttachBoneNames, KeysNum);
+
+		// Update animation
+		for (int32 FrameIndex = 0; FrameIndex < KeysNum; FrameIndex++)
+		{
+			FTransform RootFramePose;
+			UFreeAnimHelpersLibrary::GetBonePoseForFrame(Animation, RootBoneName, FFrameTime(FrameIndex), RootFramePose);
+
+			const FVector NewRootLocation = GetRootOffsetAtFrame(FrameIndex);
+
+			if (bAnimateRootBoneFromCurves)
+			{
+				UFreeAnimHelpersLibrary::GetBonePosesForFrame(Animation, AttachBoneNames, FFrameTime(FrameIndex), AttachBonePositions, Animation->GetPreviewMesh());
+
+				FTransform NewRootFramePose = RootFramePose;
+				NewRootFramePose.SetTranslation(NewRootLocation);
+
+				for (int32 i = 0; i < AttachBoneNames.Num(); i++)
+				{
+					FTransform BoneNewTr = (AttachBonePositions[i] * RootFramePose).GetRelativeTransform(NewRootFramePose);
+					OutTracks.SetKey(RootSlot + 1 + i, FrameIndex, BoneNewTr);
+				}
+			}
+
+			OutTracks.SetKey(RootSlot, FrameIndex, FTransform(RootFramePose.GetRotation(), NewRootLocation, RootFramePose.GetScale3D()));
+		}
+
+		FTrackCommitWriter Writer(Animation);
+		Writer.AddBoneTracks(OutTracks);
+		Writer.Commit();
+
+		Animation->RefreshCacheData();
+	}
+
+	//
+	// 2. Save distance data
+	//
+
+	// distance curves are committed together
+	FTrackCommitWriter CurvesWriter(Animation);
+
+	float Time = 0.0f;
+	float DistanceRangeA = 999999.f, DistanceRangeB = -999999.f;
+	{
+		FREEANIM_SCOPE("DistanceCurve");
+		SampleInterval = 1.f / SampleRate;
+		NumSteps = FMath::CeilToInt(AnimLength / SampleInterval);
+
+		TArray<FRichCurveKey> Keys;
+		Keys.Reserve(NumSteps + 1);
+		for (int32 Step = 0; Step <= NumSteps && Time < AnimLength; ++Step)
+		{
+			Time = FMath::Min(Step * SampleInterval, AnimLength);
+
+			const float Magnitude = GetSignedDistance(Time);
+			Keys.Emplace(Time, Magnitude);
+
+			DistanceRangeA = FMath::Min(DistanceRangeA, Magnitude);
+			DistanceRangeB = FMath::Max(DistanceRangeB, Magnitude);
+		}
+		CurvesWriter.AddFloatCurve(CurveName, MoveTemp(Keys));
+	}
+
+	if (bOptimizedDistanceCurveFormat)
+	{
+		FREEANIM_SCOPE("OptimizedCurve");
+		FName OptimizedCurveName = FName(CurveName.ToString() + TEXT("_Optimized"));
+		TArray<FRichCurveKey> Keys;
+		Keys.Reserve(RootOffset.Num() + 2);
+
+		// Save magnitude
+		Keys.Emplace(-1.f, DistanceRangeA);
+		Keys.Emplace(-0.5f, DistanceRangeB);
+
+		MarkerIndex = 0;
+		for (int32 FrameIndex = 0; FrameIndex < RootOffset.Num(); FrameIndex++)
+		{
+			Time = GetRootOffsetTime(FrameIndex);
+			const float Magnitude = GetSignedDistance(Time);
+
+			float MappedMagnitude = FMath::GetMappedRangeValueClamped(FVector2D(DistanceRangeA, DistanceRangeB), FVector2D(0.f, AnimLength), Magnitude);
+
+			Keys.Emplace(MappedMagnitude, Time);
+		}
+
+		// distance is the key time here, so keys aren't ordered if character moves back
+		UFreeAnimHelpersLibrary::SortCurveKeys(Keys);
+		// the first two keys store distance range and must be kept
+		CurvesWriter.AddFloatCurve(OptimizedCurveName, MoveTemp(Keys), false);
+	}
+
+	CurvesWriter.Commit();
+}
+
+void UDistanceCurveModifierEx::OnRevert_Implementation(UAnimSequence* Animation)
+{
+	const bool bRemoveNameFromSkeleton = false;
+	if (UAnimationBlueprintLibrary::DoesCurveExist(Animation, CurveName, ERawCurveTrackTypes::RCT_Float))
+	{
+		UAnimationBlueprintLibrary::RemoveCurve(Animation, CurveName, bRemoveNameFromSkeleton);
+	}
+
+	if (bAddMarkers && ReferencePoint == EFAHDMotionRefPoint::FindFromMotion
+		&& UAnimationBlueprintLibrary::IsValidAnimNotifyTrackName(Animation, MarkersTrackName))
+	{
+		UAnimationBlueprintLibrary::RemoveAnimationSyncMarkersByTrack(Animation, MarkersTrackName);
+		UAnimationBlueprintLibrary::RemoveAnimationNotifyTrack(Animation, MarkersTrackName);
+	}
+
+	if (bRootMotionToCurves)
+	{	
+		/*
+		UE_LOG(LogFreeAnimHelpers, Log, TEXT("Delete root motion curves :("));
+		UAnimationBlueprintLibrary::RemoveCurve(Animation, FName(RootCurveName.ToString() + TEXT("_X")), bRemoveNameFromSkeleton);
+		UAnimationBlueprintLibrary::RemoveCurve(Animation, FName(RootCurveName.ToString() + TEXT("_Y")), bRemoveNameFromSkeleton);
+		UAnimationBlueprintLibrary::RemoveCurve(Animation, FName(RootCurveName.ToString() + TEXT("_Z")), bRemoveNameFromSkeleton);
+		*/
+	}
+}
+
+float UDistanceCurveModifierEx::CalculateMagnitude(const FVector& Vector, EFAHDistanceCurve_Axis Axis)
+{
+	switch (Axis)
+	{
+		case EFAHDistanceCurve_Axis::X:		return FMath::Abs(Vector.X); break;
+		case EFAHDistanceCurve_Axis::Y:		return FMath::Abs(Vector.Y); break;
+		case EFAHDistanceCurve_Axis::Z:		return FMath::Abs(Vector.Z); break;
+		default: return FMath::Sqrt(CalculateMagnitudeSq(Vector, Axis)); break;
+	}
+}
+
+float UDistanceCurveModifierEx::CalculateMagnitudeSq(const FVector& Vector, EFAHDistanceCurve_Axis Axis)
+{
+	switch (Axis)
+	{
+		case EFAHDistanceCurve_Axis::X:		return FMath::Square(FMath::Abs(Vector.X)); break;
+		case EFAHDistanceCurve_Axis::Y:		return FMath::Square(FMath::Abs(Vector.Y)); break;
+		case EFAHDistanceCurve_Axis::Z:		return FMath::Square(FMath::Abs(Vector.Z)); break;
+		case EFAHDistanceCurve_Axis::XY:	return Vector.X * Vector.X + Vector.Y * Vector.Y; break;
+		case EFAHDistanceCurve_Axis::XZ:	return Vector.X * Vector.X + Vector.Z * Vector.Z; break;
+		case EFAHDistanceCurve_Axis::YZ:	return Vector.Y * Vector.Y + Vector.Z * Vector.Z; break;
+		case EFAHDistanceCurve_Axis::XYZ:	return Vector.X * Vector.X + Vector.Y * Vector.Y + Vector.Z * Vector.Z; break;
+		default: check(false); break;
+	}
+
+	return 0.f;
+}
+
+FVector UDistanceCurveModifierEx::DirectionAsVector(EMATMovementDirection Direction)
+{
+	switch (Direction)
+	{
+		case EMATMovementDirection::MD_X:		return FVector(1.f, 0.f, 0.f); break;
+		case EMATMovementDirection::MD_XY:		return FVector(1.f, 1.f, 0.f); break;
+		case EMATMovementDirection::MD_Y:		return FVector(0.f, 1.f, 0.f); break;
+		case EMATMovementDirection::MD_XnY:		return FVector(-1.f, 1.f, 0.f); break;
+		case EMATMovementDirection::MD_Xn:		return FVector(-1.f, 0.f, 0.f); break;
+		case EMATMovementDirection::MD_XnYn:	return FVector(-1.f, -1.f, 0.f); break;
+		case EMATMovementDirection::MD_Yn:		return FVector(0.f, -1.f, 0.f); break;
+		case EMATMovementDirection::MD_XYn:		return FVector(1.f, -1.f, 0.f); break;
+		case EMATMovementDirection::MD_Z:		return FVector(0.f, 0.f, 1.f); break;
+	}
+
+	return FVector::RightVector;
+}
+
+FVector UDistanceCurveModifierEx::GetRootOffsetAtFrame(int32 FrameIndex) const
+{
+	return RootOffset.IsEmpty()
+		? FVector::ZeroVector
+		: FVector(RootOffset[FMath::Clamp(FrameIndex, 0, RootOffset.Num() - 1)]);
+}
+
+FVector UDistanceCurveModifierEx::GetRootOffset(float Time) const
+{
+	if (RootOffset.IsEmpty())
+	{
+		return FVector::ZeroVector;
+	}
+
+	// linear interpolation between neighbour frames, clamped to animation range
+	const double Frame = FMath::Clamp(Time * RootOffsetFrameRate, 0.0, (double)(RootOffset.Num() - 1));
+	const int32 Frame0 = FMath::FloorToInt32(Frame);
+	const int32 Frame1 = FMath::Min(Frame0 + 1, RootOffset.Num() - 1);
+	return FVector(FMath::Lerp(RootOffset[Frame0], RootOffset[Frame1], (float)(Frame - Frame0)));
+}
+
+float UDistanceCurveModifierEx::GetRootOffsetTime(int32 FrameIndex) const
+{
+	return (float)(FrameIndex / RootOffsetFrameRate);
+}
+
+bool UDistanceCurveModifierEx::GenerateRootMotion(UAnimSequence* AnimationSequence)
+{
+	FREEANIM_SCOPE("GenerateRootMotion");
+	int32 KeysNum = AnimationSequence->GetDataModel()->GetNumberOfKeys();
+	UE_LOG(LogFreeAnimHelpers, Verbose, TEXT("GenerateRootMotion for %d animation keys"), KeysNum);
+
+	FVector LastPelvis, LastFootRight, LastFootLeft;
+	float LastDistanceR = 0.f, LastDistanceL = 0.f;
+	bool bUseRightFoot = true;
+
+	// first frame is the starting point, frames without poses stay there
+	RootOffset.Init(FVector3f::ZeroVector, FMath::Max(KeysNum, 1));
+	RootOffsetFrameRate = AnimationSequence->GetSamplingFrameRate().AsDecimal();
+
+	FAnimPoseCache PoseCache;
+	if (!PoseCache.Init(AnimationSequence, { PelvisBone, FootRightBone, FootLeftBone }))
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("GenerateRootMotion: can't read poses of %s"), *AnimationSequence->GetName());
+		FFreeAnimDiagnostics::Dump(TEXT("GenerateRootMotion failed"));
+		return false;
+	}
+	const int32 PelvisIndex = PoseCache.FindBone(PelvisBone);
+	const int32 FootRightIndex = PoseCache.FindBone(FootRightBone);
+	const int32 FootLeftIndex = PoseCache.FindBone(FootLeftBone);
+	if (PelvisIndex == INDEX_NONE || FootRightIndex == INDEX_NONE || FootLeftIndex == INDEX_NONE)
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("GenerateRootMotion: can't find pelvis or feet bones"));
+		FFreeAnimDiagnostics::Dump(TEXT("GenerateRootMotion failed"));
+		return false;
+	}
+
+	// find initial base foot
+	FVector MovementDirection = DirectionAsVector(InitialDirection);
+	if (InitialDirection != EMATMovementDirection::MD_Z)
+	{
+		for (int32 KeyIndex = 0; KeyIndex < KeysNum; KeyIndex++)
+		{
+			const FVector FootRight = PoseCache.GetComponentTransform(KeyIndex, FootRightIndex).GetTranslation();
+			const FVector FootLeft = PoseCache.GetComponentTransform(KeyIndex, FootLeftIndex).GetTranslation();
+
+			if (KeyIndex > 0)
+			{
+				bool bRightDP = FVector::DotProduct((FootRight - LastFootRight).GetSafeNormal2D(), MovementDirection) < 0.f;
+				bool bLeftDP = FVector::DotProduct((FootLeft - LastFootLeft).GetSafeNormal2D(), MovementDirection) < 0.f;
+
+				if (bRightDP && !bLeftDP)
+				{
+					bUseRightFoot = true; break;
+				}
+				else if (!bRightDP && bLeftDP)
+				{
+					bUseRightFoot = false; break;
+				}
+			}
+			LastFootRight = FootRight; LastFootLeft = FootLeft;
+		}
+	}
+
+	UE_LOG(LogFreeAnimHelpers, Verbose, TEXT("GenerateRootMotion starts with leg (1 = right, 0 = left): %d"), (int)bUseRightFoot);
+
+	FVector LastFrameRoot = FVector::ZeroVector;
+	for (int32 KeyIndex = 0; KeyIndex < KeysNum; KeyIndex++)
+	{
+		const FVector Pelvis = PoseCache.GetComponentTransform(KeyIndex, PelvisIndex).GetTranslation();
+		const FVector FootRight = PoseCache.GetComponentTransform(KeyIndex, FootRightIndex).GetTranslation();
+		const FVector FootLeft = PoseCache.GetComponentTransform(KeyIndex, FootLeftIndex).GetTranslation();
+
+		float DistanceR = FVector::Dist2D(Pelvis, FootRight),
+			DistanceL = FVector::Dist2D(Pelvis, FootLeft);
+
+		if (KeyIndex > 0)
+		{
+			if (InitialDirection == EMATMovementDirection::MD_Z)
+			{
+				LastFrameRoot = FVector(0.f, 0.f, FMath::Max(0.f, FMath::Min(FootRight.Z, FootLeft.Z)));
+			}
+			else
+			{
+				// update bearing foot
+				if (bUseRightFoot)
+				{
+					if (DistanceR < LastDistanceR && FVector::DotProduct(MovementDirection.GetSafeNormal2D(), Pelvis - FootRight) > 0.f)
+					{
+						bUseRightFoot = false;
+					}
+				}
+				else
+				{
+					if (DistanceL < LastDistanceL && FVector::DotProduct(MovementDirection.GetSafeNormal2D(), Pelvis - FootLeft) > 0.f)
+					{
+						bUseRightFoot = true;
+					}
+				}
+
+				FVector MovementDirectionR = (Pelvis - FootRight) - (LastPelvis - LastFootRight);
+				MovementDirectionR.Z = 0.f;
+				FVector MovementDirectionL = (Pelvis - FootLeft) - (LastPelvis - LastFootLeft);
+				MovementDirectionL.Z = 0.f;
+
+				if (FVector::DotProduct(MovementDirection, MovementDirectionR) > FVector::DotProduct(MovementDirection, MovementDirectionL))
+					MovementDirection = MovementDirectionR;
+				else
+					MovementDirection = MovementDirectionL;
+
+				LastFrameRoot += MovementDirection;
+			}
+
+			// save key
+			FREEANIM_DIAG(TEXT("[%d] Root location at frame %d = %s"), (int)bUseRightFoot, KeyIndex, *LastFrameRoot.ToString());
+
+			RootOffset[KeyIndex] = FVector3f(LastFrameRoot);
+		}
+
+		LastPelvis = Pelvis; LastFootRight = FootRight; LastFootLeft = FootLeft;
+		LastDistanceR = DistanceR; LastDistanceL = DistanceL;
+	}
+
+	// update extremums: frames where all non-zero differences with neighbours have the same sign. Extremums are pinned during smoothing
+	const int32 RootKeysNum = RootOffset.Num();
+	if (RootKeysNum < 3)
+	{
+		return true;
+	}
+	const bool bGaussian = RootSmoothing == EFAHRootSmoothing::Gaussian;
+
+	TBitArray<> Extremums[3];
+	for (TBitArray<>& AxisExtremums : Extremums)
+	{
+		AxisExtremums.Init(false, RootKeysNum);
+	}
+	if (bGaussian)
+	{
+		for (TBitArray<>& AxisExtremums : Extremums)
+		{
+			AxisExtremums[0] = true;
+			AxisExtremums[RootKeysNum - 1] = true;
+		}
+	}
+	else
+	{
+		// legacy smoothing pins the second frame of X axis (first and last frames aren't changed by smoothing anyway)
+		Extremums[0][1] = true;
+	}
+
+	const int32 CheckArea = 2;
+	for (int32 i = CheckArea; i < RootKeysNum - CheckArea; i++)
+	{
+		for (int32 Axis3d = 0; Axis3d < 3; Axis3d++)
+		{
+			const float CurrentValue = RootOffset[i][Axis3d];
+			int32 DeltaSign = 0;
+			bool bExtremum = true;
+			for (int32 AreaIndex = i - CheckArea; AreaIndex <= i + CheckArea && bExtremum; AreaIndex++)
+			{
+				const float Delta = CurrentValue - RootOffset[AreaIndex][Axis3d];
+				if (Delta == 0.f)
+				{
+					continue;
+				}
+				const int32 Sign = Delta > 0.f ? 1 : -1;
+				bExtremum = DeltaSign == 0 || DeltaSign == Sign;
+				DeltaSign = Sign;
+			}
+			Extremums[Axis3d][i] = bExtremum;
+		}
+		FREEANIM_DIAG(TEXT("[%f] Extremums %d %d %d"), GetRootOffsetTime(i), (int)Extremums[0][i], (int)Extremums[1][i], (int)Extremums[2][i]);
+	}
+
+	if (!bGaussian)
+	{
+		// smoothen root offsets with respect to extremums: every pass updates frames in place, so each frame sees already updated previous one
+		const float RScale = 1.f / 3.f;
+		for (int32 Axis3d = 0; Axis3d < 3; Axis3d++)
+		{
+			for (int32 Pass = 0; Pass < RootSmoothingPasses; Pass++)
+			{
+				for (int32 i = 1; i < RootKeysNum - 1; i++)
+				{
+					if (!Extremums[Axis3d][i])
+					{
+						RootOffset[i][Axis3d] = (RootOffset[i][Axis3d] + RootOffset[i - 1][Axis3d] + RootOffset[i + 1][Axis3d]) * RScale;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	// cleanup intermediate extremums: an extremum too close to the previous or the next one is unpinned,
+	// if motion keeps direction around it
+	TArray<int32> ExtremumFrames;
+	for (int32 Axis3d = 0; Axis3d < 3; Axis3d++)
+	{
+		ExtremumFrames.Reset();
+		for (TConstSetBitIterator<> It(Extremums[Axis3d]); It; ++It)
+		{
+			ExtremumFrames.Add(It.GetIndex());
+		}
+
+		auto GetValue = [this, &ExtremumFrames, Axis3d](int32 ExtrIndex) { return RootOffset[ExtremumFrames[ExtrIndex]][Axis3d]; };
+		auto GetTime = [this, &ExtremumFrames](int32 ExtrIndex) { return GetRootOffsetTime(ExtremumFrames[ExtrIndex]); };
+
+		for (int32 ExtrIndex = 1; ExtrIndex < ExtremumFrames.Num() - 1; ExtrIndex++)
+		{
+			const float PrevInterval = GetTime(ExtrIndex) - GetTime(ExtrIndex - 1);
+			const float NextInterval = GetTime(ExtrIndex + 1) - GetTime(ExtrIndex);
+			const float CurrValue = GetValue(ExtrIndex);
+
+			bool bRemove = false;
+			if (PrevInterval < SmoothenAccuracy && NextInterval > SmoothenAccuracy)
+			{
+				bRemove = ExtrIndex == 1
+					|| FMath::Sign(GetValue(ExtrIndex - 2) - CurrValue) != FMath::Sign(GetValue(ExtrIndex + 1) - CurrValue);
+			}
+			else if (NextInterval < SmoothenAccuracy && PrevInterval > SmoothenAccuracy)
+			{
+				bRemove = ExtrIndex == ExtremumFrames.Num() - 2
+					|| FMath::Sign(GetValue(ExtrIndex - 1) - CurrValue) != FMath::Sign(GetValue(ExtrIndex + 2) - CurrValue);
+			}
+
+			if (bRemove)
+			{
+				Extremums[Axis3d][ExtremumFrames[ExtrIndex]] = false;
+			}
+		}
+	}
+
+	// smoothen root offsets with respect to extremums: one gaussian filter instead of repeated passes.
+	// Three-frame average has variance of 2/3 frame, so N passes are approximated by sigma = sqrt(2N/3)
+	const float Sigma = FMath::Sqrt(2.f * FMath::Max(RootSmoothingPasses, 0) / 3.f);
+	if (Sigma <= 0.f)
+	{
+		return true;
+	}
+	const int32 Radius = FMath::CeilToInt(3.f * Sigma);
+	TArray<float> Kernel;
+	Kernel.SetNumUninitialized(Radius * 2 + 1);
+	for (int32 Offset = -Radius; Offset <= Radius; Offset++)
+	{
+		Kernel[Offset + Radius] = FMath::Exp(-0.5f * FMath::Square(Offset / Sigma));
+	}
+
+	TArray<float> Values;
+	Values.SetNumUninitialized(RootKeysNum);
+	for (int32 Axis3d = 0; Axis3d < 3; Axis3d++)
+	{
+		for (int32 i = 0; i < RootKeysNum; i++)
+		{
+			Values[i] = RootOffset[i][Axis3d];
+		}
+
+		for (int32 i = 1; i < RootKeysNum - 1; i++)
+		{
+			if (Extremums[Axis3d][i])
+			{
+				continue;
+			}
+
+			// kernel is cut at the ends of animation and normalized
+			const int32 First = FMath::Max(i - Radius, 0);
+			const int32 Last = FMath::Min(i + Radius, RootKeysNum - 1);
+			float Sum = 0.f, WeightSum = 0.f;
+			for (int32 Frame = First; Frame <= Last; Frame++)
+			{
+				const float Weight = Kernel[Frame - i + Radius];
+				Sum += Weight * Values[Frame];
+				WeightSum += Weight;
+			}
+			RootOffset[i][Axis3d] = Sum / WeightSum;
+		}
+	}
+	return true;
+}
+
+void UDistanceCurveModifierEx::FindMotionMarkers(TArray<FDistanceCurveMarker>& OutMarkers) const
+{
+	FREEANIM_SCOPE("FindMotionMarkers");
+	OutMarkers.Reset();
+
+	const float StopSpeedSq = FMath::Square(StopSpeedThreshold);
+	const float PivotCos = FMath::Cos(FMath::DegreesToRadians(PivotAngleThreshold));
+
+	// stop is the slowest frame of a range of frames slower than threshold
+	bool bInStop = false;
+	int32 StopFrame = INDEX_NONE;
+	float StopSpeed = 0.f;
+	// direction of the last moving frame, zero after stop
+	FVector2f LastHeading = FVector2f::ZeroVector;
+
+	for (int32 FrameIndex = 0; FrameIndex < RootOffset.Num() - 1; FrameIndex++)
+	{
+		// squared offset divided by frame interval, as in the original distance curve modifier
+		const FVector Delta = FVector(RootOffset[FrameIndex + 1] - RootOffset[FrameIndex]);
+		const float SpeedSq = CalculateMagnitudeSq(Delta, Axis) * RootOffsetFrameRate;
+
+		if (SpeedSq < StopSpeedSq)
+		{
+			if (!bInStop || SpeedSq < StopSpeed)
+			{
+				StopFrame = FrameIndex;
+				StopSpeed = SpeedSq;
+			}
+			bInStop = true;
+			continue;
+		}
+
+		if (bInStop)
+		{
+			OutMarkers.Add({ StopFrame, false });
+			bInStop = false;
+			LastHeading = FVector2f::ZeroVector;
+		}
+
+		// pivot: direction of movement turns without stop
+		const FVector2f Heading = FVector2f(Delta.X, Delta.Y).GetSafeNormal();
+		if (!LastHeading.IsZero() && !Heading.IsZero() && FVector2f::DotProduct(LastHeading, Heading) < PivotCos)
+		{
+			OutMarkers.Add({ FrameIndex, true });
+		}
+		if (!Heading.IsZero())
+		{
+			LastHeading = Heading;
+		}
+	}
+
+	if (bInStop)
+	{
+		OutMarkers.Add({ StopFrame, false });
+	}
+
+	for (const FDistanceCurveMarker& Marker : OutMarkers)
+	{
+		FREEANIM_DIAG(TEXT("%s at frame %d"), Marker.bPivot ? TEXT("Pivot") : TEXT("Stop"), Marker.Frame);
+	}
+}
+
+void UDistanceCurveModifierEx::AddMotionMarkers(UAnimSequence* AnimationSequence, const TArray<FDistanceCurveMarker>& Markers) const
+{
+	if (UAnimationBlueprintLibrary::IsValidAnimNotifyTrackName(AnimationSequence, MarkersTrackName))
+	{
+		UAnimationBlueprintLibrary::RemoveAnimationSyncMarkersByTrack(AnimationSequence, MarkersTrackName);
+	}
+	else
+	{
+		UAnimationBlueprintLibrary::AddAnimationNotifyTrack(AnimationSequence, MarkersTrackName);
+	}
+
+	for (const FDistanceCurveMarker& Marker : Markers)
+	{
+		UAnimationBlueprintLibrary::AddAnimationSyncMarker(AnimationSequence, Marker.bPivot ? TEXT("Pivot") : TEXT("Stop"), GetRootOffsetTime(Marker.Frame), MarkersTrackName);
+	}
+}
+
+FVector UDistanceCurveModifierEx::FindRootMotionInRange(float StartTime, float EndTime) const
+{
+	// offsets are accumulated from the first frame, so motion in range is difference of two values
+	return GetRootOffset(EndTime) - GetRootOffset(StartTime);
 }
\ No newline at end of file
@@ -1,131 +1,139 @@
-// (c) Yuri N. K. 2022. All rights reserved.
-// ykasczc@gmail.com
-
-#include "FingersCurl.h"
-#include "Animation/AnimData/AnimDataModel.h"
-#include "Runtime/Launch/Resources/Version.h"
-#include "Animation/AnimData/IAnimationDataController.h"
-#include "FreeAnimHelpersLibrary.h"
-#include "Animation/AnimSequence.h"
-#include "Animation/AnimTypes.h"
-#include "ReferenceSkeleton.h"
-#include "Engine/SkeletalMesh.h"
-#include "Kismet/KismetMathLibrary.h"
-
-UFingersCurl::UFingersCurl()
-{
-	const FRotator DefValue = FRotator(0.f, -15.f, 0.f);
-	if (HandRight.Num() == 0)
-	{
-		HandRight.Add(TEXT("thumb_03_r"), DefValue);
-		HandRight.Add(TEXT("index_03_r"), DefValue);
-		HandRight.Add(TEXT("middle_03_r"), DefValue);
-		HandRight.Add(TEXT("ring_03_r"), DefValue);
-		HandRight.Add(TEXT("pinky_03_r"), DefValue);
-	}
-	if (HandLeft.Num() == 0)
-	{
-		HandLeft.Add(TEXT("thumb_03_l"), DefValue);
-		HandLeft.Add(TEXT("index_03_l"), DefValue);
-		HandLeft.Add(TEXT("middle_03_l"), DefValue);
-		HandLeft.Add(TEXT("ring_03_l"), DefValue);
-		HandLeft.Add(TEXT("pinky_03_l"), DefValue);
-	}
-}
-
-void UFingersCurl::OnApply_Implementation(UAnimSequence* AnimationSequence)
-{
-	USkeleton* Skeleton = AnimationSequence->GetSkeleton();
-	const FReferenceSkeleton& RefSkeleton = Skeleton->GetReferenceSkeleton();
-	const int32 KeysNum = AnimationSequence->GetDataModel()->GetNumberOfKeys();
-
-	TArray<FName> BoneNames;
-	TMap<FName, FRotator> FingersAddend;
-
-	if (bApplyRightHand)
-	{
-		FingersAddend = HandRight;
-	}
-	if (bApplyLeftHand)
-	{
-		FingersAddend.Append(HandLeft);
-	}
-	if (FingersAddend.Num() == 0)
-	{
-		return;
-	}
-
-	TMap<FName, FRotator> SecondaryFingerBones;
-	for (const auto& LastBone : FingersAddend)
-	{
-		int32 Bone3Index = RefSkeleton.FindBoneIndex(LastBone.Key);
-		if (Bone3Index == INDEX_NONE) return;
-		int32 Bone2Index = RefSkeleton.GetParentIndex(Bone3Index);
-		if (Bone2Index == INDEX_NONE) return;
-		int32 Bone1Index = RefSkeleton.GetParentIndex(Bone2Index);
-		if (Bone1Index == INDEX_NONE) return;
-
-		SecondaryFingerBones.Add(RefSkeleton.GetBoneName(Bone2Index), LastBone.Value);
-		SecondaryFingerBones.Add(RefSkeleton.GetBoneName(Bone1Index), LastBone.Value);
-	}
-
-	FingersAddend.Append(SecondaryFingerBones);
-	FingersAddend.GetKeys(BoneNames);
-	TArray<FTransform> BoneTransforms;
-	BoneTransforms.SetNum(BoneNames.Num());
-
-	// Tracks to save data
-	TMap<FName, FRawAnimSequenceTrack> OutTracks;
-
-	// Initialize containers
-	for (const auto& BoneName : BoneNames)
-	{
-		FRawAnimSequenceTrack& Track = OutTracks.Add(BoneName);
-		Track.PosKeys.SetNumUninitialized(KeysNum);
-		Track.RotKeys.SetNumUninitialized(KeysNum);
-		Track.ScaleKeys.SetNumUninitialized(KeysNum);
-	}
-
-	for (int32 FrameIndex = 0; FrameIndex < KeysNum; FrameIndex++)
-	{
-		float Time;
-		UAnimationBlueprintLibrary::GetTimeAtFrame(AnimationSequence, FrameIndex, Time);
-
-		// get current transforms
-		UFreeAnimHelpersLibrary::GetBonePosesForTime(AnimationSequence, BoneNames, Time, false, BoneTransforms, AnimationSequence->GetPreviewMesh());
-
-		for (int32 i = 0; i < BoneNames.Num(); i++)
-		{
-			const FName& BoneName = BoneNames[i];
-			const FTransform& LocalTransform = BoneTransforms[i];
-
-			//FRotator LocalRotation = LocalTransform.Rotator();
-			//UKismetMathLibrary::ComposeRotators(LocalRotation, FingersAddend[BoneName]);
-
-			FRotator LocalRotation = AddLocalRotation(FingersAddend[BoneName], LocalTransform.Rotator());
-
-			OutTracks[BoneName].PosKeys[FrameIndex] = (FVector3f)LocalTransform.GetTranslation();
-			OutTracks[BoneName].RotKeys[FrameIndex] = (FQuat4f)LocalRotation.Quaternion();
-			OutTracks[BoneName].ScaleKeys[FrameIndex] = (FVector3f)LocalTransform.GetScale3D();
-		}
-	}
-
-	// Save new keys in DataModel
-	IAnimationDataController& Controller = AnimationSequence->GetController();
-	for (const auto& Track : OutTracks)
-	{
-		const FName& BoneName = Track.Key;
-		Controller.RemoveBoneTrack(BoneName);
-#if ENGINE_MINOR_VERSION < 2
-		Controller.AddBoneTrack(BoneName);
-#else
-		Controller.AddBoneCurve(BoneName);
-#endif
-		Controller.SetBoneTrackKeys(BoneName, Track.Value.PosKeys, Track.Value.RotKeys, Track.Value.ScaleKeys);
-	}
-}
-
-FRotator UFingersCurl::AddLocalRotation(const FRotator& AdditionRot, const FRotator& BaseRot)
-{
-	return UKismetMathLibrary::ComposeRotators(BaseRot.GetInverse(), AdditionRot.GetInverse()).GetInverse();
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "FingersCurl.h"
+#include "FreeAnimDiagnostics.h"
+#include "Animation/AnimData/AnimDataModel.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include "Animation/AnimData/IAnimationDataController.h"
+#include "FreeAnimHelpersLibrary.h"
+#include "Misc/MemStack.h"
+#include "AnimTrackBuffer.h"
+#include "AnimSkeletonBinding.h"
+#include "Animation/AnimSequence.h"
+#include "Animation/AnimTypes.h"
+#include "ReferenceSkeleton.h"
+#include "Engine/SkeletalMesh.h"
+#include "Kismet/KismetMathLibrary.h"
+
+UFingersCurl::UFingersCurl()
+{
+	const FRotator DefValue = FRotator(0.f, -15.f, 0.f);
+	if (HandRight.Num() == 0)
+	{
+		HandRight.Add(TEXT("thumb_03_r"), DefValue);
+		HandRight.Add(TEXT("index_03_r"), DefValue);
+		HandRight.Add(TEXT("middle_03_r"), DefValue);
+		HandRight.Add(TEXT("ring_03_r"), DefValue);
+		HandRight.Add(TEXT("pinky_03_r"), DefValue);
+	}
+	if (HandLeft.Num() == 0)
+	{
+		HandLeft.Add(TEXT("thumb_03_l"), DefValue);
+		HandLeft.Add(TEXT("index_03_l"), DefValue);
+		HandLeft.Add(TEXT("middle_03_l"), DefValue);
+		HandLeft.Add(TEXT("ring_03_l"), DefValue);
+		HandLeft.Add(TEXT("pinky_03_l"), DefValue);
+	}
+}
+
+FFreeAnimModifierEvaluation UFingersCurl::PrepareEvaluation(UAnimSequence* AnimationSequence) const
+{
+	USkeleton* Skeleton = AnimationSequence->GetSkeleton();
+	const FReferenceSkeleton& RefSkeleton = Skeleton->GetReferenceSkeleton();
+	const int32 KeysNum = AnimationSequence->GetDataModel()->GetNumberOfKeys();
+
+	TArray<FName> BoneNames;
+	TMap<FName, FRotator> FingersAddend;
+
+	if (bApplyRightHand)
+	{
+		FingersAddend = HandRight;
+	}
+	if (bApplyLeftHand)
+	{
+		FingersAddend.Append(HandLeft);
+	}
+	if (FingersAddend.Num() == 0)
+	{
+		return FFreeAnimModifierEvaluation();
+	}
+
+	TMap<FName, FRotator> SecondaryFingerBones;
+	for (const auto& LastBone : FingersAddend)
+	{
+		int32 Bone3Index = RefSkeleton.FindBoneIndex(LastBone.Key);
+		if (Bone3Index == INDEX_NONE) return FFreeAnimModifierEvaluation();
+		int32 Bone2Index = RefSkeleton.GetParentIndex(Bone3Index);
+		if (Bone2Index == INDEX_NONE) return FFreeAnimModifierEvaluation();
+		int32 Bone1Index = RefSkeleton.GetParentIndex(Bone2Index);
+		if (Bone1Index == INDEX_NONE) return FFreeAnimModifierEvaluation();
+
+		SecondaryFingerBones.Add(RefSkeleton.GetBoneName(Bone2Index), LastBone.Value);
+		SecondaryFingerBones.Add(RefSkeleton.GetBoneName(Bone1Index), LastBone.Value);
+	}
+
+	FingersAddend.Append(SecondaryFingerBones);
+	FingersAddend.GetKeys(BoneNames);
+
+	// resolve bones once, frames are evaluated in parallel
+	TArray<int32> BoneIndices;
+	const TSharedRef<const FAnimSkeletonBinding> Binding = FAnimSkeletonBinding::GetForBones(AnimationSequence, AnimationSequence->GetPreviewMesh(), BoneNames, BoneIndices);
+
+	// bones missing in binding are skipped
+	TArray<FRotator> BoneAddends;
+	for (int32 i = BoneNames.Num() - 1; i >= 0; i--)
+	{
+		if (BoneIndices[i] == INDEX_NONE)
+		{
+			UE_LOG(LogFreeAnimHelpers, Warning, TEXT("FingersCurl: bone %s is missing in %s"), *BoneNames[i].ToString(), *AnimationSequence->GetName());
+			BoneNames.RemoveAt(i);
+			BoneIndices.RemoveAt(i);
+		}
+	}
+	if (BoneNames.IsEmpty())
+	{
+		return FFreeAnimModifierEvaluation();
+	}
+	for (const auto& BoneName : BoneNames)
+	{
+		BoneAddends.Add(FingersAddend[BoneName]);
+	}
+
+	return [AnimationSequence, Binding, KeysNum, BoneNames = MoveTemp(BoneNames), BoneIndices = MoveTemp(BoneIndices), BoneAddends = MoveTemp(BoneAddends)](const FFreeAnimModifierInput& Input, FFreeAnimModifierOutput& Output)
+	{
+		// Tracks to save data, slot of bone is its index in BoneNames
+		FAnimTrackBuffer& OutTracks = Output.Tracks;
+		OutTracks.Init(BoneNames, KeysNum);
+		// bones written by previous stages of modifier stack
+		const TArray<int32> SlotMap = Input.MakeSlotMap(*Binding);
+
+		UFreeAnimHelpersLibrary::ParallelForFrames(KeysNum, [&](int32 FrameIndex)
+		{
+			// get current transforms, per-frame scratch is released with the mem stack mark
+			FMemMark Mark(FMemStack::Get());
+			TArray<FTransform, TMemStackAllocator<>> BoneTransforms;
+			BoneTransforms.SetNumUninitialized(BoneIndices.Num());
+			Input.GetBonePosesForFrame(AnimationSequence, *Binding, BoneIndices, SlotMap, FrameIndex, BoneTransforms);
+
+			for (int32 i = 0; i < BoneNames.Num(); i++)
+			{
+				const FTransform& LocalTransform = BoneTransforms[i];
+
+				//FRotator LocalRotation = LocalTransform.Rotator();
+				//UKismetMathLibrary::ComposeRotators(LocalRotation, FingersAddend[BoneName]);
+
+				FRotator LocalRotation = AddLocalRotation(BoneAddends[i], LocalTransform.Rotator());
+
+				OutTracks.SetKey(i, FrameIndex, FTransform(LocalRotation, LocalTransform.GetTranslation(), LocalTransform.GetScale3D()));
+			}
+		});
+
+		return true;
+	};
+}
+
+FRotator UFingersCurl::AddLocalRotation(const FRotator& AdditionRot, const FRotator& BaseRot)
+{
+	return UKismetMathLibrary::ComposeRotators(BaseRot.GetInverse(), AdditionRot.GetInverse()).GetInverse();
 }
\ No newline at end of file
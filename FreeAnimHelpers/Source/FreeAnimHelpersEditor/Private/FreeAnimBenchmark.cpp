@@ -0,0 +1,446 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "FreeAnimBenchmark.h"
+#include "SyntheticAnimation.h"
+#include "FreeAnimDiagnostics.h"
+#include "FreeAnimHelpersLibrary.h"
+#include "FreeAnimHelpersSettings.h"
+#include "FreeAnimModifier.h"
+#include "FreeAnimModifierBatch.h"
+#include "AnimSkeletonBinding.h"
+#include "RefPoseCache.h"
+#include "AnimationModifier.h"
+#include "Animation/AnimData/AnimDataModel.h"
+#include "Animation/AnimSequence.h"
+#include "Animation/Skeleton.h"
+#include "Engine/SkeletalMesh.h"
+#include "ReferenceSkeleton.h"
+#include "HAL/MemoryBase.h"
+#include "HAL/PlatformMemory.h"
+#include "UObject/Package.h"
+#include "UObject/StrongObjectPtr.h"
+#include "UObject/UObjectGlobals.h"
+#include "Async/Async.h"
+#include <atomic>
+
+const TCHAR* FFreeAnimBenchmark::ReportHeader = TEXT("Bones,Depth,Frames,Test,Milliseconds,FramesPerSecond,BoneFramesPerSecond,PeakDeltaMB,UsedDeltaMB,AllocationsPerFrame,Result");
+
+namespace FreeAnimBenchmark
+{
+	static constexpr int32 FrameRate = FSyntheticAnimation::FrameRate;
+	/* Allocations per frame are found as difference between animations of AllocationCheckFrames and 2 * AllocationCheckFrames keys */
+	static constexpr int32 AllocationCheckFrames = 100;
+	/* Forward kinematics tests convert a block of frames repeatedly, so pose arrays don't depend on length of animation */
+	static constexpr int32 ForwardKinematicsBlockFrames = 64;
+
+	/** Test settings shared by all tests of one configuration */
+	struct FTestContext
+	{
+		const FSyntheticAnimationConfig& Config;
+		int32 BonesNum;
+		int32 Iterations;
+		TArray<FString>& Report;
+	};
+
+	/** Polls used physical memory of the process on a separate thread to find the peak reached by one test */
+	class FMemorySampler
+	{
+	public:
+		FMemorySampler()
+			: BaseUsed((int64)FPlatformMemory::GetStats().UsedPhysical)
+			, PeakUsed(BaseUsed)
+		{
+			SamplerTask = Async(EAsyncExecution::Thread, [this]
+			{
+				while (!bStopRequested)
+				{
+					Sample();
+					FPlatformProcess::Sleep(0.001f);
+				}
+			});
+		}
+
+		/* Stop polling. Returns increase of used memory at peak and at the end of the test, in bytes */
+		void Stop(int64& OutPeakDelta, int64& OutUsedDelta)
+		{
+			bStopRequested = true;
+			SamplerTask.Wait();
+			Sample();
+			OutPeakDelta = PeakUsed - BaseUsed;
+			OutUsedDelta = (int64)FPlatformMemory::GetStats().UsedPhysical - BaseUsed;
+		}
+
+	private:
+		void Sample() { PeakUsed = FMath::Max(PeakUsed, (int64)FPlatformMemory::GetStats().UsedPhysical); }
+
+		const int64 BaseUsed;
+		/* Written by sampler thread until it's stopped */
+		int64 PeakUsed;
+		std::atomic<bool> bStopRequested = false;
+		TFuture<void> SamplerTask;
+	};
+
+	/* Run Body Iterations times, Setup isn't included in measured time or memory. Body returns false if test was skipped.
+	 * Memory is sampled during the first run only, so polling doesn't affect the best time */
+	static void Measure(const FTestContext& Context, const FString& TestName, TFunctionRef<void()> Setup, TFunctionRef<bool()> Body)
+	{
+		double BestTime = MAX_dbl;
+		int64 PeakDelta = 0;
+		int64 UsedDelta = 0;
+		bool bResult = true;
+		for (int32 Iteration = 0; Iteration < FMath::Max(Context.Iterations, 1); Iteration++)
+		{
+			Setup();
+			TOptional<FMemorySampler> MemorySampler;
+			if (Iteration == 0)
+			{
+				MemorySampler.Emplace();
+			}
+
+			const double StartTime = FPlatformTime::Seconds();
+			bResult = Body();
+			const double Time = FPlatformTime::Seconds() - StartTime;
+
+			if (MemorySampler.IsSet())
+			{
+				MemorySampler->Stop(PeakDelta, UsedDelta);
+			}
+			BestTime = FMath::Min(BestTime, Time);
+		}
+
+		const double MB = 1024.0 * 1024.0;
+		const double Seconds = FMath::Max(BestTime, UE_DOUBLE_SMALL_NUMBER);
+		const double FramesPerSecond = Context.Config.FramesNum / Seconds;
+
+		Context.Report.Add(FString::Printf(TEXT("%d,%d,%d,%s,%.3f,%.1f,%.1f,%.1f,%.1f,,%s"),
+			Context.BonesNum,
+			Context.Config.ChainLength,
+			Context.Config.FramesNum,
+			*TestName,
+			BestTime * 1000.0,
+			FramesPerSecond,
+			FramesPerSecond * Context.BonesNum,
+			PeakDelta / MB,
+			UsedDelta / MB,
+			bResult ? TEXT("Ok") : TEXT("Skipped")));
+
+		UE_LOG(LogFreeAnimHelpers, Display, TEXT("FreeAnimHelpers: benchmark %s: %.2f ms%s"), *TestName, BestTime * 1000.0, bResult ? TEXT("") : TEXT(" (skipped)"));
+	}
+
+	/* Allocations of the thread inside CountThreadAllocations, null on other threads */
+	static thread_local int64* ThreadAllocations = nullptr;
+
+	/**
+	 * Forwards everything to the engine allocator and counts allocations of threads inside CountThreadAllocations.
+	 * It's installed as GMalloc once and never removed, and the allocator it forwards to never changes,
+	 * so any thread reading GMalloc at any time gets a valid allocator and memory is always freed by the allocator which allocated it.
+	 */
+	class FAllocationCounter final : public FMalloc
+	{
+	public:
+		explicit FAllocationCounter(FMalloc* InInner) : Inner(InInner) {}
+
+		virtual void* Malloc(SIZE_T Count, uint32 Alignment) override { CountAllocation(); return Inner->Malloc(Count, Alignment); }
+		virtual void* TryMalloc(SIZE_T Count, uint32 Alignment) override { CountAllocation(); return Inner->TryMalloc(Count, Alignment); }
+		virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override { CountAllocation(); return Inner->Realloc(Original, Count, Alignment); }
+		virtual void* TryRealloc(void* Original, SIZE_T Count, uint32 Alignment) override { CountAllocation(); return Inner->TryRealloc(Original, Count, Alignment); }
+		virtual void Free(void* Original) override { Inner->Free(Original); }
+		virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override { return Inner->QuantizeSize(Count, Alignment); }
+		virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return Inner->GetAllocationSize(Original, SizeOut); }
+		virtual void Trim(bool bTrimThreadCaches) override { Inner->Trim(bTrimThreadCaches); }
+		virtual void SetupTLSCachesOnCurrentThread() override { Inner->SetupTLSCachesOnCurrentThread(); }
+		virtual void ClearAndDisableTLSCachesOnCurrentThread() override { Inner->ClearAndDisableTLSCachesOnCurrentThread(); }
+		virtual void GetAllocatorStats(FGenericMemoryStats& OutStats) override { Inner->GetAllocatorStats(OutStats); }
+		virtual void DumpAllocatorStats(FOutputDevice& Ar) override { Inner->DumpAllocatorStats(Ar); }
+		virtual void UpdateStats() override { Inner->UpdateStats(); }
+		virtual bool IsInternallyThreadSafe() const override { return Inner->IsInternallyThreadSafe(); }
+		virtual bool ValidateHeap() override { return Inner->ValidateHeap(); }
+		virtual const TCHAR* GetDescriptiveName() override { return Inner->GetDescriptiveName(); }
+
+		static void Install()
+		{
+			// thread-safe static initialization, allocated with system malloc (FMalloc uses it for new)
+			static FAllocationCounter* Counter = []
+			{
+				FAllocationCounter* NewCounter = new FAllocationCounter(GMalloc);
+				FPlatformAtomics::InterlockedExchangePtr((void**)&GMalloc, NewCounter);
+				return NewCounter;
+			}();
+		}
+
+	private:
+		static void CountAllocation()
+		{
+			if (ThreadAllocations)
+			{
+				(*ThreadAllocations)++;
+			}
+		}
+
+		FMalloc* const Inner;
+	};
+
+	/* Best (lowest) number of allocations of modifier evaluation, INDEX_NONE if modifier can't be applied to the sequence */
+	static int64 CountEvaluationAllocations(const FTestContext& Context, const UFreeAnimModifier* Modifier, UAnimSequence* Sequence)
+	{
+		FFreeAnimModifierEvaluation Evaluation = Modifier->PrepareEvaluation(Sequence);
+		if (!Evaluation)
+		{
+			return INDEX_NONE;
+		}
+
+		// frames are evaluated on this thread, so allocations of parallel tasks don't depend on the number of frames
+		UFreeAnimHelpersSettings* Settings = GetMutableDefault<UFreeAnimHelpersSettings>();
+		TGuardValue<int32> MaxWorkerThreadsGuard(Settings->MaxWorkerThreads, 1);
+
+		// the first run fills mem stack pages and caches
+		{
+			FFreeAnimModifierOutput Output;
+			Evaluation(FFreeAnimModifierInput(), Output);
+		}
+
+		int64 BestAllocations = MAX_int64;
+		for (int32 Iteration = 0; Iteration < FMath::Max(Context.Iterations, 1); Iteration++)
+		{
+			BestAllocations = FMath::Min(BestAllocations, FFreeAnimBenchmark::CountThreadAllocations([&Evaluation]
+			{
+				FFreeAnimModifierOutput Output;
+				Evaluation(FFreeAnimModifierInput(), Output);
+			}));
+		}
+		return BestAllocations;
+	}
+
+	/*
+	 * Steady-state allocations per frame of modifier evaluation: allocations on animation with twice as many frames minus allocations on the short animation.
+	 * Preparation and per-bone setup don't depend on the number of frames, so the difference is caused by frame loops only.
+	 * Only allocations of this thread are counted, so allocations of other editor threads don't affect the result.
+	 */
+	static void MeasureFrameAllocations(const FTestContext& Context, const FString& TestName, const UFreeAnimModifier* Modifier, UAnimSequence* Sequence, UAnimSequence* LongSequence)
+	{
+		const int64 Allocations = CountEvaluationAllocations(Context, Modifier, Sequence);
+		const int64 LongAllocations = Allocations == INDEX_NONE ? INDEX_NONE : CountEvaluationAllocations(Context, Modifier, LongSequence);
+		const int32 FramesDelta = LongSequence->GetDataModel()->GetNumberOfKeys() - Sequence->GetDataModel()->GetNumberOfKeys();
+
+		FString Result = TEXT("Skipped");
+		double AllocationsPerFrame = 0.0;
+		if (Allocations != INDEX_NONE && LongAllocations != INDEX_NONE && FramesDelta > 0)
+		{
+			AllocationsPerFrame = (double)FMath::Max(LongAllocations - Allocations, (int64)0) / FramesDelta;
+			Result = AllocationsPerFrame == 0.0 ? TEXT("Ok") : TEXT("Failed");
+		}
+
+		Context.Report.Add(FString::Printf(TEXT("%d,%d,%d,%s,,,,,,%.3f,%s"),
+			Context.BonesNum,
+			Context.Config.ChainLength,
+			AllocationCheckFrames,
+			*TestName,
+			AllocationsPerFrame,
+			*Result));
+
+		UE_LOG(LogFreeAnimHelpers, Display, TEXT("FreeAnimHelpers: benchmark %s: %.3f allocations per frame (%s)"), *TestName, AllocationsPerFrame, *Result);
+	}
+}
+
+void FFreeAnimBenchmark::Run(const TArray<FSyntheticAnimationConfig>& Configs, int32 Iterations, TArray<FString>& OutReport)
+{
+	using namespace FreeAnimBenchmark;
+
+	TArray<UClass*> ModifierClasses;
+	FFreeAnimModifierBatch::GetModifierClasses(ModifierClasses);
+
+	for (const FSyntheticAnimationConfig& Config : Configs)
+	{
+		USkeletalMesh* Mesh = nullptr;
+		UAnimSequence* Sequence = nullptr;
+		if (!FSyntheticAnimation::Create(Config, Mesh, Sequence))
+		{
+			UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: can't create benchmark assets for %d bones and %d frames"), Config.BonesNum, Config.FramesNum);
+			continue;
+		}
+		TStrongObjectPtr<USkeletalMesh> MeshGuard(Mesh);
+		TStrongObjectPtr<UAnimSequence> SequenceGuard(Sequence);
+
+		// the same skeleton with short animations, used to find allocations made per frame
+		FSyntheticAnimationConfig ShortConfig = Config;
+		ShortConfig.FramesNum = AllocationCheckFrames;
+		FSyntheticAnimationConfig LongConfig = Config;
+		LongConfig.FramesNum = AllocationCheckFrames * 2;
+		USkeletalMesh* ShortMesh = nullptr;
+		USkeletalMesh* LongMesh = nullptr;
+		UAnimSequence* ShortSequence = nullptr;
+		UAnimSequence* LongSequence = nullptr;
+		if (!FSyntheticAnimation::Create(ShortConfig, ShortMesh, ShortSequence) || !FSyntheticAnimation::Create(LongConfig, LongMesh, LongSequence))
+		{
+			UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: can't create benchmark assets to count allocations for %d bones"), Config.BonesNum);
+			ShortSequence = LongSequence = nullptr;
+		}
+		TStrongObjectPtr<USkeletalMesh> ShortMeshGuard(ShortMesh);
+		TStrongObjectPtr<USkeletalMesh> LongMeshGuard(LongMesh);
+		TStrongObjectPtr<UAnimSequence> ShortSequenceGuard(ShortSequence);
+		TStrongObjectPtr<UAnimSequence> LongSequenceGuard(LongSequence);
+
+		const FReferenceSkeleton& RefSkeleton = Mesh->GetRefSkeleton();
+		const FTestContext Context{ Config, RefSkeleton.GetNum(), Iterations, OutReport };
+		UE_LOG(LogFreeAnimHelpers, Display, TEXT("FreeAnimHelpers: benchmark on %d bones, chain length %d, %d frames"), Context.BonesNum, Config.ChainLength, Config.FramesNum);
+
+		TArray<FName> BoneNames;
+		for (int32 BoneIndex = 0; BoneIndex < RefSkeleton.GetNum(); BoneIndex++)
+		{
+			BoneNames.Add(RefSkeleton.GetBoneName(BoneIndex));
+		}
+
+		// library functions
+		TArray<FTransform> Poses;
+		Measure(Context, TEXT("GetBonePosesForTime"), [] {}, [&]
+		{
+			for (int32 FrameIndex = 0; FrameIndex < Config.FramesNum; FrameIndex++)
+			{
+				UFreeAnimHelpersLibrary::GetBonePosesForTime(Sequence, BoneNames, (float)FrameIndex / FrameRate, false, Poses, Mesh);
+			}
+			return true;
+		});
+
+		// the last bone is the end of the deepest chain
+		const FName LeafBoneName = BoneNames.Last();
+		Measure(Context, TEXT("GetBonePositionAtTimeInCS"), [] {}, [&]
+		{
+			for (int32 FrameIndex = 0; FrameIndex < Config.FramesNum; FrameIndex++)
+			{
+				UFreeAnimHelpersLibrary::GetBonePositionAtTimeInCS(Sequence, LeafBoneName, (float)FrameIndex / FrameRate);
+			}
+			return true;
+		});
+
+		// forward kinematics of all bones
+		{
+			const TSharedRef<const FAnimSkeletonBinding> Binding = FAnimSkeletonBinding::Get(Sequence, Mesh);
+			const int32 FKBonesNum = Binding->GetNumBones();
+			const int32 BlockFrames = FMath::Clamp(Config.FramesNum, 1, ForwardKinematicsBlockFrames);
+			const int32 BlocksNum = FMath::DivideAndRoundUp(FMath::Max(Config.FramesNum, 1), BlockFrames);
+
+			TArray<int32> FKBoneIndices, FKParentIndices;
+			for (int32 BoneIndex = 0; BoneIndex < FKBonesNum; BoneIndex++)
+			{
+				FKBoneIndices.Add(BoneIndex);
+				FKParentIndices.Add(Binding->GetParentIndex(BoneIndex));
+			}
+			TArray<FTransform> LocalPoses, ComponentPoses;
+			LocalPoses.SetNumUninitialized(BlockFrames * FKBonesNum);
+			ComponentPoses.SetNumUninitialized(BlockFrames * FKBonesNum);
+			for (int32 FrameIndex = 0; FrameIndex < BlockFrames; FrameIndex++)
+			{
+				UFreeAnimHelpersLibrary::GetBonePosesForFrameByIndex(Sequence, *Binding, FKBoneIndices, FFrameTime(FrameIndex), MakeArrayView(LocalPoses.GetData() + FrameIndex * FKBonesNum, FKBonesNum));
+			}
+
+			Measure(Context, TEXT("LocalToComponentSpace"), [] {}, [&]
+			{
+				for (int32 BlockIndex = 0; BlockIndex < BlocksNum; BlockIndex++)
+				{
+					UFreeAnimHelpersLibrary::LocalToComponentSpace(LocalPoses, FKParentIndices, ComponentPoses);
+				}
+				return true;
+			});
+		}
+
+		// modifiers with default settings
+		for (UClass* ModifierClass : ModifierClasses)
+		{
+			TStrongObjectPtr<UAnimationModifier> Modifier(NewObject<UAnimationModifier>(GetTransientPackage(), ModifierClass));
+			const FString TestName = ModifierClass->GetName();
+
+			const UFreeAnimModifier* FreeModifier = Cast<UFreeAnimModifier>(Modifier.Get());
+
+			// whole application (evaluation and commit) of every modifier. It changes animation, so every run works with a new copy
+			UAnimSequence* SequenceCopy = nullptr;
+			Measure(Context, TestName, [&]
+			{
+				SequenceCopy = DuplicateObject<UAnimSequence>(Sequence, GetTransientPackage());
+			},
+			[&]
+			{
+				Modifier->OnApply(SequenceCopy);
+				return !FreeModifier || FreeModifier->GetLastApplyResult() == EFreeAnimApplyResult::Applied;
+			});
+
+			// phases of free modifiers separately
+			if (FreeModifier)
+			{
+				Measure(Context, TestName + TEXT(".Evaluate"), [] {}, [&]
+				{
+					FFreeAnimModifierEvaluation Evaluation = FreeModifier->PrepareEvaluation(Sequence);
+					FFreeAnimModifierOutput Output;
+					return Evaluation && Evaluation(FFreeAnimModifierInput(), Output);
+				});
+
+				FFreeAnimModifierOutput Output;
+				bool bEvaluated = false;
+				Measure(Context, TestName + TEXT(".Commit"), [&]
+				{
+					SequenceCopy = DuplicateObject<UAnimSequence>(Sequence, GetTransientPackage());
+					FFreeAnimModifierEvaluation Evaluation = FreeModifier->PrepareEvaluation(SequenceCopy);
+					Output = FFreeAnimModifierOutput();
+					bEvaluated = Evaluation && Evaluation(FFreeAnimModifierInput(), Output);
+				},
+				[&]
+				{
+					return bEvaluated && UFreeAnimModifier::CommitOutput(SequenceCopy, Output) != INDEX_NONE;
+				});
+
+				if (ShortSequence && LongSequence)
+				{
+					MeasureFrameAllocations(Context, TestName + TEXT(".FrameAllocations"), FreeModifier, ShortSequence, LongSequence);
+				}
+			}
+			CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+		}
+
+		// changes reference pose of the mesh, so it's the last test
+		Measure(Context, TEXT("ResetSkinndeAssetRootBoneScale"), [] {}, [&]
+		{
+			UFreeAnimHelpersLibrary::ResetSkinndeAssetRootBoneScale(Mesh, true);
+			return true;
+		});
+
+		ReleaseSyntheticAssets(Mesh);
+		ReleaseSyntheticAssets(ShortMesh);
+		ReleaseSyntheticAssets(LongMesh);
+		MeshGuard.Reset();
+		SequenceGuard.Reset();
+		ShortMeshGuard.Reset();
+		LongMeshGuard.Reset();
+		ShortSequenceGuard.Reset();
+		LongSequenceGuard.Reset();
+		CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+	}
+}
+
+int64 FFreeAnimBenchmark::CountThreadAllocations(TFunctionRef<void()> Body)
+{
+	using namespace FreeAnimBenchmark;
+
+	check(!ThreadAllocations);
+	FAllocationCounter::Install();
+
+	int64 Allocations = 0;
+	ThreadAllocations = &Allocations;
+	Body();
+	ThreadAllocations = nullptr;
+
+	return Allocations;
+}
+
+void FFreeAnimBenchmark::ReleaseSyntheticAssets(USkeletalMesh* Mesh)
+{
+	if (IsValid(Mesh))
+	{
+		FAnimSkeletonBinding::Invalidate(Mesh);
+		FRefPoseCache::Invalidate(Mesh);
+		if (const USkeleton* Skeleton = Mesh->GetSkeleton())
+		{
+			FAnimSkeletonBinding::Invalidate(Skeleton);
+			FRefPoseCache::Invalidate(Skeleton);
+		}
+	}
+}
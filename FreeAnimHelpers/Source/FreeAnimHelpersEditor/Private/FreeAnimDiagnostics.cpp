@@ -0,0 +1,80 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "FreeAnimDiagnostics.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/ScopeLock.h"
+
+DEFINE_LOG_CATEGORY(LogFreeAnimHelpers);
+
+namespace FreeAnimDiagnostics
+{
+	static int32 Capacity = 4096;
+	static FAutoConsoleVariableRef CVarCapacity(
+		TEXT("FreeAnimHelpers.DiagnosticsCapacity"),
+		Capacity,
+		TEXT("Number of the latest diagnostics entries of Free Anim Helpers modifiers kept in memory"));
+
+	static FAutoConsoleCommand DumpCommand(
+		TEXT("FreeAnimHelpers.DumpDiagnostics"),
+		TEXT("Write buffered diagnostics of Free Anim Helpers modifiers to log"),
+		FConsoleCommandDelegate::CreateLambda([]() { FFreeAnimDiagnostics::Dump(TEXT("requested")); }));
+
+	static FCriticalSection BufferGuard;
+	static TArray<FString> Entries;
+	/* Index of the oldest entry when buffer is full */
+	static int32 Head = 0;
+}
+
+void FFreeAnimDiagnostics::Add(FString&& Entry)
+{
+	using namespace FreeAnimDiagnostics;
+
+	FScopeLock Lock(&BufferGuard);
+
+	const int32 MaxEntries = FMath::Max(Capacity, 1);
+	if (Entries.Num() < MaxEntries)
+	{
+		Entries.Add(MoveTemp(Entry));
+		return;
+	}
+
+	// capacity could be reduced by console variable
+	if (Entries.Num() > MaxEntries)
+	{
+		Reset();
+		Entries.Add(MoveTemp(Entry));
+		return;
+	}
+
+	Entries[Head] = MoveTemp(Entry);
+	Head = (Head + 1) % Entries.Num();
+}
+
+void FFreeAnimDiagnostics::Dump(const TCHAR* Reason)
+{
+	using namespace FreeAnimDiagnostics;
+
+	FScopeLock Lock(&BufferGuard);
+
+	if (Entries.IsEmpty())
+	{
+		return;
+	}
+
+	UE_LOG(LogFreeAnimHelpers, Display, TEXT("Diagnostics (%s), %d entries:"), Reason, Entries.Num());
+	for (int32 Index = 0; Index < Entries.Num(); Index++)
+	{
+		UE_LOG(LogFreeAnimHelpers, Display, TEXT("  %s"), *Entries[(Head + Index) % Entries.Num()]);
+	}
+	Reset();
+}
+
+void FFreeAnimDiagnostics::Reset()
+{
+	using namespace FreeAnimDiagnostics;
+
+	FScopeLock Lock(&BufferGuard);
+	Entries.Reset();
+	Head = 0;
+}
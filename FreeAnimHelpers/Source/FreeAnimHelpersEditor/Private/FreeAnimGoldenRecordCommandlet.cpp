@@ -0,0 +1,124 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "FreeAnimGoldenRecordCommandlet.h"
+#include "SyntheticAnimation.h"
+#include "AnimSequenceDiff.h"
+#include "AnimationModifier.h"
+#include "Animation/AnimSequence.h"
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
+#include "UObject/UObjectIterator.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogFreeAnimGolden, Log, All);
+
+namespace FreeAnimGoldenRecord
+{
+	static const TCHAR* ModulePackageName = TEXT("/Script/FreeAnimHelpersEditor");
+
+	/* List of positive numbers separated by '+'. Default values are used if parameter is missing */
+	static TArray<int32> ParseNumbers(const TMap<FString, FString>& ParamsMap, const TCHAR* Key, const TArray<int32>& Defaults)
+	{
+		TArray<FString> Values;
+		ParamsMap.FindRef(Key).TrimQuotes().ParseIntoArray(Values, TEXT("+"));
+
+		TArray<int32> Numbers;
+		for (const FString& Value : Values)
+		{
+			if (Value.IsNumeric() && FCString::Atoi(*Value) > 0)
+			{
+				Numbers.Add(FCString::Atoi(*Value));
+			}
+		}
+		return Numbers.IsEmpty() ? Defaults : Numbers;
+	}
+}
+
+UFreeAnimGoldenRecordCommandlet::UFreeAnimGoldenRecordCommandlet()
+{
+	IsClient = false;
+	IsEditor = true;
+	IsServer = false;
+	LogToConsole = true;
+	ShowErrorCount = true;
+}
+
+int32 UFreeAnimGoldenRecordCommandlet::Main(const FString& Params)
+{
+	using namespace FreeAnimGoldenRecord;
+
+	TArray<FString> Tokens, Switches;
+	TMap<FString, FString> ParamsMap;
+	ParseCommandLine(*Params, Tokens, Switches, ParamsMap);
+
+	const FString GoldenDir = ParamsMap.FindRef(TEXT("GoldenDir")).TrimQuotes();
+	if (GoldenDir.IsEmpty())
+	{
+		UE_LOG(LogFreeAnimGolden, Error, TEXT("FreeAnimGoldenRecord: output folder isn't specified, use -GoldenDir=<plugin>/Golden"));
+		return 1;
+	}
+	IFileManager::Get().MakeDirectory(*GoldenDir, true);
+
+	// every non-abstract modifier of the plugin with default settings
+	TArray<UClass*> ModifierClasses;
+	for (TObjectIterator<UClass> It; It; ++It)
+	{
+		if (It->IsChildOf(UAnimationModifier::StaticClass())
+			&& !It->HasAnyClassFlags(CLASS_Abstract | CLASS_Deprecated | CLASS_NewerVersionExists)
+			&& It->GetOutermost()->GetName() == ModulePackageName)
+		{
+			ModifierClasses.Add(*It);
+		}
+	}
+	ModifierClasses.Sort([](const UClass& A, const UClass& B) { return A.GetName() < B.GetName(); });
+
+	const int32 ChainLength = ParseNumbers(ParamsMap, TEXT("Depth"), { 4 })[0];
+	int32 RecordedNum = 0, FailedNum = 0;
+
+	for (const int32 BonesNum : ParseNumbers(ParamsMap, TEXT("Bones"), { 60, 200 }))
+	{
+		for (const int32 FramesNum : ParseNumbers(ParamsMap, TEXT("Frames"), { 31, 301 }))
+		{
+			FSyntheticAnimationConfig Config;
+			Config.BonesNum = BonesNum;
+			Config.ChainLength = ChainLength;
+			Config.FramesNum = FramesNum;
+			const FString FixtureName = FSyntheticAnimation::GetFixtureName(Config);
+
+			for (UClass* ModifierClass : ModifierClasses)
+			{
+				// every modifier starts from the same fixture
+				USkeletalMesh* Mesh = nullptr;
+				UAnimSequence* Sequence = nullptr;
+				if (!FSyntheticAnimation::Create(Config, Mesh, Sequence))
+				{
+					UE_LOG(LogFreeAnimGolden, Error, TEXT("FreeAnimGoldenRecord: can't create fixture %s"), *FixtureName);
+					FailedNum++;
+					continue;
+				}
+
+				Modifier = NewObject<UAnimationModifier>(this, ModifierClass);
+				Modifier->ApplyToAnimationSequence(Sequence);
+				FAnimSequenceSnapshot Snapshot = FAnimSequenceSnapshot::Capture(Sequence);
+				Modifier = nullptr;
+
+				const FString GoldenFileName = GoldenDir / FString::Printf(TEXT("%s_%s.golden"), *FixtureName, *ModifierClass->GetName());
+				if (Snapshot.SaveToFile(GoldenFileName))
+				{
+					UE_LOG(LogFreeAnimGolden, Display, TEXT("FreeAnimGoldenRecord: %s"), *GoldenFileName);
+					RecordedNum++;
+				}
+				else
+				{
+					UE_LOG(LogFreeAnimGolden, Error, TEXT("FreeAnimGoldenRecord: can't write %s"), *GoldenFileName);
+					FailedNum++;
+				}
+
+				CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+			}
+		}
+	}
+
+	UE_LOG(LogFreeAnimGolden, Display, TEXT("FreeAnimGoldenRecord: %d file(s) recorded, %d failed"), RecordedNum, FailedNum);
+	return FailedNum > 0 || RecordedNum == 0 ? 1 : 0;
+}
@@ -0,0 +1,665 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "FreeAnimHelpersCommandlet.h"
+#include "FreeAnimDiagnostics.h"
+#include "FreeAnimModifierBatch.h"
+#include "FreeAnimBenchmark.h"
+#include "SyntheticAnimation.h"
+#include "AnimSequenceDiff.h"
+#include "ModifierStackHash.h"
+#include "AnimationModifier.h"
+#include "Animation/AnimSequence.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include "AssetRegistry/AssetRegistryModule.h"
+#include "AssetRegistry/IAssetRegistry.h"
+#include "Dom/JsonObject.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+#include "JsonObjectConverter.h"
+#include "HAL/FileManager.h"
+#include "Interfaces/IPluginManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/PackageName.h"
+#include "Misc/Paths.h"
+#include "HAL/PlatformProcess.h"
+#include "UObject/Package.h"
+#include "UObject/SavePackage.h"
+
+// number of processed animations between garbage collections
+static constexpr int32 AnimationsPerGC = 32;
+
+static const TCHAR* ReportHeader = TEXT("Asset,Step,Milliseconds,Result");
+
+static const TCHAR* GoldenReportHeader = TEXT("Fixture,Modifier,Type,Name,Translation,RotationDegrees,Scale,Curve,WorstFrame,Result");
+
+/* List of positive numbers separated by '+'. Default values are used if parameter is missing */
+static TArray<int32> ParseNumbers(const TMap<FString, FString>& ParamsMap, const TCHAR* Key, const TArray<int32>& Defaults)
+{
+	TArray<FString> Values;
+	ParamsMap.FindRef(Key).TrimQuotes().ParseIntoArray(Values, TEXT("+"));
+
+	TArray<int32> Numbers;
+	for (const FString& Value : Values)
+	{
+		if (Value.IsNumeric() && FCString::Atoi(*Value) > 0)
+		{
+			Numbers.Add(FCString::Atoi(*Value));
+		}
+	}
+	return Numbers.IsEmpty() ? Defaults : Numbers;
+}
+
+/* Configurations of synthetic animations for every combination of -Bones and -Frames */
+static TArray<FSyntheticAnimationConfig> ParseSyntheticConfigs(const TMap<FString, FString>& ParamsMap, const TArray<int32>& DefaultBones, const TArray<int32>& DefaultFrames)
+{
+	const TArray<int32> BonesNums = ParseNumbers(ParamsMap, TEXT("Bones"), DefaultBones);
+	const TArray<int32> FramesNums = ParseNumbers(ParamsMap, TEXT("Frames"), DefaultFrames);
+	const int32 ChainLength = ParseNumbers(ParamsMap, TEXT("Depth"), { 4 })[0];
+
+	TArray<FSyntheticAnimationConfig> Configs;
+	for (const int32 BonesNum : BonesNums)
+	{
+		for (const int32 FramesNum : FramesNums)
+		{
+			FSyntheticAnimationConfig& Config = Configs.AddDefaulted_GetRef();
+			Config.BonesNum = BonesNum;
+			Config.ChainLength = ChainLength;
+			Config.FramesNum = FramesNum;
+		}
+	}
+	return Configs;
+}
+
+UFreeAnimHelpersCommandlet::UFreeAnimHelpersCommandlet()
+{
+	IsClient = false;
+	IsEditor = true;
+	IsServer = false;
+	LogToConsole = true;
+	ShowErrorCount = true;
+}
+
+int32 UFreeAnimHelpersCommandlet::Main(const FString& Params)
+{
+	TArray<FString> Tokens, Switches;
+	TMap<FString, FString> ParamsMap;
+	ParseCommandLine(*Params, Tokens, Switches, ParamsMap);
+
+	if (Switches.Contains(TEXT("Benchmark")))
+	{
+		return RunBenchmark(ParamsMap);
+	}
+	if (ParamsMap.Contains(TEXT("Golden")))
+	{
+		return RunGolden(ParamsMap);
+	}
+
+	const FString StackFileName = ParamsMap.FindRef(TEXT("Stack")).TrimQuotes();
+	if (StackFileName.IsEmpty())
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: modifier stack isn't specified, use -Stack=<file.json>"));
+		return 1;
+	}
+	if (!LoadModifierStack(StackFileName))
+	{
+		return 1;
+	}
+
+	const FString ManifestFileName = ParamsMap.FindRef(TEXT("Manifest")).TrimQuotes();
+	const FString ReportFileName = ParamsMap.FindRef(TEXT("Report")).TrimQuotes();
+	const int32 ShardsNum = FCString::Atoi(*ParamsMap.FindRef(TEXT("Shards")));
+	const int32 RetriesNum = ParamsMap.Contains(TEXT("Retries")) ? FCString::Atoi(*ParamsMap.FindRef(TEXT("Retries"))) : 1;
+	const bool bSave = !Switches.Contains(TEXT("NoSave"));
+	bForce = Switches.Contains(TEXT("Force"));
+	SettingsHash = FModifierStackHash::GetSettingsHash(Modifiers);
+
+	TArray<FSoftObjectPath> Animations;
+	if (!ManifestFileName.IsEmpty())
+	{
+		// worker process: list of animations is prepared by parent process
+		if (!ReadManifest(ManifestFileName, Animations))
+		{
+			return 1;
+		}
+	}
+	else
+	{
+		TArray<FString> ContentPaths;
+		ParamsMap.FindRef(TEXT("Path")).TrimQuotes().ParseIntoArray(ContentPaths, TEXT("+"));
+		if (ContentPaths.IsEmpty())
+		{
+			ContentPaths.Add(TEXT("/Game"));
+		}
+		FindAnimations(ContentPaths, ParamsMap.FindRef(TEXT("Filter")).TrimQuotes(), Animations);
+	}
+	UE_LOG(LogFreeAnimHelpers, Display, TEXT("FreeAnimHelpers: %d animation(s) found, %d modifier(s) in stack"), Animations.Num(), Modifiers.Num());
+
+	// Asset, Modifier, Milliseconds, Result
+	TArray<FString> Report;
+	Report.Add(ReportHeader);
+
+	const double BatchStartTime = FPlatformTime::Seconds();
+	const int32 FailedNum = (ShardsNum > 1 && ManifestFileName.IsEmpty() && Animations.Num() > 1)
+		? RunShards(Animations, ShardsNum, RetriesNum, StackFileName, bSave, Report)
+		: ProcessAnimations(Animations, bSave, Report);
+
+	const int32 UpToDateNum = Report.FilterByPredicate([](const FString& Row) { return Row.EndsWith(TEXT(",UpToDate")); }).Num();
+	UE_LOG(LogFreeAnimHelpers, Display, TEXT("FreeAnimHelpers: processed %d animation(s) in %.1f s, %d up to date, %d failed"),
+		Animations.Num() - UpToDateNum, FPlatformTime::Seconds() - BatchStartTime, UpToDateNum, FailedNum);
+
+	if (!ReportFileName.IsEmpty() && !FFileHelper::SaveStringArrayToFile(Report, *ReportFileName))
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: can't write report to %s"), *ReportFileName);
+		return 1;
+	}
+
+	return FailedNum > 0 ? 1 : 0;
+}
+
+int32 UFreeAnimHelpersCommandlet::RunBenchmark(const TMap<FString, FString>& ParamsMap)
+{
+	const TArray<FSyntheticAnimationConfig> Configs = ParseSyntheticConfigs(ParamsMap, { 30, 100, 500 }, { 30, 1000, 10000 });
+	const int32 Iterations = ParseNumbers(ParamsMap, TEXT("Iterations"), { 3 })[0];
+
+	TArray<FString> Report;
+	Report.Add(FFreeAnimBenchmark::ReportHeader);
+
+	const double BenchmarkStartTime = FPlatformTime::Seconds();
+	FFreeAnimBenchmark::Run(Configs, Iterations, Report);
+	UE_LOG(LogFreeAnimHelpers, Display, TEXT("FreeAnimHelpers: benchmark of %d configuration(s) finished in %.1f s"), Configs.Num(), FPlatformTime::Seconds() - BenchmarkStartTime);
+
+	// allocation checks are the only tests which can fail
+	const int32 FailedNum = Report.FilterByPredicate([](const FString& Row) { return Row.EndsWith(TEXT(",Failed")); }).Num();
+	if (FailedNum > 0)
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: %d modifier(s) allocate memory per frame"), FailedNum);
+	}
+
+	const FString ReportFileName = ParamsMap.FindRef(TEXT("Report")).TrimQuotes();
+	if (ReportFileName.IsEmpty())
+	{
+		for (const FString& Row : Report)
+		{
+			UE_LOG(LogFreeAnimHelpers, Display, TEXT("%s"), *Row);
+		}
+	}
+	else if (!FFileHelper::SaveStringArrayToFile(Report, *ReportFileName))
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: can't write report to %s"), *ReportFileName);
+		return 1;
+	}
+	return FailedNum > 0 ? 1 : 0;
+}
+
+int32 UFreeAnimHelpersCommandlet::RunGolden(const TMap<FString, FString>& ParamsMap)
+{
+	// golden data is recorded by UFreeAnimGoldenRecordCommandlet on the baseline version of modifiers, not by the code which is checked
+	const FString Mode = ParamsMap.FindRef(TEXT("Golden")).TrimQuotes();
+	if (!Mode.IsEmpty() && !Mode.Equals(TEXT("Compare"), ESearchCase::IgnoreCase))
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: unknown golden mode %s, use -Golden=Compare. Golden data is recorded by -run=FreeAnimGoldenRecord (see Golden/README.md of the plugin)"), *Mode);
+		return 1;
+	}
+
+	// golden data is stored with the plugin, so every checkout is compared to the same reference output
+	FString GoldenDir = ParamsMap.FindRef(TEXT("GoldenDir")).TrimQuotes();
+	if (GoldenDir.IsEmpty())
+	{
+		const TSharedPtr<IPlugin> Plugin = IPluginManager::Get().FindPlugin(TEXT("FreeAnimHelpers"));
+		GoldenDir = Plugin.IsValid()
+			? Plugin->GetBaseDir() / TEXT("Golden")
+			: FPaths::ProjectSavedDir() / TEXT("FreeAnimHelpers") / TEXT("Golden");
+	}
+	TArray<FString> GoldenFiles;
+	IFileManager::Get().FindFiles(GoldenFiles, *(GoldenDir / TEXT("*.golden")), true, false);
+	if (GoldenFiles.IsEmpty())
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: no golden data in %s, record it with -run=FreeAnimGoldenRecord (see Golden/README.md of the plugin)"), *GoldenDir);
+		return 1;
+	}
+
+	FAnimSequenceDiffTolerance Tolerance;
+	auto ParseTolerance = [&ParamsMap](const TCHAR* Key, double& Value)
+	{
+		if (const FString* String = ParamsMap.Find(Key))
+		{
+			Value = FCString::Atod(**String);
+		}
+	};
+	ParseTolerance(TEXT("TranslationTolerance"), Tolerance.Translation);
+	ParseTolerance(TEXT("RotationTolerance"), Tolerance.RotationDegrees);
+	ParseTolerance(TEXT("ScaleTolerance"), Tolerance.Scale);
+	ParseTolerance(TEXT("CurveTolerance"), Tolerance.Curve);
+
+	// modifiers added after the baseline have no golden data, they are reported but don't fail the check
+	TArray<UClass*> ModifierClasses;
+	FFreeAnimModifierBatch::GetModifierClasses(ModifierClasses);
+
+	TArray<FString> Report;
+	Report.Add(GoldenReportHeader);
+	int32 FailedNum = 0;
+
+	for (UClass* ModifierClass : ModifierClasses)
+	{
+		const FString ModifierName = ModifierClass->GetName();
+		if (!GoldenFiles.ContainsByPredicate([&ModifierName](const FString& FileName) { return FileName.EndsWith(TEXT("_") + ModifierName + TEXT(".golden")); }))
+		{
+			UE_LOG(LogFreeAnimHelpers, Warning, TEXT("FreeAnimHelpers: %s has no golden data and isn't checked"), *ModifierName);
+			Report.Add(TEXT(",") + ModifierName + TEXT(",,,,,,,,NotRecorded"));
+			continue;
+		}
+
+		for (const FSyntheticAnimationConfig& Config : ParseSyntheticConfigs(ParamsMap, { 60, 200 }, { 31, 301 }))
+		{
+			const FString FixtureName = FSyntheticAnimation::GetFixtureName(Config);
+			const FString RowPrefix = FixtureName + TEXT(",") + ModifierName;
+
+			FAnimSequenceSnapshot Expected;
+			const FString GoldenFileName = GoldenDir / FString::Printf(TEXT("%s_%s.golden"), *FixtureName, *ModifierName);
+			if (!Expected.LoadFromFile(GoldenFileName))
+			{
+				UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: can't read golden data %s"), *GoldenFileName);
+				Report.Add(RowPrefix + TEXT(",,,,,,,,NoGolden"));
+				FailedNum++;
+				continue;
+			}
+
+			// every modifier starts from the same fixture
+			USkeletalMesh* Mesh = nullptr;
+			UAnimSequence* Sequence = nullptr;
+			if (!FSyntheticAnimation::Create(Config, Mesh, Sequence))
+			{
+				UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: can't create fixture %s"), *FixtureName);
+				FailedNum++;
+				continue;
+			}
+
+			// kept alive by Modifiers property
+			UAnimationModifier* Modifier = NewObject<UAnimationModifier>(this, ModifierClass);
+			Modifiers.Add(Modifier);
+			FFreeAnimModifierBatch::ApplyToSequence(Modifier, Sequence);
+			FAnimSequenceSnapshot Snapshot = FAnimSequenceSnapshot::Capture(Sequence);
+
+			Modifiers.Remove(Modifier);
+			FFreeAnimBenchmark::ReleaseSyntheticAssets(Mesh);
+			CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+
+			const FAnimSequenceDiff Diff = FAnimSequenceDiff::Compare(Expected, Snapshot, Tolerance);
+			if (!Diff.bTimingMatches)
+			{
+				Report.Add(RowPrefix + TEXT(",Timing,,,,,,,Failed"));
+			}
+			for (const FAnimSequenceDiff::FBoneError& Error : Diff.Bones)
+			{
+				Report.Add(FString::Printf(TEXT("%s,Bone,%s,%g,%g,%g,,%d,%s"), *RowPrefix, *Error.BoneName.ToString(),
+					Error.Translation, Error.RotationDegrees, Error.Scale, Error.WorstFrame,
+					Error.bMissing ? TEXT("Missing") : (Error.bPassed ? TEXT("Passed") : TEXT("Failed"))));
+			}
+			for (const FAnimSequenceDiff::FCurveError& Error : Diff.Curves)
+			{
+				Report.Add(FString::Printf(TEXT("%s,Curve,%s,,,,%g,%d,%s"), *RowPrefix, *Error.CurveName.ToString(),
+					Error.Value, Error.WorstFrame,
+					Error.bMissing ? TEXT("Missing") : (Error.bPassed ? TEXT("Passed") : TEXT("Failed"))));
+			}
+
+			const bool bPassed = Diff.IsPassed();
+			FailedNum += bPassed ? 0 : 1;
+			UE_LOG(LogFreeAnimHelpers, Display, TEXT("FreeAnimHelpers: golden %s %s: %s"), *FixtureName, *ModifierName, bPassed ? TEXT("passed") : TEXT("FAILED"));
+		}
+	}
+
+	UE_LOG(LogFreeAnimHelpers, Display, TEXT("FreeAnimHelpers: golden comparison finished, %d failed"), FailedNum);
+
+	const FString ReportFileName = ParamsMap.FindRef(TEXT("Report")).TrimQuotes();
+	if (!ReportFileName.IsEmpty() && !FFileHelper::SaveStringArrayToFile(Report, *ReportFileName))
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: can't write report to %s"), *ReportFileName);
+		return 1;
+	}
+	return FailedNum > 0 ? 1 : 0;
+}
+
+int32 UFreeAnimHelpersCommandlet::ProcessAnimations(const TArray<FSoftObjectPath>& Animations, bool bSave, TArray<FString>& Report)
+{
+	int32 FailedNum = 0;
+
+	for (int32 AnimIndex = 0; AnimIndex < Animations.Num(); AnimIndex++)
+	{
+		const FString AssetPath = Animations[AnimIndex].ToString();
+		FString TimingLog;
+
+		double StepStartTime = FPlatformTime::Seconds();
+		UAnimSequence* AnimationSequence = Cast<UAnimSequence>(Animations[AnimIndex].TryLoad());
+		double StepTime = (FPlatformTime::Seconds() - StepStartTime) * 1000.0;
+		Report.Add(FString::Printf(TEXT("%s,Load,%.2f,%s"), *AssetPath, StepTime, AnimationSequence ? TEXT("Ok") : TEXT("Failed")));
+
+		if (!AnimationSequence)
+		{
+			UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: [%d/%d] can't load %s"), AnimIndex + 1, Animations.Num(), *AssetPath);
+			FailedNum++;
+			continue;
+		}
+		TimingLog = FString::Printf(TEXT("load %.1f ms"), StepTime);
+
+		// skip animations processed by the same stack, unless they were changed after that
+		if (!bForce)
+		{
+			StepStartTime = FPlatformTime::Seconds();
+			const bool bUpToDate = FModifierStackHash::IsUpToDate(AnimationSequence, SettingsHash);
+			StepTime = (FPlatformTime::Seconds() - StepStartTime) * 1000.0;
+
+			if (bUpToDate)
+			{
+				Report.Add(FString::Printf(TEXT("%s,Hash,%.2f,UpToDate"), *AssetPath, StepTime));
+				UE_LOG(LogFreeAnimHelpers, Display, TEXT("FreeAnimHelpers: [%d/%d] %s: up to date"), AnimIndex + 1, Animations.Num(), *AssetPath);
+				continue;
+			}
+		}
+
+		// failed modifiers are reported as Failed, so the animation is counted and retried by RunShards
+		bool bApplied = false;
+		bool bFailed = false;
+		for (UAnimationModifier* Modifier : Modifiers)
+		{
+			StepStartTime = FPlatformTime::Seconds();
+			const EFreeAnimApplyResult Result = FFreeAnimModifierBatch::ApplyToSequence(Modifier, AnimationSequence);
+			StepTime = (FPlatformTime::Seconds() - StepStartTime) * 1000.0;
+
+			const TCHAR* ResultName = Result == EFreeAnimApplyResult::Applied ? TEXT("Ok") : (Result == EFreeAnimApplyResult::Failed ? TEXT("Failed") : TEXT("Skipped"));
+			const FString ModifierName = Modifier->GetClass()->GetName();
+			Report.Add(FString::Printf(TEXT("%s,%s,%.2f,%s"), *AssetPath, *ModifierName, StepTime, ResultName));
+			TimingLog += FString::Printf(TEXT(", %s %.1f ms%s"), *ModifierName, StepTime, Result == EFreeAnimApplyResult::Applied ? TEXT("") : (Result == EFreeAnimApplyResult::Failed ? TEXT(" (failed)") : TEXT(" (skipped)")));
+			bApplied |= Result == EFreeAnimApplyResult::Applied;
+			bFailed |= Result == EFreeAnimApplyResult::Failed;
+		}
+		if (bFailed)
+		{
+			UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: [%d/%d] %s: modifier failed"), AnimIndex + 1, Animations.Num(), *AssetPath);
+			FailedNum++;
+		}
+
+		// animation with failed modifiers isn't saved: retry should start from source data, not from partially modified one
+		if (bSave && bApplied && !bFailed)
+		{
+			FModifierStackHash::Store(AnimationSequence, SettingsHash);
+
+			StepStartTime = FPlatformTime::Seconds();
+			const bool bSaved = SaveAnimation(AnimationSequence);
+			StepTime = (FPlatformTime::Seconds() - StepStartTime) * 1000.0;
+
+			Report.Add(FString::Printf(TEXT("%s,Save,%.2f,%s"), *AssetPath, StepTime, bSaved ? TEXT("Ok") : TEXT("Failed")));
+			TimingLog += FString::Printf(TEXT(", save %.1f ms"), StepTime);
+			if (!bSaved)
+			{
+				FailedNum++;
+			}
+		}
+
+		UE_LOG(LogFreeAnimHelpers, Display, TEXT("FreeAnimHelpers: [%d/%d] %s: %s"), AnimIndex + 1, Animations.Num(), *AssetPath, *TimingLog);
+
+		// unload processed animations, libraries can be too large to keep them all in memory
+		if ((AnimIndex + 1) % AnimationsPerGC == 0)
+		{
+			CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+		}
+	}
+
+	return FailedNum;
+}
+
+int32 UFreeAnimHelpersCommandlet::RunShards(const TArray<FSoftObjectPath>& Animations, int32 ShardsNum, int32 RetriesNum, const FString& StackFileName, bool bSave, TArray<FString>& Report) const
+{
+	const FString ShardsDir = FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir() / TEXT("FreeAnimHelpers") / FDateTime::Now().ToString());
+	const FString ProjectFile = FPaths::ConvertRelativePathToFull(FPaths::GetProjectFilePath());
+	const FString StackFile = FPaths::ConvertRelativePathToFull(StackFileName);
+
+	// contiguous ranges: assets are sorted by path, so neighbours usually share skeleton and preview mesh
+	ShardsNum = FMath::Min(ShardsNum, Animations.Num());
+	TArray<TArray<FString>> Shards;
+	Shards.SetNum(ShardsNum);
+	for (int32 AnimIndex = 0; AnimIndex < Animations.Num(); AnimIndex++)
+	{
+		Shards[(int64)AnimIndex * ShardsNum / Animations.Num()].Add(Animations[AnimIndex].ToString());
+	}
+
+	// report rows of the latest attempt for every asset
+	TMap<FString, TArray<FString>> AssetRows;
+
+	for (int32 Attempt = 0; Attempt <= RetriesNum && Shards.Num() > 0; Attempt++)
+	{
+		struct FShardProcess
+		{
+			FProcHandle Handle;
+			FString ReportFile;
+		};
+		TArray<FShardProcess> Processes;
+
+		for (int32 ShardIndex = 0; ShardIndex < Shards.Num(); ShardIndex++)
+		{
+			const FString ShardName = FString::Printf(TEXT("Shard_%d_%d"), Attempt, ShardIndex);
+			const FString ManifestFile = ShardsDir / ShardName + TEXT(".txt");
+			FShardProcess& Process = Processes.AddDefaulted_GetRef();
+			Process.ReportFile = ShardsDir / ShardName + TEXT(".csv");
+
+			if (!FFileHelper::SaveStringArrayToFile(Shards[ShardIndex], *ManifestFile))
+			{
+				UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: can't write manifest %s"), *ManifestFile);
+				continue;
+			}
+
+			// every worker writes its own log, otherwise they would compete for the project log file
+			const FString Args = FString::Printf(TEXT("\"%s\" -run=FreeAnimHelpers -Stack=\"%s\" -Manifest=\"%s\" -Report=\"%s\" -abslog=\"%s\"%s%s -nullrhi -unattended -nosplash -nopause"),
+				*ProjectFile, *StackFile, *ManifestFile, *Process.ReportFile, *(ShardsDir / ShardName + TEXT(".log")), bSave ? TEXT("") : TEXT(" -NoSave"), bForce ? TEXT(" -Force") : TEXT(""));
+
+			Process.Handle = FPlatformProcess::CreateProc(FPlatformProcess::ExecutablePath(), *Args, false, true, true, nullptr, 0, nullptr, nullptr);
+			if (!Process.Handle.IsValid())
+			{
+				UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: can't launch worker for %s"), *ShardName);
+			}
+		}
+		UE_LOG(LogFreeAnimHelpers, Display, TEXT("FreeAnimHelpers: attempt %d, %d worker(s) launched, logs are in %s"), Attempt + 1, Processes.Num(), *ShardsDir);
+
+		for (FShardProcess& Process : Processes)
+		{
+			if (Process.Handle.IsValid())
+			{
+				FPlatformProcess::WaitForProc(Process.Handle);
+				FPlatformProcess::CloseProc(Process.Handle);
+			}
+		}
+
+		// collect results, assets without successful result are sent to the next attempt
+		TArray<TArray<FString>> FailedShards;
+		for (int32 ShardIndex = 0; ShardIndex < Shards.Num(); ShardIndex++)
+		{
+			TArray<FString> ShardReport;
+			FFileHelper::LoadFileToStringArray(ShardReport, *Processes[ShardIndex].ReportFile);
+
+			TMap<FString, TArray<FString>> ShardRows;
+			for (int32 RowIndex = 1; RowIndex < ShardReport.Num(); RowIndex++)
+			{
+				FString AssetPath, Row;
+				if (ShardReport[RowIndex].Split(TEXT(","), &AssetPath, &Row))
+				{
+					ShardRows.FindOrAdd(AssetPath).Add(ShardReport[RowIndex]);
+				}
+			}
+
+			TArray<FString> FailedAssets;
+			for (const FString& AssetPath : Shards[ShardIndex])
+			{
+				const TArray<FString>* Rows = ShardRows.Find(AssetPath);
+				if (Rows)
+				{
+					AssetRows.Add(AssetPath, *Rows);
+				}
+				if (!Rows || Rows->ContainsByPredicate([](const FString& Row) { return Row.EndsWith(TEXT(",Failed")); }))
+				{
+					FailedAssets.Add(AssetPath);
+				}
+			}
+
+			if (FailedAssets.Num() > 0)
+			{
+				UE_LOG(LogFreeAnimHelpers, Warning, TEXT("FreeAnimHelpers: %d animation(s) of shard %d failed"), FailedAssets.Num(), ShardIndex);
+				FailedShards.Add(MoveTemp(FailedAssets));
+			}
+		}
+		Shards = MoveTemp(FailedShards);
+	}
+
+	// merge reports in the original order of assets, worker crashes are reported as failures
+	TSet<FString> FailedAssets;
+	for (const TArray<FString>& Shard : Shards)
+	{
+		FailedAssets.Append(Shard);
+	}
+	for (const FSoftObjectPath& Animation : Animations)
+	{
+		const FString AssetPath = Animation.ToString();
+		if (const TArray<FString>* Rows = AssetRows.Find(AssetPath))
+		{
+			Report.Append(*Rows);
+		}
+		else
+		{
+			Report.Add(FString::Printf(TEXT("%s,Worker,0.00,Failed"), *AssetPath));
+		}
+	}
+
+	return FailedAssets.Num();
+}
+
+bool UFreeAnimHelpersCommandlet::ReadManifest(const FString& ManifestFileName, TArray<FSoftObjectPath>& OutAnimations)
+{
+	TArray<FString> Lines;
+	if (!FFileHelper::LoadFileToStringArray(Lines, *ManifestFileName))
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: can't read manifest %s"), *ManifestFileName);
+		return false;
+	}
+
+	OutAnimations.Empty(Lines.Num());
+	for (const FString& Line : Lines)
+	{
+		const FString AssetPath = Line.TrimStartAndEnd();
+		if (!AssetPath.IsEmpty())
+		{
+			OutAnimations.Add(FSoftObjectPath(AssetPath));
+		}
+	}
+	return true;
+}
+
+bool UFreeAnimHelpersCommandlet::LoadModifierStack(const FString& StackFileName)
+{
+	Modifiers.Empty();
+
+	FString StackJson;
+	if (!FFileHelper::LoadFileToString(StackJson, *StackFileName))
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: can't read modifier stack file %s"), *StackFileName);
+		return false;
+	}
+
+	TSharedPtr<FJsonObject> Root;
+	const TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(StackJson);
+	const TArray<TSharedPtr<FJsonValue>>* ModifierValues = nullptr;
+	if (!FJsonSerializer::Deserialize(Reader, Root) || !Root.IsValid() || !Root->TryGetArrayField(TEXT("Modifiers"), ModifierValues))
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: invalid modifier stack file %s, expected { \"Modifiers\": [ ... ] }"), *StackFileName);
+		return false;
+	}
+
+	for (const TSharedPtr<FJsonValue>& ModifierValue : *ModifierValues)
+	{
+		const TSharedPtr<FJsonObject>* ModifierObject = nullptr;
+		FString ClassName;
+		if (!ModifierValue->TryGetObject(ModifierObject) || !(*ModifierObject)->TryGetStringField(TEXT("Class"), ClassName))
+		{
+			UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: modifier without class in %s"), *StackFileName);
+			return false;
+		}
+
+		UClass* ModifierClass = FFreeAnimModifierBatch::FindModifierClass(ClassName);
+		if (!ModifierClass)
+		{
+			UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: unknown modifier class %s"), *ClassName);
+			return false;
+		}
+
+		UAnimationModifier* Modifier = NewObject<UAnimationModifier>(this, ModifierClass);
+		const TSharedPtr<FJsonObject>* Properties = nullptr;
+		if ((*ModifierObject)->TryGetObjectField(TEXT("Properties"), Properties)
+			&& !FJsonObjectConverter::JsonObjectToUStruct(Properties->ToSharedRef(), ModifierClass, Modifier))
+		{
+			UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: invalid properties of modifier %s"), *ClassName);
+			return false;
+		}
+		Modifiers.Add(Modifier);
+	}
+
+	if (Modifiers.IsEmpty())
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: modifier stack %s is empty"), *StackFileName);
+		return false;
+	}
+	return true;
+}
+
+void UFreeAnimHelpersCommandlet::FindAnimations(const TArray<FString>& ContentPaths, const FString& Filter, TArray<FSoftObjectPath>& OutAnimations) const
+{
+	IAssetRegistry& AssetRegistry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>(TEXT("AssetRegistry")).Get();
+	AssetRegistry.ScanPathsSynchronous(ContentPaths, true);
+
+	FARFilter AssetFilter;
+	AssetFilter.bRecursivePaths = true;
+	AssetFilter.bRecursiveClasses = true;
+	for (const FString& ContentPath : ContentPaths)
+	{
+		AssetFilter.PackagePaths.Add(FName(*ContentPath));
+	}
+#if ENGINE_MINOR_VERSION > 0
+	AssetFilter.ClassPaths.Add(UAnimSequence::StaticClass()->GetClassPathName());
+#else
+	AssetFilter.ClassNames.Add(UAnimSequence::StaticClass()->GetFName());
+#endif
+
+	TArray<FAssetData> Assets;
+	AssetRegistry.GetAssets(AssetFilter, Assets);
+
+	OutAnimations.Empty();
+	for (const FAssetData& Asset : Assets)
+	{
+		if (Filter.IsEmpty() || Asset.AssetName.ToString().MatchesWildcard(Filter))
+		{
+			OutAnimations.Add(Asset.GetSoftObjectPath());
+		}
+	}
+
+	// stable order makes logs and reports of different runs comparable
+	OutAnimations.Sort([](const FSoftObjectPath& A, const FSoftObjectPath& B) { return A.ToString() < B.ToString(); });
+}
+
+bool UFreeAnimHelpersCommandlet::SaveAnimation(UAnimSequence* AnimationSequence)
+{
+	UPackage* Package = AnimationSequence->GetPackage();
+	const FString FileName = FPackageName::LongPackageNameToFilename(Package->GetName(), FPackageName::GetAssetPackageExtension());
+
+	if (IFileManager::Get().IsReadOnly(*FileName))
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("FreeAnimHelpers: file %s is read-only, check it out before running commandlet"), *FileName);
+		return false;
+	}
+
+#if ENGINE_MINOR_VERSION > 0
+	FSavePackageArgs SaveArgs;
+	SaveArgs.TopLevelFlags = RF_Public | RF_Standalone;
+	SaveArgs.SaveFlags = SAVE_NoError;
+	SaveArgs.Error = GWarn;
+	return UPackage::SavePackage(Package, nullptr, *FileName, SaveArgs);
+#else
+	return UPackage::SavePackage(Package, nullptr, RF_Public | RF_Standalone, *FileName, GWarn, nullptr, false, true, SAVE_NoError);
+#endif
+}
@@ -1,81 +1,380 @@
-// Copyright Epic Games, Inc. All Rights Reserved.
-
-#include "FreeAnimHelpersEditorModule.h"
-#include "ContentBrowserModule.h"
-#include "ScopedTransaction.h"
-#include "Framework/Commands/UICommandInfo.h"
-#include "Framework/Commands/UICommandList.h"
-#include "FreeAnimHelpersLibrary.h"
-
-static const FName FreeAnimHelpersTabName("FreeAnimHelpers");
-
-#define LOCTEXT_NAMESPACE "FFreeAnimHelpersModule"
-
-void FFreeAnimHelpersEditorModule::StartupModule()
-{
-	CommandList = MakeShareable(new FUICommandList);
-
-	FContentBrowserModule& ContentBrowserModule = FModuleManager::LoadModuleChecked<FContentBrowserModule>(TEXT("ContentBrowser"));
-	ContentBrowserModule.GetAllAssetViewContextMenuExtenders().Add(
-		FContentBrowserMenuExtender_SelectedAssets::CreateLambda([this](const TArray<FAssetData>& SelectedAssets)
-	{
-		TSharedRef<FExtender> Extender = MakeShared<FExtender>();
-
-		if (SelectedAssets.ContainsByPredicate([](const FAssetData& AssetData) { return AssetData.GetClass() == USkeletalMesh::StaticClass(); }))
-		{
-			// Create UYnnkVoiceLipsyncData
-			Extender->AddMenuExtension(
-				"GetAssetActions",
-				EExtensionHook::After,
-				CommandList,
-				FMenuExtensionDelegate::CreateLambda([this, SelectedAssets](FMenuBuilder& MenuBuilder)
-			{
-				MenuBuilder.AddMenuEntry(
-					LOCTEXT("ResetRootScale", "Reset Root Bone Scale"),
-					LOCTEXT("ResetRootScaleToolTip", "Reset scale of root bone, but preserve size of the model"),
-					FSlateIcon(),
-					FUIAction(FExecuteAction::CreateRaw(this, &FFreeAnimHelpersEditorModule::ResetRootScale, SelectedAssets)));
-			}));
-		}
-
-		return Extender;
-	}));
-	ContentBrowserMenuExtenderHandle = ContentBrowserModule.GetAllAssetViewContextMenuExtenders().Last().GetHandle();
-}
-
-void FFreeAnimHelpersEditorModule::ShutdownModule()
-{
-	FContentBrowserModule* ContentBrowserModule = FModuleManager::GetModulePtr<FContentBrowserModule>(TEXT("ContentBrowser"));
-	if (ContentBrowserModule && ContentBrowserMenuExtenderHandle.IsValid())
-	{
-		ContentBrowserModule->GetAllAssetViewContextMenuExtenders().RemoveAll(
-			[this](const FContentBrowserMenuExtender_SelectedAssets& InDelegate)
-			{
-				return ContentBrowserMenuExtenderHandle == InDelegate.GetHandle();
-			}
-		);
-	}
-}
-
-void FFreeAnimHelpersEditorModule::ResetRootScale(TArray<FAssetData> SelectedAssets)
-{
-	bool bKeepSize = (EAppReturnType::Type::Yes == FMessageDialog::Open(EAppMsgType::Type::YesNo, FText::FromString(TEXT("Keep current size of the model?"))));
-
-	for (auto& Asset : SelectedAssets)
-	{
-		if (USkeletalMesh* Mesh = Cast<USkeletalMesh>(Asset.GetAsset()))
-		{
-			{
-				const FScopedTransaction Transaction(LOCTEXT("ResetRootScale", "Reset root bone scale"));
-				Mesh->Modify();
-				Mesh->GetSkeleton()->Modify();
-				UFreeAnimHelpersLibrary::ResetSkinndeAssetRootBoneScale(Mesh, bKeepSize);
-			}			
-		}
-	}
-}
-
-
-#undef LOCTEXT_NAMESPACE
-	
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "FreeAnimHelpersEditorModule.h"
+#include "FreeAnimDiagnostics.h"
+#include "ContentBrowserModule.h"
+#include "ScopedTransaction.h"
+#include "Framework/Commands/UICommandInfo.h"
+#include "Framework/Commands/UICommandList.h"
+#include "FreeAnimHelpersLibrary.h"
+#include "AnimSkeletonBinding.h"
+#include "RefPoseCache.h"
+#include "FreeAnimModifierBatch.h"
+#include "FreeAnimModifierPreview.h"
+#include "FreeAnimModifier.h"
+#include "AnimationModifier.h"
+#include "Animation/AnimSequence.h"
+#include "Editor.h"
+#include "IDetailsView.h"
+#include "PropertyEditorModule.h"
+#include "Misc/ScopedSlowTask.h"
+#include "UObject/StrongObjectPtr.h"
+#include "Framework/Application/SlateApplication.h"
+#include "Framework/Notifications/NotificationManager.h"
+#include "Widgets/Notifications/SNotificationList.h"
+#include "Widgets/SWindow.h"
+#include "Widgets/Input/SButton.h"
+#include "Widgets/Layout/SBox.h"
+
+static const FName FreeAnimHelpersTabName("FreeAnimHelpers");
+
+#define LOCTEXT_NAMESPACE "FFreeAnimHelpersModule"
+
+void FFreeAnimHelpersEditorModule::StartupModule()
+{
+	CommandList = MakeShareable(new FUICommandList);
+
+	FContentBrowserModule& ContentBrowserModule = FModuleManager::LoadModuleChecked<FContentBrowserModule>(TEXT("ContentBrowser"));
+	ContentBrowserModule.GetAllAssetViewContextMenuExtenders().Add(
+		FContentBrowserMenuExtender_SelectedAssets::CreateLambda([this](const TArray<FAssetData>& SelectedAssets)
+	{
+		TSharedRef<FExtender> Extender = MakeShared<FExtender>();
+
+		if (SelectedAssets.ContainsByPredicate([](const FAssetData& AssetData) { return AssetData.GetClass() == USkeletalMesh::StaticClass(); }))
+		{
+			// Create UYnnkVoiceLipsyncData
+			Extender->AddMenuExtension(
+				"GetAssetActions",
+				EExtensionHook::After,
+				CommandList,
+				FMenuExtensionDelegate::CreateLambda([this, SelectedAssets](FMenuBuilder& MenuBuilder)
+			{
+				MenuBuilder.AddMenuEntry(
+					LOCTEXT("ResetRootScale", "Reset Root Bone Scale"),
+					LOCTEXT("ResetRootScaleToolTip", "Reset scale of root bone, but preserve size of the model"),
+					FSlateIcon(),
+					FUIAction(FExecuteAction::CreateRaw(this, &FFreeAnimHelpersEditorModule::ResetRootScale, SelectedAssets)));
+			}));
+		}
+
+		if (SelectedAssets.ContainsByPredicate([](const FAssetData& AssetData) { return AssetData.IsInstanceOf(UAnimSequence::StaticClass()); }))
+		{
+			// Apply modifier to all selected animations
+			Extender->AddMenuExtension(
+				"GetAssetActions",
+				EExtensionHook::After,
+				CommandList,
+				FMenuExtensionDelegate::CreateLambda([this, SelectedAssets](FMenuBuilder& MenuBuilder)
+			{
+				MenuBuilder.AddSubMenu(
+					LOCTEXT("ApplyFreeAnimModifier", "Apply Free Anim Modifier"),
+					LOCTEXT("ApplyFreeAnimModifierToolTip", "Apply animation modifier to all selected animation sequences"),
+					FNewMenuDelegate::CreateLambda([this, SelectedAssets](FMenuBuilder& SubMenuBuilder)
+				{
+					TArray<UClass*> ModifierClasses;
+					FFreeAnimModifierBatch::GetModifierClasses(ModifierClasses);
+
+					for (UClass* ModifierClass : ModifierClasses)
+					{
+						SubMenuBuilder.AddMenuEntry(
+							ModifierClass->GetDisplayNameText(),
+							ModifierClass->GetToolTipText(),
+							FSlateIcon(),
+							FUIAction(FExecuteAction::CreateRaw(this, &FFreeAnimHelpersEditorModule::ApplyModifier, ModifierClass, SelectedAssets)));
+					}
+				}));
+			}));
+		}
+
+		if (SelectedAssets.Num() == 1 && SelectedAssets[0].IsInstanceOf(UAnimSequence::StaticClass()))
+		{
+			// Tune modifier settings without changing the animation
+			const FAssetData SelectedAsset = SelectedAssets[0];
+			Extender->AddMenuExtension(
+				"GetAssetActions",
+				EExtensionHook::After,
+				CommandList,
+				FMenuExtensionDelegate::CreateLambda([this, SelectedAsset](FMenuBuilder& MenuBuilder)
+			{
+				MenuBuilder.AddSubMenu(
+					LOCTEXT("PreviewFreeAnimModifier", "Preview Free Anim Modifier"),
+					LOCTEXT("PreviewFreeAnimModifierToolTip", "Show result of animation modifier in a copy of the animation, apply it when settings are confirmed"),
+					FNewMenuDelegate::CreateLambda([this, SelectedAsset](FMenuBuilder& SubMenuBuilder)
+				{
+					TArray<UClass*> ModifierClasses;
+					FFreeAnimModifierBatch::GetModifierClasses(ModifierClasses);
+
+					for (UClass* ModifierClass : ModifierClasses)
+					{
+						// only modifiers evaluated without committing can be previewed
+						if (!ModifierClass->IsChildOf(UFreeAnimModifier::StaticClass()))
+						{
+							continue;
+						}
+						SubMenuBuilder.AddMenuEntry(
+							ModifierClass->GetDisplayNameText(),
+							ModifierClass->GetToolTipText(),
+							FSlateIcon(),
+							FUIAction(FExecuteAction::CreateRaw(this, &FFreeAnimHelpersEditorModule::PreviewModifier, ModifierClass, SelectedAsset)));
+					}
+				}));
+			}));
+		}
+
+		return Extender;
+	}));
+	ContentBrowserMenuExtenderHandle = ContentBrowserModule.GetAllAssetViewContextMenuExtenders().Last().GetHandle();
+}
+
+void FFreeAnimHelpersEditorModule::ShutdownModule()
+{
+	FAnimSkeletonBinding::ResetCache();
+	FRefPoseCache::ResetCache();
+
+	FContentBrowserModule* ContentBrowserModule = FModuleManager::GetModulePtr<FContentBrowserModule>(TEXT("ContentBrowser"));
+	if (ContentBrowserModule && ContentBrowserMenuExtenderHandle.IsValid())
+	{
+		ContentBrowserModule->GetAllAssetViewContextMenuExtenders().RemoveAll(
+			[this](const FContentBrowserMenuExtender_SelectedAssets& InDelegate)
+			{
+				return ContentBrowserMenuExtenderHandle == InDelegate.GetHandle();
+			}
+		);
+	}
+}
+
+void FFreeAnimHelpersEditorModule::ResetRootScale(TArray<FAssetData> SelectedAssets)
+{
+	bool bKeepSize = (EAppReturnType::Type::Yes == FMessageDialog::Open(EAppMsgType::Type::YesNo, FText::FromString(TEXT("Keep current size of the model?"))));
+
+	for (auto& Asset : SelectedAssets)
+	{
+		if (USkeletalMesh* Mesh = Cast<USkeletalMesh>(Asset.GetAsset()))
+		{
+			{
+				const FScopedTransaction Transaction(LOCTEXT("ResetRootScale", "Reset root bone scale"));
+				Mesh->Modify();
+				Mesh->GetSkeleton()->Modify();
+				UFreeAnimHelpersLibrary::ResetSkinndeAssetRootBoneScale(Mesh, bKeepSize);
+			}			
+		}
+	}
+}
+
+void FFreeAnimHelpersEditorModule::ApplyModifier(UClass* ModifierClass, TArray<FAssetData> SelectedAssets)
+{
+	// modifier isn't stored in animation sequences, so it lives in transient package
+	TStrongObjectPtr<UAnimationModifier> Modifier(NewObject<UAnimationModifier>(GetTransientPackage(), ModifierClass));
+	if (!EditModifierSettings(Modifier.Get()))
+	{
+		return;
+	}
+
+	TArray<UAnimSequence*> Sequences;
+	{
+		FScopedSlowTask LoadTask((float)SelectedAssets.Num(), LOCTEXT("LoadAnimations", "Loading animations..."));
+		LoadTask.MakeDialog();
+
+		for (const auto& Asset : SelectedAssets)
+		{
+			LoadTask.EnterProgressFrame();
+			if (Asset.IsInstanceOf(UAnimSequence::StaticClass()))
+			{
+				if (UAnimSequence* AnimationSequence = Cast<UAnimSequence>(Asset.GetAsset()))
+				{
+					Sequences.Add(AnimationSequence);
+				}
+			}
+		}
+	}
+
+	const FFreeAnimModifierBatchResult Result = FFreeAnimModifierBatch::Apply(Modifier.Get(), Sequences, true);
+
+	const FText Message = FText::Format(
+		LOCTEXT("ApplyModifierResult", "{0}: applied to {1} animation(s), skipped {2}, failed {3}{4}"),
+		ModifierClass->GetDisplayNameText(),
+		FText::AsNumber(Result.Applied),
+		FText::AsNumber(Result.Skipped),
+		FText::AsNumber(Result.Failed),
+		Result.bCanceled ? LOCTEXT("ApplyModifierCanceled", " (canceled)") : FText::GetEmpty());
+	UE_LOG(LogFreeAnimHelpers, Log, TEXT("%s"), *Message.ToString());
+
+	FNotificationInfo Info(Message);
+	Info.ExpireDuration = 5.f;
+	FSlateNotificationManager::Get().AddNotification(Info);
+}
+
+void FFreeAnimHelpersEditorModule::PreviewModifier(UClass* ModifierClass, FAssetData SelectedAsset)
+{
+	UAnimSequence* AnimationSequence = Cast<UAnimSequence>(SelectedAsset.GetAsset());
+	if (!AnimationSequence)
+	{
+		return;
+	}
+
+	// preview keeps modifier alive while the window is open
+	UFreeAnimModifier* Modifier = NewObject<UFreeAnimModifier>(GetTransientPackage(), ModifierClass);
+	TSharedRef<FFreeAnimModifierPreview> Preview = MakeShared<FFreeAnimModifierPreview>(AnimationSequence, Modifier);
+
+	FPropertyEditorModule& PropertyEditorModule = FModuleManager::LoadModuleChecked<FPropertyEditorModule>(TEXT("PropertyEditor"));
+
+	FDetailsViewArgs DetailsViewArgs;
+	DetailsViewArgs.bAllowSearch = false;
+	DetailsViewArgs.NameAreaSettings = FDetailsViewArgs::HideNameArea;
+	TSharedRef<IDetailsView> DetailsView = PropertyEditorModule.CreateDetailView(DetailsViewArgs);
+	DetailsView->SetObject(Modifier);
+	DetailsView->OnFinishedChangingProperties().AddLambda([Preview](const FPropertyChangedEvent&)
+	{
+		Preview->Update();
+	});
+
+	TSharedRef<SWindow> Window = SNew(SWindow)
+		.Title(FText::Format(LOCTEXT("PreviewModifierTitle", "Preview {0}: {1}"), ModifierClass->GetDisplayNameText(), FText::FromString(AnimationSequence->GetName())))
+		.ClientSize(FVector2D(480.f, 560.f))
+		.SupportsMinimize(false)
+		.SupportsMaximize(false);
+	TWeakPtr<SWindow> WeakWindow = Window;
+
+	Window->SetOnWindowClosed(FOnWindowClosed::CreateLambda([Preview](const TSharedRef<SWindow>&)
+	{
+		Preview->Discard();
+	}));
+
+	Window->SetContent(
+		SNew(SVerticalBox)
+		+ SVerticalBox::Slot()
+		.FillHeight(1.f)
+		[
+			DetailsView
+		]
+		+ SVerticalBox::Slot()
+		.AutoHeight()
+		.HAlign(HAlign_Right)
+		.Padding(4.f)
+		[
+			SNew(SHorizontalBox)
+			+ SHorizontalBox::Slot()
+			.AutoWidth()
+			.Padding(2.f)
+			[
+				SNew(SButton)
+				.Text(LOCTEXT("UpdatePreviewButton", "Update Preview"))
+				.OnClicked_Lambda([Preview]()
+				{
+					Preview->Update();
+					return FReply::Handled();
+				})
+			]
+			+ SHorizontalBox::Slot()
+			.AutoWidth()
+			.Padding(2.f)
+			[
+				SNew(SButton)
+				.Text(LOCTEXT("ApplyButton", "Apply"))
+				.OnClicked_Lambda([Preview, WeakWindow]()
+				{
+					const EFreeAnimApplyResult Result = Preview->Commit();
+					const bool bApplied = Result == EFreeAnimApplyResult::Applied;
+
+					const FText Message = FText::Format(
+						bApplied
+							? LOCTEXT("PreviewApplied", "{0}: applied to {1}")
+							: (Result == EFreeAnimApplyResult::Failed
+								? LOCTEXT("PreviewFailed", "{0}: applied to {1} with errors, see log")
+								: LOCTEXT("PreviewNotApplied", "{0}: can't be applied to {1}")),
+						Preview->GetModifier()->GetClass()->GetDisplayNameText(),
+						FText::FromString(Preview->GetSourceSequence()->GetName()));
+					UE_LOG(LogFreeAnimHelpers, Log, TEXT("%s"), *Message.ToString());
+
+					FNotificationInfo Info(Message);
+					Info.ExpireDuration = 5.f;
+					FSlateNotificationManager::Get().AddNotification(Info);
+
+					if (bApplied && WeakWindow.IsValid()) WeakWindow.Pin()->RequestDestroyWindow();
+					return FReply::Handled();
+				})
+			]
+			+ SHorizontalBox::Slot()
+			.AutoWidth()
+			.Padding(2.f)
+			[
+				SNew(SButton)
+				.Text(LOCTEXT("CloseButton", "Close"))
+				.OnClicked_Lambda([WeakWindow]()
+				{
+					if (WeakWindow.IsValid()) WeakWindow.Pin()->RequestDestroyWindow();
+					return FReply::Handled();
+				})
+			]
+		]);
+
+	// window isn't modal, so Animation Editor with preview sequence can be used while settings are changed
+	FSlateApplication::Get().AddWindow(Window);
+	Preview->Update();
+}
+
+bool FFreeAnimHelpersEditorModule::EditModifierSettings(UObject* Modifier)
+{
+	FPropertyEditorModule& PropertyEditorModule = FModuleManager::LoadModuleChecked<FPropertyEditorModule>(TEXT("PropertyEditor"));
+
+	FDetailsViewArgs DetailsViewArgs;
+	DetailsViewArgs.bAllowSearch = false;
+	DetailsViewArgs.NameAreaSettings = FDetailsViewArgs::HideNameArea;
+	TSharedRef<IDetailsView> DetailsView = PropertyEditorModule.CreateDetailView(DetailsViewArgs);
+	DetailsView->SetObject(Modifier);
+
+	bool bApply = false;
+	TSharedRef<SWindow> Window = SNew(SWindow)
+		.Title(FText::Format(LOCTEXT("ModifierSettingsTitle", "Apply {0}"), Modifier->GetClass()->GetDisplayNameText()))
+		.ClientSize(FVector2D(480.f, 560.f))
+		.SupportsMinimize(false)
+		.SupportsMaximize(false);
+	TWeakPtr<SWindow> WeakWindow = Window;
+
+	Window->SetContent(
+		SNew(SVerticalBox)
+		+ SVerticalBox::Slot()
+		.FillHeight(1.f)
+		[
+			DetailsView
+		]
+		+ SVerticalBox::Slot()
+		.AutoHeight()
+		.HAlign(HAlign_Right)
+		.Padding(4.f)
+		[
+			SNew(SHorizontalBox)
+			+ SHorizontalBox::Slot()
+			.AutoWidth()
+			.Padding(2.f)
+			[
+				SNew(SButton)
+				.Text(LOCTEXT("ApplyButton", "Apply"))
+				.OnClicked_Lambda([&bApply, WeakWindow]()
+				{
+					bApply = true;
+					if (WeakWindow.IsValid()) WeakWindow.Pin()->RequestDestroyWindow();
+					return FReply::Handled();
+				})
+			]
+			+ SHorizontalBox::Slot()
+			.AutoWidth()
+			.Padding(2.f)
+			[
+				SNew(SButton)
+				.Text(LOCTEXT("CancelButton", "Cancel"))
+				.OnClicked_Lambda([WeakWindow]()
+				{
+					if (WeakWindow.IsValid()) WeakWindow.Pin()->RequestDestroyWindow();
+					return FReply::Handled();
+				})
+			]
+		]);
+
+	GEditor->EditorAddModalWindow(Window);
+	return bApply;
+}
+
+#undef LOCTEXT_NAMESPACE
+	
 IMPLEMENT_MODULE(FFreeAnimHelpersEditorModule, FreeAnimHelpersEditor)
\ No newline at end of file
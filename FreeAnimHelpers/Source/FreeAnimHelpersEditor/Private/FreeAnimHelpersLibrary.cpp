@@ -1,396 +1,787 @@
-// (c) Yuri N. K. 2022. All rights reserved.
-// ykasczc@gmail.com
-
-#include "FreeAnimHelpersLibrary.h"
-#include "AnimationBlueprintLibrary.h"
-#include "Animation/AnimLinkableElement.h"
-#include "Runtime/Launch/Resources/Version.h"
-#include "Animation/AnimSequence.h"
-#include "Engine/SkeletalMesh.h"
-#include "Engine/SkeletalMeshSocket.h"
-#include "Curves/CurveFloat.h"
-#include "Curves/CurveVector.h"
-#include "ReferenceSkeleton.h"
-
-#include "Serialization/Archive.h"
-#include "Serialization/MemoryReader.h"
-#include "Serialization/BufferArchive.h"
-
-
-FTransform UFreeAnimHelpersLibrary::GetBoneRefPositionInComponentSpace(const UAnimSequence* AnimationSequence, const FName& BoneName)
-{
-	const FReferenceSkeleton& RefSkeleton = AnimationSequence->GetPreviewMesh()
-		? AnimationSequence->GetPreviewMesh()->GetRefSkeleton()
-		: AnimationSequence->GetSkeleton()->GetReferenceSkeleton();
-	return GetBoneRefPositionInComponentSpaceByIndex(AnimationSequence, RefSkeleton.FindBoneIndex(BoneName));
-}
-
-FTransform UFreeAnimHelpersLibrary::GetSocketRefPositionInComponentSpace(const UAnimSequence* AnimationSequence, const FName& SocketName)
-{
-	const USkeletalMeshSocket* Socket = AnimationSequence->GetSkeleton()->FindSocket(SocketName);
-	if (!Socket)
-	{
-		return FTransform::Identity;
-	}
-
-	FTransform BoneTr = GetBoneRefPositionInComponentSpace(AnimationSequence, Socket->BoneName);
-	return FTransform(Socket->RelativeRotation, Socket->RelativeLocation, Socket->RelativeScale) * BoneTr;
-}
-
-FTransform UFreeAnimHelpersLibrary::GetBoneRefPositionInComponentSpaceByIndex(const UAnimSequence* AnimationSequence, int32 BoneIndex)
-{
-	const FReferenceSkeleton& RefSkeleton = AnimationSequence->GetPreviewMesh()
-		? AnimationSequence->GetPreviewMesh()->GetRefSkeleton()
-		: AnimationSequence->GetSkeleton()->GetReferenceSkeleton();
-	const TArray<FTransform>& RefPoseSpaceBaseTMs = RefSkeleton.GetRefBonePose();
-
-	int32 TransformIndex = BoneIndex;
-	FTransform tr_bone = FTransform::Identity;
-
-	// stop on root
-	while (TransformIndex != INDEX_NONE)
-	{
-		tr_bone *= RefPoseSpaceBaseTMs[TransformIndex];
-		TransformIndex = RefSkeleton.GetParentIndex(TransformIndex);
-	}
-	tr_bone.NormalizeRotation();
-
-	return tr_bone;
-}
-
-FTransform UFreeAnimHelpersLibrary::GetRefSkeletonBonePositionByIndex(const FReferenceSkeleton& RefSkeleton, int32 BoneIndex)
-{
-	const TArray<FTransform>& RefPoseSpaceBaseTMs = RefSkeleton.GetRefBonePose();
-
-	int32 TransformIndex = BoneIndex;
-	FTransform tr_bone = FTransform::Identity;
-
-	// stop on root
-	while (TransformIndex != INDEX_NONE)
-	{
-		tr_bone *= RefPoseSpaceBaseTMs[TransformIndex];
-		TransformIndex = RefSkeleton.GetParentIndex(TransformIndex);
-	}
-	tr_bone.NormalizeRotation();
-	return tr_bone;
-}
-
-FTransform UFreeAnimHelpersLibrary::GetBonePositionAtTimeInCS(const UAnimSequence* AnimationSequence, const FName& BoneName, float Time)
-{
-	return GetBonePositionAtTimeInCS_ToParent(AnimationSequence, BoneName, Time, FTransform(), INDEX_NONE);
-}
-
-void UFreeAnimHelpersLibrary::AddFloatCurveKey(UCurveFloat* Curve, float Time, float Value, bool bInterpCubic)
-{
-	if (IsValid(Curve))
-	{
-		FKeyHandle h = Curve->FloatCurve.UpdateOrAddKey(Time, Value);
-		if (bInterpCubic)
-		{
-			Curve->FloatCurve.SetKeyInterpMode(h, ERichCurveInterpMode::RCIM_Cubic);
-			Curve->FloatCurve.SetKeyTangentMode(h, ERichCurveTangentMode::RCTM_Auto);
-		}
-		else
-		{
-			Curve->FloatCurve.SetKeyInterpMode(h, ERichCurveInterpMode::RCIM_Linear);
-			Curve->FloatCurve.SetKeyTangentMode(h, ERichCurveTangentMode::RCTM_Auto);
-		}
-	}
-}
-
-void UFreeAnimHelpersLibrary::AddVectorCurveKey(UCurveVector* Curve, float Time, FVector Value, bool bInterpCubic)
-{
-	if (IsValid(Curve))
-	{
-		FKeyHandle hX = Curve->FloatCurves[0].UpdateOrAddKey(Time, Value.X);
-		FKeyHandle hY = Curve->FloatCurves[1].UpdateOrAddKey(Time, Value.Y);
-		FKeyHandle hZ = Curve->FloatCurves[2].UpdateOrAddKey(Time, Value.Z);
-		if (bInterpCubic)
-		{
-			Curve->FloatCurves[0].SetKeyInterpMode(hX, ERichCurveInterpMode::RCIM_Cubic);
-			Curve->FloatCurves[0].SetKeyTangentMode(hX, ERichCurveTangentMode::RCTM_Auto);
-			Curve->FloatCurves[1].SetKeyInterpMode(hY, ERichCurveInterpMode::RCIM_Cubic);
-			Curve->FloatCurves[1].SetKeyTangentMode(hY, ERichCurveTangentMode::RCTM_Auto);
-			Curve->FloatCurves[2].SetKeyInterpMode(hZ, ERichCurveInterpMode::RCIM_Cubic);
-			Curve->FloatCurves[2].SetKeyTangentMode(hZ, ERichCurveTangentMode::RCTM_Auto);
-		}
-		else
-		{
-			Curve->FloatCurves[0].SetKeyInterpMode(hX, ERichCurveInterpMode::RCIM_Linear);
-			Curve->FloatCurves[0].SetKeyTangentMode(hX, ERichCurveTangentMode::RCTM_Auto);
-			Curve->FloatCurves[1].SetKeyInterpMode(hY, ERichCurveInterpMode::RCIM_Linear);
-			Curve->FloatCurves[1].SetKeyTangentMode(hY, ERichCurveTangentMode::RCTM_Auto);
-			Curve->FloatCurves[2].SetKeyInterpMode(hZ, ERichCurveInterpMode::RCIM_Linear);
-			Curve->FloatCurves[2].SetKeyTangentMode(hZ, ERichCurveTangentMode::RCTM_Auto);
-		}
-	}
-}
-
-void UFreeAnimHelpersLibrary::ClearFloatCurve(UCurveFloat* Curve)
-{
-	if (IsValid(Curve))
-	{
-		Curve->FloatCurve.Reset();
-	}
-}
-
-void UFreeAnimHelpersLibrary::ClearVectorCurve(UCurveVector* Curve)
-{
-	if (IsValid(Curve))
-	{
-		Curve->FloatCurves[0].Reset();
-		Curve->FloatCurves[1].Reset();
-		Curve->FloatCurves[2].Reset();
-	}
-}
-
-float UFreeAnimHelpersLibrary::GetAnimationNotifyAbsTime(const FAnimNotifyEvent& AnimNotify)
-{
-	return AnimNotify.GetTime(EAnimLinkMethod::Absolute);
-}
-
-FTransform UFreeAnimHelpersLibrary::GetBonePositionAtTimeInCS_ToParent(const UAnimSequence* AnimationSequence, const FName& BoneName, float Time, const FTransform& ParentBonePos, const int32 ParentBoneIndex)
-{
-	const FReferenceSkeleton& RefSkeleton = AnimationSequence->GetPreviewMesh()
-		? AnimationSequence->GetPreviewMesh()->GetRefSkeleton()
-		: AnimationSequence->GetSkeleton()->GetReferenceSkeleton();
-	USkeleton* Skeleton = AnimationSequence->GetSkeleton();
-	const TArray<FTransform>& RefPoseSpaceBaseTMs = RefSkeleton.GetRefBonePose();
-
-	int32 TransformIndex = RefSkeleton.FindBoneIndex(BoneName);
-	FTransform tr_bone = FTransform::Identity;
-
-	// @TODO: optimize by using GetBonePosesForTime and set of bones
-	while (TransformIndex != INDEX_NONE && TransformIndex != ParentBoneIndex)
-	{
-		FTransform ParentBoneTr;
-		UFreeAnimHelpersLibrary::GetBonePoseForTime(AnimationSequence, RefSkeleton.GetBoneName(TransformIndex), Time, false, ParentBoneTr);
-
-		EBoneTranslationRetargetingMode::Type RetargetType = Skeleton->GetBoneTranslationRetargetingMode(TransformIndex);
-		if (RetargetType == EBoneTranslationRetargetingMode::Type::Skeleton)
-		{
-			ParentBoneTr.SetTranslationAndScale3D(RefPoseSpaceBaseTMs[TransformIndex].GetTranslation(), RefPoseSpaceBaseTMs[TransformIndex].GetScale3D());
-		}
-
-		tr_bone *= ParentBoneTr;
-		TransformIndex = RefSkeleton.GetParentIndex(TransformIndex);
-	}
-
-	if (ParentBoneIndex != INDEX_NONE && TransformIndex == ParentBoneIndex)
-	{
-		tr_bone *= ParentBonePos;
-	}
-
-	tr_bone.NormalizeRotation();
-
-	return tr_bone;
-}
-
-/* Find axis of rotator the closest to being parallel to the specified vectors. Returns +1.f in Multiplier if co-directed and -1.f otherwise */
-EAxis::Type UFreeAnimHelpersLibrary::FindCoDirection(const FRotator& BoneRotator, const FVector& Direction, float& ResultMultiplier)
-{
-	EAxis::Type RetAxis;
-	FVector dir = Direction;
-	dir.Normalize();
-
-	const FVector v1 = FRotationMatrix(BoneRotator).GetScaledAxis(EAxis::X);
-	const FVector v2 = FRotationMatrix(BoneRotator).GetScaledAxis(EAxis::Y);
-	const FVector v3 = FRotationMatrix(BoneRotator).GetScaledAxis(EAxis::Z);
-
-	const float dp1 = FVector::DotProduct(v1, dir);
-	const float dp2 = FVector::DotProduct(v2, dir);
-	const float dp3 = FVector::DotProduct(v3, dir);
-
-	if (FMath::Abs(dp1) > FMath::Abs(dp2) && FMath::Abs(dp1) > FMath::Abs(dp3)) {
-		RetAxis = EAxis::X;
-		ResultMultiplier = dp1 > 0.f ? 1.f : -1.f;
-	}
-	else if (FMath::Abs(dp2) > FMath::Abs(dp1) && FMath::Abs(dp2) > FMath::Abs(dp3)) {
-		RetAxis = EAxis::Y;
-		ResultMultiplier = dp2 > 0.f ? 1.f : -1.f;
-	}
-	else {
-		RetAxis = EAxis::Z;
-		ResultMultiplier = dp3 > 0.f ? 1.f : -1.f;
-	}
-
-	return RetAxis;
-}
-
-FTransform UFreeAnimHelpersLibrary::GetSocketPositionAtTimeInCS(const UAnimSequence* AnimationSequence, const FName& SocketName, float Time)
-{
-	const USkeletalMeshSocket* Socket = AnimationSequence->GetSkeleton()->FindSocket(SocketName);
-	if (Socket)
-	{
-		FTransform LocalTransform = FTransform(Socket->RelativeRotation, Socket->RelativeLocation, Socket->RelativeScale);
-		return LocalTransform * GetBonePositionAtTimeInCS(AnimationSequence, Socket->BoneName, Time);
-	}
-	else if (AnimationSequence->GetSkeleton()->GetReferenceSkeleton().FindBoneIndex(SocketName) != INDEX_NONE)
-	{
-		return GetBonePositionAtTimeInCS(AnimationSequence, SocketName, Time);
-	}
-	else
-	{
-		return FTransform::Identity;
-	}
-}
-
-void UFreeAnimHelpersLibrary::ResetSkinndeAssetRootBoneScale(USkeletalMesh* SkeletalMesh, bool bKeepModelSize)
-{
-	if (!IsValid(SkeletalMesh))
-	{
-		return;
-	}
-	USkeleton* Skeleton = SkeletalMesh->GetSkeleton();
-	FReferenceSkeleton& MeshRefSkeleton = SkeletalMesh->GetRefSkeleton();
-	const TArray<FTransform>& MeshRefPose = MeshRefSkeleton.GetRefBonePose();
-	if (MeshRefPose.IsEmpty())
-	{
-		return;
-	}
-
-	// Update reference skeleton
-	{
-		FTransform RootBoneTr = MeshRefPose[0];
-		float ApplyScale = (RootBoneTr.GetScale3D().X + RootBoneTr.GetScale3D().Y + RootBoneTr.GetScale3D().Z) / 3.f;
-		RootBoneTr.SetScale3D(FVector::OneVector);
-
-		FReferenceSkeletonModifier RefSkelModifier(MeshRefSkeleton, Skeleton);
-
-		RefSkelModifier.UpdateRefPoseTransform(0, RootBoneTr);
-		if (bKeepModelSize)
-		{
-			for (int32 BoneIndex = 1; BoneIndex < MeshRefPose.Num(); ++BoneIndex)
-			{
-				FTransform UnscaledBoneTr = MeshRefPose[BoneIndex];
-				UnscaledBoneTr.ScaleTranslation(ApplyScale);
-				RefSkelModifier.UpdateRefPoseTransform(BoneIndex, UnscaledBoneTr);
-			}
-		}
-	}
-	// this is called actually in FReferenceSkeletonModifier destructor
-	MeshRefSkeleton.RebuildRefSkeleton(Skeleton, true);
-
-	// Update skeleton
-	Skeleton->UpdateReferencePoseFromMesh(SkeletalMesh);
-
-	// Update bounds
-	FVector MeshBoxBounds = FVector::ZeroVector;
-	int32 BonesNum = MeshRefSkeleton.GetRefBonePose().Num();
-	for (int32 BoneIndex = 0; BoneIndex < BonesNum; BoneIndex++)
-	{
-		FTransform t = GetRefSkeletonBonePositionByIndex(MeshRefSkeleton, BoneIndex);
-		FVector BoneOffset = t.GetTranslation().GetAbs();
-		
-		MeshBoxBounds.X = FMath::Max(MeshBoxBounds.X, BoneOffset.X);
-		MeshBoxBounds.Y = FMath::Max(MeshBoxBounds.Y, BoneOffset.Y);
-		MeshBoxBounds.Z = FMath::Max(MeshBoxBounds.Z, BoneOffset.Z);
-	}
-	MeshBoxBounds.Z *= 0.5f;
-		
-	FBoxSphereBounds Bounds;
-	Bounds.BoxExtent = MeshBoxBounds;
-	Bounds.Origin = FVector(0.f, 0.f, MeshBoxBounds.Z);
-	Bounds.SphereRadius = (MeshBoxBounds.X + MeshBoxBounds.Y + MeshBoxBounds.Z) / 3.f;
-	SkeletalMesh->SetImportedBounds(Bounds);
-	SkeletalMesh->SetPositiveBoundsExtension(FVector::ZeroVector);
-	SkeletalMesh->SetNegativeBoundsExtension(FVector::ZeroVector);
-	SkeletalMesh->CalculateExtendedBounds();
-
-	FMessageDialog::Open(EAppMsgType::Type::Ok, NSLOCTEXT("FreeAnimHelpersLibrary", "RootBoneScaleSucceed", "Root bone was rescaled successfully. Please restart Unreal Editor."));
-}
-
-const FFloatCurve* UFreeAnimHelpersLibrary::GetFloatCurve(const UAnimSequence* AnimationSequence, const FName& CurveName, FAnimationCurveIdentifier& OutCurveId)
-{
-	// Get Container name
-	const ERawCurveTrackTypes t = UAnimationBlueprintLibrary::RetrieveCurveTypeForCurve(AnimationSequence, CurveName);
-	if (t != ERawCurveTrackTypes::RCT_Float)
-	{
-		return nullptr;
-	}
-	// Read Curve ID
-	OutCurveId = FAnimationCurveIdentifier(CurveName, ERawCurveTrackTypes::RCT_Float);
-	// Get Curve Data
-	return static_cast<const FFloatCurve*>(AnimationSequence->GetDataModel()->FindCurve(OutCurveId));
-}
-
-void UFreeAnimHelpersLibrary::GetBonePoseForTime(const UAnimSequenceBase* AnimationSequenceBase, const FName& BoneName, float Time, bool bExtractRootMotion, FTransform& Pose, const USkeletalMesh* PreviewMesh /*= nullptr*/)
-{
-	TArray<FName> BoneNames = { BoneName };
-	TArray<FTransform> Poses;
-	Poses.SetNum(1);
-	GetBonePosesForTime(AnimationSequenceBase, BoneNames, Time, bExtractRootMotion, Poses, PreviewMesh);
-
-	if (Poses.Num() == 1)
-	{
-		Pose = Poses[0];
-	}
-}
-
-void UFreeAnimHelpersLibrary::GetBonePosesForTime(const UAnimSequenceBase* AnimationSequenceBase, const TArray<FName>& BoneNames, float Time, bool bExtractRootMotion, TArray<FTransform>& Poses, const USkeletalMesh* PreviewMesh /*= nullptr*/)
-{
-#if ENGINE_MINOR_VERSION > 1
-	Poses.Empty(BoneNames.Num());
-	if (!AnimationSequenceBase && AnimationSequenceBase->GetSkeleton())
-	{
-		UE_LOG(LogTemp, Warning, TEXT("Invalid Animation Sequence supplied for GetBonePosesForTime"));
-	}
-
-	Poses.AddDefaulted(BoneNames.Num());
-
-	// Need this for FCompactPose
-	FMemMark Mark(FMemStack::Get());
-
-	const FReferenceSkeleton& RefSkeleton = (PreviewMesh) ? PreviewMesh->GetRefSkeleton() : AnimationSequenceBase->GetSkeleton()->GetReferenceSkeleton();
-
-	if (Time < 0.f || Time > AnimationSequenceBase->GetDataModel()->GetPlayLength())
-	{
-		UE_LOG(LogTemp, Warning, TEXT("Invalid time value %f for Animation Sequence %s supplied for GetBonePosesForTime"), Time, *AnimationSequenceBase->GetName());
-	}
-
-	if (BoneNames.IsEmpty())
-	{
-		UE_LOG(LogTemp, Error, TEXT("Invalid or no bone names specified to retrieve poses given Animation Sequence %s in GetBonePosesForTime"), *AnimationSequenceBase->GetName());
-	}
-
-	int32 Frame = AnimationSequenceBase->GetFrameAtTime(Time);
-
-	for (int32 BoneNameIndex = 0; BoneNameIndex < BoneNames.Num(); ++BoneNameIndex)
-	{
-		const FName& BoneName = BoneNames[BoneNameIndex];
-		FTransform& Transform = Poses[BoneNameIndex];
-		
-		if (AnimationSequenceBase->GetDataModel()->IsValidBoneTrackName(BoneName))
-		{
-			const EAnimInterpolationType InterpolationType = [AnimationSequenceBase]() -> EAnimInterpolationType
-			{
-				if (const UAnimSequence* AnimationSequence = Cast<const UAnimSequence>(AnimationSequenceBase))
-				{
-					return AnimationSequence->Interpolation;
-				}
-
-				return EAnimInterpolationType::Linear;
-			}();
-
-			Transform = AnimationSequenceBase->GetDataModel()->EvaluateBoneTrackTransform(BoneName, FFrameTime(Frame), InterpolationType);
-			//UE::Anim::GetBoneTransformFromModel(AnimationSequenceBase->GetDataModel(), Transform, AnimationSequenceBase->GetDataModel()->GetBoneTrackIndexByName(BoneName), Time, InterpolationType);
-		}
-		else
-		{
-			// otherwise, get ref pose if exists
-			const int32 BoneIndex = RefSkeleton.FindBoneIndex(BoneName);
-			if (BoneIndex != INDEX_NONE)
-			{
-				Transform = RefSkeleton.GetRefBonePose()[BoneIndex];
-			}
-			else
-			{
-				UE_LOG(LogTemp, Warning, TEXT("Invalid bone name %s for Animation Sequence %s supplied for GetBonePosesForTime"), *BoneName.ToString(), *AnimationSequenceBase->GetName());
-				Transform = FTransform::Identity;
-			}
-		}
-	}
-#else
-	UAnimationBlueprintLibrary::GetBonePosesForTime(AnimationSequenceBase, BoneNames, Time, bExtractRootMotion, Poses, PreviewMesh);
-#endif
-}
\ No newline at end of file
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "FreeAnimHelpersLibrary.h"
+#include "FreeAnimDiagnostics.h"
+#include "AnimSkeletonBinding.h"
+#include "RefPoseCache.h"
+#include "FreeAnimProfiler.h"
+#include "FreeAnimHelpersSettings.h"
+#include "AnimationBlueprintLibrary.h"
+#include "Animation/AnimLinkableElement.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include "Animation/AnimSequence.h"
+#include "Engine/SkeletalMesh.h"
+#include "Engine/SkeletalMeshSocket.h"
+#include "Curves/CurveFloat.h"
+#include "Curves/CurveVector.h"
+#include "Curves/RichCurve.h"
+#include "Animation/AnimTypes.h"
+#include "Algo/IsSorted.h"
+#include "Algo/StableSort.h"
+#include "ReferenceSkeleton.h"
+#include "Async/ParallelFor.h"
+#include "Misc/MemStack.h"
+#include "Misc/App.h"
+#include "Misc/MessageDialog.h"
+
+#include "Serialization/Archive.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/BufferArchive.h"
+
+static EAnimInterpolationType GetSequenceInterpolation(const UAnimSequenceBase* AnimationSequenceBase)
+{
+	if (const UAnimSequence* AnimationSequence = Cast<const UAnimSequence>(AnimationSequenceBase))
+	{
+		return AnimationSequence->Interpolation;
+	}
+	return EAnimInterpolationType::Linear;
+}
+
+FTransform UFreeAnimHelpersLibrary::GetBoneRefPositionInComponentSpace(const UAnimSequence* AnimationSequence, const FName& BoneName)
+{
+	const FReferenceSkeleton& RefSkeleton = AnimationSequence->GetPreviewMesh()
+		? AnimationSequence->GetPreviewMesh()->GetRefSkeleton()
+		: AnimationSequence->GetSkeleton()->GetReferenceSkeleton();
+	return GetBoneRefPositionInComponentSpaceByIndex(AnimationSequence, RefSkeleton.FindBoneIndex(BoneName));
+}
+
+FTransform UFreeAnimHelpersLibrary::GetSocketRefPositionInComponentSpace(const UAnimSequence* AnimationSequence, const FName& SocketName)
+{
+	const USkeletalMeshSocket* Socket = AnimationSequence->GetSkeleton()->FindSocket(SocketName);
+	if (!Socket)
+	{
+		return FTransform::Identity;
+	}
+
+	FTransform BoneTr = GetBoneRefPositionInComponentSpace(AnimationSequence, Socket->BoneName);
+	return FTransform(Socket->RelativeRotation, Socket->RelativeLocation, Socket->RelativeScale) * BoneTr;
+}
+
+FTransform UFreeAnimHelpersLibrary::GetBoneRefPositionInComponentSpaceByIndex(const UAnimSequence* AnimationSequence, int32 BoneIndex)
+{
+	return AnimationSequence->GetPreviewMesh()
+		? GetRefSkeletonBonePositionByIndex(AnimationSequence->GetPreviewMesh(), BoneIndex)
+		: GetRefSkeletonBonePositionByIndex(AnimationSequence->GetSkeleton(), BoneIndex);
+}
+
+FTransform UFreeAnimHelpersLibrary::GetRefSkeletonBonePositionByIndex(const USkeleton* Skeleton, int32 BoneIndex)
+{
+	if (!Skeleton)
+	{
+		return FTransform::Identity;
+	}
+	const TSharedRef<const TArray<FTransform>> RefPoseCS = FRefPoseCache::Get(Skeleton);
+	return RefPoseCS->IsValidIndex(BoneIndex) ? (*RefPoseCS)[BoneIndex] : FTransform::Identity;
+}
+
+FTransform UFreeAnimHelpersLibrary::GetRefSkeletonBonePositionByIndex(const USkeletalMesh* SkeletalMesh, int32 BoneIndex)
+{
+	if (!SkeletalMesh)
+	{
+		return FTransform::Identity;
+	}
+	const TSharedRef<const TArray<FTransform>> RefPoseCS = FRefPoseCache::Get(SkeletalMesh);
+	return RefPoseCS->IsValidIndex(BoneIndex) ? (*RefPoseCS)[BoneIndex] : FTransform::Identity;
+}
+
+FTransform UFreeAnimHelpersLibrary::GetRefSkeletonBonePositionByIndex(const FReferenceSkeleton& RefSkeleton, int32 BoneIndex)
+{
+	// reference skeleton without owner asset can't be cached
+	const TArray<FTransform>& RefPose = RefSkeleton.GetRefBonePose();
+	if (!RefPose.IsValidIndex(BoneIndex))
+	{
+		return FTransform::Identity;
+	}
+
+	FTransform BoneTr = FTransform::Identity;
+	for (int32 TransformIndex = BoneIndex; TransformIndex != INDEX_NONE; TransformIndex = RefSkeleton.GetParentIndex(TransformIndex))
+	{
+		BoneTr *= RefPose[TransformIndex];
+	}
+	BoneTr.NormalizeRotation();
+	return BoneTr;
+}
+
+FTransform UFreeAnimHelpersLibrary::GetBonePositionAtTimeInCS(const UAnimSequence* AnimationSequence, const FName& BoneName, float Time)
+{
+	return GetBonePositionAtTimeInCS_ToParent(AnimationSequence, BoneName, Time, FTransform(), INDEX_NONE);
+}
+
+void UFreeAnimHelpersLibrary::AddFloatCurveKey(UCurveFloat* Curve, float Time, float Value, bool bInterpCubic)
+{
+	if (IsValid(Curve))
+	{
+		FKeyHandle h = Curve->FloatCurve.UpdateOrAddKey(Time, Value);
+		if (bInterpCubic)
+		{
+			Curve->FloatCurve.SetKeyInterpMode(h, ERichCurveInterpMode::RCIM_Cubic);
+			Curve->FloatCurve.SetKeyTangentMode(h, ERichCurveTangentMode::RCTM_Auto);
+		}
+		else
+		{
+			Curve->FloatCurve.SetKeyInterpMode(h, ERichCurveInterpMode::RCIM_Linear);
+			Curve->FloatCurve.SetKeyTangentMode(h, ERichCurveTangentMode::RCTM_Auto);
+		}
+	}
+}
+
+void UFreeAnimHelpersLibrary::AddVectorCurveKey(UCurveVector* Curve, float Time, FVector Value, bool bInterpCubic)
+{
+	if (IsValid(Curve))
+	{
+		FKeyHandle hX = Curve->FloatCurves[0].UpdateOrAddKey(Time, Value.X);
+		FKeyHandle hY = Curve->FloatCurves[1].UpdateOrAddKey(Time, Value.Y);
+		FKeyHandle hZ = Curve->FloatCurves[2].UpdateOrAddKey(Time, Value.Z);
+		if (bInterpCubic)
+		{
+			Curve->FloatCurves[0].SetKeyInterpMode(hX, ERichCurveInterpMode::RCIM_Cubic);
+			Curve->FloatCurves[0].SetKeyTangentMode(hX, ERichCurveTangentMode::RCTM_Auto);
+			Curve->FloatCurves[1].SetKeyInterpMode(hY, ERichCurveInterpMode::RCIM_Cubic);
+			Curve->FloatCurves[1].SetKeyTangentMode(hY, ERichCurveTangentMode::RCTM_Auto);
+			Curve->FloatCurves[2].SetKeyInterpMode(hZ, ERichCurveInterpMode::RCIM_Cubic);
+			Curve->FloatCurves[2].SetKeyTangentMode(hZ, ERichCurveTangentMode::RCTM_Auto);
+		}
+		else
+		{
+			Curve->FloatCurves[0].SetKeyInterpMode(hX, ERichCurveInterpMode::RCIM_Linear);
+			Curve->FloatCurves[0].SetKeyTangentMode(hX, ERichCurveTangentMode::RCTM_Auto);
+			Curve->FloatCurves[1].SetKeyInterpMode(hY, ERichCurveInterpMode::RCIM_Linear);
+			Curve->FloatCurves[1].SetKeyTangentMode(hY, ERichCurveTangentMode::RCTM_Auto);
+			Curve->FloatCurves[2].SetKeyInterpMode(hZ, ERichCurveInterpMode::RCIM_Linear);
+			Curve->FloatCurves[2].SetKeyTangentMode(hZ, ERichCurveTangentMode::RCTM_Auto);
+		}
+	}
+}
+
+void UFreeAnimHelpersLibrary::ClearFloatCurve(UCurveFloat* Curve)
+{
+	if (IsValid(Curve))
+	{
+		Curve->FloatCurve.Reset();
+	}
+}
+
+void UFreeAnimHelpersLibrary::ClearVectorCurve(UCurveVector* Curve)
+{
+	if (IsValid(Curve))
+	{
+		Curve->FloatCurves[0].Reset();
+		Curve->FloatCurves[1].Reset();
+		Curve->FloatCurves[2].Reset();
+	}
+}
+
+float UFreeAnimHelpersLibrary::GetAnimationNotifyAbsTime(const FAnimNotifyEvent& AnimNotify)
+{
+	return AnimNotify.GetTime(EAnimLinkMethod::Absolute);
+}
+
+FTransform UFreeAnimHelpersLibrary::GetBonePositionAtTimeInCS_ToParent(const UAnimSequence* AnimationSequence, const FName& BoneName, float Time, const FTransform& ParentBonePos, const int32 ParentBoneIndex)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UFreeAnimHelpersLibrary::GetBonePositionAtTimeInCS);
+	FFreeAnimProfiler::AddCounter(EFreeAnimCounter::HierarchyWalks);
+
+	const TSharedRef<const FAnimSkeletonBinding> Binding = FAnimSkeletonBinding::Get(AnimationSequence, AnimationSequence->GetPreviewMesh());
+
+	// bones chain from BoneName up to (but excluding) parent bone; typical chains fit in inline storage
+	TArray<int32, TInlineAllocator<32>> ChainIndices;
+	int32 TransformIndex = Binding->FindBoneIndex(BoneName);
+	while (TransformIndex != INDEX_NONE && TransformIndex != ParentBoneIndex)
+	{
+		ChainIndices.Add(TransformIndex);
+		TransformIndex = Binding->GetParentIndex(TransformIndex);
+	}
+
+	// evaluate all bones in chain at once
+	TArray<FTransform, TInlineAllocator<32>> ChainPoses;
+	ChainPoses.SetNumUninitialized(ChainIndices.Num());
+	GetBonePosesForTimeByIndex(AnimationSequence, *Binding, ChainIndices, Time, ChainPoses);
+
+	FTransform tr_bone = FTransform::Identity;
+	for (int32 i = 0; i < ChainPoses.Num(); i++)
+	{
+		FTransform& ParentBoneTr = ChainPoses[i];
+		Binding->ApplyRetargeting(ChainIndices[i], ParentBoneTr);
+		tr_bone *= ParentBoneTr;
+	}
+
+	if (ParentBoneIndex != INDEX_NONE && TransformIndex == ParentBoneIndex)
+	{
+		tr_bone *= ParentBonePos;
+	}
+
+	tr_bone.NormalizeRotation();
+
+	return tr_bone;
+}
+
+void UFreeAnimHelpersLibrary::GetBonePositionsAtTimeInCS(const UAnimSequence* AnimationSequence, const TArray<FName>& BoneNames, float Time, TArray<FTransform>& OutTransforms)
+{
+	if (!AnimationSequence || !AnimationSequence->GetSkeleton())
+	{
+		OutTransforms.Init(FTransform::Identity, BoneNames.Num());
+		return;
+	}
+
+	const TSharedRef<const FAnimSkeletonBinding> Binding = FAnimSkeletonBinding::Get(AnimationSequence, AnimationSequence->GetPreviewMesh());
+
+	TArray<int32> BoneIndices;
+	Binding->FindBoneIndices(BoneNames, BoneIndices);
+
+	GetBonePositionsAtTimeInCSByIndex(AnimationSequence, *Binding, BoneIndices, Time, OutTransforms);
+}
+
+void UFreeAnimHelpersLibrary::GetBonePositionsAtTimeInCSByIndex(const UAnimSequence* AnimationSequence, const FAnimSkeletonBinding& Binding, const TArray<int32>& BoneIndices, float Time, TArray<FTransform>& OutTransforms)
+{
+	OutTransforms.SetNumUninitialized(BoneIndices.Num());
+	GetBonePositionsAtTimeInCSByIndex(AnimationSequence, Binding, MakeArrayView(BoneIndices), Time, MakeArrayView(OutTransforms));
+}
+
+void UFreeAnimHelpersLibrary::GetBonePositionsAtTimeInCSByIndex(const UAnimSequence* AnimationSequence, const FAnimSkeletonBinding& Binding, TArrayView<const int32> BoneIndices, float Time, TArrayView<FTransform> OutTransforms)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UFreeAnimHelpersLibrary::GetBonePositionsAtTimeInCS);
+	check(OutTransforms.Num() == BoneIndices.Num());
+
+	// scratch data lives in thread's mem stack until the end of the call
+	FMemMark Mark(FMemStack::Get());
+
+	// union of all parents of requested bones
+	TArray<int32, TMemStackAllocator<>> RequiredIndices;
+	Binding.GetBoneIndicesWithParents(BoneIndices, RequiredIndices);
+
+	// local poses of all required bones in a single call
+	TArray<FTransform, TMemStackAllocator<>> Poses;
+	Poses.SetNumUninitialized(RequiredIndices.Num());
+	GetBonePosesForTimeByIndex(AnimationSequence, Binding, RequiredIndices, Time, Poses);
+
+	// forward kinematics in parent-before-child order
+	TArray<int32, TMemStackAllocator<>> RefToRequired;
+	RefToRequired.Init(INDEX_NONE, Binding.GetNumBones());
+	TArray<int32, TMemStackAllocator<>> RequiredParents;
+	RequiredParents.SetNumUninitialized(RequiredIndices.Num());
+	for (int32 i = 0; i < Poses.Num(); i++)
+	{
+		const int32 BoneIndex = RequiredIndices[i];
+		const int32 ParentIndex = Binding.GetParentIndex(BoneIndex);
+
+		RefToRequired[BoneIndex] = i;
+		RequiredParents[i] = ParentIndex == INDEX_NONE ? INDEX_NONE : RefToRequired[ParentIndex];
+		Binding.ApplyRetargeting(BoneIndex, Poses[i]);
+	}
+	LocalToComponentSpace(Poses, RequiredParents, Poses);
+
+	for (int32 i = 0; i < BoneIndices.Num(); i++)
+	{
+		OutTransforms[i] = BoneIndices[i] == INDEX_NONE ? FTransform::Identity : Poses[RefToRequired[BoneIndices[i]]];
+	}
+}
+
+void UFreeAnimHelpersLibrary::LocalToComponentSpace(TArrayView<const FTransform> LocalPoses, TArrayView<const int32> ParentIndices, TArrayView<FTransform> OutComponentPoses)
+{
+	const int32 BonesNum = ParentIndices.Num();
+	if (BonesNum == 0)
+	{
+		return;
+	}
+	check(LocalPoses.Num() % BonesNum == 0 && OutComponentPoses.Num() == LocalPoses.Num());
+
+	const int32 FramesNum = LocalPoses.Num() / BonesNum;
+	FFreeAnimProfiler::AddCounter(EFreeAnimCounter::HierarchyWalks, FramesNum);
+
+	for (int32 FrameIndex = 0; FrameIndex < FramesNum; FrameIndex++)
+	{
+		const FTransform* Local = LocalPoses.GetData() + FrameIndex * BonesNum;
+		FTransform* Component = OutComponentPoses.GetData() + FrameIndex * BonesNum;
+
+		for (int32 BoneIndex = 0; BoneIndex < BonesNum; BoneIndex++)
+		{
+			const int32 ParentIndex = ParentIndices[BoneIndex];
+			Component[BoneIndex] = ParentIndex == INDEX_NONE ? Local[BoneIndex] : Local[BoneIndex] * Component[ParentIndex];
+			Component[BoneIndex].NormalizeRotation();
+		}
+	}
+}
+
+void UFreeAnimHelpersLibrary::ParallelForFrames(int32 FramesNum, TFunctionRef<void(int32 FrameIndex)> FrameBody)
+{
+	if (FramesNum <= 0)
+	{
+		return;
+	}
+
+	const UFreeAnimHelpersSettings* Settings = GetDefault<UFreeAnimHelpersSettings>();
+	const int32 MaxWorkers = Settings->MaxWorkerThreads > 0
+		? Settings->MaxWorkerThreads
+		: FTaskGraphInterface::Get().GetNumWorkerThreads() + 1;
+
+	// one block per worker, so number of blocks limits number of threads
+	const int32 FramesPerBlock = FMath::Max(FMath::Max(Settings->MinFramesPerTask, 1), FMath::DivideAndRoundUp(FramesNum, MaxWorkers));
+	const int32 BlocksNum = FMath::DivideAndRoundUp(FramesNum, FramesPerBlock);
+
+	// workers report to profiler of the calling thread, which outlives ParallelFor
+	FFreeAnimProfiler* Profiler = FFreeAnimProfiler::GetActive();
+
+	ParallelFor(BlocksNum, [FramesNum, FramesPerBlock, &FrameBody, Profiler](int32 BlockIndex)
+	{
+		FFreeAnimProfiler::FThreadScope ProfilerScope(Profiler);
+		const int32 FirstFrame = BlockIndex * FramesPerBlock;
+		const int32 EndFrame = FMath::Min(FirstFrame + FramesPerBlock, FramesNum);
+		for (int32 FrameIndex = FirstFrame; FrameIndex < EndFrame; FrameIndex++)
+		{
+			FrameBody(FrameIndex);
+		}
+	}, BlocksNum > 1 ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+}
+
+/* Find axis of rotator the closest to being parallel to the specified vectors. Returns +1.f in Multiplier if co-directed and -1.f otherwise */
+EAxis::Type UFreeAnimHelpersLibrary::FindCoDirection(const FRotator& BoneRotator, const FVector& Direction, float& ResultMultiplier)
+{
+	EAxis::Type RetAxis;
+	FVector dir = Direction;
+	dir.Normalize();
+
+	const FVector v1 = FRotationMatrix(BoneRotator).GetScaledAxis(EAxis::X);
+	const FVector v2 = FRotationMatrix(BoneRotator).GetScaledAxis(EAxis::Y);
+	const FVector v3 = FRotationMatrix(BoneRotator).GetScaledAxis(EAxis::Z);
+
+	const float dp1 = FVector::DotProduct(v1, dir);
+	const float dp2 = FVector::DotProduct(v2, dir);
+	const float dp3 = FVector::DotProduct(v3, dir);
+
+	if (FMath::Abs(dp1) > FMath::Abs(dp2) && FMath::Abs(dp1) > FMath::Abs(dp3)) {
+		RetAxis = EAxis::X;
+		ResultMultiplier = dp1 > 0.f ? 1.f : -1.f;
+	}
+	else if (FMath::Abs(dp2) > FMath::Abs(dp1) && FMath::Abs(dp2) > FMath::Abs(dp3)) {
+		RetAxis = EAxis::Y;
+		ResultMultiplier = dp2 > 0.f ? 1.f : -1.f;
+	}
+	else {
+		RetAxis = EAxis::Z;
+		ResultMultiplier = dp3 > 0.f ? 1.f : -1.f;
+	}
+
+	return RetAxis;
+}
+
+FTransform UFreeAnimHelpersLibrary::GetSocketPositionAtTimeInCS(const UAnimSequence* AnimationSequence, const FName& SocketName, float Time)
+{
+	const USkeletalMeshSocket* Socket = AnimationSequence->GetSkeleton()->FindSocket(SocketName);
+	if (Socket)
+	{
+		FTransform LocalTransform = FTransform(Socket->RelativeRotation, Socket->RelativeLocation, Socket->RelativeScale);
+		return LocalTransform * GetBonePositionAtTimeInCS(AnimationSequence, Socket->BoneName, Time);
+	}
+	else if (AnimationSequence->GetSkeleton()->GetReferenceSkeleton().FindBoneIndex(SocketName) != INDEX_NONE)
+	{
+		return GetBonePositionAtTimeInCS(AnimationSequence, SocketName, Time);
+	}
+	else
+	{
+		return FTransform::Identity;
+	}
+}
+
+void UFreeAnimHelpersLibrary::ResetSkinndeAssetRootBoneScale(USkeletalMesh* SkeletalMesh, bool bKeepModelSize)
+{
+	if (!IsValid(SkeletalMesh))
+	{
+		return;
+	}
+	USkeleton* Skeleton = SkeletalMesh->GetSkeleton();
+	FReferenceSkeleton& MeshRefSkeleton = SkeletalMesh->GetRefSkeleton();
+	const TArray<FTransform>& MeshRefPose = MeshRefSkeleton.GetRefBonePose();
+	if (MeshRefPose.IsEmpty())
+	{
+		return;
+	}
+
+	// Update reference skeleton
+	{
+		FTransform RootBoneTr = MeshRefPose[0];
+		float ApplyScale = (RootBoneTr.GetScale3D().X + RootBoneTr.GetScale3D().Y + RootBoneTr.GetScale3D().Z) / 3.f;
+		RootBoneTr.SetScale3D(FVector::OneVector);
+
+		FReferenceSkeletonModifier RefSkelModifier(MeshRefSkeleton, Skeleton);
+
+		RefSkelModifier.UpdateRefPoseTransform(0, RootBoneTr);
+		if (bKeepModelSize)
+		{
+			for (int32 BoneIndex = 1; BoneIndex < MeshRefPose.Num(); ++BoneIndex)
+			{
+				FTransform UnscaledBoneTr = MeshRefPose[BoneIndex];
+				UnscaledBoneTr.ScaleTranslation(ApplyScale);
+				RefSkelModifier.UpdateRefPoseTransform(BoneIndex, UnscaledBoneTr);
+			}
+		}
+	}
+	// this is called actually in FReferenceSkeletonModifier destructor
+	MeshRefSkeleton.RebuildRefSkeleton(Skeleton, true);
+
+	// Update skeleton
+	Skeleton->UpdateReferencePoseFromMesh(SkeletalMesh);
+
+	// Reference pose was changed in place
+	FRefPoseCache::Invalidate(SkeletalMesh);
+	FRefPoseCache::Invalidate(Skeleton);
+	FAnimSkeletonBinding::Invalidate(SkeletalMesh);
+	FAnimSkeletonBinding::Invalidate(Skeleton);
+
+	// Update bounds
+	FVector MeshBoxBounds = FVector::ZeroVector;
+	const TSharedRef<const TArray<FTransform>> MeshRefPoseCS = FRefPoseCache::Get(SkeletalMesh);
+	for (const FTransform& t : *MeshRefPoseCS)
+	{
+		FVector BoneOffset = t.GetTranslation().GetAbs();
+		
+		MeshBoxBounds.X = FMath::Max(MeshBoxBounds.X, BoneOffset.X);
+		MeshBoxBounds.Y = FMath::Max(MeshBoxBounds.Y, BoneOffset.Y);
+		MeshBoxBounds.Z = FMath::Max(MeshBoxBounds.Z, BoneOffset.Z);
+	}
+	MeshBoxBounds.Z *= 0.5f;
+		
+	FBoxSphereBounds Bounds;
+	Bounds.BoxExtent = MeshBoxBounds;
+	Bounds.Origin = FVector(0.f, 0.f, MeshBoxBounds.Z);
+	Bounds.SphereRadius = (MeshBoxBounds.X + MeshBoxBounds.Y + MeshBoxBounds.Z) / 3.f;
+	SkeletalMesh->SetImportedBounds(Bounds);
+	SkeletalMesh->SetPositiveBoundsExtension(FVector::ZeroVector);
+	SkeletalMesh->SetNegativeBoundsExtension(FVector::ZeroVector);
+	SkeletalMesh->CalculateExtendedBounds();
+
+	ShowMessage(NSLOCTEXT("FreeAnimHelpersLibrary", "RootBoneScaleSucceed", "Root bone was rescaled successfully. Please restart Unreal Editor."));
+}
+
+void UFreeAnimHelpersLibrary::ShowMessage(const FText& Message)
+{
+	// modal dialog would block build machine forever
+	if (IsRunningCommandlet() || FApp::IsUnattended())
+	{
+		UE_LOG(LogFreeAnimHelpers, Warning, TEXT("%s"), *Message.ToString());
+		return;
+	}
+	FMessageDialog::Open(EAppMsgType::Type::Ok, Message);
+}
+
+const FFloatCurve* UFreeAnimHelpersLibrary::GetFloatCurve(const UAnimSequence* AnimationSequence, const FName& CurveName, FAnimationCurveIdentifier& OutCurveId)
+{
+	// Get Container name
+	const ERawCurveTrackTypes t = UAnimationBlueprintLibrary::RetrieveCurveTypeForCurve(AnimationSequence, CurveName);
+	if (t != ERawCurveTrackTypes::RCT_Float)
+	{
+		return nullptr;
+	}
+	// Read Curve ID
+	OutCurveId = FAnimationCurveIdentifier(CurveName, ERawCurveTrackTypes::RCT_Float);
+	// Get Curve Data
+	return static_cast<const FFloatCurve*>(AnimationSequence->GetDataModel()->FindCurve(OutCurveId));
+}
+
+void UFreeAnimHelpersLibrary::SortCurveKeys(TArray<FRichCurveKey>& InOutKeys)
+{
+	// stable sort keeps keys with the same time in order of adding
+	if (!Algo::IsSortedBy(InOutKeys, &FRichCurveKey::Time))
+	{
+		Algo::StableSortBy(InOutKeys, &FRichCurveKey::Time);
+	}
+
+	int32 KeysNum = 0;
+	for (int32 KeyIndex = 0; KeyIndex < InOutKeys.Num(); KeyIndex++)
+	{
+		if (KeysNum > 0 && FMath::IsNearlyEqual(InOutKeys[KeysNum - 1].Time, InOutKeys[KeyIndex].Time))
+		{
+			InOutKeys[KeysNum - 1] = InOutKeys[KeyIndex];
+		}
+		else
+		{
+			InOutKeys[KeysNum++] = InOutKeys[KeyIndex];
+		}
+	}
+	InOutKeys.SetNum(KeysNum);
+}
+
+int32 UFreeAnimHelpersLibrary::ReduceCurveKeys(TArray<FRichCurveKey>& InOutKeys, float MaxError)
+{
+	const int32 SourceKeysNum = InOutKeys.Num();
+	if (SourceKeysNum < 3 || MaxError <= 0.f)
+	{
+		return 0;
+	}
+	// cubic keys depend on tangents, so they can't be checked by line
+	for (const FRichCurveKey& Key : InOutKeys)
+	{
+		if (Key.InterpMode != ERichCurveInterpMode::RCIM_Linear)
+		{
+			return 0;
+		}
+	}
+
+	// first key of current segment and range of slopes of line from it which pass all skipped keys
+	FRichCurveKey AnchorKey = InOutKeys[0];
+	int32 AnchorIndex = 0;
+	float MinSlope = -MAX_flt, MaxSlope = MAX_flt;
+	// kept keys are moved to the beginning of array, AnchorKey is a copy because its slot can be overwritten
+	int32 KeysNum = 1;
+
+	auto StartSegment = [&](int32 KeyIndex)
+	{
+		AnchorKey = InOutKeys[KeyIndex];
+		AnchorIndex = KeyIndex;
+		InOutKeys[KeysNum++] = AnchorKey;
+		MinSlope = -MAX_flt;
+		MaxSlope = MAX_flt;
+	};
+
+	for (int32 KeyIndex = 1; KeyIndex < SourceKeysNum; KeyIndex++)
+	{
+		const FRichCurveKey& Key = InOutKeys[KeyIndex];
+		if (Key.Time - AnchorKey.Time > UE_SMALL_NUMBER)
+		{
+			const float Slope = (Key.Value - AnchorKey.Value) / (Key.Time - AnchorKey.Time);
+			if (Slope < MinSlope || Slope > MaxSlope)
+			{
+				// line to this key misses one of skipped keys: keep the previous key and start new segment from it
+				StartSegment(KeyIndex - 1);
+			}
+		}
+
+		const float DeltaTime = Key.Time - AnchorKey.Time;
+		if (DeltaTime <= UE_SMALL_NUMBER)
+		{
+			// keys with the same time make a step, which can't be checked by line: keep both of them
+			StartSegment(KeyIndex);
+			continue;
+		}
+
+		MinSlope = FMath::Max(MinSlope, (Key.Value - MaxError - AnchorKey.Value) / DeltaTime);
+		MaxSlope = FMath::Min(MaxSlope, (Key.Value + MaxError - AnchorKey.Value) / DeltaTime);
+	}
+
+	// slot of the last key is overwritten only if it's already kept
+	if (AnchorIndex != SourceKeysNum - 1)
+	{
+		InOutKeys[KeysNum++] = InOutKeys[SourceKeysNum - 1];
+	}
+	InOutKeys.SetNum(KeysNum);
+
+	return SourceKeysNum - KeysNum;
+}
+
+void UFreeAnimHelpersLibrary::GetBonePoseForTime(const UAnimSequenceBase* AnimationSequenceBase, const FName& BoneName, float Time, bool bExtractRootMotion, FTransform& Pose, const USkeletalMesh* PreviewMesh /*= nullptr*/)
+{
+#if ENGINE_MINOR_VERSION > 1
+	if (!AnimationSequenceBase || !AnimationSequenceBase->GetSkeleton())
+	{
+		UE_LOG(LogFreeAnimHelpers, Warning, TEXT("Invalid Animation Sequence supplied for GetBonePoseForTime"));
+		Pose = FTransform::Identity;
+		return;
+	}
+
+	if (Time < 0.f || Time > AnimationSequenceBase->GetDataModel()->GetPlayLength())
+	{
+		UE_LOG(LogFreeAnimHelpers, Warning, TEXT("Invalid time value %f for Animation Sequence %s supplied for GetBonePoseForTime"), Time, *AnimationSequenceBase->GetName());
+	}
+
+	GetBonePoseForFrame(AnimationSequenceBase, BoneName, GetFrameTimeAtTime(AnimationSequenceBase, Time), Pose, PreviewMesh);
+#else
+	UAnimationBlueprintLibrary::GetBonePoseForTime(AnimationSequenceBase, BoneName, Time, bExtractRootMotion, Pose, PreviewMesh);
+#endif
+}
+
+void UFreeAnimHelpersLibrary::GetBonePosesForTime(const UAnimSequenceBase* AnimationSequenceBase, const TArray<FName>& BoneNames, float Time, bool bExtractRootMotion, TArray<FTransform>& Poses, const USkeletalMesh* PreviewMesh /*= nullptr*/)
+{
+#if ENGINE_MINOR_VERSION > 1
+	if (!AnimationSequenceBase || !AnimationSequenceBase->GetSkeleton())
+	{
+		UE_LOG(LogFreeAnimHelpers, Warning, TEXT("Invalid Animation Sequence supplied for GetBonePosesForTime"));
+		Poses.Init(FTransform::Identity, BoneNames.Num());
+		return;
+	}
+
+	if (Time < 0.f || Time > AnimationSequenceBase->GetDataModel()->GetPlayLength())
+	{
+		UE_LOG(LogFreeAnimHelpers, Warning, TEXT("Invalid time value %f for Animation Sequence %s supplied for GetBonePosesForTime"), Time, *AnimationSequenceBase->GetName());
+	}
+
+	GetBonePosesForFrame(AnimationSequenceBase, BoneNames, GetFrameTimeAtTime(AnimationSequenceBase, Time), Poses, PreviewMesh);
+#else
+	UAnimationBlueprintLibrary::GetBonePosesForTime(AnimationSequenceBase, BoneNames, Time, bExtractRootMotion, Poses, PreviewMesh);
+#endif
+}
+
+void UFreeAnimHelpersLibrary::GetBonePosesForTimeByIndex(const UAnimSequenceBase* AnimationSequenceBase, const FAnimSkeletonBinding& Binding, const TArray<int32>& BoneIndices, float Time, TArray<FTransform>& Poses)
+{
+	GetBonePosesForFrameByIndex(AnimationSequenceBase, Binding, BoneIndices, GetFrameTimeAtTime(AnimationSequenceBase, Time), Poses);
+}
+
+void UFreeAnimHelpersLibrary::GetBonePosesForTimeByIndex(const UAnimSequenceBase* AnimationSequenceBase, const FAnimSkeletonBinding& Binding, TArrayView<const int32> BoneIndices, float Time, TArrayView<FTransform> Poses)
+{
+	GetBonePosesForFrameByIndex(AnimationSequenceBase, Binding, BoneIndices, GetFrameTimeAtTime(AnimationSequenceBase, Time), Poses);
+}
+
+FFrameTime UFreeAnimHelpersLibrary::GetFrameTimeAtTime(const UAnimSequenceBase* AnimationSequenceBase, float Time)
+{
+	const double Frame = AnimationSequenceBase->GetSamplingFrameRate().AsDecimal() * Time;
+
+	// time of integer frame doesn't survive float round trip exactly
+	const double NearestFrame = FMath::RoundToDouble(Frame);
+	return FMath::IsNearlyEqual(Frame, NearestFrame, 1.e-3)
+		? FFrameTime(static_cast<int32>(NearestFrame))
+		: FFrameTime::FromDecimal(Frame);
+}
+
+#if ENGINE_MINOR_VERSION > 1
+/* Keys surrounding sampled frame and blend weight between them, shared by all bones */
+struct FFrameSample
+{
+	FFrameNumber Key0;
+	FFrameNumber Key1;
+	float Alpha = 0.f;
+};
+
+static FFrameSample MakeFrameSample(const UAnimSequenceBase* AnimationSequenceBase, const FFrameTime& Frame)
+{
+	const int32 LastKey = FMath::Max(AnimationSequenceBase->GetDataModel()->GetNumberOfKeys() - 1, 0);
+
+	FFrameSample Sample;
+	Sample.Key0 = FMath::Clamp(Frame.FrameNumber.Value, 0, LastKey);
+	Sample.Key1 = FMath::Min(Sample.Key0.Value + 1, LastKey);
+
+	const bool bBetweenKeys = Frame.FrameNumber.Value >= 0 && Sample.Key0 != Sample.Key1;
+	if (bBetweenKeys && GetSequenceInterpolation(AnimationSequenceBase) != EAnimInterpolationType::Step)
+	{
+		Sample.Alpha = Frame.GetSubFrame();
+	}
+	return Sample;
+}
+
+static FTransform SampleBoneTrack(const IAnimationDataModel* DataModel, const FName& TrackName, const FFrameSample& Sample)
+{
+	const FTransform Key0 = DataModel->GetBoneTrackTransform(TrackName, Sample.Key0);
+	if (Sample.Alpha <= 0.f)
+	{
+		return Key0;
+	}
+
+	FTransform Result;
+	Result.Blend(Key0, DataModel->GetBoneTrackTransform(TrackName, Sample.Key1), Sample.Alpha);
+	return Result;
+}
+
+static FTransform SampleBonePose(const UAnimSequenceBase* AnimationSequenceBase, const FAnimSkeletonBinding& Binding, const FName& BoneName, const FFrameSample& Sample)
+{
+	const IAnimationDataModel* DataModel = AnimationSequenceBase->GetDataModel();
+	const int32 BoneIndex = Binding.FindBoneIndex(BoneName);
+	FFreeAnimProfiler::AddCounter(EFreeAnimCounter::TrackEvaluations);
+
+	if (BoneIndex != INDEX_NONE)
+	{
+		// animation track or ref pose
+		return Binding.HasTrack(BoneIndex)
+			? SampleBoneTrack(DataModel, BoneName, Sample)
+			: Binding.GetRefPose(BoneIndex);
+	}
+	else if (DataModel->IsValidBoneTrackName(BoneName))
+	{
+		// animated bone which doesn't exist in preview mesh
+		return SampleBoneTrack(DataModel, BoneName, Sample);
+	}
+
+	UE_LOG(LogFreeAnimHelpers, Warning, TEXT("Invalid bone name %s for Animation Sequence %s supplied for GetBonePosesForFrame"), *BoneName.ToString(), *AnimationSequenceBase->GetName());
+	return FTransform::Identity;
+}
+#endif
+
+void UFreeAnimHelpersLibrary::GetBonePoseForFrame(const UAnimSequenceBase* AnimationSequenceBase, const FName& BoneName, const FFrameTime& Frame, FTransform& Pose, const USkeletalMesh* PreviewMesh)
+{
+#if ENGINE_MINOR_VERSION > 1
+	if (!AnimationSequenceBase || !AnimationSequenceBase->GetSkeleton())
+	{
+		UE_LOG(LogFreeAnimHelpers, Warning, TEXT("Invalid Animation Sequence supplied for GetBonePoseForFrame"));
+		Pose = FTransform::Identity;
+		return;
+	}
+
+	const TSharedRef<const FAnimSkeletonBinding> Binding = FAnimSkeletonBinding::Get(AnimationSequenceBase, PreviewMesh);
+	Pose = SampleBonePose(AnimationSequenceBase, *Binding, BoneName, MakeFrameSample(AnimationSequenceBase, Frame));
+#else
+	const float Time = AnimationSequenceBase->GetSamplingFrameRate().AsSeconds(Frame);
+	UAnimationBlueprintLibrary::GetBonePoseForTime(AnimationSequenceBase, BoneName, Time, false, Pose, PreviewMesh);
+#endif
+}
+
+void UFreeAnimHelpersLibrary::GetBonePosesForFrame(const UAnimSequenceBase* AnimationSequenceBase, const TArray<FName>& BoneNames, const FFrameTime& Frame, TArray<FTransform>& Poses, const USkeletalMesh* PreviewMesh)
+{
+#if ENGINE_MINOR_VERSION > 1
+	if (!AnimationSequenceBase || !AnimationSequenceBase->GetSkeleton())
+	{
+		UE_LOG(LogFreeAnimHelpers, Warning, TEXT("Invalid Animation Sequence supplied for GetBonePosesForFrame"));
+		Poses.Init(FTransform::Identity, BoneNames.Num());
+		return;
+	}
+
+	Poses.Empty(BoneNames.Num());
+	Poses.AddDefaulted(BoneNames.Num());
+
+	if (BoneNames.IsEmpty())
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("Invalid or no bone names specified to retrieve poses given Animation Sequence %s in GetBonePosesForFrame"), *AnimationSequenceBase->GetName());
+	}
+
+	const TSharedRef<const FAnimSkeletonBinding> Binding = FAnimSkeletonBinding::Get(AnimationSequenceBase, PreviewMesh);
+	const FFrameSample Sample = MakeFrameSample(AnimationSequenceBase, Frame);
+
+	for (int32 BoneNameIndex = 0; BoneNameIndex < BoneNames.Num(); ++BoneNameIndex)
+	{
+		Poses[BoneNameIndex] = SampleBonePose(AnimationSequenceBase, *Binding, BoneNames[BoneNameIndex], Sample);
+	}
+#else
+	const float Time = AnimationSequenceBase->GetSamplingFrameRate().AsSeconds(Frame);
+	UAnimationBlueprintLibrary::GetBonePosesForTime(AnimationSequenceBase, BoneNames, Time, false, Poses, PreviewMesh);
+#endif
+}
+
+void UFreeAnimHelpersLibrary::GetBonePosesForFrameByIndex(const UAnimSequenceBase* AnimationSequenceBase, const FAnimSkeletonBinding& Binding, const TArray<int32>& BoneIndices, const FFrameTime& Frame, TArray<FTransform>& Poses)
+{
+	Poses.SetNumUninitialized(BoneIndices.Num());
+	GetBonePosesForFrameByIndex(AnimationSequenceBase, Binding, MakeArrayView(BoneIndices), Frame, MakeArrayView(Poses));
+}
+
+void UFreeAnimHelpersLibrary::GetBonePosesForFrameByIndex(const UAnimSequenceBase* AnimationSequenceBase, const FAnimSkeletonBinding& Binding, TArrayView<const int32> BoneIndices, const FFrameTime& Frame, TArrayView<FTransform> Poses)
+{
+	check(Poses.Num() == BoneIndices.Num());
+	if (BoneIndices.IsEmpty())
+	{
+		return;
+	}
+	TRACE_CPUPROFILER_EVENT_SCOPE(UFreeAnimHelpersLibrary::GetBonePosesForFrame);
+	FFreeAnimProfiler::AddCounter(EFreeAnimCounter::TrackEvaluations, BoneIndices.Num());
+
+#if ENGINE_MINOR_VERSION > 1
+	const IAnimationDataModel* DataModel = AnimationSequenceBase->GetDataModel();
+	const FFrameSample Sample = MakeFrameSample(AnimationSequenceBase, Frame);
+
+	for (int32 i = 0; i < BoneIndices.Num(); i++)
+	{
+		const int32 BoneIndex = BoneIndices[i];
+		Poses[i] = Binding.HasTrack(BoneIndex)
+			? SampleBoneTrack(DataModel, Binding.GetBoneName(BoneIndex), Sample)
+			: Binding.GetRefPose(BoneIndex);
+	}
+#else
+	TArray<FName> BoneNames;
+	BoneNames.Reserve(BoneIndices.Num());
+	for (const int32 BoneIndex : BoneIndices)
+	{
+		BoneNames.Add(Binding.GetBoneName(BoneIndex));
+	}
+	TArray<FTransform> BonePoses;
+	const float Time = AnimationSequenceBase->GetSamplingFrameRate().AsSeconds(Frame);
+	UAnimationBlueprintLibrary::GetBonePosesForTime(AnimationSequenceBase, BoneNames, Time, false, BonePoses);
+	for (int32 i = 0; i < BonePoses.Num(); i++)
+	{
+		Poses[i] = BonePoses[i];
+	}
+#endif
+}
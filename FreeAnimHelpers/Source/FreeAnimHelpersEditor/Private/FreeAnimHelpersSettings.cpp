@@ -0,0 +1,14 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "FreeAnimHelpersSettings.h"
+
+UFreeAnimHelpersSettings::UFreeAnimHelpersSettings()
+	: MaxWorkerThreads(0)
+	, MinFramesPerTask(16)
+	, MaxPoseCacheSizeMB(1024)
+	, bLogModifierTiming(false)
+	, bReduceKeys(false)
+	, MaxCurveError(0.01f)
+{
+}
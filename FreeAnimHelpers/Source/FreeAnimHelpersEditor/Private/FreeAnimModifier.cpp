@@ -0,0 +1,119 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "FreeAnimModifier.h"
+#include "TrackCommitWriter.h"
+#include "FreeAnimHelpersLibrary.h"
+#include "AnimSkeletonBinding.h"
+#include "FreeAnimProfiler.h"
+#include "Animation/AnimSequence.h"
+
+const UAnimSequence* UFreeAnimModifier::EvaluatedSequence = nullptr;
+const FFreeAnimModifierOutput* UFreeAnimModifier::EvaluatedOutput = nullptr;
+
+UFreeAnimModifier::FScopedEvaluatedOutput::FScopedEvaluatedOutput(const UAnimSequence* AnimationSequence, const FFreeAnimModifierOutput& Output)
+	: PrevSequence(EvaluatedSequence)
+	, PrevOutput(EvaluatedOutput)
+{
+	check(IsInGameThread());
+	EvaluatedSequence = AnimationSequence;
+	EvaluatedOutput = &Output;
+}
+
+UFreeAnimModifier::FScopedEvaluatedOutput::~FScopedEvaluatedOutput()
+{
+	EvaluatedSequence = PrevSequence;
+	EvaluatedOutput = PrevOutput;
+}
+
+void UFreeAnimModifier::OnApply_Implementation(UAnimSequence* AnimationSequence)
+{
+	FFreeAnimProfiler Profiler(this, AnimationSequence);
+	LastApplyResult = EFreeAnimApplyResult::Skipped;
+
+	// output of batch or preview is committed once, next applications evaluate the modifier
+	if (EvaluatedOutput && EvaluatedSequence == AnimationSequence)
+	{
+		const FFreeAnimModifierOutput* Output = EvaluatedOutput;
+		EvaluatedOutput = nullptr;
+		LastApplyResult = CommitOutput(AnimationSequence, *Output) == INDEX_NONE ? EFreeAnimApplyResult::Failed : EFreeAnimApplyResult::Applied;
+		return;
+	}
+
+	FFreeAnimModifierEvaluation Evaluation;
+	{
+		FREEANIM_SCOPE("Setup");
+		Evaluation = PrepareEvaluation(AnimationSequence);
+	}
+	if (!Evaluation)
+	{
+		return;
+	}
+
+	FFreeAnimModifierOutput Output;
+	bool bEvaluated;
+	{
+		FREEANIM_SCOPE("Evaluate");
+		bEvaluated = Evaluation(FFreeAnimModifierInput(), Output);
+	}
+	if (bEvaluated)
+	{
+		LastApplyResult = CommitOutput(AnimationSequence, Output) == INDEX_NONE ? EFreeAnimApplyResult::Failed : EFreeAnimApplyResult::Applied;
+	}
+}
+
+const TArray<FRichCurveKey>* FFreeAnimModifierInput::FindFloatCurve(const FName& CurveName) const
+{
+	if (!FloatCurves)
+	{
+		return nullptr;
+	}
+	const auto* Curve = FloatCurves->FindByPredicate([&CurveName](const TPair<FName, TArray<FRichCurveKey>>& Item) { return Item.Key == CurveName; });
+	return Curve ? &Curve->Value : nullptr;
+}
+
+TArray<int32> FFreeAnimModifierInput::MakeSlotMap(const FAnimSkeletonBinding& Binding) const
+{
+	TArray<int32> SlotMap;
+	if (Tracks && Tracks->IsValid())
+	{
+		SlotMap.SetNumUninitialized(Binding.GetNumBones());
+		for (int32 BoneIndex = 0; BoneIndex < SlotMap.Num(); BoneIndex++)
+		{
+			SlotMap[BoneIndex] = Tracks->FindSlot(Binding.GetBoneName(BoneIndex));
+		}
+	}
+	return SlotMap;
+}
+
+void FFreeAnimModifierInput::GetBonePosesForFrame(const UAnimSequence* AnimationSequence, const FAnimSkeletonBinding& Binding, TArrayView<const int32> BoneIndices, TArrayView<const int32> SlotMap, int32 FrameIndex, TArrayView<FTransform> OutPoses) const
+{
+	UFreeAnimHelpersLibrary::GetBonePosesForFrameByIndex(AnimationSequence, Binding, BoneIndices, FFrameTime(FrameIndex), OutPoses);
+
+	if (SlotMap.IsEmpty())
+	{
+		return;
+	}
+	check(Tracks && SlotMap.Num() == Binding.GetNumBones());
+	const int32 KeyIndex = FMath::Min(FrameIndex, Tracks->GetNumFrames() - 1);
+	for (int32 Index = 0; Index < BoneIndices.Num(); Index++)
+	{
+		const int32 Slot = BoneIndices[Index] == INDEX_NONE ? INDEX_NONE : SlotMap[BoneIndices[Index]];
+		if (Slot != INDEX_NONE)
+		{
+			OutPoses[Index] = Tracks->GetKey(Slot, KeyIndex);
+		}
+	}
+}
+
+int32 UFreeAnimModifier::CommitOutput(UAnimSequence* AnimationSequence, const FFreeAnimModifierOutput& Output, bool bShouldTransact)
+{
+	FTrackCommitWriter Writer(AnimationSequence, bShouldTransact);
+	Writer.AddBoneTracks(Output.Tracks);
+	for (const auto& Curve : Output.FloatCurves)
+	{
+		Writer.AddFloatCurve(Curve.Key, Curve.Value);
+	}
+	const int32 ChangesNum = Writer.Commit();
+	return Writer.GetFailedNum() > 0 ? INDEX_NONE : ChangesNum;
+}
@@ -0,0 +1,375 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "FreeAnimModifierBatch.h"
+#include "FreeAnimModifier.h"
+#include "FreeAnimHelpersSettings.h"
+#include "FreeAnimProfiler.h"
+#include "FreeAnimDiagnostics.h"
+#include "AnimationModifier.h"
+#include "AnimationModifiersAssetUserData.h"
+#include "Animation/AnimSequence.h"
+#include "Animation/AnimData/IAnimationDataModel.h"
+#include "Animation/AnimData/AnimDataNotifications.h"
+#include "Async/Async.h"
+#include "Misc/OutputDevice.h"
+#include "UObject/UnrealType.h"
+#include "Misc/ScopedSlowTask.h"
+#include "UObject/UObjectIterator.h"
+#include <atomic>
+
+#define LOCTEXT_NAMESPACE "FFreeAnimModifierBatch"
+
+namespace FreeAnimModifierBatch
+{
+	static const TCHAR* ModulePackageName = TEXT("/Script/FreeAnimHelpersEditor");
+
+	/** Evaluation running on worker thread. Output is empty if modifier returned false */
+	struct FPendingEvaluation
+	{
+		UAnimSequence* AnimationSequence = nullptr;
+		TFuture<TUniquePtr<FFreeAnimModifierOutput>> Output;
+	};
+
+	/* Profiler of evaluation is created on the evaluating thread, so sequences evaluated at the same time are reported separately */
+	static TUniquePtr<FFreeAnimModifierOutput> Evaluate(FFreeAnimModifierEvaluation& Evaluation, const UAnimationModifier* Modifier, const UAnimSequence* AnimationSequence)
+	{
+		FFreeAnimProfiler Profiler(Modifier, AnimationSequence);
+		FREEANIM_SCOPE("Evaluate");
+
+		TUniquePtr<FFreeAnimModifierOutput> Output = MakeUnique<FFreeAnimModifierOutput>();
+		if (!Evaluation(FFreeAnimModifierInput(), *Output))
+		{
+			Output.Reset();
+		}
+		return Output;
+	}
+
+	/**
+	 * Notices errors logged while modifier which isn't UFreeAnimModifier is applied: such modifiers report failures only to log.
+	 * Only errors of the thread applying the modifier are counted, evaluations of other sequences and editor log to other threads
+	 */
+	class FLoggedErrorCapture : public FOutputDevice
+	{
+	public:
+		FLoggedErrorCapture()
+			: ThreadId(FPlatformTLS::GetCurrentThreadId())
+		{
+			GLog->AddOutputDevice(this);
+		}
+		virtual ~FLoggedErrorCapture() override { GLog->RemoveOutputDevice(this); }
+
+		virtual void Serialize(const TCHAR* V, ELogVerbosity::Type Verbosity, const FName& Category) override
+		{
+			const ELogVerbosity::Type Level = (ELogVerbosity::Type)(Verbosity & ELogVerbosity::VerbosityMask);
+			if ((Level == ELogVerbosity::Error || Level == ELogVerbosity::Fatal) && FPlatformTLS::GetCurrentThreadId() == ThreadId)
+			{
+				bErrorLogged = true;
+			}
+		}
+		/* called by the logging thread itself, otherwise messages are buffered and serialized by another thread */
+		virtual bool CanBeUsedOnAnyThread() const override { return true; }
+		virtual bool CanBeUsedOnMultipleThreads() const override { return true; }
+
+		std::atomic<bool> bErrorLogged = false;
+
+	private:
+		const uint32 ThreadId;
+	};
+
+	static void AddResult(FFreeAnimModifierBatchResult& Result, EFreeAnimApplyResult ApplyResult)
+	{
+		switch (ApplyResult)
+		{
+			case EFreeAnimApplyResult::Applied: Result.Applied++; break;
+			case EFreeAnimApplyResult::Skipped: Result.Skipped++; break;
+			case EFreeAnimApplyResult::Failed: Result.Failed++; break;
+		}
+	}
+
+	/* Instances list of asset user data isn't exposed for writing, the same property is used by Animation Data Modifiers window */
+	static TArray<TObjectPtr<UAnimationModifier>>* GetModifierInstances(UAnimationModifiersAssetUserData* UserData)
+	{
+		const FArrayProperty* InstancesProperty = FindFProperty<FArrayProperty>(UAnimationModifiersAssetUserData::StaticClass(), TEXT("AnimationModifierInstances"));
+		return InstancesProperty
+			? InstancesProperty->ContainerPtrToValuePtr<TArray<TObjectPtr<UAnimationModifier>>>(UserData)
+			: nullptr;
+	}
+}
+
+FFreeAnimModifierBatchResult FFreeAnimModifierBatch::Apply(UAnimationModifier* Modifier, const TArray<UAnimSequence*>& Sequences, bool bShowProgress)
+{
+	using namespace FreeAnimModifierBatch;
+
+	FFreeAnimModifierBatchResult Result;
+	if (!IsValid(Modifier) || Sequences.IsEmpty())
+	{
+		return Result;
+	}
+
+	FScopedSlowTask SlowTask((float)Sequences.Num(), FText::Format(LOCTEXT("ApplyModifier", "Applying {0}..."), Modifier->GetClass()->GetDisplayNameText()));
+	if (bShowProgress)
+	{
+		SlowTask.MakeDialog(true);
+	}
+
+	const UFreeAnimModifier* FreeModifier = Cast<UFreeAnimModifier>(Modifier);
+	if (!FreeModifier)
+	{
+		// modifier can't be evaluated outside of game thread
+		for (UAnimSequence* AnimationSequence : Sequences)
+		{
+			if (SlowTask.ShouldCancel())
+			{
+				Result.bCanceled = true;
+				break;
+			}
+			SlowTask.EnterProgressFrame(1.f, IsValid(AnimationSequence) ? FText::FromString(AnimationSequence->GetName()) : FText::GetEmpty());
+
+			AddResult(Result, ApplyToSequence(Modifier, AnimationSequence));
+		}
+		return Result;
+	}
+
+	// sequences read by evaluations of other sequences: later sequences are prepared and evaluated only after they are committed,
+	// so nothing reads data model while it's changed and every sequence sees the same data as in sequential application
+	TArray<const UAnimSequence*> ReferencedSequences;
+	FreeModifier->GetReferencedSequences(ReferencedSequences);
+	auto IsReferenced = [&ReferencedSequences](const FPendingEvaluation& Pending) { return ReferencedSequences.Contains(Pending.AnimationSequence); };
+
+	// number of sequences evaluated at the same time, each of them also evaluates frames in parallel
+	const UFreeAnimHelpersSettings* Settings = GetDefault<UFreeAnimHelpersSettings>();
+	const int32 MaxInFlight = Settings->MaxWorkerThreads > 0
+		? Settings->MaxWorkerThreads
+		: FTaskGraphInterface::Get().GetNumWorkerThreads() + 1;
+
+	TArray<FPendingEvaluation> InFlight;
+	int32 NextSequence = 0;
+
+	while (NextSequence < Sequences.Num() || InFlight.Num() > 0)
+	{
+		// schedule new evaluations, preparation reads assets and has to be done on game thread
+		while (!Result.bCanceled && NextSequence < Sequences.Num() && InFlight.Num() < MaxInFlight && !InFlight.ContainsByPredicate(IsReferenced))
+		{
+			UAnimSequence* AnimationSequence = Sequences[NextSequence++];
+			FFreeAnimModifierEvaluation Evaluation;
+			if (IsValid(AnimationSequence))
+			{
+				FREEANIM_SCOPE("Setup");
+				Evaluation = FreeModifier->PrepareEvaluation(AnimationSequence);
+			}
+
+			if (!Evaluation)
+			{
+				SlowTask.EnterProgressFrame(1.f);
+				Result.Skipped++;
+				continue;
+			}
+
+			FPendingEvaluation& Pending = InFlight.AddDefaulted_GetRef();
+			Pending.AnimationSequence = AnimationSequence;
+			if (MaxInFlight > 1)
+			{
+				Pending.Output = Async(EAsyncExecution::ThreadPool, [Evaluation = MoveTemp(Evaluation), Modifier, AnimationSequence]() mutable
+				{
+					return Evaluate(Evaluation, Modifier, AnimationSequence);
+				});
+			}
+			else
+			{
+				// multithreading is disabled in settings
+				TPromise<TUniquePtr<FFreeAnimModifierOutput>> Promise;
+				Promise.SetValue(Evaluate(Evaluation, Modifier, AnimationSequence));
+				Pending.Output = Promise.GetFuture();
+			}
+		}
+
+		if (InFlight.IsEmpty())
+		{
+			break;
+		}
+
+		// commit in order of sequences, keep progress dialog responsive while waiting
+		FPendingEvaluation Pending = MoveTemp(InFlight[0]);
+		InFlight.RemoveAt(0);
+
+		while (!Pending.Output.WaitFor(FTimespan::FromMilliseconds(50.0)))
+		{
+			SlowTask.TickProgress();
+		}
+		TUniquePtr<FFreeAnimModifierOutput> Output = Pending.Output.Consume();
+
+		// evaluations started before cancellation are finished, but not committed
+		if (Result.bCanceled)
+		{
+			continue;
+		}
+
+		SlowTask.EnterProgressFrame(1.f, FText::FromString(Pending.AnimationSequence->GetName()));
+		AddResult(Result, Output.IsValid() ? RegisterAndApply(Modifier, Pending.AnimationSequence, Output.Get()) : EFreeAnimApplyResult::Skipped);
+
+		if (SlowTask.ShouldCancel())
+		{
+			Result.bCanceled = true;
+		}
+	}
+
+	return Result;
+}
+
+EFreeAnimApplyResult FFreeAnimModifierBatch::ApplyToSequence(UAnimationModifier* Modifier, UAnimSequence* AnimationSequence)
+{
+	using namespace FreeAnimModifierBatch;
+
+	if (!IsValid(Modifier) || !IsValid(AnimationSequence))
+	{
+		return EFreeAnimApplyResult::Skipped;
+	}
+
+	FFreeAnimProfiler Profiler(Modifier, AnimationSequence);
+
+	if (const UFreeAnimModifier* FreeModifier = Cast<UFreeAnimModifier>(Modifier))
+	{
+		FFreeAnimModifierEvaluation Evaluation;
+		{
+			FREEANIM_SCOPE("Setup");
+			Evaluation = FreeModifier->PrepareEvaluation(AnimationSequence);
+		}
+		if (!Evaluation)
+		{
+			FFreeAnimDiagnostics::Dump(TEXT("modifier can't be applied"));
+			return EFreeAnimApplyResult::Skipped;
+		}
+		TUniquePtr<FFreeAnimModifierOutput> Output = Evaluate(Evaluation, Modifier, AnimationSequence);
+		if (!Output.IsValid())
+		{
+			FFreeAnimDiagnostics::Dump(TEXT("modifier can't be applied"));
+			return EFreeAnimApplyResult::Skipped;
+		}
+		return RegisterAndApply(Modifier, AnimationSequence, Output.Get());
+	}
+
+	return RegisterAndApply(Modifier, AnimationSequence);
+}
+
+EFreeAnimApplyResult FFreeAnimModifierBatch::RegisterAndApply(UAnimationModifier* Modifier, UAnimSequence* AnimationSequence, const FFreeAnimModifierOutput* EvaluatedOutput)
+{
+	using namespace FreeAnimModifierBatch;
+
+	if (!IsValid(Modifier) || !IsValid(AnimationSequence))
+	{
+		return EFreeAnimApplyResult::Skipped;
+	}
+
+	UAnimationModifiersAssetUserData* UserData = AnimationSequence->GetAssetUserData<UAnimationModifiersAssetUserData>();
+	if (!UserData)
+	{
+		UserData = NewObject<UAnimationModifiersAssetUserData>(AnimationSequence, NAME_None, RF_Transactional);
+		AnimationSequence->AddAssetUserData(UserData);
+	}
+	TArray<TObjectPtr<UAnimationModifier>>* Instances = GetModifierInstances(UserData);
+	if (!Instances)
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("Can't register %s in animation modifiers of %s"), *Modifier->GetClass()->GetName(), *AnimationSequence->GetName());
+		return EFreeAnimApplyResult::Skipped;
+	}
+
+	// modifier is the template of the new instance, so its settings and instanced stages are copied.
+	// Instances registered before aren't replaced: their changes stay in the sequence and can still be reverted
+	UAnimationModifier* Instance = NewObject<UAnimationModifier>(UserData, Modifier->GetClass(), NAME_None, RF_Transactional, Modifier);
+	UserData->Modify();
+	Instances->Add(Instance);
+
+	// failures of modifiers are only visible as errors in log and as unchanged animation data
+	bool bDataChanged = false;
+	const FDelegateHandle ModifiedHandle = AnimationSequence->GetDataModel()->GetModifiedEvent().AddLambda([&bDataChanged](const EAnimDataModelNotifyType& NotifyType, IAnimationDataModel*, const FAnimDataModelNotifPayload&)
+	{
+		bDataChanged |= NotifyType != EAnimDataModelNotifyType::BracketOpened && NotifyType != EAnimDataModelNotifyType::BracketClosed;
+	});
+	const UFreeAnimModifier* FreeInstance = Cast<UFreeAnimModifier>(Instance);
+	bool bErrorLogged = false;
+	{
+		TOptional<FLoggedErrorCapture> ErrorCapture;
+		if (!FreeInstance)
+		{
+			ErrorCapture.Emplace();
+		}
+		TOptional<UFreeAnimModifier::FScopedEvaluatedOutput> EvaluatedOutputScope;
+		if (EvaluatedOutput)
+		{
+			EvaluatedOutputScope.Emplace(AnimationSequence, *EvaluatedOutput);
+		}
+		Instance->ApplyToAnimationSequence(AnimationSequence);
+		bErrorLogged = ErrorCapture.IsSet() && ErrorCapture->bErrorLogged;
+	}
+	AnimationSequence->GetDataModel()->GetModifiedEvent().Remove(ModifiedHandle);
+
+	if (!bDataChanged)
+	{
+		// modifier which didn't change anything isn't kept in the list
+		Instances->Remove(Instance);
+		FFreeAnimDiagnostics::Dump(TEXT("modifier didn't change animation"));
+		return EFreeAnimApplyResult::Skipped;
+	}
+
+	AnimationSequence->MarkPackageDirty();
+
+	const bool bFailed = FreeInstance ? FreeInstance->GetLastApplyResult() == EFreeAnimApplyResult::Failed : bErrorLogged;
+	if (bFailed)
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("%s changed %s with errors, it's kept in animation modifiers so the changes can be reverted"),
+			*Modifier->GetClass()->GetName(), *AnimationSequence->GetName());
+		return EFreeAnimApplyResult::Failed;
+	}
+	return EFreeAnimApplyResult::Applied;
+}
+
+void FFreeAnimModifierBatch::GetModifierClasses(TArray<UClass*>& OutClasses)
+{
+	using namespace FreeAnimModifierBatch;
+
+	OutClasses.Empty();
+	for (TObjectIterator<UClass> It; It; ++It)
+	{
+		UClass* Class = *It;
+		if (Class->IsChildOf(UAnimationModifier::StaticClass())
+			&& !Class->HasAnyClassFlags(CLASS_Abstract | CLASS_Deprecated | CLASS_NewerVersionExists)
+			&& Class->GetOutermost()->GetName() == ModulePackageName)
+		{
+			OutClasses.Add(Class);
+		}
+	}
+
+	OutClasses.Sort([](const UClass& A, const UClass& B)
+	{
+		return A.GetDisplayNameText().CompareTo(B.GetDisplayNameText()) < 0;
+	});
+}
+
+UClass* FFreeAnimModifierBatch::FindModifierClass(const FString& ClassName)
+{
+	UClass* Class = nullptr;
+	if (ClassName.StartsWith(TEXT("/")))
+	{
+		Class = LoadClass<UAnimationModifier>(nullptr, *ClassName);
+	}
+	else
+	{
+		const FString ShortName = ClassName.StartsWith(TEXT("U")) ? ClassName.RightChop(1) : ClassName;
+
+		TArray<UClass*> ModifierClasses;
+		GetModifierClasses(ModifierClasses);
+		for (UClass* ModifierClass : ModifierClasses)
+		{
+			if (ModifierClass->GetName() == ShortName || ModifierClass->GetName() == ClassName)
+			{
+				Class = ModifierClass;
+				break;
+			}
+		}
+	}
+
+	return (Class && Class->IsChildOf(UAnimationModifier::StaticClass()) && !Class->HasAnyClassFlags(CLASS_Abstract)) ? Class : nullptr;
+}
+
+#undef LOCTEXT_NAMESPACE
@@ -0,0 +1,189 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "FreeAnimModifierPreview.h"
+#include "FreeAnimModifier.h"
+#include "FreeAnimModifierBatch.h"
+#include "ModifierStackHash.h"
+#include "Animation/AnimData/AnimDataModel.h"
+#include "Animation/AnimData/IAnimationDataController.h"
+#include "Animation/AnimCurveTypes.h"
+#include "Animation/AnimSequence.h"
+#include "Editor.h"
+#include "Subsystems/AssetEditorSubsystem.h"
+
+#define LOCTEXT_NAMESPACE "FFreeAnimModifierPreview"
+
+FFreeAnimModifierPreview::FFreeAnimModifierPreview(UAnimSequence* InSourceSequence, UFreeAnimModifier* InModifier)
+	: SourceSequence(InSourceSequence)
+	, PreviewSequence(nullptr)
+	, Modifier(InModifier)
+{
+}
+
+FFreeAnimModifierPreview::~FFreeAnimModifierPreview()
+{
+	Discard();
+}
+
+bool FFreeAnimModifierPreview::Update()
+{
+	if (!IsValid(SourceSequence) || !IsValid(Modifier))
+	{
+		return false;
+	}
+
+	TUniquePtr<FFreeAnimModifierOutput> NewOutput = Evaluate();
+
+	bool bOpenEditor = false;
+	if (!IsValid(PreviewSequence))
+	{
+		// transient copy isn't saved and isn't tracked by undo buffer
+		UPackage* TransientPackage = GetTransientPackage();
+		const FName PreviewName = MakeUniqueObjectName(TransientPackage, UAnimSequence::StaticClass(), *(SourceSequence->GetName() + TEXT("_Preview")));
+		PreviewSequence = DuplicateObject<UAnimSequence>(SourceSequence, TransientPackage, PreviewName);
+		PreviewSequence->ClearFlags(RF_Public | RF_Standalone);
+		PreviewSequence->SetFlags(RF_Transient);
+		Output.Reset();
+		bOpenEditor = true;
+	}
+
+	{
+		// previous and new result are sent to data model in one bracket, so preview is recompressed once
+		IAnimationDataController& Controller = PreviewSequence->GetController();
+		IAnimationDataController::FScopedBracket ScopedBracket(Controller, LOCTEXT("UpdatePreview", "Update Modifier Preview"), false);
+
+		if (Output.IsValid())
+		{
+			RestorePreviewSequence(*Output);
+		}
+		if (NewOutput.IsValid())
+		{
+			UFreeAnimModifier::CommitOutput(PreviewSequence, *NewOutput, false);
+		}
+	}
+
+	Output = MoveTemp(NewOutput);
+	EvaluatedInputHash = Output.IsValid() ? GetInputHash() : FString();
+
+	if (bOpenEditor)
+	{
+		GEditor->GetEditorSubsystem<UAssetEditorSubsystem>()->OpenEditorForAsset(PreviewSequence);
+	}
+
+	return Output.IsValid();
+}
+
+EFreeAnimApplyResult FFreeAnimModifierPreview::Commit()
+{
+	if (!IsValid(SourceSequence) || !IsValid(Modifier))
+	{
+		return EFreeAnimApplyResult::Skipped;
+	}
+
+	// settings could be changed after last update without refreshing the preview
+	if (!Output.IsValid() || EvaluatedInputHash != GetInputHash())
+	{
+		Output = Evaluate();
+		EvaluatedInputHash = Output.IsValid() ? GetInputHash() : FString();
+	}
+	if (!Output.IsValid())
+	{
+		return EFreeAnimApplyResult::Skipped;
+	}
+
+	// registered in animation modifiers of the sequence like modifiers applied by batch
+	return FFreeAnimModifierBatch::RegisterAndApply(Modifier, SourceSequence, Output.Get());
+}
+
+void FFreeAnimModifierPreview::Discard()
+{
+	if (IsValid(PreviewSequence))
+	{
+		if (GEditor)
+		{
+			GEditor->GetEditorSubsystem<UAssetEditorSubsystem>()->CloseAllEditorsForAsset(PreviewSequence);
+		}
+		PreviewSequence->MarkAsGarbage();
+	}
+	PreviewSequence = nullptr;
+	Output.Reset();
+	EvaluatedInputHash.Empty();
+}
+
+void FFreeAnimModifierPreview::AddReferencedObjects(FReferenceCollector& Collector)
+{
+	Collector.AddReferencedObject(SourceSequence);
+	Collector.AddReferencedObject(PreviewSequence);
+	Collector.AddReferencedObject(Modifier);
+}
+
+TUniquePtr<FFreeAnimModifierOutput> FFreeAnimModifierPreview::Evaluate() const
+{
+	// modifier always reads source sequence, so results of previous preview don't accumulate
+	FFreeAnimModifierEvaluation Evaluation = Modifier->PrepareEvaluation(SourceSequence);
+	if (!Evaluation)
+	{
+		return nullptr;
+	}
+
+	TUniquePtr<FFreeAnimModifierOutput> NewOutput = MakeUnique<FFreeAnimModifierOutput>();
+	if (!Evaluation(FFreeAnimModifierInput(), *NewOutput))
+	{
+		return nullptr;
+	}
+	return NewOutput;
+}
+
+void FFreeAnimModifierPreview::RestorePreviewSequence(const FFreeAnimModifierOutput& PreviousOutput)
+{
+	const IAnimationDataModel* SourceModel = SourceSequence->GetDataModel();
+	IAnimationDataController& Controller = PreviewSequence->GetController();
+
+	TArray<FTransform> SourceKeys;
+	TArray<FVector3f> PosKeys, ScaleKeys;
+	TArray<FQuat4f> RotKeys;
+	for (int32 Slot = 0; Slot < PreviousOutput.Tracks.GetNumBones(); Slot++)
+	{
+		const FName& BoneName = PreviousOutput.Tracks.GetBoneName(Slot);
+		if (!SourceModel->IsValidBoneTrackName(BoneName))
+		{
+			// track was added by modifier
+			Controller.RemoveBoneTrack(BoneName, false);
+			continue;
+		}
+
+		SourceKeys.Reset();
+		SourceModel->GetBoneTrackTransforms(BoneName, SourceKeys);
+		PosKeys.SetNumUninitialized(SourceKeys.Num());
+		RotKeys.SetNumUninitialized(SourceKeys.Num());
+		ScaleKeys.SetNumUninitialized(SourceKeys.Num());
+		for (int32 KeyIndex = 0; KeyIndex < SourceKeys.Num(); KeyIndex++)
+		{
+			PosKeys[KeyIndex] = FVector3f(SourceKeys[KeyIndex].GetTranslation());
+			RotKeys[KeyIndex] = FQuat4f(SourceKeys[KeyIndex].GetRotation());
+			ScaleKeys[KeyIndex] = FVector3f(SourceKeys[KeyIndex].GetScale3D());
+		}
+		Controller.SetBoneTrackKeys(BoneName, PosKeys, RotKeys, ScaleKeys, false);
+	}
+
+	for (const auto& Curve : PreviousOutput.FloatCurves)
+	{
+		const FAnimationCurveIdentifier CurveId(Curve.Key, ERawCurveTrackTypes::RCT_Float);
+		if (const FFloatCurve* SourceCurve = SourceModel->FindFloatCurve(CurveId))
+		{
+			Controller.SetCurveKeys(CurveId, SourceCurve->FloatCurve.GetConstRefOfKeys(), false);
+		}
+		else
+		{
+			Controller.RemoveCurve(CurveId, false);
+		}
+	}
+}
+
+FString FFreeAnimModifierPreview::GetInputHash() const
+{
+	return FModifierStackHash::GetSettingsHash({ Modifier.Get() }) + FModifierStackHash::GetAnimationDataHash(SourceSequence);
+}
+
+#undef LOCTEXT_NAMESPACE
@@ -0,0 +1,90 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "FreeAnimModifierStack.h"
+#include "FreeAnimDiagnostics.h"
+#include "Animation/AnimSequence.h"
+
+FFreeAnimModifierEvaluation UFreeAnimModifierStack::PrepareEvaluation(UAnimSequence* AnimationSequence) const
+{
+	// all stages are prepared on game thread before evaluation of the first one
+	TArray<FFreeAnimModifierEvaluation> StageEvaluations;
+	for (const UFreeAnimModifier* Stage : Stages)
+	{
+		if (!Stage || Stage == this)
+		{
+			continue;
+		}
+
+		FFreeAnimModifierEvaluation StageEvaluation = Stage->PrepareEvaluation(AnimationSequence);
+		if (StageEvaluation)
+		{
+			StageEvaluations.Add(MoveTemp(StageEvaluation));
+		}
+		else
+		{
+			UE_LOG(LogFreeAnimHelpers, Warning, TEXT("Modifier stack: %s can't be applied to %s, stage is skipped"), *Stage->GetClass()->GetName(), *AnimationSequence->GetName());
+			FFreeAnimDiagnostics::Dump(TEXT("stage is skipped"));
+		}
+	}
+
+	if (StageEvaluations.IsEmpty())
+	{
+		return FFreeAnimModifierEvaluation();
+	}
+
+	return [StageEvaluations = MoveTemp(StageEvaluations)](const FFreeAnimModifierInput& Input, FFreeAnimModifierOutput& Output)
+	{
+		// stack can be a stage of another stack: start from keys and curves of outer stages
+		if (Input.Tracks)
+		{
+			Output.Tracks.Merge(*Input.Tracks);
+		}
+		if (Input.FloatCurves)
+		{
+			Output.FloatCurves = *Input.FloatCurves;
+		}
+
+		bool bChanged = false;
+		for (const FFreeAnimModifierEvaluation& StageEvaluation : StageEvaluations)
+		{
+			FFreeAnimModifierInput StageInput;
+			StageInput.Tracks = &Output.Tracks;
+			StageInput.FloatCurves = &Output.FloatCurves;
+
+			FFreeAnimModifierOutput StageOutput;
+			if (!StageEvaluation(StageInput, StageOutput))
+			{
+				continue;
+			}
+			bChanged = true;
+
+			Output.Tracks.Merge(StageOutput.Tracks);
+			for (auto& Curve : StageOutput.FloatCurves)
+			{
+				auto* ExistingCurve = Output.FloatCurves.FindByPredicate([&Curve](const TPair<FName, TArray<FRichCurveKey>>& Item) { return Item.Key == Curve.Key; });
+				if (ExistingCurve)
+				{
+					ExistingCurve->Value = MoveTemp(Curve.Value);
+				}
+				else
+				{
+					Output.FloatCurves.Add(MoveTemp(Curve));
+				}
+			}
+		}
+
+		return bChanged;
+	};
+}
+
+void UFreeAnimModifierStack::GetReferencedSequences(TArray<const UAnimSequence*>& OutSequences) const
+{
+	for (const UFreeAnimModifier* Stage : Stages)
+	{
+		if (Stage && Stage != this)
+		{
+			Stage->GetReferencedSequences(OutSequences);
+		}
+	}
+}
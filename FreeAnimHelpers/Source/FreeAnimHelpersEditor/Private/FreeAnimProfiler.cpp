@@ -0,0 +1,127 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "FreeAnimProfiler.h"
+#include "FreeAnimDiagnostics.h"
+#include "FreeAnimHelpersSettings.h"
+#include "Animation/AnimSequence.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/ScopeLock.h"
+
+namespace FreeAnimProfiler
+{
+	static const TCHAR* CounterNames[] = { TEXT("TrackEvaluations"), TEXT("HierarchyWalks"), TEXT("CommittedTracks") };
+	static_assert(UE_ARRAY_COUNT(CounterNames) == (int32)EFreeAnimCounter::Num, "Name of every counter is required");
+
+	/* Profiler of the current thread, evaluations running at the same time on other threads don't see it */
+	static thread_local FFreeAnimProfiler* ActiveProfiler = nullptr;
+}
+
+FFreeAnimProfiler::FFreeAnimProfiler(const UObject* Modifier, const UAnimSequence* AnimationSequence)
+	: StartTime(FPlatformTime::Seconds())
+	, bActive(false)
+{
+	for (std::atomic<int64>& Counter : Counters)
+	{
+		Counter = 0;
+	}
+
+	// nested applies (modifier called by batch or stack) are reported by the outer profiler
+	if (!GetDefault<UFreeAnimHelpersSettings>()->bLogModifierTiming || FreeAnimProfiler::ActiveProfiler)
+	{
+		return;
+	}
+	FreeAnimProfiler::ActiveProfiler = this;
+	bActive = true;
+
+	Title = FString::Printf(TEXT("%s on %s"),
+		Modifier ? *Modifier->GetClass()->GetName() : TEXT("None"),
+		AnimationSequence ? *AnimationSequence->GetName() : TEXT("None"));
+}
+
+FFreeAnimProfiler::~FFreeAnimProfiler()
+{
+	if (!bActive)
+	{
+		return;
+	}
+	FreeAnimProfiler::ActiveProfiler = nullptr;
+
+	UE_LOG(LogFreeAnimHelpers, Display, TEXT("FreeAnimHelpers: %s"), *GetSummary());
+}
+
+void FFreeAnimProfiler::AddCounter(EFreeAnimCounter Counter, int64 Value)
+{
+	if (FFreeAnimProfiler* Profiler = FreeAnimProfiler::ActiveProfiler)
+	{
+		Profiler->Counters[(int32)Counter].fetch_add(Value, std::memory_order_relaxed);
+	}
+}
+
+FFreeAnimProfiler* FFreeAnimProfiler::GetActive()
+{
+	return FreeAnimProfiler::ActiveProfiler;
+}
+
+FFreeAnimProfiler::FThreadScope::FThreadScope(FFreeAnimProfiler* Profiler)
+	: PrevProfiler(FreeAnimProfiler::ActiveProfiler)
+{
+	FreeAnimProfiler::ActiveProfiler = Profiler;
+}
+
+FFreeAnimProfiler::FThreadScope::~FThreadScope()
+{
+	FreeAnimProfiler::ActiveProfiler = PrevProfiler;
+}
+
+void FFreeAnimProfiler::AddPhaseTime(const TCHAR* PhaseName, double Seconds)
+{
+	FScopeLock Lock(&PhasesGuard);
+
+	FPhase* Phase = Phases.FindByPredicate([PhaseName](const FPhase& Item) { return FCString::Strcmp(Item.Name, PhaseName) == 0; });
+	if (!Phase)
+	{
+		Phase = &Phases.Add_GetRef({ PhaseName });
+	}
+	Phase->Seconds += Seconds;
+	Phase->Calls++;
+}
+
+FString FFreeAnimProfiler::GetSummary() const
+{
+	using namespace FreeAnimProfiler;
+
+	FString Summary = FString::Printf(TEXT("%s: %.2f ms"), *Title, (FPlatformTime::Seconds() - StartTime) * 1000.0);
+
+	// phases are nested, so their sum can exceed total time
+	for (int32 Index = 0; Index < Phases.Num(); Index++)
+	{
+		Summary += Index == 0 ? TEXT(" | ") : TEXT(", ");
+		Summary += FString::Printf(TEXT("%s %.2f ms"), Phases[Index].Name, Phases[Index].Seconds * 1000.0);
+		if (Phases[Index].Calls > 1)
+		{
+			Summary += FString::Printf(TEXT(" (%d)"), Phases[Index].Calls);
+		}
+	}
+
+	Summary += TEXT(" |");
+	for (int32 Index = 0; Index < (int32)EFreeAnimCounter::Num; Index++)
+	{
+		Summary += FString::Printf(TEXT(" %s %lld"), CounterNames[Index], Counters[Index].load());
+	}
+	return Summary;
+}
+
+FFreeAnimProfiler::FScope::FScope(const TCHAR* InPhaseName)
+	: PhaseName(InPhaseName)
+	, StartTime(FPlatformTime::Seconds())
+{
+}
+
+FFreeAnimProfiler::FScope::~FScope()
+{
+	if (FFreeAnimProfiler* Profiler = FreeAnimProfiler::ActiveProfiler)
+	{
+		Profiler->AddPhaseTime(PhaseName, FPlatformTime::Seconds() - StartTime);
+	}
+}
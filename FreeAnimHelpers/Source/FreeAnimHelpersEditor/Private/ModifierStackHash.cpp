@@ -0,0 +1,230 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "ModifierStackHash.h"
+#include "AnimationModifier.h"
+#include "Animation/AnimSequence.h"
+#include "Animation/AnimData/AnimDataModel.h"
+#include "Animation/AnimCurveTypes.h"
+#include "Animation/Skeleton.h"
+#include "Engine/SkeletalMesh.h"
+#include "ReferenceSkeleton.h"
+#include "Hash/Blake3.h"
+#include "UObject/MetaData.h"
+#include "UObject/Package.h"
+#include "UObject/UnrealType.h"
+#include "UObject/PropertyIterator.h"
+
+static const TCHAR* SettingsHashKey = TEXT("FreeAnimHelpers.StackSettingsHash");
+static const TCHAR* DataHashKey = TEXT("FreeAnimHelpers.StackResultHash");
+
+namespace ModifierStackHash
+{
+	static void UpdateHash(FBlake3& Hasher, const FString& Value)
+	{
+		Hasher.Update(*Value, Value.Len() * sizeof(TCHAR));
+	}
+
+	/* Bone names, hierarchy and reference pose in single precision */
+	static void UpdateHash(FBlake3& Hasher, const FReferenceSkeleton& RefSkeleton)
+	{
+		const TArray<FMeshBoneInfo>& BoneInfo = RefSkeleton.GetRawRefBoneInfo();
+		const TArray<FTransform>& RefPose = RefSkeleton.GetRawRefBonePose();
+		for (int32 BoneIndex = 0; BoneIndex < BoneInfo.Num(); BoneIndex++)
+		{
+			UpdateHash(Hasher, BoneInfo[BoneIndex].Name.ToString());
+			Hasher.Update(&BoneInfo[BoneIndex].ParentIndex, sizeof(int32));
+
+			const FVector3f Translation(RefPose[BoneIndex].GetTranslation());
+			const FQuat4f Rotation(RefPose[BoneIndex].GetRotation());
+			const FVector3f Scale(RefPose[BoneIndex].GetScale3D());
+			Hasher.Update(&Translation, sizeof(Translation));
+			Hasher.Update(&Rotation, sizeof(Rotation));
+			Hasher.Update(&Scale, sizeof(Scale));
+		}
+	}
+
+	static bool IsSettingsProperty(const FProperty* Property, const UObject* Object)
+	{
+		// only settings declared in modifier classes, base class keeps revision and bookkeeping data
+		const UClass* OwnerClass = Property->GetOwnerClass();
+		if (!OwnerClass || Property->HasAnyPropertyFlags(CPF_Transient))
+		{
+			return false;
+		}
+		return !Object->IsA<UAnimationModifier>()
+			|| (OwnerClass->IsChildOf(UAnimationModifier::StaticClass()) && OwnerClass != UAnimationModifier::StaticClass());
+	}
+
+	static void UpdateObjectHash(FBlake3& Hasher, const UObject* Object, TSet<const UObject*>& VisitedObjects);
+
+	/* Exported text of object reference is only a path, so content of referenced objects is hashed as well:
+	 * data of animations, reference skeleton of skeletons and meshes, settings of other objects */
+	static void UpdatePropertiesHash(FBlake3& Hasher, const UObject* Object, TSet<const UObject*>& VisitedObjects)
+	{
+		const UClass* ObjectClass = Object->GetClass();
+		UpdateHash(Hasher, ObjectClass->GetPathName());
+
+		for (TFieldIterator<FProperty> It(ObjectClass); It; ++It)
+		{
+			const FProperty* Property = *It;
+			if (!IsSettingsProperty(Property, Object))
+			{
+				continue;
+			}
+
+			FString Value;
+			Property->ExportText_InContainer(0, Value, Object, nullptr, nullptr, PPF_None);
+			UpdateHash(Hasher, Property->GetName());
+			UpdateHash(Hasher, Value);
+		}
+
+		for (TPropertyValueIterator<FObjectPropertyBase> It(ObjectClass, Object); It; ++It)
+		{
+			TArray<const FProperty*> PropertyChain;
+			It.GetPropertyChain(PropertyChain);
+			if (!IsSettingsProperty(PropertyChain.Last(), Object))
+			{
+				continue;
+			}
+
+			const UObject* Referenced = nullptr;
+			if (const FSoftObjectProperty* SoftProperty = CastField<FSoftObjectProperty>(It.Key()))
+			{
+				Referenced = SoftProperty->GetPropertyValue(It.Value()).LoadSynchronous();
+			}
+			else
+			{
+				Referenced = It.Key()->GetObjectPropertyValue(It.Value());
+			}
+			UpdateObjectHash(Hasher, Referenced, VisitedObjects);
+		}
+	}
+
+	static void UpdateObjectHash(FBlake3& Hasher, const UObject* Object, TSet<const UObject*>& VisitedObjects)
+	{
+		if (!Object)
+		{
+			UpdateHash(Hasher, TEXT("None"));
+			return;
+		}
+
+		bool bVisited = false;
+		VisitedObjects.Add(Object, &bVisited);
+		if (bVisited)
+		{
+			UpdateHash(Hasher, Object->GetPathName());
+			return;
+		}
+
+		if (const UAnimSequence* AnimationSequence = Cast<UAnimSequence>(Object))
+		{
+			UpdateHash(Hasher, FModifierStackHash::GetAnimationDataHash(AnimationSequence));
+		}
+		else if (const USkeleton* Skeleton = Cast<USkeleton>(Object))
+		{
+			UpdateHash(Hasher, Skeleton->GetReferenceSkeleton());
+		}
+		else if (const USkeletalMesh* SkeletalMesh = Cast<USkeletalMesh>(Object))
+		{
+			UpdateHash(Hasher, SkeletalMesh->GetRefSkeleton());
+		}
+		else
+		{
+			UpdatePropertiesHash(Hasher, Object, VisitedObjects);
+		}
+	}
+}
+
+FString FModifierStackHash::GetSettingsHash(const TArray<UAnimationModifier*>& Modifiers)
+{
+	FBlake3 Hasher;
+	for (const UAnimationModifier* Modifier : Modifiers)
+	{
+		if (!Modifier)
+		{
+			continue;
+		}
+		// the same asset can be referenced by several modifiers, each of them hashes it
+		TSet<const UObject*> VisitedObjects;
+		ModifierStackHash::UpdateObjectHash(Hasher, Modifier, VisitedObjects);
+	}
+	return LexToString(Hasher.Finalize());
+}
+
+FString FModifierStackHash::GetAnimationDataHash(const UAnimSequence* AnimationSequence)
+{
+	const IAnimationDataModel* DataModel = AnimationSequence->GetDataModel();
+
+	FBlake3 Hasher;
+	const FFrameRate FrameRate = DataModel->GetFrameRate();
+	const int32 KeysNum = DataModel->GetNumberOfKeys();
+	Hasher.Update(&FrameRate, sizeof(FrameRate));
+	Hasher.Update(&KeysNum, sizeof(KeysNum));
+
+	// modifiers read reference pose, so changes of skeleton invalidate results
+	if (const USkeleton* Skeleton = AnimationSequence->GetSkeleton())
+	{
+		ModifierStackHash::UpdateHash(Hasher, Skeleton->GetReferenceSkeleton());
+	}
+
+	// keys are stored in single precision, hash them the same way to be independent from conversions
+	TArray<FName> TrackNames;
+	DataModel->GetBoneTrackNames(TrackNames);
+	TrackNames.Sort(FNameLexicalLess());
+
+	TArray<FTransform> TrackKeys;
+	for (const FName& TrackName : TrackNames)
+	{
+		ModifierStackHash::UpdateHash(Hasher, TrackName.ToString());
+
+		TrackKeys.Reset();
+		DataModel->GetBoneTrackTransforms(TrackName, TrackKeys);
+		for (const FTransform& Key : TrackKeys)
+		{
+			const FVector3f Translation(Key.GetTranslation());
+			const FQuat4f Rotation(Key.GetRotation());
+			const FVector3f Scale(Key.GetScale3D());
+			Hasher.Update(&Translation, sizeof(Translation));
+			Hasher.Update(&Rotation, sizeof(Rotation));
+			Hasher.Update(&Scale, sizeof(Scale));
+		}
+	}
+
+	for (const FFloatCurve& Curve : DataModel->GetFloatCurves())
+	{
+		ModifierStackHash::UpdateHash(Hasher, Curve.GetName().ToString());
+		for (const FRichCurveKey& Key : Curve.FloatCurve.GetConstRefOfKeys())
+		{
+			Hasher.Update(&Key.Time, sizeof(Key.Time));
+			Hasher.Update(&Key.Value, sizeof(Key.Value));
+			Hasher.Update(&Key.ArriveTangent, sizeof(Key.ArriveTangent));
+			Hasher.Update(&Key.LeaveTangent, sizeof(Key.LeaveTangent));
+			const uint8 Modes[] = { (uint8)Key.InterpMode, (uint8)Key.TangentMode };
+			Hasher.Update(Modes, sizeof(Modes));
+		}
+	}
+
+	return LexToString(Hasher.Finalize());
+}
+
+bool FModifierStackHash::IsUpToDate(UAnimSequence* AnimationSequence, const FString& SettingsHash)
+{
+	UMetaData* MetaData = AnimationSequence->GetPackage()->GetMetaData();
+	if (!MetaData || !MetaData->HasValue(AnimationSequence, SettingsHashKey) || !MetaData->HasValue(AnimationSequence, DataHashKey))
+	{
+		return false;
+	}
+
+	return MetaData->GetValue(AnimationSequence, SettingsHashKey) == SettingsHash
+		&& MetaData->GetValue(AnimationSequence, DataHashKey) == GetAnimationDataHash(AnimationSequence);
+}
+
+void FModifierStackHash::Store(UAnimSequence* AnimationSequence, const FString& SettingsHash)
+{
+	if (UMetaData* MetaData = AnimationSequence->GetPackage()->GetMetaData())
+	{
+		MetaData->SetValue(AnimationSequence, SettingsHashKey, *SettingsHash);
+		MetaData->SetValue(AnimationSequence, DataHashKey, *GetAnimationDataHash(AnimationSequence));
+	}
+}
@@ -0,0 +1,242 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "RefPoseCache.h"
+#include "AnimSkeletonBinding.h"
+#include "Animation/Skeleton.h"
+#include "Engine/SkeletalMesh.h"
+#include "ReferenceSkeleton.h"
+#include "Misc/ScopeLock.h"
+#include "UObject/ObjectKey.h"
+#include "UObject/UObjectGlobals.h"
+#include "Misc/TransactionObjectEvent.h"
+
+/** Global storage of component-space reference poses */
+class FRefPoseCacheRegistry
+{
+public:
+	struct FEntry
+	{
+		TSharedPtr<const TArray<FTransform>> ComponentSpacePose;
+		/* Reference pose array the entry was built from */
+		const FTransform* RefPoseData = nullptr;
+		int32 BonesNum = 0;
+	};
+
+	static FRefPoseCacheRegistry& Get()
+	{
+		static FRefPoseCacheRegistry Instance;
+		return Instance;
+	}
+
+	/* Owner is skeleton or skeletal mesh of the reference skeleton. Object key includes serial number,
+	 * so entry of destroyed asset can't match a new asset created at the same address */
+	TSharedRef<const TArray<FTransform>> FindOrAdd(const UObject* Owner, const FReferenceSkeleton& RefSkeleton)
+	{
+		FScopeLock ScopeLock(&Lock);
+
+		if (!PostGarbageCollectHandle.IsValid())
+		{
+			PostGarbageCollectHandle = FCoreUObjectDelegates::GetPostGarbageCollect().AddRaw(this, &FRefPoseCacheRegistry::RemoveStaleEntries);
+			ObjectTransactedHandle = FCoreUObjectDelegates::OnObjectTransacted.AddRaw(this, &FRefPoseCacheRegistry::OnObjectTransacted);
+		}
+
+		const TObjectKey<UObject> OwnerKey(Owner);
+		const TArray<FTransform>& RefPose = RefSkeleton.GetRefBonePose();
+		if (const FEntry* Entry = Entries.Find(OwnerKey))
+		{
+			// resized or reallocated pose means that reference skeleton was rebuilt
+			if (Entry->RefPoseData == RefPose.GetData() && Entry->BonesNum == RefPose.Num())
+			{
+				return Entry->ComponentSpacePose.ToSharedRef();
+			}
+		}
+
+		const int32 BonesNum = RefPose.Num();
+		TSharedRef<TArray<FTransform>> ComponentSpacePose = MakeShared<TArray<FTransform>>();
+		ComponentSpacePose->SetNumUninitialized(BonesNum);
+
+		// parent bone always has lower index in reference skeleton
+		for (int32 BoneIndex = 0; BoneIndex < BonesNum; BoneIndex++)
+		{
+			FTransform& BoneTr = (*ComponentSpacePose)[BoneIndex];
+			const int32 ParentIndex = RefSkeleton.GetParentIndex(BoneIndex);
+
+			BoneTr = RefPose[BoneIndex];
+			if (ParentIndex != INDEX_NONE)
+			{
+				BoneTr *= (*ComponentSpacePose)[ParentIndex];
+			}
+			BoneTr.NormalizeRotation();
+		}
+
+		FEntry& Entry = Entries.Add(OwnerKey);
+		Entry.ComponentSpacePose = ComponentSpacePose;
+		Entry.RefPoseData = RefPose.GetData();
+		Entry.BonesNum = BonesNum;
+
+		return ComponentSpacePose;
+	}
+
+	void Watch(const USkeleton* Skeleton)
+	{
+		FScopeLock ScopeLock(&Lock);
+
+		const TObjectKey<USkeleton> SkeletonKey(Skeleton);
+		if (!WatchedSkeletons.Contains(SkeletonKey))
+		{
+			USkeleton* MutableSkeleton = const_cast<USkeleton*>(Skeleton);
+			MutableSkeleton->RegisterOnSkeletonHierarchyChanged(
+				USkeleton::FOnSkeletonHierarchyChanged::CreateRaw(this, &FRefPoseCacheRegistry::OnSkeletonHierarchyChanged, SkeletonKey));
+			WatchedSkeletons.Add(SkeletonKey, MutableSkeleton);
+		}
+	}
+
+	void Watch(const USkeletalMesh* SkeletalMesh)
+	{
+		FScopeLock ScopeLock(&Lock);
+
+		const TObjectKey<USkeletalMesh> MeshKey(SkeletalMesh);
+		if (!WatchedMeshes.Contains(MeshKey))
+		{
+			USkeletalMesh* MutableMesh = const_cast<USkeletalMesh*>(SkeletalMesh);
+			MutableMesh->GetOnMeshChanged().AddRaw(this, &FRefPoseCacheRegistry::OnMeshChanged, MeshKey);
+			WatchedMeshes.Add(MeshKey, MutableMesh);
+		}
+	}
+
+	void Remove(const UObject* Owner)
+	{
+		FScopeLock ScopeLock(&Lock);
+		Entries.Remove(TObjectKey<UObject>(Owner));
+	}
+
+	void Reset()
+	{
+		FScopeLock ScopeLock(&Lock);
+
+		for (const auto& Skeleton : WatchedSkeletons)
+		{
+			if (USkeleton* SkeletonAsset = Skeleton.Value.Get())
+			{
+				SkeletonAsset->UnregisterOnSkeletonHierarchyChanged(this);
+			}
+		}
+		for (const auto& Mesh : WatchedMeshes)
+		{
+			if (USkeletalMesh* MeshAsset = Mesh.Value.Get())
+			{
+				MeshAsset->GetOnMeshChanged().RemoveAll(this);
+			}
+		}
+		if (PostGarbageCollectHandle.IsValid())
+		{
+			FCoreUObjectDelegates::GetPostGarbageCollect().Remove(PostGarbageCollectHandle);
+			FCoreUObjectDelegates::OnObjectTransacted.Remove(ObjectTransactedHandle);
+			PostGarbageCollectHandle.Reset();
+			ObjectTransactedHandle.Reset();
+		}
+
+		WatchedSkeletons.Empty();
+		WatchedMeshes.Empty();
+		Entries.Empty();
+	}
+
+private:
+	/* Drop poses and subscriptions of destroyed assets */
+	void RemoveStaleEntries()
+	{
+		FScopeLock ScopeLock(&Lock);
+
+		for (auto It = Entries.CreateIterator(); It; ++It)
+		{
+			if (!It.Key().ResolveObjectPtr())
+			{
+				It.RemoveCurrent();
+			}
+		}
+		for (auto It = WatchedSkeletons.CreateIterator(); It; ++It)
+		{
+			if (!It.Value().IsValid())
+			{
+				It.RemoveCurrent();
+			}
+		}
+		for (auto It = WatchedMeshes.CreateIterator(); It; ++It)
+		{
+			if (!It.Value().IsValid())
+			{
+				It.RemoveCurrent();
+			}
+		}
+	}
+
+	void OnSkeletonHierarchyChanged(TObjectKey<USkeleton> SkeletonKey)
+	{
+		if (const USkeleton* Skeleton = SkeletonKey.ResolveObjectPtr())
+		{
+			Remove(Skeleton);
+			FAnimSkeletonBinding::Invalidate(Skeleton);
+		}
+	}
+
+	void OnMeshChanged(TObjectKey<USkeletalMesh> MeshKey)
+	{
+		if (const USkeletalMesh* SkeletalMesh = MeshKey.ResolveObjectPtr())
+		{
+			Remove(SkeletalMesh);
+			FAnimSkeletonBinding::Invalidate(SkeletalMesh);
+		}
+	}
+
+	/* Undo and redo restore reference pose in place, without hierarchy or mesh change notifications */
+	void OnObjectTransacted(UObject* Object, const FTransactionObjectEvent& Event)
+	{
+		if (Event.GetEventType() == ETransactionObjectEventType::UndoRedo && (Object->IsA<USkeleton>() || Object->IsA<USkeletalMesh>()))
+		{
+			Remove(Object);
+			FAnimSkeletonBinding::Invalidate(Object);
+		}
+	}
+
+	FCriticalSection Lock;
+	TMap<TObjectKey<UObject>, FEntry> Entries;
+	TMap<TObjectKey<USkeleton>, TWeakObjectPtr<USkeleton>> WatchedSkeletons;
+	TMap<TObjectKey<USkeletalMesh>, TWeakObjectPtr<USkeletalMesh>> WatchedMeshes;
+	FDelegateHandle PostGarbageCollectHandle;
+	FDelegateHandle ObjectTransactedHandle;
+};
+
+TSharedRef<const TArray<FTransform>> FRefPoseCache::Get(const USkeleton* Skeleton)
+{
+	check(Skeleton);
+	FRefPoseCacheRegistry::Get().Watch(Skeleton);
+	return FRefPoseCacheRegistry::Get().FindOrAdd(Skeleton, Skeleton->GetReferenceSkeleton());
+}
+
+TSharedRef<const TArray<FTransform>> FRefPoseCache::Get(const USkeletalMesh* SkeletalMesh)
+{
+	check(SkeletalMesh);
+	FRefPoseCacheRegistry::Get().Watch(SkeletalMesh);
+	return FRefPoseCacheRegistry::Get().FindOrAdd(SkeletalMesh, SkeletalMesh->GetRefSkeleton());
+}
+
+void FRefPoseCache::Watch(const USkeleton* Skeleton)
+{
+	FRefPoseCacheRegistry::Get().Watch(Skeleton);
+}
+
+void FRefPoseCache::Watch(const USkeletalMesh* SkeletalMesh)
+{
+	FRefPoseCacheRegistry::Get().Watch(SkeletalMesh);
+}
+
+void FRefPoseCache::Invalidate(const UObject* Asset)
+{
+	FRefPoseCacheRegistry::Get().Remove(Asset);
+}
+
+void FRefPoseCache::ResetCache()
+{
+	FRefPoseCacheRegistry::Get().Reset();
+}
@@ -1,86 +1,74 @@
-// (c) Yuri N. K. 2022. All rights reserved.
-// ykasczc@gmail.com
-
-#include "ResetBonesTranslation.h"
-#include "FreeAnimHelpersLibrary.h"
-#include "Runtime/Launch/Resources/Version.h"
-#include "Animation/AnimData/AnimDataModel.h"
-#include "Animation/AnimData/IAnimationDataController.h"
-#include "Animation/AnimSequence.h"
-#include "Animation/AnimTypes.h"
-#include "ReferenceSkeleton.h"
-#include "Engine/SkeletalMesh.h"
-#include "Engine/SkeletalMeshSocket.h"
-
-UResetBonesTranslation::UResetBonesTranslation()
-	: PreviewMesh(nullptr)
-{
-}
-
-void UResetBonesTranslation::OnApply_Implementation(UAnimSequence* AnimationSequence)
-{
-	if (!IsValid(PreviewMesh))
-	{
-		PreviewMesh = AnimationSequence->GetPreviewMesh();
-		if (!IsValid(PreviewMesh)) return;
-	}
-
-	USkeleton* Skeleton = AnimationSequence->GetSkeleton();
-	const FReferenceSkeleton& RefSkeleton = PreviewMesh->GetRefSkeleton();
-	const TArray<FTransform>& RefPoseSpaceBaseTMs = RefSkeleton.GetRefBonePose();
-	const int32 KeysNum = AnimationSequence->GetDataModel()->GetNumberOfKeys();
-
-	TArray<FTransform> Bones;
-	TArray<FVector> BoneRefTranslation;
-	TArray<FName> BoneNames;
-	TMap<FName, FRawAnimSequenceTrack> OutTracks;
-	Bones.Reserve(RefSkeleton.GetNum());
-	BoneNames.Reserve(RefSkeleton.GetNum());
-	OutTracks.Reserve(RefSkeleton.GetNum());
-
-	for (int32 BoneIndex = 0; BoneIndex < RefSkeleton.GetNum(); BoneIndex++)
-	{
-		EBoneTranslationRetargetingMode::Type RetargetType = Skeleton->GetBoneTranslationRetargetingMode(BoneIndex);
-		if (RetargetType == EBoneTranslationRetargetingMode::Type::Skeleton)
-		{
-			const FName BoneName = RefSkeleton.GetBoneName(BoneIndex);
-			BoneNames.Add(BoneName);
-			BoneRefTranslation.Add(RefPoseSpaceBaseTMs[BoneIndex].GetTranslation());
-			Bones.Add(FTransform());
-
-			auto& Track = OutTracks.Add(BoneName, FRawAnimSequenceTrack());
-			Track.PosKeys.SetNum(KeysNum);
-			Track.RotKeys.SetNum(KeysNum);
-			Track.ScaleKeys.SetNum(KeysNum);
-		}
-	}
-
-	for (int32 FrameIndex = 0; FrameIndex < KeysNum; FrameIndex++)
-	{
-		float Time;
-		UAnimationBlueprintLibrary::GetTimeAtFrame(AnimationSequence, FrameIndex, Time);
-
-		UFreeAnimHelpersLibrary::GetBonePosesForTime(AnimationSequence, BoneNames, Time, false, Bones);
-
-		for (int32 Index = 0; Index < BoneNames.Num(); Index++)
-		{
-			const FName BoneName = BoneNames[Index];
-			OutTracks[BoneName].PosKeys[FrameIndex] = (FVector3f)BoneRefTranslation[Index];
-			OutTracks[BoneName].RotKeys[FrameIndex] = (FQuat4f)Bones[Index].GetRotation();
-			OutTracks[BoneName].ScaleKeys[FrameIndex] = (FVector3f)Bones[Index].GetScale3D();
-		}
-	}
-
-	// Save new keys in DataModel
-	IAnimationDataController& Controller = AnimationSequence->GetController();
-	for (const auto& BoneName : BoneNames)
-	{
-		Controller.RemoveBoneTrack(BoneName);
-#if ENGINE_MINOR_VERSION < 2
-		Controller.AddBoneTrack(BoneName);
-#else
-		Controller.AddBoneCurve(BoneName);
-#endif
-		Controller.SetBoneTrackKeys(BoneName, OutTracks[BoneName].PosKeys, OutTracks[BoneName].RotKeys, OutTracks[BoneName].ScaleKeys);
-	}
-}
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "ResetBonesTranslation.h"
+#include "FreeAnimHelpersLibrary.h"
+#include "Misc/MemStack.h"
+#include "AnimTrackBuffer.h"
+#include "AnimSkeletonBinding.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include "Animation/AnimData/AnimDataModel.h"
+#include "Animation/AnimData/IAnimationDataController.h"
+#include "Animation/AnimSequence.h"
+#include "Animation/AnimTypes.h"
+#include "ReferenceSkeleton.h"
+#include "Engine/SkeletalMesh.h"
+#include "Engine/SkeletalMeshSocket.h"
+
+UResetBonesTranslation::UResetBonesTranslation()
+	: PreviewMesh(nullptr)
+{
+}
+
+FFreeAnimModifierEvaluation UResetBonesTranslation::PrepareEvaluation(UAnimSequence* AnimationSequence) const
+{
+	// modifier is const during preparation, so preview mesh of the sequence isn't stored in the property
+	USkeletalMesh* SourceMesh = IsValid(PreviewMesh) ? PreviewMesh : AnimationSequence->GetPreviewMesh();
+	if (!IsValid(SourceMesh)) return FFreeAnimModifierEvaluation();
+
+	const TSharedRef<const FAnimSkeletonBinding> Binding = FAnimSkeletonBinding::Get(AnimationSequence, SourceMesh);
+	const int32 KeysNum = AnimationSequence->GetDataModel()->GetNumberOfKeys();
+
+	TArray<int32> BoneIndices;
+	TArray<FVector> BoneRefTranslation;
+	TArray<FName> BoneNames;
+	BoneIndices.Reserve(Binding->GetNumBones());
+	BoneNames.Reserve(Binding->GetNumBones());
+
+	for (int32 BoneIndex = 0; BoneIndex < Binding->GetNumBones(); BoneIndex++)
+	{
+		if (Binding->IsTranslationRetargeted(BoneIndex))
+		{
+			const FName BoneName = Binding->GetBoneName(BoneIndex);
+			BoneNames.Add(BoneName);
+			BoneIndices.Add(BoneIndex);
+			BoneRefTranslation.Add(Binding->GetRefPose(BoneIndex).GetTranslation());
+		}
+	}
+
+	return [AnimationSequence, Binding, KeysNum, BoneNames = MoveTemp(BoneNames), BoneIndices = MoveTemp(BoneIndices), BoneRefTranslation = MoveTemp(BoneRefTranslation)](const FFreeAnimModifierInput& Input, FFreeAnimModifierOutput& Output)
+	{
+		// slot of bone is its index in BoneNames
+		FAnimTrackBuffer& OutTracks = Output.Tracks;
+		OutTracks.Init(BoneNames, KeysNum);
+		// bones written by previous stages of modifier stack
+		const TArray<int32> SlotMap = Input.MakeSlotMap(*Binding);
+
+		UFreeAnimHelpersLibrary::ParallelForFrames(KeysNum, [&](int32 FrameIndex)
+		{
+			FMemMark Mark(FMemStack::Get());
+			TArray<FTransform, TMemStackAllocator<>> Bones;
+			Bones.SetNumUninitialized(BoneIndices.Num());
+			Input.GetBonePosesForFrame(AnimationSequence, *Binding, BoneIndices, SlotMap, FrameIndex, Bones);
+
+			for (int32 Index = 0; Index < BoneNames.Num(); Index++)
+			{
+				OutTracks.SetPosKey(Index, FrameIndex, BoneRefTranslation[Index]);
+				OutTracks.SetRotKey(Index, FrameIndex, Bones[Index].GetRotation());
+				OutTracks.SetScaleKey(Index, FrameIndex, Bones[Index].GetScale3D());
+			}
+		});
+
+		return true;
+	};
+}
@@ -0,0 +1,266 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "SyntheticAnimation.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include "Animation/AnimData/AnimDataModel.h"
+#include "Animation/AnimData/IAnimationDataController.h"
+#include "Animation/AnimSequence.h"
+#include "Animation/Skeleton.h"
+#include "Engine/SkeletalMesh.h"
+#include "Engine/SkeletalMeshSocket.h"
+#include "ReferenceSkeleton.h"
+#include "UObject/Package.h"
+
+#define LOCTEXT_NAMESPACE "FSyntheticAnimation"
+
+namespace SyntheticAnimation
+{
+	/** Bone of mannequin-like part of synthetic skeleton */
+	struct FNamedBone
+	{
+		const TCHAR* Name;
+		const TCHAR* Parent;
+		FVector Location;
+	};
+
+	// character faces +Y, left side is +X
+	static const FNamedBone BodyBones[] =
+	{
+		{ TEXT("root"), nullptr, FVector(0.f, 0.f, 0.f) },
+		{ TEXT("pelvis"), TEXT("root"), FVector(0.f, 0.f, 95.f) },
+		{ TEXT("spine_01"), TEXT("pelvis"), FVector(0.f, 0.f, 10.f) },
+		{ TEXT("spine_02"), TEXT("spine_01"), FVector(0.f, 0.f, 15.f) },
+		{ TEXT("spine_03"), TEXT("spine_02"), FVector(0.f, 0.f, 15.f) },
+		{ TEXT("neck_01"), TEXT("spine_03"), FVector(0.f, 0.f, 15.f) },
+		{ TEXT("head"), TEXT("neck_01"), FVector(0.f, 0.f, 10.f) },
+		{ TEXT("thigh_l"), TEXT("pelvis"), FVector(10.f, 0.f, -5.f) },
+		{ TEXT("calf_l"), TEXT("thigh_l"), FVector(0.f, 1.f, -45.f) },
+		{ TEXT("foot_l"), TEXT("calf_l"), FVector(0.f, -1.f, -42.f) },
+		{ TEXT("ball_l"), TEXT("foot_l"), FVector(0.f, 12.f, -8.f) },
+		{ TEXT("thigh_r"), TEXT("pelvis"), FVector(-10.f, 0.f, -5.f) },
+		{ TEXT("calf_r"), TEXT("thigh_r"), FVector(0.f, 1.f, -45.f) },
+		{ TEXT("foot_r"), TEXT("calf_r"), FVector(0.f, -1.f, -42.f) },
+		{ TEXT("ball_r"), TEXT("foot_r"), FVector(0.f, 12.f, -8.f) },
+		{ TEXT("clavicle_l"), TEXT("spine_03"), FVector(5.f, 0.f, 10.f) },
+		{ TEXT("upperarm_l"), TEXT("clavicle_l"), FVector(15.f, 0.f, 0.f) },
+		{ TEXT("lowerarm_l"), TEXT("upperarm_l"), FVector(30.f, 0.f, 0.f) },
+		{ TEXT("hand_l"), TEXT("lowerarm_l"), FVector(25.f, 0.f, 0.f) },
+		{ TEXT("clavicle_r"), TEXT("spine_03"), FVector(-5.f, 0.f, 10.f) },
+		{ TEXT("upperarm_r"), TEXT("clavicle_r"), FVector(-15.f, 0.f, 0.f) },
+		{ TEXT("lowerarm_r"), TEXT("upperarm_r"), FVector(-30.f, 0.f, 0.f) },
+		{ TEXT("hand_r"), TEXT("lowerarm_r"), FVector(-25.f, 0.f, 0.f) },
+		{ TEXT("ik_foot_root"), TEXT("root"), FVector(0.f, 0.f, 0.f) },
+		{ TEXT("ik_foot_l"), TEXT("ik_foot_root"), FVector(10.f, 0.f, 8.f) },
+		{ TEXT("ik_foot_r"), TEXT("ik_foot_root"), FVector(-10.f, 0.f, 8.f) },
+		{ TEXT("ik_hand_root"), TEXT("root"), FVector(0.f, 0.f, 0.f) },
+		{ TEXT("ik_hand_gun"), TEXT("ik_hand_root"), FVector(-50.f, 20.f, 110.f) },
+		{ TEXT("ik_hand_r"), TEXT("ik_hand_gun"), FVector(0.f, 0.f, 0.f) },
+		{ TEXT("ik_hand_l"), TEXT("ik_hand_gun"), FVector(100.f, 0.f, 0.f) }
+	};
+
+	static const TCHAR* FingerNames[] = { TEXT("thumb"), TEXT("index"), TEXT("middle"), TEXT("ring"), TEXT("pinky") };
+
+	/** Hierarchy of synthetic skeleton in parent-before-child order */
+	struct FBoneList
+	{
+		TArray<FName> Names;
+		TArray<int32> Parents;
+		TArray<FTransform> RefPose;
+		int32 MaxNum = 0;
+
+		bool IsFull() const { return Names.Num() >= MaxNum; }
+
+		void Add(const FName& Name, const FName& ParentName, const FVector& Location)
+		{
+			if (!IsFull())
+			{
+				Names.Add(Name);
+				Parents.Add(ParentName.IsNone() ? INDEX_NONE : Names.IndexOfByKey(ParentName));
+				RefPose.Add(FTransform(Location));
+			}
+		}
+	};
+
+	static void BuildBoneList(const FSyntheticAnimationConfig& Config, FBoneList& OutBones)
+	{
+		OutBones.MaxNum = FMath::Max(Config.BonesNum, 1);
+
+		for (const FNamedBone& Bone : BodyBones)
+		{
+			OutBones.Add(Bone.Name, Bone.Parent ? FName(Bone.Parent) : NAME_None, Bone.Location);
+		}
+
+		// fingers are used by FingersCurl
+		for (const TCHAR* Side : { TEXT("l"), TEXT("r") })
+		{
+			const FName HandName = *FString::Printf(TEXT("hand_%s"), Side);
+			const float SideSign = Side[0] == TEXT('l') ? 1.f : -1.f;
+			if (!OutBones.Names.Contains(HandName))
+			{
+				continue;
+			}
+			for (int32 FingerIndex = 0; FingerIndex < UE_ARRAY_COUNT(FingerNames); FingerIndex++)
+			{
+				FName ParentName = HandName;
+				for (int32 Phalanx = 1; Phalanx <= 3; Phalanx++)
+				{
+					const FName Name = *FString::Printf(TEXT("%s_%02d_%s"), FingerNames[FingerIndex], Phalanx, Side);
+					const FVector Location = Phalanx == 1
+						? FVector(SideSign * 8.f, (FingerIndex - 2) * 2.f, 0.f)
+						: FVector(SideSign * 3.f, 0.f, 0.f);
+					OutBones.Add(Name, ParentName, Location);
+					ParentName = Name;
+				}
+			}
+		}
+
+		// the rest of bones are chains of configured length
+		TArray<FName> ChainRoots;
+		for (const TCHAR* RootName : { TEXT("hand_l"), TEXT("hand_r"), TEXT("head"), TEXT("spine_03") })
+		{
+			if (OutBones.Names.Contains(FName(RootName)))
+			{
+				ChainRoots.Add(RootName);
+			}
+		}
+		if (ChainRoots.IsEmpty())
+		{
+			ChainRoots.Add(OutBones.Names[0]);
+		}
+
+		const int32 ChainLength = FMath::Max(Config.ChainLength, 1);
+		for (int32 ChainIndex = 0; !OutBones.IsFull(); ChainIndex++)
+		{
+			FName ParentName = ChainRoots[ChainIndex % ChainRoots.Num()];
+			for (int32 LinkIndex = 0; LinkIndex < ChainLength && !OutBones.IsFull(); LinkIndex++)
+			{
+				const FName Name = *FString::Printf(TEXT("chain_%03d_%02d"), ChainIndex, LinkIndex);
+				OutBones.Add(Name, ParentName, FVector(0.f, 0.f, LinkIndex == 0 ? 5.f : 3.f));
+				ParentName = Name;
+			}
+		}
+	}
+}
+
+bool FSyntheticAnimation::Create(const FSyntheticAnimationConfig& Config, USkeletalMesh*& OutMesh, UAnimSequence*& OutSequence)
+{
+	using namespace SyntheticAnimation;
+
+	OutMesh = nullptr;
+	OutSequence = nullptr;
+
+	FBoneList Bones;
+	BuildBoneList(Config, Bones);
+	const int32 BonesNum = Bones.Names.Num();
+	const int32 FramesNum = FMath::Max(Config.FramesNum, 2);
+
+	UPackage* TransientPackage = GetTransientPackage();
+	USkeleton* Skeleton = NewObject<USkeleton>(TransientPackage, MakeUniqueObjectName(TransientPackage, USkeleton::StaticClass(), TEXT("SyntheticSkeleton")), RF_Transient);
+	USkeletalMesh* Mesh = NewObject<USkeletalMesh>(TransientPackage, MakeUniqueObjectName(TransientPackage, USkeletalMesh::StaticClass(), TEXT("SyntheticMesh")), RF_Transient);
+
+	{
+		FReferenceSkeletonModifier RefSkelModifier(Mesh->GetRefSkeleton(), Skeleton);
+		for (int32 BoneIndex = 0; BoneIndex < BonesNum; BoneIndex++)
+		{
+			RefSkelModifier.Add(FMeshBoneInfo(Bones.Names[BoneIndex], Bones.Names[BoneIndex].ToString(), Bones.Parents[BoneIndex]), Bones.RefPose[BoneIndex]);
+		}
+	}
+	Mesh->SetSkeleton(Skeleton);
+	if (!Skeleton->MergeAllBonesToBoneTree(Mesh, false))
+	{
+		return false;
+	}
+	Skeleton->SetPreviewMesh(Mesh);
+
+	// foot tip sockets are used by SnapFootToGround
+	for (const TCHAR* Side : { TEXT("l"), TEXT("r") })
+	{
+		const FName FootName = *FString::Printf(TEXT("foot_%s"), Side);
+		if (Bones.Names.Contains(FootName))
+		{
+			USkeletalMeshSocket* Socket = NewObject<USkeletalMeshSocket>(Skeleton);
+			Socket->SocketName = *FString::Printf(TEXT("foot_tip_%s"), Side);
+			Socket->BoneName = FootName;
+			Socket->RelativeLocation = FVector(0.f, 15.f, -8.f);
+			Skeleton->Sockets.Add(Socket);
+		}
+	}
+
+	UAnimSequence* Sequence = NewObject<UAnimSequence>(TransientPackage, MakeUniqueObjectName(TransientPackage, UAnimSequence::StaticClass(), TEXT("SyntheticSequence")), RF_Transient);
+	Sequence->SetSkeleton(Skeleton);
+	Sequence->SetPreviewMesh(Mesh);
+
+	IAnimationDataController& Controller = Sequence->GetController();
+#if ENGINE_MINOR_VERSION >= 2
+	Controller.InitializeModel();
+#endif
+	{
+		IAnimationDataController::FScopedBracket ScopedBracket(Controller, LOCTEXT("CreateSyntheticSequence", "Create Synthetic Sequence"), false);
+
+		Controller.SetFrameRate(FFrameRate(FrameRate, 1), false);
+#if ENGINE_MINOR_VERSION < 1
+		Controller.SetPlayLength((float)(FramesNum - 1) / FrameRate, false);
+#else
+		Controller.SetNumberOfFrames(FFrameNumber(FramesNum - 1), false);
+#endif
+
+		TArray<FVector3f> PosKeys, ScaleKeys;
+		TArray<FQuat4f> RotKeys;
+		PosKeys.SetNumUninitialized(FramesNum);
+		RotKeys.SetNumUninitialized(FramesNum);
+		ScaleKeys.Init(FVector3f::OneVector, FramesNum);
+
+		for (int32 BoneIndex = 0; BoneIndex < BonesNum; BoneIndex++)
+		{
+			const FTransform& RefTr = Bones.RefPose[BoneIndex];
+			// every bone swings around its own axis with its own phase
+			const FVector SwingAxis = BoneIndex % 3 == 0 ? FVector::XAxisVector : (BoneIndex % 3 == 1 ? FVector::YAxisVector : FVector::ZAxisVector);
+			const float Phase = BoneIndex * 0.7f;
+
+			for (int32 FrameIndex = 0; FrameIndex < FramesNum; FrameIndex++)
+			{
+				const float Time = (float)FrameIndex / FrameRate;
+				const float Wave = FMath::Sin(UE_TWO_PI * Time + Phase);
+
+				FVector Location = RefTr.GetTranslation();
+				FQuat Rotation = RefTr.GetRotation();
+				if (BoneIndex == 0)
+				{
+					// root moves forward to produce root motion
+					Location.Y += 150.f * Time;
+				}
+				else
+				{
+					Rotation = Rotation * FQuat(SwingAxis, 0.3f * Wave);
+					if (BoneIndex == 1)
+					{
+						Location.Z += 2.f * Wave;
+					}
+				}
+				PosKeys[FrameIndex] = FVector3f(Location);
+				RotKeys[FrameIndex] = FQuat4f(Rotation);
+			}
+
+#if ENGINE_MINOR_VERSION < 2
+			Controller.AddBoneTrack(Bones.Names[BoneIndex], false);
+#else
+			Controller.AddBoneCurve(Bones.Names[BoneIndex], false);
+#endif
+			Controller.SetBoneTrackKeys(Bones.Names[BoneIndex], PosKeys, RotKeys, ScaleKeys, false);
+		}
+
+		Controller.NotifyPopulated();
+	}
+
+	OutMesh = Mesh;
+	OutSequence = Sequence;
+	return true;
+}
+
+FString FSyntheticAnimation::GetFixtureName(const FSyntheticAnimationConfig& Config)
+{
+	return FString::Printf(TEXT("B%d_D%d_F%d"), Config.BonesNum, Config.ChainLength, Config.FramesNum);
+}
+
+#undef LOCTEXT_NAMESPACE
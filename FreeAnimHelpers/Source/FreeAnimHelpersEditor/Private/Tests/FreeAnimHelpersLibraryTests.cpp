@@ -0,0 +1,68 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "FreeAnimBenchmark.h"
+#include "FreeAnimHelpersLibrary.h"
+#include "SyntheticAnimation.h"
+#include "Animation/AnimSequence.h"
+#include "Engine/SkeletalMesh.h"
+#include "ReferenceSkeleton.h"
+#include "UObject/StrongObjectPtr.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FFreeAnimBonePoseAllocationsTest, "FreeAnimHelpers.Library.GetBonePoseForTimeAllocations",
+	EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+/* Bone sampling is called per bone per frame by modifiers, so it shouldn't allocate memory once skeleton binding is cached */
+bool FFreeAnimBonePoseAllocationsTest::RunTest(const FString& Parameters)
+{
+	FSyntheticAnimationConfig Config;
+	Config.BonesNum = 100;
+	Config.ChainLength = 4;
+	Config.FramesNum = 100;
+
+	USkeletalMesh* Mesh = nullptr;
+	UAnimSequence* Sequence = nullptr;
+	if (!TestTrue(TEXT("Synthetic animation is created"), FSyntheticAnimation::Create(Config, Mesh, Sequence)))
+	{
+		return false;
+	}
+	TStrongObjectPtr<USkeletalMesh> MeshGuard(Mesh);
+	TStrongObjectPtr<UAnimSequence> SequenceGuard(Sequence);
+
+	// the last bone is the end of the deepest chain
+	const FReferenceSkeleton& RefSkeleton = Mesh->GetRefSkeleton();
+	const FName LeafBoneName = RefSkeleton.GetBoneName(RefSkeleton.GetNum() - 1);
+	const float FrameRate = (float)FSyntheticAnimation::FrameRate;
+
+	// the first calls build skeleton binding and fill mem stack pages
+	FTransform Pose;
+	UFreeAnimHelpersLibrary::GetBonePoseForTime(Sequence, LeafBoneName, 0.f, false, Pose, Mesh);
+	UFreeAnimHelpersLibrary::GetBonePositionAtTimeInCS(Sequence, LeafBoneName, 0.f);
+
+	const int64 PoseAllocations = FFreeAnimBenchmark::CountThreadAllocations([&]
+	{
+		for (int32 FrameIndex = 0; FrameIndex < Config.FramesNum; FrameIndex++)
+		{
+			UFreeAnimHelpersLibrary::GetBonePoseForTime(Sequence, LeafBoneName, FrameIndex / FrameRate, false, Pose, Mesh);
+		}
+	});
+	TestEqual(TEXT("Allocations of GetBonePoseForTime"), PoseAllocations, (int64)0);
+
+	const int64 ComponentSpaceAllocations = FFreeAnimBenchmark::CountThreadAllocations([&]
+	{
+		for (int32 FrameIndex = 0; FrameIndex < Config.FramesNum; FrameIndex++)
+		{
+			UFreeAnimHelpersLibrary::GetBonePositionAtTimeInCS(Sequence, LeafBoneName, FrameIndex / FrameRate);
+		}
+	});
+	TestEqual(TEXT("Allocations of GetBonePositionAtTimeInCS"), ComponentSpaceAllocations, (int64)0);
+
+	FFreeAnimBenchmark::ReleaseSyntheticAssets(Mesh);
+	return true;
+}
+
+#endif
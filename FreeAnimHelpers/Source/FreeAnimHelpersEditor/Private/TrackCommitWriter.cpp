@@ -0,0 +1,229 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#include "TrackCommitWriter.h"
+#include "AnimTrackBuffer.h"
+#include "FreeAnimProfiler.h"
+#include "FreeAnimHelpersLibrary.h"
+#include "FreeAnimHelpersSettings.h"
+#include "FreeAnimDiagnostics.h"
+#include "Runtime/Launch/Resources/Version.h"
+#include "Animation/AnimData/AnimDataModel.h"
+#include "Animation/AnimData/IAnimationDataController.h"
+#include "Animation/AnimCurveTypes.h"
+#include "Animation/AnimSequence.h"
+
+#define LOCTEXT_NAMESPACE "FTrackCommitWriter"
+
+FTrackCommitWriter::FTrackCommitWriter(UAnimSequence* InAnimationSequence, bool bInShouldTransact)
+	: AnimationSequence(InAnimationSequence)
+	, bShouldTransact(bInShouldTransact)
+	, bReduceKeys(GetDefault<UFreeAnimHelpersSettings>()->bReduceKeys)
+{
+}
+
+void FTrackCommitWriter::AddBoneTrack(const FName& BoneName, FRawAnimSequenceTrack&& Track)
+{
+	BoneTracks.Emplace(BoneName, MoveTemp(Track));
+}
+
+void FTrackCommitWriter::AddBoneTrack(const FName& BoneName, const FRawAnimSequenceTrack& Track)
+{
+	BoneTracks.Emplace(BoneName, Track);
+}
+
+void FTrackCommitWriter::AddBoneTracks(TMap<FName, FRawAnimSequenceTrack>&& Tracks)
+{
+	BoneTracks.Reserve(BoneTracks.Num() + Tracks.Num());
+	for (auto& Track : Tracks)
+	{
+		BoneTracks.Emplace(Track.Key, MoveTemp(Track.Value));
+	}
+	Tracks.Empty();
+}
+
+void FTrackCommitWriter::AddBoneTracks(const FAnimTrackBuffer& Buffer)
+{
+	if (Buffer.IsValid())
+	{
+		TrackBuffers.Add(&Buffer);
+	}
+}
+
+void FTrackCommitWriter::AddFloatCurve(const FName& CurveName, TArray<FRichCurveKey>&& Keys, bool bAllowKeyReduction)
+{
+	FloatCurves.Emplace(CurveName, MoveTemp(Keys));
+	if (!bAllowKeyReduction)
+	{
+		ExactCurves.Add(CurveName);
+	}
+}
+
+void FTrackCommitWriter::AddFloatCurve(const FName& CurveName, const TArray<FRichCurveKey>& Keys, bool bAllowKeyReduction)
+{
+	FloatCurves.Emplace(CurveName, Keys);
+	if (!bAllowKeyReduction)
+	{
+		ExactCurves.Add(CurveName);
+	}
+}
+
+int32 FTrackCommitWriter::Commit()
+{
+	FREEANIM_SCOPE("Commit");
+
+	int32 ChangesNum = 0;
+	FailedNum = 0;
+	if (!IsValid(AnimationSequence) || IsEmpty())
+	{
+		BoneTracks.Empty();
+		TrackBuffers.Empty();
+		FloatCurves.Empty();
+		ExactCurves.Empty();
+		return ChangesNum;
+	}
+
+	const IAnimationDataModel* DataModel = AnimationSequence->GetDataModel();
+	IAnimationDataController& Controller = AnimationSequence->GetController();
+
+	{
+		// sequence handles model changes when the outer bracket is closed
+		IAnimationDataController::FScopedBracket ScopedBracket(Controller, LOCTEXT("CommitModifierData", "Apply Animation Modifier"), bShouldTransact);
+
+		for (const auto& Track : BoneTracks)
+		{
+			if (CommitBoneTrack(Track.Key, Track.Value))
+			{
+				ChangesNum++;
+			}
+		}
+
+		// buffers are converted to raw tracks one bone at a time
+		FRawAnimSequenceTrack BufferTrack;
+		for (const FAnimTrackBuffer* Buffer : TrackBuffers)
+		{
+			for (int32 Slot = 0; Slot < Buffer->GetNumBones(); Slot++)
+			{
+				Buffer->ToRawTrack(Slot, BufferTrack);
+				if (CommitBoneTrack(Buffer->GetBoneName(Slot), BufferTrack))
+				{
+					ChangesNum++;
+				}
+			}
+		}
+
+		const UFreeAnimHelpersSettings* Settings = GetDefault<UFreeAnimHelpersSettings>();
+		for (auto& Curve : FloatCurves)
+		{
+			if (bReduceKeys && !ExactCurves.Contains(Curve.Key))
+			{
+				UFreeAnimHelpersLibrary::ReduceCurveKeys(Curve.Value, Settings->MaxCurveError);
+			}
+			if (IsFloatCurveUnchanged(Curve.Key, Curve.Value))
+			{
+				continue;
+			}
+
+			const FAnimationCurveIdentifier CurveId(Curve.Key, ERawCurveTrackTypes::RCT_Float);
+			if ((!DataModel->FindFloatCurve(CurveId) && !Controller.AddCurve(CurveId, AACF_DefaultCurve, bShouldTransact))
+				|| !Controller.SetCurveKeys(CurveId, Curve.Value, bShouldTransact))
+			{
+				UE_LOG(LogFreeAnimHelpers, Error, TEXT("Can't write curve %s to %s"), *Curve.Key.ToString(), *AnimationSequence->GetName());
+				FailedNum++;
+				continue;
+			}
+			ChangesNum++;
+		}
+	}
+
+	BoneTracks.Empty();
+	TrackBuffers.Empty();
+	FloatCurves.Empty();
+	ExactCurves.Empty();
+
+	FFreeAnimProfiler::AddCounter(EFreeAnimCounter::CommittedTracks, ChangesNum);
+	return ChangesNum;
+}
+
+bool FTrackCommitWriter::CommitBoneTrack(const FName& BoneName, const FRawAnimSequenceTrack& Track)
+{
+	if (IsBoneTrackUnchanged(BoneName, Track))
+	{
+		return false;
+	}
+
+	IAnimationDataController& Controller = AnimationSequence->GetController();
+	bool bTrackExists = AnimationSequence->GetDataModel()->IsValidBoneTrackName(BoneName);
+	if (!bTrackExists)
+	{
+#if ENGINE_MINOR_VERSION < 2
+		bTrackExists = Controller.AddBoneTrack(BoneName, bShouldTransact) != INDEX_NONE;
+#else
+		bTrackExists = Controller.AddBoneCurve(BoneName, bShouldTransact);
+#endif
+	}
+	if (!bTrackExists || !Controller.SetBoneTrackKeys(BoneName, Track.PosKeys, Track.RotKeys, Track.ScaleKeys, bShouldTransact))
+	{
+		UE_LOG(LogFreeAnimHelpers, Error, TEXT("Can't write bone track %s to %s"), *BoneName.ToString(), *AnimationSequence->GetName());
+		FailedNum++;
+		return false;
+	}
+	return true;
+}
+
+bool FTrackCommitWriter::IsBoneTrackUnchanged(const FName& BoneName, const FRawAnimSequenceTrack& Track) const
+{
+	const IAnimationDataModel* DataModel = AnimationSequence->GetDataModel();
+	if (!DataModel->IsValidBoneTrackName(BoneName))
+	{
+		return false;
+	}
+
+	TArray<FTransform> ExistingKeys;
+	DataModel->GetBoneTrackTransforms(BoneName, ExistingKeys);
+
+	const int32 KeysNum = ExistingKeys.Num();
+	if (Track.PosKeys.Num() != KeysNum || Track.RotKeys.Num() != KeysNum || Track.ScaleKeys.Num() != KeysNum)
+	{
+		return false;
+	}
+
+	// keys are stored in single precision, so conversion to double is exact
+	for (int32 KeyIndex = 0; KeyIndex < KeysNum; KeyIndex++)
+	{
+		const FTransform& Key = ExistingKeys[KeyIndex];
+		if (Key.GetTranslation() != FVector(Track.PosKeys[KeyIndex])
+			|| Key.GetRotation() != FQuat(Track.RotKeys[KeyIndex])
+			|| Key.GetScale3D() != FVector(Track.ScaleKeys[KeyIndex]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FTrackCommitWriter::IsFloatCurveUnchanged(const FName& CurveName, const TArray<FRichCurveKey>& Keys) const
+{
+	const FFloatCurve* ExistingCurve = AnimationSequence->GetDataModel()->FindFloatCurve(FAnimationCurveIdentifier(CurveName, ERawCurveTrackTypes::RCT_Float));
+	if (!ExistingCurve)
+	{
+		return false;
+	}
+
+	const TArray<FRichCurveKey>& ExistingKeys = ExistingCurve->FloatCurve.GetConstRefOfKeys();
+	if (ExistingKeys.Num() != Keys.Num())
+	{
+		return false;
+	}
+
+	for (int32 KeyIndex = 0; KeyIndex < Keys.Num(); KeyIndex++)
+	{
+		if (!(ExistingKeys[KeyIndex] == Keys[KeyIndex]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+#undef LOCTEXT_NAMESPACE
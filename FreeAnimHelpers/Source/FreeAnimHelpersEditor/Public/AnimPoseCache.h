@@ -0,0 +1,77 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UAnimSequence;
+class USkeletalMesh;
+class FAnimSkeletonBinding;
+class IAnimationDataModel;
+struct FAnimTrackBuffer;
+
+/**
+ * Poses of all frames of animation sequence, evaluated once.
+ * Only component-space transforms are stored, in single precision in a flat frame-major array: [Frame * NumBones + Bone].
+ * Local transforms are read from animation data on request, so sequence and override tracks should outlive the cache.
+ * If poses don't fit in MaxPoseCacheSizeMB of plugin settings, nothing is stored and component-space transforms are evaluated
+ * on request by walking the parent chain. Only requested bones and their parents are evaluated; cache bones are ordered parent-before-child.
+ */
+struct FREEANIMHELPERSEDITOR_API FAnimPoseCache
+{
+public:
+	/* Evaluate all frames of animation sequence. Empty RequiredBones means whole skeleton.
+	 * If PreviewMesh is null, preview mesh of the sequence is used (or skeleton if there is no preview mesh) */
+	bool Init(const UAnimSequence* AnimationSequence, const TArray<FName>& RequiredBones = TArray<FName>(), const USkeletalMesh* PreviewMesh = nullptr);
+	/* Evaluate with already resolved skeleton binding. Doesn't touch binding registry, so it can be called from worker threads.
+	 * Keys of bones present in OverrideTracks are used instead of animation data (output of previous modifiers in stack) */
+	bool Init(const UAnimSequence* AnimationSequence, const FAnimSkeletonBinding& Binding, const TArray<FName>& RequiredBones = TArray<FName>(), const FAnimTrackBuffer* OverrideTracks = nullptr);
+
+	void Reset();
+
+	bool IsValid() const { return NumFrames > 0 && BoneNames.Num() > 0; }
+	/* False if poses exceed memory limit and are evaluated on request */
+	bool IsPrecomputed() const { return !ComponentPoses.IsEmpty(); }
+	int32 GetNumFrames() const { return NumFrames; }
+	int32 GetNumBones() const { return BoneNames.Num(); }
+
+	/* Index of bone in cache or INDEX_NONE */
+	int32 FindBone(const FName& BoneName) const;
+	/* Index of parent bone in cache or INDEX_NONE for root */
+	int32 GetParentIndex(int32 CacheBoneIndex) const { return ParentIndices[CacheBoneIndex]; }
+	const FName& GetBoneName(int32 CacheBoneIndex) const { return BoneNames[CacheBoneIndex]; }
+	/* Index of bone in reference skeleton used to build the cache */
+	int32 GetRefBoneIndex(int32 CacheBoneIndex) const { return RefBoneIndices[CacheBoneIndex]; }
+
+	/* Local transform as it's stored in animation track (or reference pose if bone isn't animated) */
+	FTransform GetLocalTransform(int32 FrameIndex, int32 CacheBoneIndex) const;
+	/* Local transform with translation and scale replaced by reference pose for bones with "Skeleton" translation retargeting */
+	FTransform GetRetargetedLocalTransform(int32 FrameIndex, int32 CacheBoneIndex) const;
+	FTransform GetComponentTransform(int32 FrameIndex, int32 CacheBoneIndex) const;
+	FTransform GetComponentTransform(int32 FrameIndex, const FName& BoneName) const;
+
+	/* Size of precomputed poses in bytes */
+	static SIZE_T GetPosesSize(int32 FramesNum, int32 BonesNum) { return (SIZE_T)FramesNum * BonesNum * sizeof(FTransform3f); }
+
+private:
+	int32 NumFrames = 0;
+
+	TArray<FName> BoneNames;
+	TArray<int32> RefBoneIndices;
+	TArray<int32> ParentIndices;
+	TMap<FName, int32> BoneNameToIndex;
+	/* Reference pose of cached bones and flags of "Skeleton" translation retargeting */
+	TArray<FTransform> RetargetRefPoses;
+	TBitArray<> UseRetargetRefPose;
+	/* Bones with tracks in animation data */
+	TBitArray<> HasTrack;
+	/* Slots of bones in override tracks or INDEX_NONE */
+	TArray<int32> OverrideSlots;
+
+	/* Sources of local transforms */
+	const IAnimationDataModel* SourceDataModel = nullptr;
+	const FAnimTrackBuffer* SourceOverrideTracks = nullptr;
+
+	TArray<FTransform3f> ComponentPoses;
+};
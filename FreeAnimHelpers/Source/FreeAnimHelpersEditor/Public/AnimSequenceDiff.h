@@ -0,0 +1,82 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Curves/RichCurve.h"
+
+class UAnimSequence;
+
+/** Copy of bone tracks and float curves of animation sequence, used as golden data of regression checks */
+struct FREEANIMHELPERSEDITOR_API FAnimSequenceSnapshot
+{
+	/** Keys of one bone track in single precision, as they are stored in data model */
+	struct FBoneKeys
+	{
+		TArray<FVector3f> PosKeys;
+		TArray<FQuat4f> RotKeys;
+		TArray<FVector3f> ScaleKeys;
+	};
+
+	FFrameRate FrameRate;
+	int32 NumKeys = 0;
+	TMap<FName, FBoneKeys> BoneTracks;
+	TMap<FName, TArray<FRichCurveKey>> FloatCurves;
+
+	/* Read current animation data of the sequence */
+	static FAnimSequenceSnapshot Capture(const UAnimSequence* AnimationSequence);
+
+	bool SaveToFile(const FString& FileName);
+	bool LoadFromFile(const FString& FileName);
+
+	friend FArchive& operator<<(FArchive& Ar, FAnimSequenceSnapshot& Snapshot);
+};
+
+/** Maximal allowed differences between expected and actual animation data */
+struct FREEANIMHELPERSEDITOR_API FAnimSequenceDiffTolerance
+{
+	/* Centimeters */
+	double Translation = 0.01;
+	/* Angle between rotations in degrees */
+	double RotationDegrees = 0.01;
+	double Scale = 0.0001;
+	/* Difference of curve values sampled at frame times */
+	double Curve = 0.0001;
+};
+
+/** Result of comparison of two snapshots: max errors of every bone track and curve */
+struct FREEANIMHELPERSEDITOR_API FAnimSequenceDiff
+{
+	struct FBoneError
+	{
+		FName BoneName;
+		double Translation = 0.0;
+		double RotationDegrees = 0.0;
+		double Scale = 0.0;
+		/* Frame with the largest error */
+		int32 WorstFrame = INDEX_NONE;
+		/* Track exists only in one of snapshots */
+		bool bMissing = false;
+		bool bPassed = true;
+	};
+
+	struct FCurveError
+	{
+		FName CurveName;
+		double Value = 0.0;
+		int32 WorstFrame = INDEX_NONE;
+		bool bMissing = false;
+		bool bPassed = true;
+	};
+
+	/* Frame rate and number of keys are the same */
+	bool bTimingMatches = true;
+	TArray<FBoneError> Bones;
+	TArray<FCurveError> Curves;
+
+	/* Compare actual animation data to expected one. Tracks and curves are sorted by name */
+	static FAnimSequenceDiff Compare(const FAnimSequenceSnapshot& Expected, const FAnimSequenceSnapshot& Actual, const FAnimSequenceDiffTolerance& Tolerance);
+
+	bool IsPassed() const;
+};
@@ -0,0 +1,101 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/ObjectKey.h"
+#include "Misc/MemStack.h"
+
+class UAnimSequenceBase;
+class USkeletalMesh;
+class USkeleton;
+
+/**
+ * Bone lookup tables of animation sequence: bone name -> reference bone index -> animation track -> parent index -> retargeting mode.
+ * Resolved once per (sequence, skeleton, preview mesh) and cached until data model of the sequence changes or
+ * hierarchy or reference pose of the skeleton or the preview mesh is changed. Retargeting modes are read from the skeleton,
+ * so they don't need invalidation. Entries of destroyed assets are removed after garbage collection.
+ * Bone indices are indices in reference skeleton of the preview mesh (or of the skeleton if preview mesh is null).
+ */
+class FREEANIMHELPERSEDITOR_API FAnimSkeletonBinding
+{
+public:
+	/* Get cached binding or build a new one */
+	static TSharedRef<const FAnimSkeletonBinding> Get(const UAnimSequenceBase* AnimationSequence, const USkeletalMesh* PreviewMesh = nullptr);
+	/* Binding of preview mesh if it has all bones, binding of the skeleton otherwise. OutBoneIndices are INDEX_NONE for bones missing in both */
+	static TSharedRef<const FAnimSkeletonBinding> GetForBones(const UAnimSequenceBase* AnimationSequence, const USkeletalMesh* PreviewMesh, const TArray<FName>& BoneNames, TArray<int32>& OutBoneIndices);
+	/* Drop cached bindings which use this sequence, skeleton or skeletal mesh; drop all bindings if Asset is null */
+	static void Invalidate(const UObject* Asset = nullptr);
+	/* Drop all bindings and stop listening to asset changes */
+	static void ResetCache();
+
+	bool IsValid() const { return BoneNames.Num() > 0; }
+	int32 GetNumBones() const { return BoneNames.Num(); }
+
+	/* Index of bone in reference skeleton or INDEX_NONE */
+	int32 FindBoneIndex(const FName& BoneName) const;
+	/* Indices of several bones (INDEX_NONE for missing bones). Returns false if any bone wasn't found */
+	bool FindBoneIndices(const TArray<FName>& InBoneNames, TArray<int32>& OutBoneIndices) const;
+	const FName& GetBoneName(int32 BoneIndex) const { return BoneNames[BoneIndex]; }
+	int32 GetParentIndex(int32 BoneIndex) const { return ParentIndices[BoneIndex]; }
+	const FTransform& GetRefPose(int32 BoneIndex) const { return RefPose[BoneIndex]; }
+	const TArray<FTransform>& GetRefPose() const { return RefPose; }
+	/* Bone has animation track in data model */
+	bool HasTrack(int32 BoneIndex) const { return HasTrackMask[BoneIndex]; }
+	/* Bone uses "Skeleton" translation retargeting mode */
+	bool IsTranslationRetargeted(int32 BoneIndex) const;
+
+	/* Replace translation and scale by reference pose for bones with "Skeleton" translation retargeting */
+	void ApplyRetargeting(int32 BoneIndex, FTransform& InOutLocalPose) const
+	{
+		if (IsTranslationRetargeted(BoneIndex))
+		{
+			InOutLocalPose.SetTranslationAndScale3D(RefPose[BoneIndex].GetTranslation(), RefPose[BoneIndex].GetScale3D());
+		}
+	}
+
+	/* Get indices of bones and all their parents, sorted parent-before-child. INDEX_NONE in BoneIndices is ignored.
+	 * Output array can use stack or mem stack allocator; the function itself doesn't touch the heap */
+	template<typename AllocatorType>
+	void GetBoneIndicesWithParents(TArrayView<const int32> BoneIndices, TArray<int32, AllocatorType>& OutBoneIndices) const
+	{
+		OutBoneIndices.Reset();
+
+		FMemMark Mark(FMemStack::Get());
+		TBitArray<TMemStackAllocator<>> RequiredMask(false, BoneNames.Num());
+		for (int32 BoneIndex : BoneIndices)
+		{
+			while (BoneIndex != INDEX_NONE && !RequiredMask[BoneIndex])
+			{
+				RequiredMask[BoneIndex] = true;
+				BoneIndex = ParentIndices[BoneIndex];
+			}
+		}
+
+		// parent bone always has lower index in reference skeleton
+		for (TConstSetBitIterator<TMemStackAllocator<>> It(RequiredMask); It; ++It)
+		{
+			OutBoneIndices.Add(It.GetIndex());
+		}
+	}
+
+private:
+	FAnimSkeletonBinding() {}
+
+	void Build(const UAnimSequenceBase* AnimationSequence, const USkeletalMesh* PreviewMesh);
+
+	TObjectKey<USkeleton> Skeleton;
+	/* Skeleton of the sequence, alive while the sequence is used */
+	const USkeleton* SkeletonAsset = nullptr;
+
+	TArray<FName> BoneNames;
+	TArray<int32> ParentIndices;
+	TArray<FTransform> RefPose;
+	TMap<FName, int32> NameToIndex;
+	TBitArray<> HasTrackMask;
+	/* Bone indices in the skeleton, retargeting mode is stored there */
+	TArray<int32> SkeletonBoneIndices;
+
+	friend class FAnimSkeletonBindingRegistry;
+};
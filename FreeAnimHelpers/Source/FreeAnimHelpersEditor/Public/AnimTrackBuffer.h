@@ -0,0 +1,71 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Animation/AnimTypes.h"
+
+/**
+ * Output keys of animation modifier for a fixed set of bones.
+ * Translation, rotation and scale are stored in separate bone-major planes: [Slot * NumFrames + Frame].
+ * Memory is allocated once in Init; keys are written by bone slot, so hot loops don't need name lookups.
+ * Different frames can be written from different threads.
+ */
+struct FREEANIMHELPERSEDITOR_API FAnimTrackBuffer
+{
+public:
+	/* Add bones and allocate keys. Slot of bone is its index in BoneNames */
+	void Init(const TArray<FName>& InBoneNames, int32 InNumFrames);
+	/* Allocate keys for bones added by AddBone */
+	void Init(int32 InNumFrames);
+	/* Add bone slot. Should be called before Init; returns existing slot if bone is already added */
+	int32 AddBone(const FName& BoneName);
+
+	void Reset();
+
+	bool IsValid() const { return NumFrames > 0 && BoneNames.Num() > 0 && PosKeys.Num() == BoneNames.Num() * NumFrames; }
+	int32 GetNumFrames() const { return NumFrames; }
+	int32 GetNumBones() const { return BoneNames.Num(); }
+
+	/* Slot of bone or INDEX_NONE */
+	int32 FindSlot(const FName& BoneName) const
+	{
+		const int32* Slot = SlotsByName.Find(BoneName);
+		return Slot ? *Slot : INDEX_NONE;
+	}
+	const FName& GetBoneName(int32 Slot) const { return BoneNames[Slot]; }
+
+	void SetKey(int32 Slot, int32 FrameIndex, const FTransform& Key)
+	{
+		const int32 KeyIndex = Slot * NumFrames + FrameIndex;
+		PosKeys[KeyIndex] = (FVector3f)Key.GetTranslation();
+		RotKeys[KeyIndex] = (FQuat4f)Key.GetRotation();
+		ScaleKeys[KeyIndex] = (FVector3f)Key.GetScale3D();
+	}
+	void SetPosKey(int32 Slot, int32 FrameIndex, const FVector& Value) { PosKeys[Slot * NumFrames + FrameIndex] = (FVector3f)Value; }
+	void SetRotKey(int32 Slot, int32 FrameIndex, const FQuat& Value) { RotKeys[Slot * NumFrames + FrameIndex] = (FQuat4f)Value; }
+	void SetScaleKey(int32 Slot, int32 FrameIndex, const FVector& Value) { ScaleKeys[Slot * NumFrames + FrameIndex] = (FVector3f)Value; }
+
+	FTransform GetKey(int32 Slot, int32 FrameIndex) const;
+
+	/* Keys of one bone */
+	TArrayView<const FVector3f> GetPosKeys(int32 Slot) const { return MakeArrayView(PosKeys.GetData() + Slot * NumFrames, NumFrames); }
+	TArrayView<const FQuat4f> GetRotKeys(int32 Slot) const { return MakeArrayView(RotKeys.GetData() + Slot * NumFrames, NumFrames); }
+	TArrayView<const FVector3f> GetScaleKeys(int32 Slot) const { return MakeArrayView(ScaleKeys.GetData() + Slot * NumFrames, NumFrames); }
+
+	/* Copy keys of all bones of Other buffer, adding missing bones. Both buffers should have the same number of frames */
+	void Merge(const FAnimTrackBuffer& Other);
+
+	/* Copy keys of bone to raw track. Track arrays are reused, so the same track can be passed for all slots */
+	void ToRawTrack(int32 Slot, FRawAnimSequenceTrack& OutTrack) const;
+
+private:
+	int32 NumFrames = 0;
+
+	TArray<FName> BoneNames;
+	TMap<FName, int32> SlotsByName;
+	TArray<FVector3f> PosKeys;
+	TArray<FQuat4f> RotKeys;
+	TArray<FVector3f> ScaleKeys;
+};
@@ -0,0 +1,33 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "SyntheticAnimation.h"
+
+class USkeletalMesh;
+
+/**
+ * Measures speed of modifiers and library functions on skeletons and animations created in memory (see FSyntheticAnimation).
+ * Report is CSV with one row per configuration and test:
+ * Bones,Depth,Frames,Test,Milliseconds,FramesPerSecond,BoneFramesPerSecond,PeakDeltaMB,UsedDeltaMB,AllocationsPerFrame,Result
+ * BoneFramesPerSecond is number of skeleton bones multiplied by frames per second. Memory values are increase of used physical memory
+ * of the process during the first run of the test: at its peak (polled every millisecond) and at the end.
+ * <Modifier> rows apply modifier to a copy of animation, for UFreeAnimModifier classes <Modifier>.Evaluate and <Modifier>.Commit rows time both phases separately.
+ * <Modifier>.FrameAllocations rows only fill AllocationsPerFrame: heap allocations per frame of single-threaded evaluation in steady state, expected to be zero.
+ */
+class FREEANIMHELPERSEDITOR_API FFreeAnimBenchmark
+{
+public:
+	/* Run all tests for every configuration. Time of each test is the best of Iterations runs */
+	static void Run(const TArray<FSyntheticAnimationConfig>& Configs, int32 Iterations, TArray<FString>& OutReport);
+
+	/* Number of heap allocations made by the calling thread while Body runs. Allocations of work sent to other threads aren't counted */
+	static int64 CountThreadAllocations(TFunctionRef<void()> Body);
+
+	/* Remove cached data of synthetic assets before they are garbage collected, so it isn't found by new objects at the same addresses */
+	static void ReleaseSyntheticAssets(USkeletalMesh* Mesh);
+
+	static const TCHAR* ReportHeader;
+};
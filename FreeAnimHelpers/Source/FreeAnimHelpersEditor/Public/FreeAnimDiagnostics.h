@@ -0,0 +1,40 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Logging/LogMacros.h"
+
+FREEANIMHELPERSEDITOR_API DECLARE_LOG_CATEGORY_EXTERN(LogFreeAnimHelpers, Log, All);
+
+/**
+ * In-memory ring buffer of per-frame diagnostics of modifiers.
+ * Enabled by Verbose verbosity of LogFreeAnimHelpers (console: log LogFreeAnimHelpers Verbose). Entries aren't written to log,
+ * they're dumped when modifier fails or by console command FreeAnimHelpers.DumpDiagnostics.
+ * Size of the buffer is set by FreeAnimHelpers.DiagnosticsCapacity.
+ */
+class FREEANIMHELPERSEDITOR_API FFreeAnimDiagnostics
+{
+public:
+	/* Should diagnostics be recorded. Checked before formatting, see FREEANIM_DIAG */
+	static bool IsEnabled() { return !LogFreeAnimHelpers.IsSuppressed(ELogVerbosity::Verbose); }
+
+	/* Add entry to buffer, the oldest entry is replaced if buffer is full. Thread safe */
+	static void Add(FString&& Entry);
+
+	/* Write all buffered entries to log and clear the buffer */
+	static void Dump(const TCHAR* Reason);
+
+	static void Reset();
+};
+
+/* Per-frame diagnostics: formatted only if recording is enabled */
+#define FREEANIM_DIAG(Format, ...) \
+	do \
+	{ \
+		if (FFreeAnimDiagnostics::IsEnabled()) \
+		{ \
+			FFreeAnimDiagnostics::Add(FString::Printf(Format, ##__VA_ARGS__)); \
+		} \
+	} while (0)
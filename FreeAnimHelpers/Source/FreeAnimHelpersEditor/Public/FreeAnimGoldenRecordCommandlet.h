@@ -0,0 +1,35 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "FreeAnimGoldenRecordCommandlet.generated.h"
+
+class UAnimationModifier;
+
+/**
+ * Records golden data for -Golden=Compare of UFreeAnimHelpersCommandlet: every modifier of the plugin is applied with default settings
+ * to synthetic animations (see FSyntheticAnimation) and the result is saved as FAnimSequenceSnapshot.
+ * Uses only engine API, FSyntheticAnimation and FAnimSequenceSnapshot, so it can be copied to the baseline version of the plugin
+ * and record reference output of modifiers as they were before optimizations (see Golden/README.md).
+ * UnrealEditor-Cmd Project.uproject -run=FreeAnimGoldenRecord -GoldenDir=Dir [-Bones=60+200] [-Depth=4] [-Frames=31+301] -nullrhi
+ */
+UCLASS()
+class FREEANIMHELPERSEDITOR_API UFreeAnimGoldenRecordCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UFreeAnimGoldenRecordCommandlet();
+
+	/* UCommandlet overrides */
+	virtual int32 Main(const FString& Params) override;
+	/* UCommandlet overrides end */
+
+protected:
+	/* Modifier applied to the current fixture. Kept here to be referenced during garbage collection */
+	UPROPERTY(Transient)
+	UAnimationModifier* Modifier = nullptr;
+};
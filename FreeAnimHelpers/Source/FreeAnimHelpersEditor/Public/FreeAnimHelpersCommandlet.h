@@ -0,0 +1,84 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "FreeAnimHelpersCommandlet.generated.h"
+
+class UAnimationModifier;
+class UAnimSequence;
+
+/**
+ * Applies stack of animation modifiers to animation sequences without editor UI and saves modified packages.
+ * UnrealEditor-Cmd Project.uproject -run=FreeAnimHelpers -Stack=Stack.json [-Path=/Game/Anims+/Game/Other] [-Filter=*_Run*] [-Report=Report.csv] [-NoSave] [-Force] [-Shards=8 [-Retries=1]] -nullrhi
+ *
+ * Stack file:
+ * {
+ *   "Modifiers": [
+ *     { "Class": "MirrorAnimation", "Properties": { "MirrorAxis": "X" } },
+ *     { "Class": "SnapFootToGround", "Properties": { "FootTipSocket_Right": "foot_tip_r", "bSnapFootRotation": true } }
+ *   ]
+ * }
+ * Modifiers are applied in the listed order, each of them to one sequence at a time.
+ * With -Shards=K list of animations is split to K manifests processed by child editor processes (-Manifest=<file>),
+ * their reports are merged and failed animations are processed again up to -Retries times.
+ * Animations already processed by the same stack and not changed since then are skipped, unless -Force is specified.
+ *
+ * Benchmark of modifiers and library functions on skeletons and animations generated in memory, see FFreeAnimBenchmark:
+ * UnrealEditor-Cmd Project.uproject -run=FreeAnimHelpers -Benchmark [-Bones=30+100+500] [-Depth=4] [-Frames=30+1000+10000] [-Iterations=3] [-Report=Benchmark.csv] -nullrhi
+ *
+ * Regression check: every modifier is applied with default settings to synthetic animations and result is compared with tolerances
+ * (see FAnimSequenceDiff) to golden data recorded by the baseline version of modifiers (see UFreeAnimGoldenRecordCommandlet).
+ * Exit code is 1 if there is no golden data or any bone or curve differs from it more than allowed.
+ * UnrealEditor-Cmd Project.uproject -run=FreeAnimHelpers -Golden=Compare [-GoldenDir=Dir] [-Bones=60+200] [-Depth=4] [-Frames=31+301]
+ *     [-TranslationTolerance=0.01] [-RotationTolerance=0.01] [-ScaleTolerance=0.0001] [-CurveTolerance=0.0001] [-Report=Golden.csv] -nullrhi
+ */
+UCLASS()
+class FREEANIMHELPERSEDITOR_API UFreeAnimHelpersCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UFreeAnimHelpersCommandlet();
+
+	/* UCommandlet overrides */
+	virtual int32 Main(const FString& Params) override;
+	/* UCommandlet overrides end */
+
+protected:
+	/* Create modifiers described in json file */
+	bool LoadModifierStack(const FString& StackFileName);
+
+	/* Apply modifier stack to animations in this process, returns number of failed animations */
+	int32 ProcessAnimations(const TArray<FSoftObjectPath>& Animations, bool bSave, TArray<FString>& Report);
+
+	/* Split animations between child processes and merge their reports, returns number of failed animations */
+	int32 RunShards(const TArray<FSoftObjectPath>& Animations, int32 ShardsNum, int32 RetriesNum, const FString& StackFileName, bool bSave, TArray<FString>& Report) const;
+
+	/* Run benchmark for every combination of bones and frames numbers, returns exit code */
+	static int32 RunBenchmark(const TMap<FString, FString>& ParamsMap);
+
+	/* Compare modifiers applied to synthetic animations to golden data, returns exit code */
+	int32 RunGolden(const TMap<FString, FString>& ParamsMap);
+
+	/* Read list of animations prepared by parent process */
+	static bool ReadManifest(const FString& ManifestFileName, TArray<FSoftObjectPath>& OutAnimations);
+
+	/* Find animation sequences in content paths, Filter is wildcard for asset name */
+	void FindAnimations(const TArray<FString>& ContentPaths, const FString& Filter, TArray<FSoftObjectPath>& OutAnimations) const;
+
+	/* Save package of animation sequence to disk */
+	static bool SaveAnimation(UAnimSequence* AnimationSequence);
+
+	/* Modifiers of the stack. Kept here to be referenced during garbage collection */
+	UPROPERTY(Transient)
+	TArray<UAnimationModifier*> Modifiers;
+
+	/* Hash of modifier stack settings, see FModifierStackHash */
+	FString SettingsHash;
+
+	/* Process animations even if they are up to date */
+	bool bForce = false;
+};
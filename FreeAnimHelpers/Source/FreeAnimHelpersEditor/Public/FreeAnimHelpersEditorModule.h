@@ -1,26 +1,36 @@
-// Copyright Epic Games, Inc. All Rights Reserved.
-
-#pragma once
-
-#include "CoreMinimal.h"
-#include "Framework/Commands/Commands.h"
-#include "Modules/ModuleManager.h"
-
-class FToolBarBuilder;
-class FMenuBuilder;
-
-class FFreeAnimHelpersEditorModule : public IModuleInterface
-{
-public:
-
-	/** IModuleInterface implementation */
-	virtual void StartupModule() override;
-	virtual void ShutdownModule() override;
-	
-	void ResetRootScale(TArray<FAssetData> SelectedAssets);
-
-protected:
-	TSharedPtr<FUICommandList> CommandList;
-
-	FDelegateHandle ContentBrowserMenuExtenderHandle;
-};
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Framework/Commands/Commands.h"
+#include "Modules/ModuleManager.h"
+
+class FToolBarBuilder;
+class FMenuBuilder;
+
+class FFreeAnimHelpersEditorModule : public IModuleInterface
+{
+public:
+
+	/** IModuleInterface implementation */
+	virtual void StartupModule() override;
+	virtual void ShutdownModule() override;
+	
+	void ResetRootScale(TArray<FAssetData> SelectedAssets);
+
+	/* Ask for settings of new modifier and apply it to all selected animation sequences */
+	void ApplyModifier(UClass* ModifierClass, TArray<FAssetData> SelectedAssets);
+
+	/* Show result of new modifier in transient copy of animation sequence, apply it to the sequence when confirmed */
+	void PreviewModifier(UClass* ModifierClass, FAssetData SelectedAsset);
+
+protected:
+	TSharedPtr<FUICommandList> CommandList;
+
+	FDelegateHandle ContentBrowserMenuExtenderHandle;
+
+private:
+	/* Show modal window with properties of modifier. Returns false if user canceled */
+	static bool EditModifierSettings(UObject* Modifier);
+};
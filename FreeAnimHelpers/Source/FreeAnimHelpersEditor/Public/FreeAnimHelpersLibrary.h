@@ -1,75 +1,125 @@
-// (c) Yuri N. K. 2022. All rights reserved.
-// ykasczc@gmail.com
-
-#pragma once
-
-#include "CoreMinimal.h"
-#include "Kismet/BlueprintFunctionLibrary.h"
-#include "FreeAnimHelpersLibrary.generated.h"
-
-class UAnimSequence;
-class USkeletalMesh;
-class UCurveFloat;
-class UCurveVector;
-
-/**
- * Global functions for Editor module
- */
-UCLASS()
-class FREEANIMHELPERSEDITOR_API UFreeAnimHelpersLibrary : public UBlueprintFunctionLibrary
-{
-	GENERATED_BODY()
-	
-public:
-	/* For reference pose: get bone transform in component space by bone name */
-	UFUNCTION(BlueprintCallable, Category = "FreeAnimHelpersLibrary")
-	static FTransform GetBoneRefPositionInComponentSpace(const UAnimSequence* AnimationSequence, const FName& BoneName);
-
-	/* For reference pose: get transform of socket in component space by its name */
-	UFUNCTION(BlueprintCallable, Category = "FreeAnimHelpersLibrary")
-	static FTransform GetSocketRefPositionInComponentSpace(const UAnimSequence* AnimationSequence, const FName& SocketName);
-
-	/* For reference pose: get bone transform in component space by bone index */
-	static FTransform GetBoneRefPositionInComponentSpaceByIndex(const UAnimSequence* AnimationSequence, int32 BoneIndex);
-
-	/* For reference pose: get bone transform in component space by bone index, for reference skeleton */
-	static FTransform GetRefSkeletonBonePositionByIndex(const FReferenceSkeleton& RefSkeleton, int32 BoneIndex);
-
-	/* For pose in animation: get bone transform in compnent space */
-	UFUNCTION(BlueprintCallable, meta = (DisplayName = "Get Bone Transform at Animation Time"), Category = "FreeAnimHelpersLibrary")
-	static FTransform GetBonePositionAtTimeInCS(const UAnimSequence* AnimationSequence, const FName& BoneName, float Time);
-
-	/* For pose in animation: get socket transform in compnent space */
-	UFUNCTION(BlueprintCallable, meta=(DisplayName="Get Socket Transform at Animation Time"), Category = "FreeAnimHelpersLibrary")
-	static FTransform GetSocketPositionAtTimeInCS(const UAnimSequence* AnimationSequence, const FName& SocketName, float Time);
-
-	UFUNCTION(BlueprintCallable, Category = "FreeAnimHelpersLibrary")
-	static void ResetSkinndeAssetRootBoneScale(USkeletalMesh* SkeletalMesh, bool bKeepModelSize = true);
-
-	UFUNCTION(BlueprintCallable, Category = "FreeAnimHelpersLibrary")
-	static void AddFloatCurveKey(UCurveFloat* Curve, float Time, float Value, bool bInterpCubic);
-
-	UFUNCTION(BlueprintCallable, Category = "FreeAnimHelpersLibrary")
-	static void AddVectorCurveKey(UCurveVector* Curve, float Time, FVector Value, bool bInterpCubic);
-
-	UFUNCTION(BlueprintCallable, Category = "FreeAnimHelpersLibrary")
-	static void ClearFloatCurve(UCurveFloat* Curve);
-
-	UFUNCTION(BlueprintCallable, Category = "FreeAnimHelpersLibrary")
-	static void ClearVectorCurve(UCurveVector* Curve);
-
-	UFUNCTION(BlueprintPure, Category = "FreeAnimHelpersLibrary")
-	static float GetAnimationNotifyAbsTime(const FAnimNotifyEvent& AnimNotify);
-
-	/* For pose in animation: get bone transform in compnent space (relative to another bone; use for optimization) */
-	static FTransform GetBonePositionAtTimeInCS_ToParent(const UAnimSequence* AnimationSequence, const FName& BoneName, float Time, const FTransform& ParentBonePos, const int32 ParentBoneIndex);
-
-	/* Find axis of rotator the closest to being parallel to the specified vectors. Returns +1.f in Multiplier if co-directed and -1.f otherwise */
-	static EAxis::Type FindCoDirection(const FRotator& BoneRotator, const FVector& Direction, float& ResultMultiplier);
-
-	/* Find float curve */
-	static const FFloatCurve* GetFloatCurve(const UAnimSequence* AnimationSequence, const FName& CurveName, FAnimationCurveIdentifier& OutCurveId);
-
-	static void GetBonePoseForTime(const UAnimSequenceBase* AnimationSequenceBase, const FName& BoneName, float Time, bool bExtractRootMotion, FTransform& Pose, const USkeletalMesh* PreviewMesh = nullptr);
-	static void GetBonePosesForTime(const UAnimSequenceBase* AnimationSequenceBase, const TArray<FName>& BoneNames, float Time, bool bExtractRootMotion, TArray<FTransform>& Poses, const USkeletalMesh* PreviewMesh = nullptr);
-};
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Kismet/BlueprintFunctionLibrary.h"
+#include "FreeAnimHelpersLibrary.generated.h"
+
+class UAnimSequence;
+class USkeleton;
+class USkeletalMesh;
+class UCurveFloat;
+class UCurveVector;
+class FAnimSkeletonBinding;
+struct FRichCurveKey;
+
+/**
+ * Global functions for Editor module
+ */
+UCLASS()
+class FREEANIMHELPERSEDITOR_API UFreeAnimHelpersLibrary : public UBlueprintFunctionLibrary
+{
+	GENERATED_BODY()
+	
+public:
+	/* For reference pose: get bone transform in component space by bone name */
+	UFUNCTION(BlueprintCallable, Category = "FreeAnimHelpersLibrary")
+	static FTransform GetBoneRefPositionInComponentSpace(const UAnimSequence* AnimationSequence, const FName& BoneName);
+
+	/* For reference pose: get transform of socket in component space by its name */
+	UFUNCTION(BlueprintCallable, Category = "FreeAnimHelpersLibrary")
+	static FTransform GetSocketRefPositionInComponentSpace(const UAnimSequence* AnimationSequence, const FName& SocketName);
+
+	/* For reference pose: get bone transform in component space by bone index */
+	static FTransform GetBoneRefPositionInComponentSpaceByIndex(const UAnimSequence* AnimationSequence, int32 BoneIndex);
+
+	/* For reference pose: get bone transform in component space by bone index, for reference skeleton of skeleton or skeletal mesh asset.
+	 * Pose is read from FRefPoseCache, which is rebuilt after the asset changes */
+	static FTransform GetRefSkeletonBonePositionByIndex(const USkeleton* Skeleton, int32 BoneIndex);
+	static FTransform GetRefSkeletonBonePositionByIndex(const USkeletalMesh* SkeletalMesh, int32 BoneIndex);
+
+	/* For reference pose: get bone transform in component space by bone index, for reference skeleton. Walks parent chain on every call */
+	UE_DEPRECATED(5.2, "Reference skeleton without owner asset can't be cached. Use overload with skeleton or skeletal mesh.")
+	static FTransform GetRefSkeletonBonePositionByIndex(const FReferenceSkeleton& RefSkeleton, int32 BoneIndex);
+
+	/* For pose in animation: get bone transform in compnent space */
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "Get Bone Transform at Animation Time"), Category = "FreeAnimHelpersLibrary")
+	static FTransform GetBonePositionAtTimeInCS(const UAnimSequence* AnimationSequence, const FName& BoneName, float Time);
+
+	/* For pose in animation: get transforms of several bones in component space. Each parent bone is evaluated only once */
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "Get Bones Transforms at Animation Time"), Category = "FreeAnimHelpersLibrary")
+	static void GetBonePositionsAtTimeInCS(const UAnimSequence* AnimationSequence, const TArray<FName>& BoneNames, float Time, TArray<FTransform>& OutTransforms);
+
+	/* For pose in animation: get socket transform in compnent space */
+	UFUNCTION(BlueprintCallable, meta=(DisplayName="Get Socket Transform at Animation Time"), Category = "FreeAnimHelpersLibrary")
+	static FTransform GetSocketPositionAtTimeInCS(const UAnimSequence* AnimationSequence, const FName& SocketName, float Time);
+
+	UFUNCTION(BlueprintCallable, Category = "FreeAnimHelpersLibrary")
+	static void ResetSkinndeAssetRootBoneScale(USkeletalMesh* SkeletalMesh, bool bKeepModelSize = true);
+
+	UFUNCTION(BlueprintCallable, Category = "FreeAnimHelpersLibrary")
+	static void AddFloatCurveKey(UCurveFloat* Curve, float Time, float Value, bool bInterpCubic);
+
+	UFUNCTION(BlueprintCallable, Category = "FreeAnimHelpersLibrary")
+	static void AddVectorCurveKey(UCurveVector* Curve, float Time, FVector Value, bool bInterpCubic);
+
+	UFUNCTION(BlueprintCallable, Category = "FreeAnimHelpersLibrary")
+	static void ClearFloatCurve(UCurveFloat* Curve);
+
+	UFUNCTION(BlueprintCallable, Category = "FreeAnimHelpersLibrary")
+	static void ClearVectorCurve(UCurveVector* Curve);
+
+	UFUNCTION(BlueprintPure, Category = "FreeAnimHelpersLibrary")
+	static float GetAnimationNotifyAbsTime(const FAnimNotifyEvent& AnimNotify);
+
+	/* For pose in animation: get bone transform in compnent space (relative to another bone; use for optimization) */
+	static FTransform GetBonePositionAtTimeInCS_ToParent(const UAnimSequence* AnimationSequence, const FName& BoneName, float Time, const FTransform& ParentBonePos, const int32 ParentBoneIndex);
+
+	/* For pose in animation: get transforms of several bones in component space by indices in skeleton binding. INDEX_NONE results in identity transform */
+	static void GetBonePositionsAtTimeInCSByIndex(const UAnimSequence* AnimationSequence, const FAnimSkeletonBinding& Binding, const TArray<int32>& BoneIndices, float Time, TArray<FTransform>& OutTransforms);
+	/* Allocation-free version: OutTransforms should have the same size as BoneIndices */
+	static void GetBonePositionsAtTimeInCSByIndex(const UAnimSequence* AnimationSequence, const FAnimSkeletonBinding& Binding, TArrayView<const int32> BoneIndices, float Time, TArrayView<FTransform> OutTransforms);
+
+	/* Forward kinematics for one or several frames. Poses are stored frame-major ([Frame * NumBones + Bone]), parents must precede children.
+	 * LocalPoses and OutComponentPoses can point to the same array. Bones are composed with FTransform::operator* followed by NormalizeRotation */
+	static void LocalToComponentSpace(TArrayView<const FTransform> LocalPoses, TArrayView<const int32> ParentIndices, TArrayView<FTransform> OutComponentPoses);
+
+	/* Call FrameBody for every frame. Frames are split into contiguous blocks evaluated in parallel, number of workers is limited by plugin settings.
+	 * FrameBody must only read shared data and write to its own frame slots */
+	static void ParallelForFrames(int32 FramesNum, TFunctionRef<void(int32 FrameIndex)> FrameBody);
+
+	/* Show message box in editor. In commandlets and unattended sessions message is written to log instead */
+	static void ShowMessage(const FText& Message);
+
+	/* Find axis of rotator the closest to being parallel to the specified vectors. Returns +1.f in Multiplier if co-directed and -1.f otherwise */
+	static EAxis::Type FindCoDirection(const FRotator& BoneRotator, const FVector& Direction, float& ResultMultiplier);
+
+	/* Find float curve */
+	static const FFloatCurve* GetFloatCurve(const UAnimSequence* AnimationSequence, const FName& CurveName, FAnimationCurveIdentifier& OutCurveId);
+
+	/* Prepare keys collected in any order for FTrackCommitWriter::AddFloatCurve: sort by time and keep the last added key
+	 * of keys with the same time (as FRichCurve::UpdateOrAddKey). Keys collected in order of time are left unchanged */
+	static void SortCurveKeys(TArray<FRichCurveKey>& InOutKeys);
+
+	/* Remove keys of linear curve which can be interpolated from neighbouring keys with error not greater than MaxError.
+	 * Keys should be sorted by time. Single pass: segment is extended while a line from its first key can pass all skipped keys.
+	 * Keys with the same time are kept. Curves with non-linear keys aren't changed. Returns number of removed keys */
+	static int32 ReduceCurveKeys(TArray<FRichCurveKey>& InOutKeys, float MaxError);
+
+	static void GetBonePoseForTime(const UAnimSequenceBase* AnimationSequenceBase, const FName& BoneName, float Time, bool bExtractRootMotion, FTransform& Pose, const USkeletalMesh* PreviewMesh = nullptr);
+	static void GetBonePosesForTime(const UAnimSequenceBase* AnimationSequenceBase, const TArray<FName>& BoneNames, float Time, bool bExtractRootMotion, TArray<FTransform>& Poses, const USkeletalMesh* PreviewMesh = nullptr);
+	/* Local poses of bones by indices in skeleton binding, without name lookups */
+	static void GetBonePosesForTimeByIndex(const UAnimSequenceBase* AnimationSequenceBase, const FAnimSkeletonBinding& Binding, const TArray<int32>& BoneIndices, float Time, TArray<FTransform>& Poses);
+	static void GetBonePosesForTimeByIndex(const UAnimSequenceBase* AnimationSequenceBase, const FAnimSkeletonBinding& Binding, TArrayView<const int32> BoneIndices, float Time, TArrayView<FTransform> Poses);
+
+	/* Local poses of bones at frame. Integer frames read keys directly, fractional frames are interpolated between neighbouring keys */
+	static void GetBonePoseForFrame(const UAnimSequenceBase* AnimationSequenceBase, const FName& BoneName, const FFrameTime& Frame, FTransform& Pose, const USkeletalMesh* PreviewMesh = nullptr);
+	static void GetBonePosesForFrame(const UAnimSequenceBase* AnimationSequenceBase, const TArray<FName>& BoneNames, const FFrameTime& Frame, TArray<FTransform>& Poses, const USkeletalMesh* PreviewMesh = nullptr);
+	static void GetBonePosesForFrameByIndex(const UAnimSequenceBase* AnimationSequenceBase, const FAnimSkeletonBinding& Binding, const TArray<int32>& BoneIndices, const FFrameTime& Frame, TArray<FTransform>& Poses);
+	/* Allocation-free version for per-frame loops: Poses should have the same size as BoneIndices and can use inline or mem stack storage */
+	static void GetBonePosesForFrameByIndex(const UAnimSequenceBase* AnimationSequenceBase, const FAnimSkeletonBinding& Binding, TArrayView<const int32> BoneIndices, const FFrameTime& Frame, TArrayView<FTransform> Poses);
+	/* Convert time to frame of animation sequence, keeping fraction of sub-frame time */
+	static FFrameTime GetFrameTimeAtTime(const UAnimSequenceBase* AnimationSequenceBase, float Time);
+};
@@ -0,0 +1,47 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DeveloperSettings.h"
+#include "FreeAnimHelpersSettings.generated.h"
+
+/**
+ * Editor settings of Free Anim Helpers plugin
+ */
+UCLASS(config = EditorPerProjectUserSettings, meta = (DisplayName = "Free Anim Helpers"))
+class FREEANIMHELPERSEDITOR_API UFreeAnimHelpersSettings : public UDeveloperSettings
+{
+	GENERATED_BODY()
+
+public:
+	UFreeAnimHelpersSettings();
+
+	virtual FName GetCategoryName() const override { return TEXT("Plugins"); }
+
+	/* Maximum number of threads used to evaluate frames of animation in parallel. 0 means all available workers, 1 disables multithreading */
+	UPROPERTY(config, EditAnywhere, Category = "Performance", meta = (ClampMin = "0"))
+	int32 MaxWorkerThreads;
+
+	/* Minimal number of frames evaluated by one task. Short animations aren't split to avoid threading overhead */
+	UPROPERTY(config, EditAnywhere, Category = "Performance", meta = (ClampMin = "1"))
+	int32 MinFramesPerTask;
+
+	/* Maximum size of component-space poses precomputed for one animation. Poses of larger animations are evaluated on request,
+	 * which needs less memory but walks bone hierarchy for every read. 0 disables the limit */
+	UPROPERTY(config, EditAnywhere, Category = "Performance", meta = (ClampMin = "0", Units = "Megabytes"))
+	int32 MaxPoseCacheSizeMB;
+
+	/* Print time of phases and counters of track evaluations and hierarchy walks to log after modifier is applied */
+	UPROPERTY(config, EditAnywhere, Category = "Performance")
+	bool bLogModifierTiming;
+
+	/* Remove redundant keys of float curves before modifier output is saved to animation */
+	UPROPERTY(config, EditAnywhere, Category = "Key Reduction")
+	bool bReduceKeys;
+
+	/* Maximum difference between reduced and original float curve at time of any original key */
+	UPROPERTY(config, EditAnywhere, Category = "Key Reduction", meta = (ClampMin = "0", EditCondition = "bReduceKeys"))
+	float MaxCurveError;
+};
@@ -0,0 +1,92 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AnimationModifier.h"
+#include "AnimTrackBuffer.h"
+#include "FreeAnimModifierBatch.h"
+#include "Curves/RichCurve.h"
+#include "FreeAnimModifier.generated.h"
+
+class FAnimSkeletonBinding;
+
+/** Output keys of modifier evaluation, sent to animation sequence on game thread */
+struct FREEANIMHELPERSEDITOR_API FFreeAnimModifierOutput
+{
+	FAnimTrackBuffer Tracks;
+	TArray<TPair<FName, TArray<FRichCurveKey>>> FloatCurves;
+};
+
+/**
+ * Input of modifier evaluation. In modifier stack, keys and curves written by previous stages replace animation data of the sequence.
+ * Curves of the sequence itself aren't changed until the whole stack is committed, so stages reading curves should check FindFloatCurve first.
+ */
+struct FREEANIMHELPERSEDITOR_API FFreeAnimModifierInput
+{
+	/* Keys of previous stages, null if modifier is applied alone */
+	const FAnimTrackBuffer* Tracks = nullptr;
+	/* Curves of previous stages, null if modifier is applied alone */
+	const TArray<TPair<FName, TArray<FRichCurveKey>>>* FloatCurves = nullptr;
+
+	/* Keys of curve written by previous stages or null */
+	const TArray<FRichCurveKey>* FindFloatCurve(const FName& CurveName) const;
+
+	/* Slot in Tracks for every bone of binding (INDEX_NONE if previous stages didn't write the bone). Empty if there are no previous stages.
+	 * Should be built once per evaluation and passed to GetBonePosesForFrame */
+	TArray<int32> MakeSlotMap(const FAnimSkeletonBinding& Binding) const;
+
+	/* Local poses of bones at frame: keys of previous stages if bone is present there, animation data otherwise */
+	void GetBonePosesForFrame(const UAnimSequence* AnimationSequence, const FAnimSkeletonBinding& Binding, TArrayView<const int32> BoneIndices, TArrayView<const int32> SlotMap, int32 FrameIndex, TArrayView<FTransform> OutPoses) const;
+};
+
+/** Evaluation prepared for one animation sequence. Can be called on any thread; returns false if nothing should be committed */
+using FFreeAnimModifierEvaluation = TUniqueFunction<bool(const FFreeAnimModifierInput& Input, FFreeAnimModifierOutput& Output)>;
+
+/**
+ * Base class of modifiers which split their work to preparation on game thread, evaluation on any thread and commit on game thread.
+ * Evaluation only reads animation data and writes to its own output, so several sequences can be evaluated in parallel.
+ */
+UCLASS(Abstract, EditInlineNew)
+class FREEANIMHELPERSEDITOR_API UFreeAnimModifier : public UAnimationModifier
+{
+	GENERATED_BODY()
+
+public:
+	/* UAnimationModifier overrides */
+	virtual void OnApply_Implementation(UAnimSequence* AnimationSequence) override;
+	/* UAnimationModifier overrides end */
+
+	/* Game thread: resolve everything which can't be accessed from worker threads (bindings, other assets, settings)
+	 * and return function computing output keys. Empty function means that modifier can't be applied to the sequence */
+	virtual FFreeAnimModifierEvaluation PrepareEvaluation(UAnimSequence* AnimationSequence) const PURE_VIRTUAL(UFreeAnimModifier::PrepareEvaluation, return FFreeAnimModifierEvaluation(););
+
+	/* Animation sequences other than the modified one which are read by evaluation. Batch doesn't modify them while they are read */
+	virtual void GetReferencedSequences(TArray<const UAnimSequence*>& OutSequences) const {}
+
+	/* Game thread: result of the last OnApply of this instance. Animation modifiers report failures only to log, so batch reads it instead */
+	EFreeAnimApplyResult GetLastApplyResult() const { return LastApplyResult; }
+
+	/* Game thread: send evaluated keys to data model of the sequence. Returns number of changed tracks and curves or INDEX_NONE if data model rejected some of them */
+	static int32 CommitOutput(UAnimSequence* AnimationSequence, const FFreeAnimModifierOutput& Output, bool bShouldTransact = true);
+
+	/* Game thread: while the scope exists, OnApply for the sequence commits output evaluated in advance instead of evaluating the modifier again.
+	 * Lets batch and preview apply registered modifier instances through UAnimationModifier::ApplyToAnimationSequence */
+	class FREEANIMHELPERSEDITOR_API FScopedEvaluatedOutput
+	{
+	public:
+		FScopedEvaluatedOutput(const UAnimSequence* AnimationSequence, const FFreeAnimModifierOutput& Output);
+		~FScopedEvaluatedOutput();
+
+	private:
+		const UAnimSequence* PrevSequence;
+		const FFreeAnimModifierOutput* PrevOutput;
+	};
+
+private:
+	EFreeAnimApplyResult LastApplyResult = EFreeAnimApplyResult::Skipped;
+
+	static const UAnimSequence* EvaluatedSequence;
+	static const FFreeAnimModifierOutput* EvaluatedOutput;
+};
@@ -0,0 +1,63 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UAnimationModifier;
+class UAnimSequence;
+struct FFreeAnimModifierOutput;
+
+/** Result of applying modifier to one animation sequence */
+enum class EFreeAnimApplyResult : uint8
+{
+	/* Animation data was changed, modifier is registered in animation modifiers of the sequence */
+	Applied,
+	/* Modifier can't be applied or didn't change animation data, sequence is left as it was */
+	Skipped,
+	/* Modifier changed animation data and reported an error. It stays registered, so the changes can be reverted */
+	Failed
+};
+
+/** Result of applying modifier to a set of animation sequences */
+struct FREEANIMHELPERSEDITOR_API FFreeAnimModifierBatchResult
+{
+	/* Sequences evaluated and committed */
+	int32 Applied = 0;
+	/* Sequences the modifier couldn't be applied to */
+	int32 Skipped = 0;
+	/* Sequences changed by modifier which reported an error */
+	int32 Failed = 0;
+	/* Batch was canceled by user, remaining sequences weren't modified */
+	bool bCanceled = false;
+};
+
+/**
+ * Applies one animation modifier to many animation sequences.
+ * Modifiers derived from UFreeAnimModifier are prepared on game thread, evaluated on worker threads and committed on game thread
+ * in order of sequences. Sequences read by the modifier (see UFreeAnimModifier::GetReferencedSequences) aren't evaluated and committed
+ * at the same time as others, so result is the same as of sequential application. Other modifiers are applied one by one on game thread.
+ * Copy of the modifier is added to animation modifiers of every sequence, as in Animation Data Modifiers window,
+ * so it can be reverted, reapplied and updated later.
+ */
+class FREEANIMHELPERSEDITOR_API FFreeAnimModifierBatch
+{
+public:
+	/* Apply modifier to all sequences. If bShowProgress is true, cancelable progress dialog is shown */
+	static FFreeAnimModifierBatchResult Apply(UAnimationModifier* Modifier, const TArray<UAnimSequence*>& Sequences, bool bShowProgress = true);
+
+	/* Apply modifier to one sequence on game thread */
+	static EFreeAnimApplyResult ApplyToSequence(UAnimationModifier* Modifier, UAnimSequence* AnimationSequence);
+
+	/* Game thread: add copy of modifier to animation modifiers of the sequence and apply it through UAnimationModifier::ApplyToAnimationSequence.
+	 * Output evaluated in advance is committed instead of evaluating UFreeAnimModifier again.
+	 * Copy is removed if animation data wasn't changed. UFreeAnimModifier reports errors by its apply result, other modifiers by errors logged on game thread */
+	static EFreeAnimApplyResult RegisterAndApply(UAnimationModifier* Modifier, UAnimSequence* AnimationSequence, const FFreeAnimModifierOutput* EvaluatedOutput = nullptr);
+
+	/* Get non-abstract animation modifier classes declared in this plugin, sorted by display name */
+	static void GetModifierClasses(TArray<UClass*>& OutClasses);
+
+	/* Find modifier class by name (MirrorAnimation, UMirrorAnimation) or by path (/Script/Module.Class, Blueprint class path) */
+	static UClass* FindModifierClass(const FString& ClassName);
+};
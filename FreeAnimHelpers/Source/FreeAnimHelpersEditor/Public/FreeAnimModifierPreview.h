@@ -0,0 +1,59 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/GCObject.h"
+#include "FreeAnimModifierBatch.h"
+
+class UAnimSequence;
+class UFreeAnimModifier;
+struct FFreeAnimModifierOutput;
+
+/**
+ * Evaluates modifier without changing animation sequence.
+ * Result is written to transient copy of the sequence opened in Animation Editor, so settings can be tuned
+ * without apply-revert cycles. Source sequence is changed only by Commit, using already evaluated keys.
+ */
+class FREEANIMHELPERSEDITOR_API FFreeAnimModifierPreview : public FGCObject
+{
+public:
+	FFreeAnimModifierPreview(UAnimSequence* InSourceSequence, UFreeAnimModifier* InModifier);
+	virtual ~FFreeAnimModifierPreview();
+
+	/* Evaluate modifier with current settings and show result in preview sequence. Returns false if modifier can't be applied */
+	bool Update();
+
+	/* Send evaluated keys to source sequence and register the modifier in its animation modifiers.
+	 * Modifier is evaluated again if settings or source animation were changed after Update */
+	EFreeAnimApplyResult Commit();
+
+	/* Close Animation Editor of preview sequence and release it */
+	void Discard();
+
+	UAnimSequence* GetSourceSequence() const { return SourceSequence; }
+	UAnimSequence* GetPreviewSequence() const { return PreviewSequence; }
+	UFreeAnimModifier* GetModifier() const { return Modifier; }
+
+	/* FGCObject interface */
+	virtual void AddReferencedObjects(FReferenceCollector& Collector) override;
+	virtual FString GetReferencerName() const override { return TEXT("FFreeAnimModifierPreview"); }
+	/* FGCObject interface end */
+
+private:
+	/* Evaluate modifier for source sequence. Returns null if modifier can't be applied */
+	TUniquePtr<FFreeAnimModifierOutput> Evaluate() const;
+	/* Copy bones and curves changed by previous result from source sequence to preview sequence */
+	void RestorePreviewSequence(const FFreeAnimModifierOutput& PreviousOutput);
+	/* Hash of modifier settings and source animation, used to check if evaluated keys are still valid */
+	FString GetInputHash() const;
+
+	TObjectPtr<UAnimSequence> SourceSequence;
+	TObjectPtr<UAnimSequence> PreviewSequence;
+	TObjectPtr<UFreeAnimModifier> Modifier;
+
+	/* Last evaluated keys, shown in preview sequence */
+	TUniquePtr<FFreeAnimModifierOutput> Output;
+	FString EvaluatedInputHash;
+};
@@ -0,0 +1,28 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FreeAnimModifier.h"
+#include "FreeAnimModifierStack.generated.h"
+
+/**
+ * Applies several modifiers as one: stages are evaluated in order on in-memory keys and committed once.
+ * Each stage reads keys and curves written by previous stages instead of animation data, and only bones written by stages are stored.
+ */
+UCLASS(meta = (DisplayName = "Free Anim Modifier Stack"))
+class FREEANIMHELPERSEDITOR_API UFreeAnimModifierStack : public UFreeAnimModifier
+{
+	GENERATED_BODY()
+
+public:
+	/* Modifiers applied in order */
+	UPROPERTY(EditAnywhere, Instanced, Category = "Setup")
+	TArray<UFreeAnimModifier*> Stages;
+
+	/* UFreeAnimModifier overrides */
+	virtual FFreeAnimModifierEvaluation PrepareEvaluation(UAnimSequence* AnimationSequence) const override;
+	virtual void GetReferencedSequences(TArray<const UAnimSequence*>& OutSequences) const override;
+	/* UFreeAnimModifier overrides end */
+};
@@ -0,0 +1,89 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include <atomic>
+
+class UAnimSequence;
+
+/** Counters of expensive operations reported in timing summary of modifier */
+enum class EFreeAnimCounter : uint8
+{
+	/* Bone poses sampled from animation: one bone at one frame */
+	TrackEvaluations,
+	/* Conversions of one pose from local to component space */
+	HierarchyWalks,
+	/* Bone tracks and curves changed in data model */
+	CommittedTracks,
+	Num
+};
+
+/**
+ * Time of modifier phases and counters of expensive operations, printed to log when modifier is applied
+ * (see UFreeAnimHelpersSettings::bLogModifierTiming). Profiler is active on the thread which created it, nested profilers of the same thread are inactive.
+ * Worker threads evaluating frames of the same animation report to it through FThreadScope (see UFreeAnimHelpersLibrary::ParallelForFrames),
+ * while sequences evaluated at the same time by batch have their own profilers.
+ * Phases are visible in Unreal Insights as CPU events (-trace=cpu).
+ */
+class FREEANIMHELPERSEDITOR_API FFreeAnimProfiler
+{
+public:
+	FFreeAnimProfiler(const UObject* Modifier, const UAnimSequence* AnimationSequence);
+	~FFreeAnimProfiler();
+
+	static void AddCounter(EFreeAnimCounter Counter, int64 Value = 1);
+
+	/* Profiler of the calling thread or null */
+	static FFreeAnimProfiler* GetActive();
+
+	/* Makes profiler active on the calling thread while the scope exists. Profiler should outlive the scope */
+	class FREEANIMHELPERSEDITOR_API FThreadScope
+	{
+	public:
+		explicit FThreadScope(FFreeAnimProfiler* Profiler);
+		~FThreadScope();
+
+	private:
+		FFreeAnimProfiler* PrevProfiler;
+	};
+
+	/* Adds time between construction and destruction to the named phase. Use FREEANIM_SCOPE */
+	class FREEANIMHELPERSEDITOR_API FScope
+	{
+	public:
+		explicit FScope(const TCHAR* InPhaseName);
+		~FScope();
+
+	private:
+		const TCHAR* PhaseName;
+		double StartTime;
+	};
+
+private:
+	void AddPhaseTime(const TCHAR* PhaseName, double Seconds);
+	FString GetSummary() const;
+
+	struct FPhase
+	{
+		const TCHAR* Name;
+		double Seconds = 0.0;
+		int32 Calls = 0;
+	};
+
+	FString Title;
+	double StartTime;
+	bool bActive;
+
+	FCriticalSection PhasesGuard;
+	/* In order of the first call */
+	TArray<FPhase> Phases;
+	std::atomic<int64> Counters[(int32)EFreeAnimCounter::Num];
+};
+
+/* Coarse phase of modifier (not a per-frame call): CPU trace event and time in summary of active profiler */
+#define FREEANIM_SCOPE(PhaseName) \
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("FreeAnim." PhaseName); \
+	FFreeAnimProfiler::FScope PREPROCESSOR_JOIN(FreeAnimProfilerScope, __LINE__)(TEXT(PhaseName))
@@ -0,0 +1,31 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UAnimationModifier;
+class UAnimSequence;
+
+/**
+ * Hashes used to skip animations which were already processed by the same modifier stack.
+ * After the stack is applied, hash of its settings and hash of resulting bone tracks and curves are stored in package metadata.
+ * Animation is up to date while both hashes match: neither settings nor animation data were changed since then.
+ */
+class FREEANIMHELPERSEDITOR_API FModifierStackHash
+{
+public:
+	/* Hash of modifier classes and values of their properties, in order of the stack.
+	 * Referenced animations, skeletons and meshes are hashed by their data, other objects by their properties */
+	static FString GetSettingsHash(const TArray<UAnimationModifier*>& Modifiers);
+
+	/* Hash of frame rate, bone tracks and float curves of the sequence, and of hierarchy and reference pose of its skeleton */
+	static FString GetAnimationDataHash(const UAnimSequence* AnimationSequence);
+
+	/* Check if modifier stack with SettingsHash was applied to the current data of the sequence */
+	static bool IsUpToDate(UAnimSequence* AnimationSequence, const FString& SettingsHash);
+
+	/* Remember that modifier stack with SettingsHash was applied. Call after all modifiers of the stack are committed */
+	static void Store(UAnimSequence* AnimationSequence, const FString& SettingsHash);
+};
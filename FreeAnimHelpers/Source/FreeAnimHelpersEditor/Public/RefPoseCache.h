@@ -0,0 +1,31 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class USkeleton;
+class USkeletalMesh;
+
+/**
+ * Component-space transforms of reference pose, evaluated in a single parent-before-child pass
+ * and cached per skeleton or skeletal mesh asset. Entries are dropped when the asset reports change
+ * of hierarchy or reference pose, on undo and redo of the asset, and after garbage collection if the asset was destroyed.
+ */
+class FREEANIMHELPERSEDITOR_API FRefPoseCache
+{
+public:
+	/* Component-space reference pose of skeleton asset */
+	static TSharedRef<const TArray<FTransform>> Get(const USkeleton* Skeleton);
+	/* Component-space reference pose of skeletal mesh asset */
+	static TSharedRef<const TArray<FTransform>> Get(const USkeletalMesh* SkeletalMesh);
+	/* Listen to hierarchy and reference pose changes of the asset, which drop its cached pose and skeleton bindings */
+	static void Watch(const USkeleton* Skeleton);
+	static void Watch(const USkeletalMesh* SkeletalMesh);
+
+	/* Drop cached pose of skeleton or skeletal mesh asset */
+	static void Invalidate(const UObject* Asset);
+	/* Drop all poses and stop listening to asset changes */
+	static void ResetCache();
+};
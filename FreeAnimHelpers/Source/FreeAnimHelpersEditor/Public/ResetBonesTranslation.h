@@ -1,29 +1,29 @@
-// (c) Yuri N. K. 2022. All rights reserved.
-// ykasczc@gmail.com
-
-#pragma once
-
-#include "CoreMinimal.h"
-#include "AnimationModifier.h"
-#include "ResetBonesTranslation.generated.h"
-
-/**
- * Set real local translation of all bones to Retargeting Option specified in the Skeleton asset
- */
-UCLASS()
-class FREEANIMHELPERSEDITOR_API UResetBonesTranslation : public UAnimationModifier
-{
-	GENERATED_BODY()
-	
-public:
-	UResetBonesTranslation();
-
-	UPROPERTY(EditAnywhere, Category = "Setup")
-	class USkeletalMesh* PreviewMesh;
-
-	/* UAnimationModifier overrides */
-	virtual void OnApply_Implementation(UAnimSequence* AnimationSequence) override;
-	/* UAnimationModifier overrides end */
-
-private:
-};
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FreeAnimModifier.h"
+#include "ResetBonesTranslation.generated.h"
+
+/**
+ * Set real local translation of all bones to Retargeting Option specified in the Skeleton asset
+ */
+UCLASS()
+class FREEANIMHELPERSEDITOR_API UResetBonesTranslation : public UFreeAnimModifier
+{
+	GENERATED_BODY()
+	
+public:
+	UResetBonesTranslation();
+
+	UPROPERTY(EditAnywhere, Category = "Setup")
+	class USkeletalMesh* PreviewMesh;
+
+	/* UFreeAnimModifier overrides */
+	virtual FFreeAnimModifierEvaluation PrepareEvaluation(UAnimSequence* AnimationSequence) const override;
+	/* UFreeAnimModifier overrides end */
+
+private:
+};
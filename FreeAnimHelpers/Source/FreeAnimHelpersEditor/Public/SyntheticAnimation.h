@@ -0,0 +1,36 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class USkeletalMesh;
+class UAnimSequence;
+
+/** Size of procedurally generated skeleton and animation */
+struct FREEANIMHELPERSEDITOR_API FSyntheticAnimationConfig
+{
+	/* Number of bones in skeleton. First bones follow UE mannequin naming, the rest are chains attached to hands, head and spine */
+	int32 BonesNum = 100;
+	/* Length of additional bone chains, defines depth of hierarchy */
+	int32 ChainLength = 4;
+	/* Number of keys in animation sequence */
+	int32 FramesNum = 1000;
+};
+
+/**
+ * Transient skeletal mesh, skeleton and animation sequence with procedural keys, used by benchmark and golden output check.
+ * Only engine API is used here, so the same fixtures can be created by the baseline version of the plugin to record golden data.
+ */
+class FREEANIMHELPERSEDITOR_API FSyntheticAnimation
+{
+public:
+	/* Create transient skeletal mesh, skeleton and animation sequence */
+	static bool Create(const FSyntheticAnimationConfig& Config, USkeletalMesh*& OutMesh, UAnimSequence*& OutSequence);
+
+	/* Name of fixture in golden data: B<bones>_D<depth>_F<frames> */
+	static FString GetFixtureName(const FSyntheticAnimationConfig& Config);
+
+	static constexpr int32 FrameRate = 30;
+};
@@ -0,0 +1,61 @@
+// (c) Yuri N. K. 2022. All rights reserved.
+// ykasczc@gmail.com
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Animation/AnimTypes.h"
+#include "Curves/RichCurve.h"
+
+class UAnimSequence;
+struct FAnimTrackBuffer;
+
+/**
+ * Collects output of animation modifier and sends it to data model of animation sequence at once.
+ * All changes are made in a single controller bracket, so sequence is notified and recompressed once.
+ * Tracks and curves with keys identical to existing data are skipped.
+ * Writer without transactions is used for transient sequences, which aren't tracked by undo buffer.
+ * If key reduction is enabled in plugin settings, redundant keys are removed from float curves before commit.
+ * Bone tracks keep one key per frame, as data model requires.
+ */
+class FREEANIMHELPERSEDITOR_API FTrackCommitWriter
+{
+public:
+	FTrackCommitWriter(UAnimSequence* InAnimationSequence, bool bInShouldTransact = true);
+
+	/* Queue keys of bone track. Number of keys should match number of keys in the sequence */
+	void AddBoneTrack(const FName& BoneName, FRawAnimSequenceTrack&& Track);
+	void AddBoneTrack(const FName& BoneName, const FRawAnimSequenceTrack& Track);
+	void AddBoneTracks(TMap<FName, FRawAnimSequenceTrack>&& Tracks);
+	/* Queue all bones of track buffer. Buffer isn't copied, so it should stay alive until Commit */
+	void AddBoneTracks(const FAnimTrackBuffer& Buffer);
+
+	/* Queue keys of float curve. Curve is created if it doesn't exist, all existing keys are replaced.
+	 * Keys should be sorted by time (see UFreeAnimHelpersLibrary::SortCurveKeys). Disable key reduction for curves storing data in specific keys */
+	void AddFloatCurve(const FName& CurveName, TArray<FRichCurveKey>&& Keys, bool bAllowKeyReduction = true);
+	void AddFloatCurve(const FName& CurveName, const TArray<FRichCurveKey>& Keys, bool bAllowKeyReduction = true);
+
+	/* Send all queued data to data model. Returns number of tracks and curves which were actually changed */
+	int32 Commit();
+
+	/* Number of tracks and curves rejected by data model in the last Commit */
+	int32 GetFailedNum() const { return FailedNum; }
+
+	bool IsEmpty() const { return BoneTracks.IsEmpty() && TrackBuffers.IsEmpty() && FloatCurves.IsEmpty(); }
+
+private:
+	bool CommitBoneTrack(const FName& BoneName, const FRawAnimSequenceTrack& Track);
+	bool IsBoneTrackUnchanged(const FName& BoneName, const FRawAnimSequenceTrack& Track) const;
+	bool IsFloatCurveUnchanged(const FName& CurveName, const TArray<FRichCurveKey>& Keys) const;
+
+	UAnimSequence* AnimationSequence;
+	bool bShouldTransact;
+	TArray<TPair<FName, FRawAnimSequenceTrack>> BoneTracks;
+	TArray<const FAnimTrackBuffer*> TrackBuffers;
+	TArray<TPair<FName, TArray<FRichCurveKey>>> FloatCurves;
+	/* Curves added with disabled key reduction */
+	TSet<FName> ExactCurves;
+	/* Copied from settings in constructor */
+	bool bReduceKeys;
+	int32 FailedNum = 0;
+};